@@ -222,6 +222,7 @@ class Blob {
   const Dtype* gpu_data() const;
   void set_gpu_data(Dtype* data);
   const Dtype* cpu_diff() const;
+  void set_cpu_diff(Dtype* diff);
   const Dtype* gpu_diff() const;
   Dtype* mutable_cpu_data();
   Dtype* mutable_gpu_data();
@@ -25,6 +25,12 @@ class DataTransformer {
    */
   void InitRand();
 
+  /**
+   * @brief Initialize the Random number generations with a given seed, e.g.
+   *    per item when several transformers share the items of a batch.
+   */
+  void InitRand(unsigned int seed);
+
   /**
    * @brief Applies the transformation defined in the data layer's
    * transform_param block to the data.
@@ -127,6 +133,9 @@ class DataTransformer {
   vector<int> InferBlobShape(const cv::Mat& cv_img);
 #endif  // USE_OPENCV
 
+  // mirror or random crops
+  bool NeedsRand() const;
+
  protected:
    /**
    * @brief Generates a random integer from Uniform({0, 1, ..., n-1}).
@@ -1,18 +1,50 @@
 #ifndef CAFFE_GPI_COMMUNICATOR_DIFF_HPP
 #define CAFFE_GPI_COMMUNICATOR_DIFF_HPP
 
+#include <boost/atomic.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
 #include "caffe/util/GPIhelper.h"
 #include "caffe/blob.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "gpi_diff_topology.hpp"
 #include "gpi_ring_buffer.hpp"
 
+#include <map>
 #include <vector>
 
 namespace caffe {
 
+/**
+ * @brief Reduces the diffs of the calculated blobs to their root rank or,
+ * with update_mode ALLREDUCE, to all ranks.
+ *
+ * The diffs of all blobs are moved into the GPI segment of the communicator,
+ * in the order the blobs are calculated, and are sent and received in place.
+ * Consecutive blobs smaller than diff_bucket_size form one bucket which is
+ * transferred as a single contiguous array. Each bucket is split into the
+ * partitions of the DiffTopology. Every link to or from a remote rank streams
+ * the (bucket, slice) pairs it carries in the order the blobs were
+ * calculated. Slices the remote adds pass through a ring buffer, slices the
+ * remote copies are written directly into its diff. With a 16 bit
+ * diff_wire_format all slices pass through ring buffers which convert them.
+ * With diff_topk_ratio the diffs of a blob are sparsified to its largest
+ * elements when it is added, the rest stays in a local residual that is
+ * added to the next diff of the blob. All slices then pass through ring
+ * buffers as sparse messages.
+ *
+ * Blobs with different roots never share a bucket, the buckets of every root
+ * are reduced along a DiffTopology of their own. A link streams the slices of
+ * all these topologies that run over it.
+ */
 template <typename Dtype>
 class CommunicatorDiff {
 public:
-  CommunicatorDiff(const long buffer_size,
+  // roots holds the rank that receives the reduced diff of every blob, all
+  // blobs are reduced to rank 0 if it is empty
+  CommunicatorDiff(const std::vector<Blob<Dtype>*>& blobs,
+                   const std::vector<gaspi_rank_t>& roots,
+                   const GPIParameter& param,
                    const gaspi_notification_id_t notification_id_base_,
                    const gaspi_segment_id_t segment_id,
                    const gaspi_queue_id_t queue,
@@ -23,25 +55,107 @@ public:
   void operator()(void);
   bool CommunicateLayerDiffFinished(void);
   bool CommunicateLayerDiffReadFinished(int index);
+  bool CommunicateLayerDiffWriteFinished(int index);
+  // the diffs may only change after the writes from them completed locally
+  void WaitForLocalCompletion(void);
   void AddCalculatedBlob(Blob<Dtype>* blob);
   void ResetCommunicationStatus(void);
+  // logs the mean latency of every bucket since the last call
+  void LogBucketTimings(void);
+  // diff bytes sent to and received from remote ranks since construction
+  unsigned long long BytesSent(void) const;
+  unsigned long long BytesReceived(void) const;
 
 private:
-  int GetDiffTreeBranchingFactor() const;
-  std::vector<gaspi_rank_t> GetDiffTreeWriteRanks(gaspi_rank_t rank,
-                                                  int branching_factor) const;
-  std::vector<gaspi_rank_t> GetDiffTreeReadRanks(gaspi_rank_t rank,
-                                                 int branching_factor) const;
+  // position of a link in its stream of (bucket, slice) pairs
+  struct Position {
+    long bucket;
+    long slice;// index into the slices of the link for the bucket
+    long count;// slices passed
+  };
+
+  void BuildBuckets(const std::vector<long>& blob_sizes,
+                    const std::vector<gaspi_rank_t>& blob_roots,
+                    long bucket_size);
+  void CreateSegment(long size);
+  void UpdateBucketTimings(void);
+  bool ReadDirect(long link, gaspi_notification_t sequence);
+  void WriteDirect(long link, long offset, long len,
+                   gaspi_notification_t sequence);
+
+  bool Compressed(void) const;
+  bool Sparse(void) const;
+  // whether all slices pass through ring buffers with local staging
+  bool Staged(void) const;
+  // keeps the largest elements of the diff of blob index, moves the rest
+  // into its residual
+  void Sparsify(long index);
+  long GetLinkSize(gaspi_rank_t rank_from, gaspi_rank_t rank_to) const;
+  std::vector<std::vector<long> > GetLinkSlices(gaspi_rank_t rank_from,
+                                                gaspi_rank_t rank_to) const;
+  std::vector<gaspi_rank_t> GetReadRanks(gaspi_rank_t rank) const;
+  std::vector<gaspi_rank_t> GetWriteRanks(gaspi_rank_t rank) const;
+  void GetLinkLocation(gaspi_rank_t rank, gaspi_rank_t rank_remote,
+                       bool write, long* index, long* offset) const;
+  bool SliceReadFinished(long bucket, long slice) const;
+  static gaspi_notification_t Sequence(const Position& pos);
+  // slices are the slices of a link for every topology
+  Position LinkStart(const std::vector<std::vector<long> >& slices) const;
+  void Advance(const std::vector<std::vector<long> >& slices,
+               Position& pos) const;
+  void SkipEmptyBuckets(const std::vector<std::vector<long> >& slices,
+                        Position& pos) const;
+
+  std::vector<DiffTopology> topologies_;// one per root
+  long num_partitions_;// the same for every topology
+  GPIParameter_WireFormat wire_format_;
+  long element_size_;// bytes per element on the wire
+  // counted by the progress thread, read by the compute thread
+  boost::atomic<unsigned long long> bytes_sent_;
+  boost::atomic<unsigned long long> bytes_received_;
+  float topk_ratio_;
+  long topk_min_count_;
+  long link_iterations_;// iterations the ring buffers of a link can hold
+  std::vector<std::vector<Dtype> > residual_;// of every blob
+  std::vector<Dtype> topk_magnitude_;
+
+  std::vector<long> blob_bucket_;// bucket of every blob
+  std::vector<long> bucket_topology_;// of every bucket
+  std::vector<long> bucket_begin_;// first blob of every bucket, plus end
+  std::vector<long> bucket_offset_;// in the diff storage, plus end
+  long buckets_ready_;// buckets with all blobs calculated
+  long buckets_finished_;
+
+  std::vector<boost::posix_time::ptime> bucket_ready_time_;
+  std::vector<double> bucket_latency_;// summed microseconds
+  long bucket_timing_count_;
 
   gaspi_segment_id_t segment_id_;
+  gaspi_queue_id_t queue_;
+  gaspi_uint queue_depth_;
   gaspi_rank_t rank_;
   gaspi_rank_t num_ranks_;
+  Dtype* diff_;// start of the segment, holds the diffs of all blobs
+  bool pinned_memory_;
 
   vector<RingBufferRead<Dtype> > com_buffers_diff_read_;
   vector<RingBufferWrite<Dtype> > com_buffers_diff_write_;
-  vector<int> com_buffers_diff_read_status_;
-  vector<int> com_buffers_diff_write_status_;
-  vector<Blob<Dtype>* > calculated_blobs_;
+  vector<gaspi_rank_t> write_ranks_;
+  vector<gaspi_notification_id_t> read_direct_notification_;
+  vector<gaspi_notification_id_t> write_direct_notification_;
+  vector<gaspi_notification_t> read_direct_sequence_;// highest received
+  // [link][topology][index]
+  vector<std::vector<std::vector<long> > > read_slices_;
+  vector<std::vector<std::vector<DiffTopology::ReadMode> > > read_modes_;
+  vector<std::vector<std::vector<long> > > write_slices_;
+  vector<std::vector<std::vector<DiffTopology::ReadMode> > > write_modes_;
+  // (read link, index into its slices) of all reads of a slice, per topology
+  vector<std::vector<std::vector<std::pair<long, long> > > > slice_reads_;
+  vector<Position> com_buffers_diff_read_status_;
+  vector<Position> com_buffers_diff_write_status_;
+  vector<Blob<Dtype>* > blobs_;
+  long num_calculated_blobs_;
+  mutable std::map<std::pair<gaspi_rank_t, gaspi_rank_t>, long> link_size_;
 };
 
 }
@@ -1,6 +1,8 @@
 #ifndef CAFFE_GPI_COMMUNICATOR_MODEL_HPP
 #define CAFFE_GPI_COMMUNICATOR_MODEL_HPP
 
+#include <boost/atomic.hpp>
+
 #include "caffe/util/GPIhelper.h"
 #include "caffe/blob.hpp"
 
@@ -21,6 +23,7 @@ public:
   void LiftLocalStatus(long status);
   unsigned long GetStartedSending();
   unsigned long GetAcknowledgement();
+  unsigned long long BytesSent(void) const { return bytes_sent_; }
 
   void status(std::ostream& s) const;
 
@@ -42,6 +45,7 @@ private:
   unsigned long status_we_started_sending_;
   unsigned long status_we_finished_sending_;
   unsigned long status_acknowledged_by_remote_;//this version can be overwritten
+  unsigned long long bytes_sent_;
 };
 
 class TransferForwardConsumer {
@@ -80,13 +84,27 @@ public:
                     const gaspi_queue_id_t queue_transfer,
                     const gaspi_queue_id_t queue_acknowledge,
                     const gaspi_rank_t rank,
-                    const gaspi_rank_t num_ranks);
+                    const gaspi_rank_t num_ranks,
+                    const gaspi_rank_t root);
 
   void operator()(void);
   void Acknowledge(void);
+  // the local process is done with every version received so far, with SSP
+  // the versions received after the last Acknowledge() are never used when
+  // the processes synchronize
+  void AcknowledgeReceived(void);
   void UpdatedModelOnMaster(void);
   bool HaveUpdateSource(void) const;
   bool Complete() const;
+  // versions the model lags behind the lockstep version of the local
+  // process, Complete() if 0
+  unsigned long Staleness() const;
+  // the model may only change on the master after the sends of the last
+  // version completed locally, with SSP they can still be running
+  void WaitForLocalCompletion(void);
+  // model bytes sent to and received from remote ranks since construction
+  unsigned long long BytesSent(void) const;
+  unsigned long long BytesReceived(void) const;
 
   void status(std::ostream& s) const;
 
@@ -113,10 +131,15 @@ private:
   gaspi_queue_id_t queue_acknowledge_;
 
   unsigned long acknowledgement_local_;//local process ready for this version
+  unsigned long status_acknowledged_local_;//local process done with this version
 
   unsigned long status_;// version we currently have
   unsigned long status_completed_;// version we have and transferred to other nodes
   unsigned long acknowledgement_total_;//this version can be overwritten
+  // counted respectively published by the progress thread, read by the
+  // compute thread
+  boost::atomic<unsigned long long> bytes_received_;
+  boost::atomic<unsigned long long> bytes_sent_;
 
   std::vector<TransferForwardConsumer> consumer_;
   std::vector<TransferForwardProducer> producer_;
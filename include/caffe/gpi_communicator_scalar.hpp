@@ -0,0 +1,75 @@
+#ifndef CAFFE_GPI_COMMUNICATOR_SCALAR_HPP
+#define CAFFE_GPI_COMMUNICATOR_SCALAR_HPP
+
+#include "caffe/util/GPIhelper.h"
+
+#include <vector>
+
+namespace caffe {
+
+/**
+ * @brief Sums a few values, e.g. the loss and the net outputs, over all
+ * ranks by recursive doubling.
+ *
+ * Every rank exchanges its partial sums with log2(num_ranks) partners. The
+ * ranks beyond the largest power of two first hand their values to a partner
+ * below and receive the sums from it at the end. Both partners of an exchange
+ * add the same two operands, so all ranks end up with bitwise identical sums.
+ *
+ * A reduction is started with Start(), driven by Progress() while the rank
+ * computes and completed with Finish(). Consecutive reductions alternate
+ * between two sets of receive buffers, a rank can not get further ahead of
+ * its partners.
+ */
+template <typename Dtype>
+class CommunicatorScalar {
+public:
+  // creates segment_id with room for up to max_count values per reduction
+  CommunicatorScalar(const long max_count,
+                     const gaspi_segment_id_t segment_id,
+                     const gaspi_queue_id_t queue,
+                     const gaspi_rank_t rank,
+                     const gaspi_rank_t num_ranks);
+  ~CommunicatorScalar();
+
+  long MaxCount(void) const;
+  // all ranks start the reductions with the same number of values
+  void Start(const std::vector<Dtype>& values);
+  // returns true once the sums arrived, never blocks
+  bool Progress(void);
+  // blocks until the sums arrived
+  void Finish(std::vector<Dtype>* sums);
+
+private:
+  enum OperationType {
+    SEND,
+    RECEIVE_ADD,
+    RECEIVE_COPY
+  };
+  struct Operation {
+    OperationType type;
+    gaspi_rank_t remote;
+    long slot;
+  };
+
+  gaspi_offset_t ReceiveOffset(long buffer, long slot) const;
+  gaspi_offset_t SendOffset(long slot) const;
+  gaspi_notification_id_t NotificationID(long buffer, long slot) const;
+
+  const long max_count_;
+  const gaspi_segment_id_t segment_id_;
+  const gaspi_queue_id_t queue_;
+  long num_slots_;
+  // the steps of this rank, in order
+  std::vector<Operation> operations_;
+  Dtype* buffer_;
+
+  // the running reduction
+  std::vector<Dtype> sums_;
+  long operation_;
+  long buffer_index_;
+  bool running_;
+};
+
+}
+#endif
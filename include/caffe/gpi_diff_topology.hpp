@@ -0,0 +1,124 @@
+#ifndef CAFFE_GPI_DIFF_TOPOLOGY_HPP
+#define CAFFE_GPI_DIFF_TOPOLOGY_HPP
+
+#include "caffe/util/GPIhelper.h"
+#include "caffe/proto/caffe.pb.h"
+
+#include <vector>
+
+namespace caffe {
+
+/**
+ * @brief Describes how the parameter diffs travel between the ranks.
+ *
+ * Every blob is cut into NumPartitions() partitions. Each partition is
+ * reduced along its own tree in phase 0: a rank adds the partition of all its
+ * read ranks in mode ADD and forwards the sum to its write rank. The later
+ * phases distribute the reduced partition in mode COPY, either to rank 0
+ * (update_mode MASTER) or to all ranks (update_mode ALLREDUCE).
+ *
+ * A slice is one partition in one phase, slice = phase * NumPartitions()
+ * + partition. A rank writes every slice to at most one remote rank.
+ *
+ * The ranks are numbered relative to root, which takes the place of rank 0:
+ * the diffs are reduced to root instead of rank 0.
+ *
+ * The HIERARCHICAL topology groups the ranks into nodes. The diffs are
+ * reduced along a tree within every node to the lowest rank of the node, the
+ * node leader, and along a tree of the node leaders to root. The broadcast of
+ * ALLREDUCE runs the other way round.
+ */
+class DiffTopology {
+public:
+  enum ReadMode {
+    ADD,
+    COPY
+  };
+
+  struct Read {
+    gaspi_rank_t rank;
+    ReadMode mode;
+  };
+
+  // rank_nodes holds the node of every rank, e.g. from GetRankNodes(), and
+  // is only used by HIERARCHICAL. Empty puts every rank on a node of its own.
+  DiffTopology(const GPIParameter& param, const gaspi_rank_t num_ranks,
+               const gaspi_rank_t root,
+               const std::vector<long>& rank_nodes = std::vector<long>());
+
+  long NumPartitions(void) const;
+  long NumPhases(void) const;
+  long NumSlices(void) const;
+  long SlicePartition(long slice) const;
+  long SlicePhase(long slice) const;
+  bool Allreduce(void) const;
+
+  std::vector<Read> GetReads(gaspi_rank_t rank, long slice) const;
+  bool GetWrite(gaspi_rank_t rank, long slice, gaspi_rank_t* remote) const;
+
+  // sorted ranks this rank reads from / writes to for any slice
+  std::vector<gaspi_rank_t> GetReadRanks(gaspi_rank_t rank) const;
+  std::vector<gaspi_rank_t> GetWriteRanks(gaspi_rank_t rank) const;
+  // sorted slices transferred from rank_from to rank_to
+  std::vector<long> GetLinkSlices(gaspi_rank_t rank_from,
+                                  gaspi_rank_t rank_to) const;
+  ReadMode GetReadMode(gaspi_rank_t rank, gaspi_rank_t rank_remote,
+                       long slice) const;
+
+  static long PartitionBegin(long count, long partition, long num_partitions);
+  // assigns every item to a rank, largest items first to the rank with the
+  // smallest sum of sizes so far
+  static std::vector<gaspi_rank_t> BalanceRanks(const std::vector<long>& sizes,
+                                                long num_ranks);
+  // the node of every rank, identified by its lowest rank. The hosts are
+  // read from param.diff_machinefile or else gathered from the hostnames of
+  // all ranks, in which case all ranks have to call it.
+  static std::vector<long> GetRankNodes(const GPIParameter& param,
+                                        gaspi_rank_t rank,
+                                        gaspi_rank_t num_ranks);
+
+private:
+  // rank relative to root and back
+  gaspi_rank_t Virtual(gaspi_rank_t rank) const;
+  gaspi_rank_t Real(gaspi_rank_t rank) const;
+
+  // the following work on ranks relative to root
+  void BuildNodes(const std::vector<long>& rank_nodes);
+  void GetTreeReads(gaspi_rank_t rank, long partition,
+                    std::vector<Read>& reads) const;
+  bool GetTreeWrite(gaspi_rank_t rank, long partition,
+                    gaspi_rank_t* remote) const;
+  bool GetDistributeRead(gaspi_rank_t rank, long partition, long phase,
+                         gaspi_rank_t* remote) const;
+  bool GetDistributeWrite(gaspi_rank_t rank, long partition, long phase,
+                          gaspi_rank_t* remote) const;
+
+  // k-nomial tree over the indices [0, size) rooted at 0
+  long BinomialLevels(long size) const;
+  bool BinomialParent(long index, long* parent) const;
+  std::vector<long> BinomialChildren(long index, long size) const;
+  // broadcast down the tree, one child index per tree level and phase,
+  // phases start at 1
+  bool BinomialBroadcastRead(long index, long phase, long* remote) const;
+  bool BinomialBroadcastWrite(long index, long phase, long size,
+                              long* remote) const;
+
+  GPIParameter_DiffTopology type_;
+  bool allreduce_;
+  long branching_factor_;
+  long num_ranks_;
+  long root_;
+  long num_ranks_pow2_;// largest power of two <= num_ranks_
+  long num_bits_;// log2(num_ranks_pow2_)
+  long num_levels_;// depth of the binomial tree
+  // HIERARCHICAL: the ranks of every node, its leader first, the node of
+  // root first, and the node and index within it of every rank
+  std::vector<std::vector<gaspi_rank_t> > nodes_;
+  std::vector<long> rank_node_;
+  std::vector<long> rank_local_;
+  long num_node_levels_;// depth of the tree of the node leaders
+  long num_local_levels_;// depth of the tree within the largest node
+};
+
+}
+#endif
@@ -0,0 +1,109 @@
+#ifndef CAFFE_GPI_PROGRESS_THREAD_HPP
+#define CAFFE_GPI_PROGRESS_THREAD_HPP
+
+#include <boost/atomic.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/scoped_array.hpp>
+
+#include "caffe/blob.hpp"
+#include "caffe/internal_thread.hpp"
+#include "gpi_communicator_diff.hpp"
+#include "gpi_communicator_model.hpp"
+
+#include <vector>
+
+namespace caffe {
+
+/**
+ * @brief Drives the diff and model communicators of a net from a thread of
+ * its own, so data moves while the compute thread runs the backward pass.
+ *
+ * The communicators are only touched by the progress thread, including the
+ * gaspi_wait for the local completion of their sends. The compute thread
+ * announces calculated blobs and updated models through a lock-free single
+ * producer, single consumer queue, and sees the progress through counters
+ * the progress thread publishes after every round.
+ */
+template <typename Dtype>
+class CommunicationProgressThread : public InternalThread {
+public:
+  CommunicationProgressThread(
+    const std::vector<shared_ptr<CommunicatorDiff<Dtype> > >& diff,
+    const std::vector<shared_ptr<CommunicatorModel<Dtype> > >& data,
+    const bool communicate_data);
+  virtual ~CommunicationProgressThread();
+
+  // Calls from the compute thread.
+  // returns once the communicators are reset
+  void ResetCommunicationStatus(void);
+  // the diff of blob is calculated, acknowledge marks the model of the blob
+  // as awaited from the master
+  void AddCalculatedBlob(Blob<Dtype>* blob, bool acknowledge);
+  void UpdatedModelOnMaster(long index);
+  // returns once CommunicatorModel::AcknowledgeReceived() was called on all
+  // models
+  void AcknowledgeReceivedData(void);
+  void LogBucketTimings(void);
+  // return once the sends of all diffs respectively of the model of blob
+  // index have completed locally
+  void WaitForDiffLocalCompletion(void);
+  void WaitForDataLocalCompletion(long index);
+  // number of calculated blobs, in the order they were added, whose diff
+  // reads respectively writes have finished
+  long DiffReadFinished(void) const;
+  long DiffWriteFinished(void) const;
+  // whether the models of all blobs are complete, including all updates
+  // announced so far
+  bool DataFinished(void) const;
+  // CommunicatorModel::Staleness() of blob index, up to date with all
+  // updates announced so far
+  bool DataStaleness(long index, unsigned long* staleness) const;
+
+protected:
+  virtual void InternalThreadEntry();
+
+private:
+  enum EventType {
+    RESET,
+    BLOB_CALCULATED,
+    MODEL_UPDATED,
+    RECEIVED_ACKNOWLEDGED,
+    LOG_TIMINGS,
+    DIFF_LOCAL_COMPLETION,
+    DATA_LOCAL_COMPLETION
+  };
+  struct Event {
+    EventType type;
+    Blob<Dtype>* blob;
+    long index;
+    bool acknowledge;
+  };
+
+  void Post(const Event& event);
+  void WaitForEvents(void) const;
+  void Process(const Event& event);
+  void Publish(void);
+
+  std::vector<shared_ptr<CommunicatorDiff<Dtype> > > diff_;
+  std::vector<shared_ptr<CommunicatorModel<Dtype> > > data_;
+  bool communicate_data_;
+  boost::lockfree::spsc_queue<Event> events_;
+
+  // owned by the progress thread
+  long num_calculated_blobs_;
+  long read_finished_local_;
+  long write_finished_local_;
+
+  // written by the compute thread
+  unsigned long events_posted_;
+
+  // published by the progress thread
+  boost::atomic<unsigned long> events_processed_;
+  boost::atomic<long> read_finished_;
+  boost::atomic<long> write_finished_;
+  boost::atomic<bool> data_finished_;
+  boost::scoped_array<boost::atomic<unsigned long> > model_staleness_;
+};
+
+}
+#endif
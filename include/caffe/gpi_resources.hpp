@@ -0,0 +1,41 @@
+#ifndef CAFFE_GPI_RESOURCES_HPP
+#define CAFFE_GPI_RESOURCES_HPP
+
+#include "caffe/util/GPIhelper.h"
+
+#include <string>
+
+namespace caffe {
+
+/**
+ * @brief Hands out the GPI-2 segment ids and queues of the process to the
+ * nets, communicators and data layers.
+ *
+ * Segments are created collectively, so every rank has to pick the same id
+ * for the same segment. The lowest free id is handed out, hence the ranks
+ * agree as long as they build the same nets and layers in the same order,
+ * which they do. Notification ids are local to a segment, the owner of a
+ * segment may use all of them.
+ *
+ * A queue is held exclusively while unused queues are left. Once all queues
+ * are taken, the queue with the fewest holders is shared, which is correct
+ * but lets the holders wait for each other's requests.
+ */
+class GPIResources {
+public:
+  // dies if all segment ids are taken
+  static gaspi_segment_id_t AcquireSegment(const std::string& owner);
+  // call after gaspi_segment_delete
+  static void ReleaseSegment(const gaspi_segment_id_t id);
+
+  static gaspi_queue_id_t AcquireQueue(const std::string& owner);
+  // a fixed queue, shared if it is already held
+  static gaspi_queue_id_t AcquireQueue(const std::string& owner,
+                                       const gaspi_queue_id_t id);
+  // the holder has waited for its requests
+  static void ReleaseQueue(const gaspi_queue_id_t id);
+};
+
+}
+
+#endif
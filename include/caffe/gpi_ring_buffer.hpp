@@ -1,8 +1,10 @@
 #ifndef CAFFE_GPI_RING_BUFFER_HPP
 #define CAFFE_GPI_RING_BUFFER_HPP
 
-#include "caffe/util/GPIhelper.h"
+#include <vector>
 
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/GPIhelper.h"
 
 namespace caffe {
 
@@ -17,18 +19,34 @@ public:
                   const gaspi_segment_id_t segment_id_remote,
                   const gaspi_notification_id_t notification_id_remote,
                   const gaspi_offset_t offset_remote,
-                  const gaspi_queue_id_t queue);
+                  const gaspi_queue_id_t queue,
+                  const GPIParameter_WireFormat wire_format
+                    = GPIParameter_WireFormat_NATIVE);
 
   unsigned long GetFreeSpace(void);
   int Write(const Dtype* p, const unsigned long len);
+  // sends the non-zero elements of p as (index, value) pairs, or all len
+  // elements if that is shorter, in one message of *written elements. The
+  // buffer needs space for len + 1 elements per message.
+  int WriteSparse(const Dtype* p, const unsigned long len,
+                  unsigned long* written = NULL);
+  // sends len elements at byte offset_local of segment_id_local without
+  // staging them in the local ring buffer, NATIVE wire format only
+  int WriteFromSegment(const gaspi_segment_id_t segment_id_local,
+                       const gaspi_offset_t offset_local,
+                       const unsigned long len);
 
 private:
 
   void UpdateReadPointer(void);
   void ClearQueue(void);
+  // converts len elements into the local ring buffer at position pos
+  void Pack(const Dtype* p, const unsigned long pos, const unsigned long len);
 
   int error_;
 
+  GPIParameter_WireFormat wire_format_;
+  unsigned long element_size_;// bytes per element on the wire
   unsigned long size_;
   unsigned long rp_;
   unsigned long wp_;
@@ -43,6 +61,7 @@ private:
   gaspi_offset_t buffer_offset_remote_;
   gaspi_queue_id_t queue_;
   gaspi_uint queue_depth_;
+  std::vector<Dtype> message_;// staging of WriteSparse
 };
 
 template <typename Dtype>
@@ -56,19 +75,31 @@ public:
                  const gaspi_segment_id_t segment_id_remote,
                  const gaspi_notification_id_t notification_id_remote,
                  const gaspi_offset_t offset_remote,
-                 const gaspi_queue_id_t queue);
+                 const gaspi_queue_id_t queue,
+                 const GPIParameter_WireFormat wire_format
+                   = GPIParameter_WireFormat_NATIVE);
 
   unsigned long GetNumData(void);
   int Read(Dtype* p, const unsigned long len);
   int Add(Dtype* p, const unsigned long len);
+  // receives a message of WriteSparse for len elements and scatters it to p,
+  // adding to p if add is set, else the elements missing are zero
+  int ReadSparse(Dtype* p, const unsigned long len, bool add,
+                 unsigned long* read = NULL);
 
 private:
 
   void UpdateWritePointer(void);
   void ClearQueue(void);
+  // converts len elements at position pos of the ring buffer to p, adding
+  // them to p if add is set
+  void Unpack(const unsigned long pos, const unsigned long len, Dtype* p,
+              bool add);
 
   int error_;
 
+  GPIParameter_WireFormat wire_format_;
+  unsigned long element_size_;// bytes per element on the wire
   unsigned long size_;
   unsigned long rp_;
   unsigned long wp_;
@@ -0,0 +1,96 @@
+#ifndef CAFFE_GPI_TRACE_HPP
+#define CAFFE_GPI_TRACE_HPP
+
+#include <boost/atomic.hpp>
+
+#include "caffe/util/GPIhelper.h"
+
+#include <string>
+
+namespace caffe {
+
+/**
+ * @brief Records timestamped events of all threads of the process and merges
+ * the events of all ranks into one Chrome trace event file, which
+ * chrome://tracing and Perfetto display as one timeline per rank and thread.
+ *
+ * Every thread appends its events to a buffer of its own without locking,
+ * Stop() collects the buffers and rank 0 reads those of the other ranks. The
+ * names passed for the events have to stay valid until Stop(), Intern() keeps
+ * copies of names that do not. The ranks take their time origin at the end
+ * of a common barrier, so the timelines line up to the skew of that barrier.
+ * A process is traced at most once.
+ */
+class GPITrace {
+public:
+  // collective, starts recording with at most max_events events per thread
+  static void Start(const std::string& file, const long max_events);
+  // collective, rank 0 gathers the events of all ranks over GPI-2 and writes
+  // them to file, so only rank 0 needs to reach its path
+  static void Stop(void);
+  static bool enabled(void) {
+    return enabled_.load(boost::memory_order_relaxed);
+  }
+  // microseconds since the time origin
+  static double Now(void);
+  // a copy of name that stays valid for the life of the process
+  static const char* Intern(const std::string& name);
+  // an event of the calling thread from begin to end, arg_name NULL omits the
+  // argument
+  static void Record(const char* category, const char* name,
+                     const double begin, const double end,
+                     const char* arg_name = NULL, const long arg = 0,
+                     const char* arg_name2 = NULL, const long arg2 = 0);
+
+  // gaspi_write_notify, recorded with the remote rank and the bytes
+  static gaspi_return_t WriteNotify(
+    const gaspi_segment_id_t segment_id_local,
+    const gaspi_offset_t offset_local,
+    const gaspi_rank_t rank,
+    const gaspi_segment_id_t segment_id_remote,
+    const gaspi_offset_t offset_remote,
+    const gaspi_size_t size,
+    const gaspi_notification_id_t notification_id,
+    const gaspi_notification_t notification_value,
+    const gaspi_queue_id_t queue,
+    const gaspi_timeout_t timeout);
+  // gaspi_notify_waitsome, recorded with the first notification id
+  static gaspi_return_t NotifyWaitsome(
+    const gaspi_segment_id_t segment_id,
+    const gaspi_notification_id_t notification_begin,
+    const gaspi_number_t num,
+    gaspi_notification_id_t* first_id,
+    const gaspi_timeout_t timeout);
+
+private:
+  static boost::atomic<bool> enabled_;
+};
+
+// records the time from its construction to its destruction as an event
+class GPITraceSpan {
+public:
+  GPITraceSpan(const char* category, const char* name,
+               const char* arg_name = NULL, const long arg = 0)
+    : category_(category), name_(name), arg_name_(arg_name), arg_(arg),
+      begin_(GPITrace::enabled() ? GPITrace::Now() : -1) {}
+  ~GPITraceSpan() {
+    if (begin_ >= 0) {
+      GPITrace::Record(category_, name_, begin_, GPITrace::Now(),
+                       arg_name_, arg_);
+    }
+  }
+
+private:
+  GPITraceSpan(const GPITraceSpan&);
+  GPITraceSpan& operator=(const GPITraceSpan&);
+
+  const char* category_;
+  const char* name_;
+  const char* arg_name_;
+  const long arg_;
+  const double begin_;
+};
+
+}
+
+#endif
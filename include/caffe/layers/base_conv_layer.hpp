@@ -30,16 +30,40 @@ class BaseConvolutionLayer : public Layer<Dtype> {
 
  protected:
   // Helper functions that abstract away the column buffer and gemm arguments.
-  // The last argument in forward_cpu_gemm is so that we can skip the im2col if
-  // we just called weight_cpu_gemm with the same input.
+  // The skip_im2col argument in forward_cpu_gemm is so that we can skip the
+  // im2col if we just called weight_cpu_gemm with the same input. The CPU
+  // helpers use col_buffer_ unless they are given another col buffer, e.g.
+  // one of part_col_buffers_.
   void forward_cpu_gemm(const Dtype* input, const Dtype* weights,
-      Dtype* output, bool skip_im2col = false);
+      Dtype* output, bool skip_im2col = false, Dtype* col_buff = NULL);
   void forward_cpu_bias(Dtype* output, const Dtype* bias);
   void backward_cpu_gemm(const Dtype* input, const Dtype* weights,
-      Dtype* output);
+      Dtype* output, Dtype* col_buff = NULL);
   void weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype*
-      weights);
+      weights, Dtype* col_buff = NULL);
   void backward_cpu_bias(Dtype* bias, const Dtype* input);
+  // The passes of 1x1 convolutions over images, pack_images_ of them at a
+  // time in one gemm on pack_buff, which holds their inputs and outputs as
+  // channels x (images * spatial) matrices. backward_cpu_1x1 skips the
+  // gradient w.r.t. the weights or the input if weights_diff or input_diff is
+  // NULL.
+  void forward_cpu_1x1(const Dtype* input, const Dtype* weights,
+      Dtype* output, int images, Dtype* pack_buff);
+  void backward_cpu_1x1(const Dtype* output_diff, const Dtype* input,
+      const Dtype* weights, Dtype* weights_diff, Dtype* input_diff,
+      int images, Dtype* pack_buff);
+
+  // The CPU passes may split the batch into cpu_parts_ parts of consecutive
+  // images which run concurrently, one per thread of caffe_parallel_for().
+  // Sets up a col buffer per part, or with batched_1x1_ the pack_buff of the
+  // images of the part, to be called before every pass.
+  void prepare_cpu_parts();
+  /// @brief The images of a part are [first_image(part), first_image(part+1)).
+  inline int first_image(int part) const {
+    return static_cast<long>(num_) * part / cpu_parts_;
+  }
+  int cpu_parts_;
+  vector<Dtype*> part_col_buffers_;
 
 #ifndef CPU_ONLY
   void forward_gpu_gemm(const Dtype* col_input, const Dtype* weights,
@@ -91,9 +115,28 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   int num_output_;
   bool bias_term_;
   bool is_1x1_;
+  // Whether the CPU passes of a 1x1 convolution use forward_cpu_1x1() and
+  // backward_cpu_1x1(), for pack_images_ > 1.
+  bool batched_1x1_;
+  int batched_1x1_cols_;
+  int pack_images_;
   bool force_nd_im2col_;
+  int col_tile_size_;
 
  private:
+  // Gathers the channels x spatial planes of consecutive images into the
+  // channels x (images * spatial) matrix pack, and scatters them back.
+  void pack_images_cpu(const Dtype* data, int images, int channels,
+      Dtype* pack);
+  void unpack_images_cpu(const Dtype* pack, int images, int channels,
+      Dtype* data);
+  // forward_cpu_1x1() and backward_cpu_1x1() of at most pack_images_ images
+  void forward_cpu_pack(const Dtype* input, const Dtype* weights,
+      Dtype* output, int images, Dtype* pack_buff);
+  void backward_cpu_pack(const Dtype* output_diff, const Dtype* input,
+      const Dtype* weights, Dtype* weights_diff, Dtype* input_diff,
+      int images, Dtype* pack_buff);
+
   // wrap im2col/col2im so we don't have to remember the (long) argument lists
   inline void conv_im2col_cpu(const Dtype* data, Dtype* col_buff) {
     if (!force_nd_im2col_ && num_spatial_axes_ == 2) {
@@ -123,6 +166,27 @@ class BaseConvolutionLayer : public Layer<Dtype> {
           pad_.cpu_data(), stride_.cpu_data(), dilation_.cpu_data(), data);
     }
   }
+  // im2col/col2im of the output positions [col_begin, col_end), 2D only
+  inline void conv_im2col_tile_cpu(const Dtype* data, int col_begin,
+      int col_end, Dtype* col_buff) {
+    im2col_tile_cpu(data, conv_in_channels_,
+        conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
+        kernel_shape_.cpu_data()[0], kernel_shape_.cpu_data()[1],
+        pad_.cpu_data()[0], pad_.cpu_data()[1],
+        stride_.cpu_data()[0], stride_.cpu_data()[1],
+        dilation_.cpu_data()[0], dilation_.cpu_data()[1],
+        col_begin, col_end, col_buff);
+  }
+  inline void conv_col2im_tile_add_cpu(const Dtype* col_buff, int col_begin,
+      int col_end, Dtype* data) {
+    col2im_tile_add_cpu(col_buff, conv_in_channels_,
+        conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
+        kernel_shape_.cpu_data()[0], kernel_shape_.cpu_data()[1],
+        pad_.cpu_data()[0], pad_.cpu_data()[1],
+        stride_.cpu_data()[0], stride_.cpu_data()[1],
+        dilation_.cpu_data()[0], dilation_.cpu_data()[1],
+        col_begin, col_end, data);
+  }
 #ifndef CPU_ONLY
   inline void conv_im2col_gpu(const Dtype* data, Dtype* col_buff) {
     if (!force_nd_im2col_ && num_spatial_axes_ == 2) {
@@ -164,8 +228,14 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   int kernel_dim_;
   int col_offset_;
   int output_offset_;
+  // The number of output positions the CPU helpers im2col at a time, 0 if
+  // they im2col whole images. col_buffer_ then holds one tile only.
+  int col_tile_;
 
   Blob<Dtype> col_buffer_;
+  // The col buffers of the parts but the first, which uses col_buffer_, or
+  // the pack buffers of all parts.
+  vector<Dtype> part_buffers_;
   Blob<Dtype> bias_multiplier_;
 };
 
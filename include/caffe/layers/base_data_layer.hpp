@@ -9,6 +9,7 @@
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -70,6 +71,15 @@ class BasePrefetchingDataLayer :
  protected:
   virtual void InternalThreadEntry();
   virtual void load_batch(Batch<Dtype>* batch) = 0;
+  // Calls transform_item for the items [0, batch_size) of the batch on
+  // transform_param.num_threads threads. load_batch reshapes batch and
+  // transformed_data_ and reads all sequential state, e.g. labels and file
+  // positions, before.
+  void TransformItems(Batch<Dtype>* batch, int batch_size);
+  // Decodes and transforms one item into batch. Runs concurrently for
+  // different items, transformer and transformed_data belong to thread.
+  virtual void transform_item(Batch<Dtype>* batch, int item_id, int thread,
+      DataTransformer<Dtype>* transformer, Blob<Dtype>* transformed_data) {}
 
   vector<shared_ptr<Batch<Dtype> > > prefetch_;
   BlockingQueue<Batch<Dtype>*> prefetch_free_;
@@ -77,6 +87,16 @@ class BasePrefetchingDataLayer :
   Batch<Dtype>* prefetch_current_;
 
   Blob<Dtype> transformed_data_;
+
+ private:
+  void TransformItem(Batch<Dtype>* batch, int item_id, int thread);
+
+  shared_ptr<ThreadPool> transform_pool_;
+  // per thread, the first transformer is data_transformer_
+  vector<shared_ptr<DataTransformer<Dtype> > > transformers_;
+  vector<shared_ptr<Blob<Dtype> > > transformed_datas_;
+  // drawn in item order, the batches do not depend on the number of threads
+  vector<unsigned int> item_seeds_;
 };
 
 }  // namespace caffe
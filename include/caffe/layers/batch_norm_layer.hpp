@@ -60,6 +60,22 @@ class BatchNormLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  // The CPU passes work on the planes (image, channel) in [begin, end).
+  // sums[plane] = scale * sum(a * b), b NULL sums a
+  void SumPlanes_cpu(const Dtype* a, const Dtype* b, Dtype scale,
+      Dtype* sums, int begin, int end);
+  // top = bottom - mean, sums[plane] = scale * sum(top^2) unless sums is NULL
+  void CenterPlanes_cpu(const Dtype* bottom_data, const Dtype* mean,
+      Dtype scale, Dtype* sums, Dtype* top_data, int begin, int end);
+  // x_norm = top = top / std
+  void NormalizePlanes_cpu(const Dtype* std, Dtype* top_data,
+      Dtype* x_norm_data, int begin, int end);
+  // bottom_diff = (top_diff - mean_diff - mean_diff_y * y) / std, the means
+  // are NULL with the global statistics
+  void BackwardPlanes_cpu(const Dtype* top_data, const Dtype* top_diff,
+      const Dtype* mean_diff, const Dtype* mean_diff_y, const Dtype* std,
+      Dtype* bottom_diff, int begin, int end);
+
   Blob<Dtype> mean_, variance_, temp_, x_norm_;
   bool use_global_stats_;
   Dtype moving_average_fraction_;
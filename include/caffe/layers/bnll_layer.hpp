@@ -63,6 +63,11 @@ class BNLLLayer : public NeuronLayer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+
+  void ForwardRange_cpu(const Dtype* bottom_data, Dtype* top_data,
+      int begin, int end);
+  void BackwardRange_cpu(const Dtype* bottom_data, const Dtype* top_diff,
+      Dtype* bottom_diff, int begin, int end);
 };
 
 }  // namespace caffe
@@ -77,6 +77,19 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual inline bool reverse_dimensions() { return false; }
   virtual void compute_output_shape();
+
+ private:
+  // The passes of the parts [part_begin, part_end) of the batch, see
+  // BaseConvolutionLayer::prepare_cpu_parts().
+  void ForwardParts_cpu(const Dtype* bottom_data, const Dtype* weight,
+      const Dtype* bias, Dtype* top_data, int part_begin, int part_end);
+  void BackwardParts_cpu(const Dtype* top_diff, const Dtype* bottom_data,
+      const Dtype* weight, Dtype* bottom_diff, int part_begin, int part_end);
+
+  // The parts but the first sum up their weight diff separately, it is added
+  // to the weight diff in the order of the parts after the pass.
+  vector<Dtype> weight_diff_parts_;
+  vector<Dtype*> part_weight_diffs_;
 };
 
 }  // namespace caffe
@@ -31,10 +31,14 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
   void Next();
   bool Skip();
   virtual void load_batch(Batch<Dtype>* batch);
+  virtual void transform_item(Batch<Dtype>* batch, int item_id, int thread,
+      DataTransformer<Dtype>* transformer, Blob<Dtype>* transformed_data);
 
   shared_ptr<db::DB> db_;
   shared_ptr<db::Cursor> cursor_;
   uint64_t offset_;
+  // the serialized datums of the current batch
+  vector<string> item_values_;
 };
 
 }  // namespace caffe
@@ -73,6 +73,10 @@ class DropoutLayer : public NeuronLayer<Dtype> {
   /// the scale for undropped inputs at train time @f$ 1 / (1 - p) @f$
   Dtype scale_;
   unsigned int uint_thres_;
+
+  // x * mask * scale on [begin, end), the mask is drawn beforehand
+  void ScaleRange_cpu(const Dtype* x, const unsigned int* mask, Dtype* y,
+      int begin, int end);
 };
 
 }  // namespace caffe
@@ -39,6 +39,13 @@ class EltwiseLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  // the CPU passes on the elements in [begin, end), Backward for bottom i
+  void ForwardRange_cpu(const vector<const Dtype*>& bottom_data,
+      Dtype* top_data, int* mask, int begin, int end);
+  void BackwardRange_cpu(const vector<const Dtype*>& bottom_data,
+      const Dtype* top_data, const Dtype* top_diff, const int* mask, int i,
+      Dtype* bottom_diff, int begin, int end);
+
   EltwiseParameter_EltwiseOp op_;
   vector<Dtype> coeffs_;
   Blob<int> max_idx_;
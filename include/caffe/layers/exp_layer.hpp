@@ -73,6 +73,11 @@ class ExpLayer : public NeuronLayer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
   Dtype inner_scale_, outer_scale_;
+
+  void ForwardRange_cpu(const Dtype* bottom_data, Dtype* top_data,
+      int begin, int end);
+  void BackwardRange_cpu(const Dtype* top_data, const Dtype* top_diff,
+      Dtype* bottom_diff, int begin, int end);
 };
 
 }  // namespace caffe
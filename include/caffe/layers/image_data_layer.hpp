@@ -36,9 +36,13 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual void ShuffleImages();
   virtual void load_batch(Batch<Dtype>* batch);
+  virtual void transform_item(Batch<Dtype>* batch, int item_id, int thread,
+      DataTransformer<Dtype>* transformer, Blob<Dtype>* transformed_data);
 
   vector<std::pair<std::string, int> > lines_;
   int lines_id_;
+  // the image files of the current batch
+  vector<std::string> item_files_;
 };
 
 
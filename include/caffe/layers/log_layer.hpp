@@ -75,6 +75,11 @@ class LogLayer : public NeuronLayer<Dtype> {
   Dtype base_scale_;
   Dtype input_scale_, input_shift_;
   Dtype backward_num_scale_;
+
+  void ForwardRange_cpu(const Dtype* bottom_data, Dtype* top_data,
+      int begin, int end);
+  void BackwardRange_cpu(const Dtype* bottom_data, const Dtype* top_diff,
+      Dtype* bottom_diff, int begin, int end);
 };
 
 }  // namespace caffe
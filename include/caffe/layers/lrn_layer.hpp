@@ -55,6 +55,12 @@ class LRNLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void WithinChannelBackward(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  // ACROSS_CHANNELS on the images in [begin, end)
+  void CrossChannelForwardImages_cpu(const Dtype* bottom_data,
+      Dtype* scale_data, Dtype* top_data, int begin, int end);
+  void CrossChannelBackwardImages_cpu(const Dtype* top_data,
+      const Dtype* top_diff, const Dtype* bottom_data,
+      const Dtype* scale_data, Dtype* bottom_diff, int begin, int end);
 
   int size_;
   int pre_pad_;
@@ -17,6 +17,7 @@
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/db.hpp"
+#include "caffe/util/mapped_file.hpp"
 #include "caffe/util/GPIhelper.h"
 
 namespace caffe {
@@ -24,6 +25,10 @@ namespace caffe {
  * @brief parallel extension of DataLayer - reads from single raw file into memory.
  *
  * NOTE: needs parallel file system (like BeeGFS) to provide scalable data input.
+ *
+ * The raw file is mapped into memory once, gray images are handed to the
+ * DataTransformer without copy. With shuffle, the samples are taken in a
+ * global order per epoch, which every rank computes from the seed.
  */
 template <typename Dtype>
 class ParallelDataLayer : public BasePrefetchingDataLayer<Dtype> {
@@ -42,14 +47,24 @@ class ParallelDataLayer : public BasePrefetchingDataLayer<Dtype> {
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual void ShuffleImages();
   virtual void load_batch(Batch<Dtype>* batch);
+  virtual void transform_item(Batch<Dtype>* batch, int item_id, int thread,
+      DataTransformer<Dtype>* transformer, Blob<Dtype>* transformed_data);
   
-  uint8_t* rawData_;
+  shared_ptr<MappedFile> source_file_;
+  // per transform thread the BGR copy of the current color image
+  std::vector<std::vector<uint8_t> > rawData_;
+  // the images of the current batch in source_file_
+  std::vector<const uint8_t*> itemData_;
   std::vector<int> Labels_;
   long label_id_; //offset in global label order
   long maxLabel_;
   long samplesPerRank_;
   long minLabel_;
   long data_id_; //offset in locat data block
+  long sampleCount_; //samples loaded so far
+  std::vector<int> order_; //global sample order of shuffleEpoch_
+  std::vector<int> nextSamples_; //sorted samples of the next batch
+  long shuffleEpoch_;
 };
 
 }  // namespace caffe
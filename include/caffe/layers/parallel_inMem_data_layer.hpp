@@ -17,14 +17,35 @@
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/db.hpp"
+#include "caffe/util/mapped_file.hpp"
 #include "caffe/util/GPIhelper.h"
 
 namespace caffe {
+/**
+ * @brief Every rank keeps its share of the batches in a GPI-2 segment and
+ * reads the batches of the other ranks from there.
+ *
+ * The remote images are read ahead into a ring of remote_prefetch + 1
+ * staging slots behind the local batches. With shuffle, the batches are drawn
+ * from a global sample order per epoch, which every rank computes from the
+ * seed without communication. The images a rank holds in consecutive order
+ * are read from it at once.
+ *
+ * With encode_type "png" or "jpg" the images are kept encoded in the segment
+ * behind an index of the image offsets of all ranks, and the transform
+ * threads decode them.
+ *
+ * The shard is loaded with large reads on transform_param.num_threads
+ * threads. With a cache prefix, every rank stores its segment content in
+ * <cache>.rank<r> and later runs register the mapped file with GPI-2
+ * directly, as long as the source, the shape and the number of ranks match.
+ */
 template <typename Dtype>
 class ParallelInMemDataLayer : public BasePrefetchingDataLayer<Dtype> {
  public:
   explicit ParallelInMemDataLayer(const LayerParameter& param)
-      : BasePrefetchingDataLayer<Dtype>(param) {}
+      : BasePrefetchingDataLayer<Dtype>(param), segmentCreated_(false),
+        mappedBytes_(0) {}
   virtual ~ParallelInMemDataLayer();
   virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
@@ -37,10 +58,49 @@ class ParallelInMemDataLayer : public BasePrefetchingDataLayer<Dtype> {
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual void ShuffleImages();
   virtual void load_batch(Batch<Dtype>* batch);
+  // assigns the images of the load-th batch and starts reading the remote
+  // ones into its staging slot
+  void ReadBatch(long load);
+  // segment offset of image local of rank, local = samplesPerRank_ gives the
+  // end of the last image
+  long ImageOffset(gaspi_rank_t rank, long local) const;
+  // sends the index of the encoded images of this rank to all others
+  void ExchangeIndex();
 
-  uint8_t* rawData_;
+  // first page of a shard cache file, the segment content follows
+  struct ShardCacheHeader {
+    char magic[8];
+    int64_t sourceSize;
+    int64_t sourceTime;
+    int64_t firstSample;
+    int64_t samples;
+    int64_t headerSize;
+    int64_t imageSize;
+    int64_t numRanks;
+    char encodeType[16];
+    // the layout of the cached content
+    int64_t dataBytes;
+    int64_t maxImageBytes;
+  };
+  // samples per chunk read at startup
+  long LoadChunkSamples() const;
+  // copies the pixels of a chunk of the shard into the segment
+  void LoadChunk(const MappedFile* source, long firstSample, int chunk,
+      int thread);
+  void EncodeChunk(const MappedFile* source, long firstSample,
+      std::vector<std::vector<uint8_t> >* data, std::vector<long>* sizes,
+      int chunk, int thread);
+  // returns the descriptor of a cache matching header and completes the
+  // layout of header, -1 without
+  int OpenCache(const string& filename, ShardCacheHeader* header);
+  // segmentSize bytes of memory starting with dataBytes of the cache
+  void* MapCache(int fd, long dataBytes, long segmentSize);
+  void WriteCache(const string& filename, const ShardCacheHeader& header);
+  virtual void transform_item(Batch<Dtype>* batch, int item_id, int thread,
+      DataTransformer<Dtype>* transformer, Blob<Dtype>* transformed_data);
+
+  uint8_t* rawData_; //the segment
   std::vector<int> Labels_;
-  long label_id_; //offset in global label order
   long maxLabel_;
   long samplesPerRank_;
   long batchesPerRank_;
@@ -48,8 +108,28 @@ class ParallelInMemDataLayer : public BasePrefetchingDataLayer<Dtype> {
   long batchMemSize_;
   long rankOffset_;
   gaspi_pointer_t segment_0_P_;
-  gaspi_number_t qID_;
-  gaspi_segment_id_t segment_id_;
+  gaspi_queue_id_t qID_;
+  gaspi_segment_id_t segment_id_; //from GPIResources
+  bool segmentCreated_;
+  long mappedBytes_; //of a mapped cache, the segment memory
+  gaspi_rank_t currentRank_;
+  long prefetchDepth_; //remote batches read ahead
+  long loadCount_; //batches loaded so far
+  long readCount_; //batches whose remote read was started
+  long stagingOffset_; //first staging slot in the segment
+  bool encoded_;
+  long imageBytes_; //largest image in the segment of any rank
+  long indexOffset_; //of the image index of all ranks in the segment
+  long* imageIndex_; //image offsets of all ranks, if encoded_
+  long currentSlot_; //staging slot of the batch being transformed
+  // per staging slot the segment offset, the size and the label of every
+  // image and the number of reads to wait for
+  std::vector<std::vector<long> > itemOffsets_;
+  std::vector<std::vector<long> > itemSizes_;
+  std::vector<std::vector<int> > itemLabels_;
+  std::vector<long> slotReads_;
+  std::vector<int> order_; //global sample order of shuffleEpoch_
+  long shuffleEpoch_;
 };
 
 
@@ -44,6 +44,17 @@ class PoolingLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  // The CPU passes over the planes (image, channel) in [begin, end), the
+  // planes are split over the threads of caffe_parallel_for().
+  void MaxForwardPlanes_cpu(const Dtype* bottom_data, Dtype* top_data,
+      int* mask, Dtype* top_mask, int begin, int end);
+  void AveForwardPlanes_cpu(const Dtype* bottom_data, Dtype* top_data,
+      int begin, int end);
+  void MaxBackwardPlanes_cpu(const Dtype* top_diff, const int* mask,
+      const Dtype* top_mask, Dtype* bottom_diff, int begin, int end);
+  void AveBackwardPlanes_cpu(const Dtype* top_diff, Dtype* bottom_diff,
+      int begin, int end);
+
   int kernel_h_, kernel_w_;
   int stride_h_, stride_w_;
   int pad_h_, pad_w_;
@@ -82,6 +82,11 @@ class PowerLayer : public NeuronLayer<Dtype> {
   Dtype shift_;
   /// @brief Result of @f$ \alpha \gamma @f$
   Dtype diff_scale_;
+
+  void ForwardRange_cpu(const Dtype* bottom_data, Dtype* top_data,
+      int begin, int end);
+  void BackwardRange_cpu(const Dtype* bottom_data, const Dtype* top_data,
+      const Dtype* top_diff, Dtype* bottom_diff, int begin, int end);
 };
 
 }  // namespace caffe
@@ -94,6 +94,12 @@ class PReLULayer : public NeuronLayer<Dtype> {
   Blob<Dtype> multiplier_;  // dot multiplier for backward computation of params
   Blob<Dtype> backward_buff_;  // temporary buffer for backward computation
   Blob<Dtype> bottom_memory_;  // memory for in-place computation
+
+  void ForwardRange_cpu(const Dtype* bottom_data, const Dtype* slope_data,
+      Dtype* top_data, int channels, int dim, int begin, int end);
+  void BackwardRange_cpu(const Dtype* bottom_data, const Dtype* slope_data,
+      const Dtype* top_diff, Dtype* bottom_diff, int channels, int dim,
+      int begin, int end);
 };
 
 }  // namespace caffe
@@ -36,6 +36,14 @@ class SoftmaxLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  // the CPU passes on the outer indices in [begin, end), each uses its own
+  // part of scale_
+  void ForwardRange_cpu(const Dtype* bottom_data, const Dtype* sum_multiplier,
+      Dtype* scale_data, Dtype* top_data, int begin, int end);
+  void BackwardRange_cpu(const Dtype* top_data, const Dtype* top_diff,
+      const Dtype* sum_multiplier, Dtype* scale_data, Dtype* bottom_diff,
+      int begin, int end);
+
   int outer_num_;
   int inner_num_;
   int softmax_axis_;
@@ -57,6 +57,9 @@ class ThresholdLayer : public NeuronLayer<Dtype> {
   }
 
   Dtype threshold_;
+
+  void ForwardRange_cpu(const Dtype* bottom_data, Dtype* top_data,
+      int begin, int end);
 };
 
 }  // namespace caffe
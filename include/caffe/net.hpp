@@ -12,9 +12,13 @@
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
 #include "gpi_ring_buffer.hpp"
 #include "gpi_communicator_model.hpp"
 #include "gpi_communicator_diff.hpp"
+#include "gpi_communicator_scalar.hpp"
+#include "gpi_trace.hpp"
+#include "gpi_progress_thread.hpp"
 
 namespace caffe {
 
@@ -133,8 +137,26 @@ class Net {
   // Communicate layers
   void CommunicateDataBlocking(void);
   bool AmIGPIMaster(void) {
-    return !com_buffers_data_.size() || !com_buffers_data_[0]->HaveUpdateSource();}
+    return !com_buffers_data_.size() || (rank_ == 0);}
+  gaspi_rank_t GPIRank(void) const { return rank_; }
+  /// @brief True if every rank applies the solver update itself.
+  bool GPIAllreduce(void) const {
+    return gpi_communication_
+      && (gpi_param_.update_mode() == GPIParameter_UpdateMode_ALLREDUCE);}
+  bool GPISSP(void) const {
+    return gpi_communication_
+      && (gpi_param_.update_mode() == GPIParameter_UpdateMode_SSP);}
+  bool GPISharded(void) const {
+    return gpi_communication_
+      && (gpi_param_.update_mode() == GPIParameter_UpdateMode_SHARDED);}
+  /// @brief True if this rank applies the solver update of param_id and
+  /// thus needs its solver history.
+  bool GPIUpdatesParam(int param_id) const;
+  // logs the staleness of the weights used since the last call with SSP
+  void LogWeightStaleness(void);
   void MarkDataAsUpdatedOnMasterNode(void);
+  /// @brief Logs the latency of the fused diff buckets on rank 0.
+  void LogDiffBucketTimings(void);
 
   /// @brief Updates the network weights based on the diff values computed.
   void Update();
@@ -266,6 +288,35 @@ class Net {
   const shared_ptr<Layer<Dtype> > layer_by_name(const string& layer_name) const;
 
   void set_debug_info(const bool value) { debug_info_ = value; }
+  /// @brief Average the output blobs over all ranks together with the loss
+  /// in the following iterations, e.g. on display iterations only.
+  void set_gpi_reduce_outputs(const bool value) {
+    gpi_reduce_outputs_ = value;
+  }
+
+  /**
+   * @brief Where the distributed training steps spend their time, in
+   * microseconds summed over the steps since profiling was enabled. In GPU
+   * mode every lap synchronizes the device.
+   */
+  struct GPIProfile {
+    vector<double> forward;    // per layer, the layer itself
+    vector<double> data_wait;  // per layer, waiting for its weights
+    vector<double> backward;   // per layer, the layer itself
+    double overlap;        // diff communication and updates between layers
+    double diff_blocking;  // waiting for the diffs after the backward pass
+    double data_blocking;  // CommunicateDataBlocking
+    double loss_blocking;  // waiting for the loss reduction
+  };
+  /// @brief Enables the profiling of the distributed steps, resets the times.
+  void set_gpi_profile(const bool value);
+  const GPIProfile& gpi_profile() const { return gpi_profile_; }
+  /// @brief The bytes the diff and model communicators of this rank sent
+  /// and received so far, read them between the steps.
+  void GPIBytes(unsigned long long* diff_sent,
+                unsigned long long* diff_received,
+                unsigned long long* data_sent,
+                unsigned long long* data_received) const;
 
   // Helpers for Init.
   /**
@@ -325,13 +376,11 @@ class Net {
   void UpdateDebugInfo(const int param_id);
 
   // Communicate layers
-  void CheckAvailableSegments(gaspi_segment_id_t id);
+  // the rank updating the parameters of every layer
+  void AssignLayerUpdateRanks();
+  // the update ranks of the parameter blobs in the order of the backward pass
+  std::vector<gaspi_rank_t> CalculatedBlobUpdateRanks();
   void BuildLayerDiffCommunication();
-  int GetDiffTreeBranchingFactor() const;
-  std::vector<gaspi_rank_t> GetDiffTreeWriteRanks(gaspi_rank_t rank,
-                                                  int branching_factor) const;
-  std::vector<gaspi_rank_t> GetDiffTreeReadRanks(gaspi_rank_t rank,
-                                                 int branching_factor) const;
   void BuildLayerDataCommunication();
   void ResetCommunicationStatus(void);
   void AppendLayerToCalculatedBlobs(int index);
@@ -339,16 +388,40 @@ class Net {
   void CommunicateLayerDiffBlocking(void);
   bool CommunicateLayerDiffFinished(void);
   bool CommunicateLayerDiffReadFinished(int index);
+  bool CommunicateLayerDiffWriteFinished(int index);
+  // the sends of the diffs respectively of the model of blob index have
+  // completed locally, waited for by the progress thread if there is one
+  void WaitForDiffLocalCompletion(void);
+  void WaitForDataLocalCompletion(int index);
   void ScaleLayerDiff(Dtype s);
   void CommunicateLayerData();
   bool CommunicateLayerDataFinished(void);
-  void CommunicateLayerDiffAndDataBlocking(Solver<Dtype>* solver);
-  bool CommunicateLayerDiffAndDataFinished(void);
+  // largest CommunicatorModel::Staleness() of the parameters of layer_id,
+  // false if it is not known yet
+  bool LayerDataStaleness(int layer_id, unsigned long* staleness);
+  // drives the model communicators until the parameters of layer_id arrived
+  void WaitForLayerData(int layer_id);
+  void ProgressLayerData(void);
+  // no forward pass uses the weights received so far, see
+  // CommunicatorModel::AcknowledgeReceived()
+  void AcknowledgeReceivedLayerData(void);
+  void CommunicateLayerDiffAndUpdateBlocking(Solver<Dtype>* solver);
+  bool CommunicateLayerDiffAndUpdateFinished(void);
   void UpdateLayersWithSolver(Solver<Dtype>* solver);
+  void ApplyUpdateLayer(Solver<Dtype>* solver, int param_id);
+  void UpdatedModelOnMaster(int index);
+  // lets the progress thread run while the compute thread waits for it
+  void YieldToProgressThread(void);
   int FindLearnableParamsID(Blob<Dtype>* blob);
+  // the loss and, with gpi_reduce_outputs_, the outputs are averaged over
+  // all ranks, with SSP every rank keeps its own
   void CommunicateLossSend(Dtype loss);
+  void CommunicateLossProgress(void);
   void CommunicateLossCollect(Dtype& loss);
   gaspi_datatype_t GetGPI2DataType(void);
+  // adds the time since the last lap to *time if profiling, NULL starts a
+  // lap
+  void ProfileLap(double* time);
 
   /// @brief The network name
   string name_;
@@ -417,22 +490,43 @@ DISABLE_COPY_AND_ASSIGN(Net);
 
   //GPI communication
   bool gpi_communication_;
+  GPIParameter gpi_param_;
   gaspi_rank_t rank_;
   gaspi_rank_t num_ranks_;
   vector<unsigned long> learnable_params_size_aggregated_;
   vector<Blob<Dtype>* > calculated_blobs_;
   vector<shared_ptr<CommunicatorModel<Dtype> > > com_buffers_data_;
+  // indices into com_buffers_data_ of the parameters of every layer
+  vector<vector<int> > layer_com_buffers_data_;
+  // the rank applying the solver update, per layer and per learnable param
+  vector<gaspi_rank_t> layer_update_rank_;
+  vector<gaspi_rank_t> learnable_param_update_rank_;
   vector<shared_ptr<CommunicatorDiff<Dtype> > > com_buffers_diff_;
+  // drives the communicators with gpi_param.progress_thread, destroyed
+  // before them
+  shared_ptr<CommunicationProgressThread<Dtype> > progress_thread_;
   int update_status_;
-  gaspi_notification_id_t loss_buffer_index_;
-  static const gaspi_queue_id_t queue_diff_ = 0;
-  static const gaspi_queue_id_t queue_data_ = 1;
-  static const gaspi_queue_id_t queue_data_write = 5;
-  static const gaspi_queue_id_t queue_data_acknowledge_ = 6;
-  static const gaspi_queue_id_t queue_loss_ = 2;
-  static const gaspi_segment_id_t segment_id_diff_ = 0;
-  static const gaspi_segment_id_t segment_id_data_ = 2;
-  static const gaspi_segment_id_t segment_id_loss_ = 1;
+  // weight staleness observed by the forward passes
+  double staleness_sum_;
+  unsigned long staleness_max_;
+  long staleness_count_;
+  shared_ptr<CommunicatorScalar<Dtype> > com_scalars_;
+  bool gpi_reduce_outputs_;
+  bool gpi_profiling_;
+  GPIProfile gpi_profile_;
+  CPUTimer profile_timer_;
+  // this net started the GPITrace of the process
+  bool gpi_tracing_;
+  // layer_names_ as GPITrace event names
+  vector<const char*> trace_layer_names_;
+  // from GPIResources
+  gaspi_queue_id_t queue_diff_;
+  gaspi_queue_id_t queue_data_write_;
+  gaspi_queue_id_t queue_data_acknowledge_;
+  gaspi_queue_id_t queue_loss_;
+  gaspi_segment_id_t segment_id_diff_;
+  gaspi_segment_id_t segment_id_data_;
+  gaspi_segment_id_t segment_id_loss_;
   static const gaspi_notification_id_t notification_id_diff_ = 0;
   static const gaspi_notification_id_t notification_id_data_ = 0;
   static const gaspi_notification_id_t notification_id_loss_ = 0;
@@ -101,6 +101,9 @@ class Solver {
  protected:
   virtual bool SupportApplyUpdateLayer();
   string SnapshotFilename(const string extension);
+  // with update_mode SHARDED every rank keeps the solver state of the layers
+  // it updates in a file of its own
+  string SolverStateFilename(const string& filename);
   string SnapshotToBinaryProto();
   string SnapshotToHDF5();
   // The test routine
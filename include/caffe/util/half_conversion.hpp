@@ -0,0 +1,45 @@
+#ifndef CAFFE_UTIL_HALF_CONVERSION_H_
+#define CAFFE_UTIL_HALF_CONVERSION_H_
+
+#include <stdint.h>
+
+namespace caffe {
+
+// 16 bit floating point formats used to compress data on the wire.
+//    - HALF_FP16: IEEE 754 binary16, 11 bit precision, largest finite value
+//      65504.
+//    - HALF_BF16: bfloat16, the upper half of a float, 8 bit precision with
+//      the full float range.
+enum HalfFormat {
+  HALF_FP16 = 0,
+  HALF_BF16 = 1
+};
+
+// Scalar conversions, rounding to nearest even. Overflows become infinity,
+// NaNs stay quiet NaNs.
+uint16_t caffe_float_to_half(const float x, const HalfFormat format);
+float caffe_half_to_float(const uint16_t x, const HalfFormat format);
+
+// y = half(x). Uses F16C respectively AVX2 if the CPU supports them, the
+// results are identical to the scalar conversions.
+template <typename Dtype>
+void caffe_cpu_half_pack(const int N, const Dtype* x, uint16_t* y,
+    const HalfFormat format);
+
+// y = float(x)
+template <typename Dtype>
+void caffe_cpu_half_unpack(const int N, const uint16_t* x, Dtype* y,
+    const HalfFormat format);
+
+// y += float(x), accumulating in Dtype
+template <typename Dtype>
+void caffe_cpu_half_unpack_add(const int N, const uint16_t* x, Dtype* y,
+    const HalfFormat format);
+
+// x = float(half(x)), rounds x to the values representable in format
+template <typename Dtype>
+void caffe_cpu_half_round(const int N, Dtype* x, const HalfFormat format);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_HALF_CONVERSION_H_
@@ -29,6 +29,25 @@ void col2im_cpu(const Dtype* data_col, const int channels,
     const int stride_w, const int dilation_h, const int dilation_w,
     Dtype* data_im);
 
+// im2col_cpu of the columns [col_begin, col_end) of the col matrix only, i.e.
+// of the output positions in that range. data_col holds
+// channels * kernel_h * kernel_w rows of col_end - col_begin columns.
+template <typename Dtype>
+void im2col_tile_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int dilation_h, const int dilation_w,
+    const int col_begin, const int col_end, Dtype* data_col);
+
+// The inverse of im2col_tile_cpu. Unlike col2im_cpu it adds to data_im, so
+// data_im has to be zeroed before the first tile.
+template <typename Dtype>
+void col2im_tile_add_cpu(const Dtype* data_col, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int dilation_h, const int dilation_w,
+    const int col_begin, const int col_end, Dtype* data_im);
+
 template <typename Dtype>
 void im2col_nd_gpu(const Dtype* data_im, const int num_spatial_axes,
     const int col_size, const int* im_shape, const int* col_shape,
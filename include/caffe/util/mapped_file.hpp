@@ -0,0 +1,43 @@
+#ifndef CAFFE_UTIL_MAPPED_FILE_H_
+#define CAFFE_UTIL_MAPPED_FILE_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Maps a file read-only into memory.
+ *
+ * The file is opened once, the pages are loaded by the kernel on first
+ * access and shared with the page cache, i.e. reading an image is a pointer
+ * offset without copy. Several threads may read concurrently. The access
+ * pattern tells the kernel whether to read ahead.
+ */
+class MappedFile {
+ public:
+  enum Access { SEQUENTIAL, RANDOM };
+
+  explicit MappedFile(const string& filename, Access access = SEQUENTIAL);
+  ~MappedFile();
+
+  // NULL for an empty file
+  inline const uint8_t* data() const { return data_; }
+  inline size_t size() const { return size_; }
+
+  // asks the kernel to read [offset, offset + length) ahead asynchronously
+  void WillNeed(size_t offset, size_t length) const;
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+
+  DISABLE_COPY_AND_ASSIGN(MappedFile);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_MAPPED_FILE_H_
@@ -0,0 +1,33 @@
+#ifndef CAFFE_UTIL_PARALLEL_FOR_H_
+#define CAFFE_UTIL_PARALLEL_FOR_H_
+
+#include <boost/function.hpp>
+
+namespace caffe {
+
+/**
+ * @brief The CPU layers split their loops over one ThreadPool of the process.
+ *
+ * By default there is a single thread and the loops run on the calling
+ * thread as before. caffe_parallel_for() runs sequentially as well when it is
+ * called from within a parallel loop or while another thread runs one, e.g.
+ * a prefetch thread, so the layers may call it from anywhere.
+ */
+
+// Sets the number of threads, must not be called while a loop runs.
+void caffe_set_cpu_threads(int num_threads);
+int caffe_cpu_threads();
+
+// Splits [0, n) into contiguous ranges of at least grain items, at most one
+// per thread, and calls task(begin, end) for every range concurrently.
+// Returns once all ranges are done.
+void caffe_parallel_for(int n, int grain,
+                        const boost::function<void(int, int)>& task);
+
+// The grain of the element-wise loops, smaller loops are not worth waking
+// the threads for.
+const int kElementwiseGrain = 16384;
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_PARALLEL_FOR_H_
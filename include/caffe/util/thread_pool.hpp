@@ -0,0 +1,62 @@
+#ifndef CAFFE_UTIL_THREAD_POOL_H_
+#define CAFFE_UTIL_THREAD_POOL_H_
+
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace boost { class thread; }
+
+namespace caffe {
+
+/**
+ * @brief A fixed set of threads that share the items of a loop.
+ *
+ * Run() hands the items out one by one to whichever thread is idle, the
+ * calling thread works on the items as well. A pool of one thread runs the
+ * loop on the calling thread only.
+ */
+class ThreadPool {
+ public:
+  explicit ThreadPool(int num_threads);
+  ~ThreadPool();
+
+  inline int num_threads() const { return num_threads_; }
+
+  // Calls task(item, thread) for every item in [0, num_items) and returns
+  // once all calls returned. thread is in [0, num_threads()), the calling
+  // thread is thread 0. Run() must not be called from within a task.
+  void Run(int num_items, const boost::function<void(int, int)>& task);
+
+ private:
+  void Work(int thread);
+  void RunItems(int thread);
+
+  const int num_threads_;
+  std::vector<shared_ptr<boost::thread> > threads_;
+
+  boost::mutex mutex_;
+  boost::condition_variable start_;
+  boost::condition_variable done_;
+  // counts the calls of Run(), wakes the threads
+  long generation_;
+  // threads still working on the current loop, besides the calling one
+  int busy_;
+  bool stop_;
+
+  // the current loop
+  const boost::function<void(int, int)>* task_;
+  int num_items_;
+  boost::atomic<int> next_item_;
+
+  DISABLE_COPY_AND_ASSIGN(ThreadPool);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_THREAD_POOL_H_
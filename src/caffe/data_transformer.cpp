@@ -519,11 +519,14 @@ vector<int> DataTransformer<Dtype>::InferBlobShape(
 }
 #endif  // USE_OPENCV
 
+template <typename Dtype>
+bool DataTransformer<Dtype>::NeedsRand() const {
+  return param_.mirror() || (phase_ == TRAIN && param_.crop_size());
+}
+
 template <typename Dtype>
 void DataTransformer<Dtype>::InitRand() {
-  const bool needs_rand = param_.mirror() ||
-      (phase_ == TRAIN && param_.crop_size());
-  if (needs_rand) {
+  if (NeedsRand()) {
     const unsigned int rng_seed = caffe_rng_rand();
     rng_.reset(new Caffe::RNG(rng_seed));
   } else {
@@ -531,6 +534,15 @@ void DataTransformer<Dtype>::InitRand() {
   }
 }
 
+template <typename Dtype>
+void DataTransformer<Dtype>::InitRand(unsigned int seed) {
+  if (NeedsRand()) {
+    rng_.reset(new Caffe::RNG(seed));
+  } else {
+    rng_.reset();
+  }
+}
+
 template <typename Dtype>
 int DataTransformer<Dtype>::Rand(int n) {
   CHECK(rng_);
@@ -1,4 +1,10 @@
 #include "caffe/gpi_communicator_diff.hpp"
+#include "caffe/gpi_trace.hpp"
+#include "caffe/util/half_conversion.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include <algorithm>
+#include <cmath>
 
 namespace caffe {
 
@@ -6,166 +12,666 @@ template <typename Dtype>
 void CommunicatorDiff<Dtype>::operator()(void) {
   for (long i = 0; i < com_buffers_diff_read_.size(); i++) {
     RingBufferRead<Dtype>& buffer = com_buffers_diff_read_[i];
-    while (com_buffers_diff_read_status_[i] < calculated_blobs_.size()) {
-      Blob<Dtype>& blob = *calculated_blobs_[com_buffers_diff_read_status_[i]];
-      if (buffer.Add(blob.mutable_cpu_diff(), blob.count())) {
-        break;
-      } else {
-        com_buffers_diff_read_status_[i]++;
+    Position& pos = com_buffers_diff_read_status_[i];
+    while (pos.bucket < buckets_ready_) {
+      const long t = bucket_topology_[pos.bucket];
+      const long size = bucket_offset_[pos.bucket + 1]
+        - bucket_offset_[pos.bucket];
+      const long partition =
+        topologies_[t].SlicePartition(read_slices_[i][t][pos.slice]);
+      const DiffTopology::ReadMode mode = read_modes_[i][t][pos.slice];
+      const long begin = DiffTopology::PartitionBegin(
+        size, partition, num_partitions_);
+      const long end = DiffTopology::PartitionBegin(
+        size, partition + 1, num_partitions_);
+      if (end > begin) {
+        Dtype* p = diff_ + bucket_offset_[pos.bucket] + begin;
+        if (Sparse()) {
+          unsigned long read;
+          if (buffer.ReadSparse(p, end - begin, mode == DiffTopology::ADD,
+                                &read)) {
+            break;
+          }
+          bytes_received_.fetch_add(read * element_size_,
+                                    boost::memory_order_relaxed);
+        } else if (mode == DiffTopology::ADD) {
+          if (buffer.Add(p, end - begin)) break;
+        } else if (Compressed()) {
+          if (buffer.Read(p, end - begin)) break;
+        } else {
+          // the remote has written the slice into our diff
+          if (!ReadDirect(i, Sequence(pos))) break;
+        }
+        if (!Sparse()) {
+          bytes_received_.fetch_add((end - begin) * element_size_,
+                                    boost::memory_order_relaxed);
+        }
       }
+      Advance(read_slices_[i], pos);
     }
   }
   for (long i = 0; i < com_buffers_diff_write_.size(); i++) {
     RingBufferWrite<Dtype>& buffer = com_buffers_diff_write_[i];
-    while ((com_buffers_diff_write_status_[i] < calculated_blobs_.size())
-           && CommunicateLayerDiffReadFinished(com_buffers_diff_write_status_[i])) {
-      Blob<Dtype>& blob = *calculated_blobs_[com_buffers_diff_write_status_[i]];
-//todo aggregate diffs from other cpu too
-      if (buffer.Write(blob.cpu_diff(), blob.count())) {
-        break;
-      } else {
-        com_buffers_diff_write_status_[i]++;
+    Position& pos = com_buffers_diff_write_status_[i];
+    while ((pos.bucket < buckets_ready_)
+           && SliceReadFinished(pos.bucket, write_slices_[i]
+                                [bucket_topology_[pos.bucket]][pos.slice])) {
+      const long t = bucket_topology_[pos.bucket];
+      const long size = bucket_offset_[pos.bucket + 1]
+        - bucket_offset_[pos.bucket];
+      const long partition =
+        topologies_[t].SlicePartition(write_slices_[i][t][pos.slice]);
+      const long begin = DiffTopology::PartitionBegin(
+        size, partition, num_partitions_);
+      const long end = DiffTopology::PartitionBegin(
+        size, partition + 1, num_partitions_);
+      if (end > begin) {
+        const long offset = bucket_offset_[pos.bucket] + begin;
+        const bool copy = (write_modes_[i][t][pos.slice] == DiffTopology::COPY);
+        if (Sparse()) {
+          unsigned long written;
+          if (buffer.WriteSparse(diff_ + offset, end - begin, &written)) break;
+          bytes_sent_.fetch_add(written * element_size_,
+                                boost::memory_order_relaxed);
+        } else if (Compressed()) {
+          if (buffer.Write(diff_ + offset, end - begin)) break;
+          // keep the values the remote receives, so all ranks hold the
+          // same reduced diff
+          if (copy) {
+            caffe_cpu_half_round(end - begin, diff_ + offset,
+                                 (wire_format_ == GPIParameter_WireFormat_BF16)
+                                 ? HALF_BF16 : HALF_FP16);
+          }
+        } else if (copy) {
+          WriteDirect(i, offset, end - begin, Sequence(pos));
+        } else if (buffer.WriteFromSegment(segment_id_, offset * sizeof(Dtype),
+                                           end - begin)) {
+          break;
+        }
+        if (!Sparse()) {
+          bytes_sent_.fetch_add((end - begin) * element_size_,
+                                boost::memory_order_relaxed);
+        }
       }
+      Advance(write_slices_[i], pos);
     }
   }
+  UpdateBucketTimings();
 }
 
 template <typename Dtype>
-bool CommunicatorDiff<Dtype>::CommunicateLayerDiffFinished() {
-  int running = !CommunicateLayerDiffReadFinished(calculated_blobs_.size() - 1);
-  for (long i = 0; i < com_buffers_diff_write_status_.size(); i++) {
-    running |= (com_buffers_diff_write_status_[i] < calculated_blobs_.size());
+bool CommunicatorDiff<Dtype>::ReadDirect(long link,
+                                         gaspi_notification_t sequence) {
+  gaspi_notification_t value;
+  SUCCESS_OR_DIE(gaspi_notify_reset(segment_id_,
+                                    read_direct_notification_[link],
+                                    &value));
+  read_direct_sequence_[link] = std::max(read_direct_sequence_[link], value);
+  return read_direct_sequence_[link] >= sequence;
+}
+
+// Slices the remote copies go to the same offset of its diff. The remote
+// does not touch them before they arrive as it needs our contribution to
+// them first.
+template <typename Dtype>
+void CommunicatorDiff<Dtype>::WriteDirect(long link, long offset, long len,
+                                          gaspi_notification_t sequence) {
+  gaspi_number_t entries;
+  SUCCESS_OR_DIE(gaspi_queue_size(queue_, &entries));
+  if ((long(queue_depth_) - long(entries)) < 1) {
+    SUCCESS_OR_DIE(gaspi_wait(queue_, GASPI_BLOCK));
   }
-  return !running;
+  SUCCESS_OR_DIE(GPITrace::WriteNotify(segment_id_,
+                                       offset * sizeof(Dtype),
+                                       write_ranks_[link],
+                                       segment_id_,
+                                       offset * sizeof(Dtype),
+                                       len * sizeof(Dtype),
+                                       write_direct_notification_[link],
+                                       sequence,
+                                       queue_,
+                                       GASPI_BLOCK));
+}
+
+// position of a slice in the stream of its link, zero is not allowed as
+// notification
+template <typename Dtype>
+gaspi_notification_t CommunicatorDiff<Dtype>::Sequence(const Position& pos) {
+  return pos.count + 1;
+}
+
+template <typename Dtype>
+void CommunicatorDiff<Dtype>::WaitForLocalCompletion(void) {
+  SUCCESS_OR_DIE(gaspi_wait(queue_, GASPI_BLOCK));
+}
+
+template <typename Dtype>
+bool CommunicatorDiff<Dtype>::CommunicateLayerDiffFinished() {
+  const int index = num_calculated_blobs_ - 1;
+  return CommunicateLayerDiffReadFinished(index)
+    && CommunicateLayerDiffWriteFinished(index);
 }
 
 template <typename Dtype>
 bool CommunicatorDiff<Dtype>::CommunicateLayerDiffReadFinished(int index) {
+  if (index < 0) return true;
   int running = 0;
   for (long i = 0; i < com_buffers_diff_read_status_.size(); i++) {
-    running |= (com_buffers_diff_read_status_[i] <= index);
+    running |= (com_buffers_diff_read_status_[i].bucket <= blob_bucket_[index]);
+  }
+  return !running;
+}
+
+template <typename Dtype>
+bool CommunicatorDiff<Dtype>::CommunicateLayerDiffWriteFinished(int index) {
+  if (index < 0) return true;
+  int running = 0;
+  for (long i = 0; i < com_buffers_diff_write_status_.size(); i++) {
+    running |=
+      (com_buffers_diff_write_status_[i].bucket <= blob_bucket_[index]);
   }
   return !running;
 }
 
+// A slice may be written once all reads of its partition up to its own
+// phase have arrived.
+template <typename Dtype>
+bool CommunicatorDiff<Dtype>::SliceReadFinished(long bucket,
+                                                long slice) const {
+  const long t = bucket_topology_[bucket];
+  for (long s = topologies_[t].SlicePartition(slice); s <= slice;
+       s += num_partitions_) {
+    const std::vector<std::pair<long, long> >& reads = slice_reads_[t][s];
+    for (long i = 0; i < reads.size(); i++) {
+      const Position& pos = com_buffers_diff_read_status_[reads[i].first];
+      if ((pos.bucket < bucket)
+          || ((pos.bucket == bucket) && (pos.slice <= reads[i].second))) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+template <typename Dtype>
+void CommunicatorDiff<Dtype>::Advance(
+  const std::vector<std::vector<long> >& slices, Position& pos) const {
+  pos.slice++;
+  pos.count++;
+  SkipEmptyBuckets(slices, pos);
+}
+
+// A link carries no slices of the buckets reduced along topologies it is not
+// part of.
+template <typename Dtype>
+void CommunicatorDiff<Dtype>::SkipEmptyBuckets(
+  const std::vector<std::vector<long> >& slices, Position& pos) const {
+  while ((pos.bucket < bucket_topology_.size())
+         && (pos.slice >= slices[bucket_topology_[pos.bucket]].size())) {
+    pos.slice = 0;
+    pos.bucket++;
+  }
+}
+
+template <typename Dtype>
+typename CommunicatorDiff<Dtype>::Position CommunicatorDiff<Dtype>::LinkStart(
+  const std::vector<std::vector<long> >& slices) const {
+  Position pos = {0, 0, 0};
+  SkipEmptyBuckets(slices, pos);
+  return pos;
+}
+
 template <typename Dtype>
 void CommunicatorDiff<Dtype>::AddCalculatedBlob(Blob<Dtype>* blob) {
-  calculated_blobs_.push_back(blob);
+  CHECK_LT(num_calculated_blobs_, blobs_.size());
+  CHECK_EQ(blob, blobs_[num_calculated_blobs_])
+    << "Blobs must be calculated in the order given to CommunicatorDiff";
+  blob->mutable_cpu_diff();// synchronizes the diff in the segment
+  Sparsify(num_calculated_blobs_);
+  num_calculated_blobs_++;
+  while ((buckets_ready_ < bucket_latency_.size())
+         && (bucket_begin_[buckets_ready_ + 1] <= num_calculated_blobs_)) {
+    bucket_ready_time_[buckets_ready_] =
+      boost::posix_time::microsec_clock::local_time();
+    buckets_ready_++;
+  }
+}
+
+template <typename Dtype>
+void CommunicatorDiff<Dtype>::UpdateBucketTimings(void) {
+  while ((buckets_finished_ < buckets_ready_)
+         && CommunicateLayerDiffReadFinished(bucket_begin_[buckets_finished_])
+         && CommunicateLayerDiffWriteFinished(
+              bucket_begin_[buckets_finished_])) {
+    bucket_latency_[buckets_finished_] +=
+      (boost::posix_time::microsec_clock::local_time()
+       - bucket_ready_time_[buckets_finished_]).total_microseconds();
+    buckets_finished_++;
+    if (buckets_finished_ == bucket_latency_.size()) bucket_timing_count_++;
+  }
+}
+
+template <typename Dtype>
+void CommunicatorDiff<Dtype>::LogBucketTimings(void) {
+  if (!bucket_timing_count_) return;
+  LOG(INFO) << "Diff communication of " << bucket_latency_.size()
+            << " buckets, mean latency over " << bucket_timing_count_
+            << " iterations:";
+  for (long i = 0; i < bucket_latency_.size(); i++) {
+    LOG(INFO) << "    bucket " << i << ": blobs " << bucket_begin_[i]
+              << "-" << bucket_begin_[i + 1] - 1 << ", "
+              << bucket_offset_[i + 1] - bucket_offset_[i] << " elements, "
+              << bucket_latency_[i] / bucket_timing_count_ / 1000. << " ms";
+    bucket_latency_[i] = 0.0;
+  }
+  bucket_timing_count_ = 0;
+}
+
+template <typename Dtype>
+unsigned long long CommunicatorDiff<Dtype>::BytesSent(void) const {
+  return bytes_sent_.load(boost::memory_order_relaxed);
+}
+
+template <typename Dtype>
+unsigned long long CommunicatorDiff<Dtype>::BytesReceived(void) const {
+  return bytes_received_.load(boost::memory_order_relaxed);
+}
+
+template <typename Dtype>
+bool CommunicatorDiff<Dtype>::Compressed(void) const {
+  return wire_format_ != GPIParameter_WireFormat_NATIVE;
+}
+
+template <typename Dtype>
+bool CommunicatorDiff<Dtype>::Sparse(void) const {
+  return topk_ratio_ > 0;
+}
+
+template <typename Dtype>
+bool CommunicatorDiff<Dtype>::Staged(void) const {
+  return Compressed() || Sparse();
+}
+
+// Error feedback: the diff plus the residual of the last iteration is split
+// into its k largest elements, which are reduced, and the new residual.
+template <typename Dtype>
+void CommunicatorDiff<Dtype>::Sparsify(long index) {
+  const int count = blobs_[index]->count();
+  if (!Sparse() || (count < topk_min_count_)) return;
+  Dtype* diff = blobs_[index]->mutable_cpu_diff();
+  Dtype* residual = &residual_[index][0];
+  caffe_add(count, diff, residual, diff);
+
+  const int k = std::max(1, int(std::ceil(topk_ratio_ * count)));
+  if (k >= count) {
+    caffe_set(count, Dtype(0), residual);
+    return;
+  }
+  topk_magnitude_.resize(count);
+  caffe_abs(count, diff, &topk_magnitude_[0]);
+  std::nth_element(topk_magnitude_.begin(),
+                   topk_magnitude_.begin() + (count - k),
+                   topk_magnitude_.end());
+  const Dtype threshold = topk_magnitude_[count - k];
+  // fewer than k elements are above the threshold, fill up with ties
+  int ties = k;
+  for (int i = 0; i < count; i++) ties -= (std::fabs(diff[i]) > threshold);
+  for (int i = 0; i < count; i++) {
+    const Dtype magnitude = std::fabs(diff[i]);
+    if ((magnitude > threshold) || ((magnitude == threshold) && (ties-- > 0))) {
+      residual[i] = 0;
+    } else {
+      residual[i] = diff[i];
+      diff[i] = 0;
+    }
+  }
 }
 
 template <typename Dtype>
 void CommunicatorDiff<Dtype>::ResetCommunicationStatus(void) {
   for (int i = 0; i < com_buffers_diff_read_status_.size(); i++)
-    com_buffers_diff_read_status_[i] = 0;
+    com_buffers_diff_read_status_[i] = LinkStart(read_slices_[i]);
   for (int i = 0; i < com_buffers_diff_write_status_.size(); i++)
-    com_buffers_diff_write_status_[i] = 0;
-  calculated_blobs_.resize(0);
+    com_buffers_diff_write_status_[i] = LinkStart(write_slices_[i]);
+  for (int i = 0; i < read_direct_sequence_.size(); i++)
+    read_direct_sequence_[i] = 0;
+  num_calculated_blobs_ = 0;
+  buckets_ready_ = 0;
+  buckets_finished_ = 0;
+}
+
+// Fuses consecutive blobs with the same root as long as the bucket stays
+// within bucket_size. Bigger blobs get a bucket of their own.
+template <typename Dtype>
+void CommunicatorDiff<Dtype>::BuildBuckets(
+  const std::vector<long>& blob_sizes,
+  const std::vector<gaspi_rank_t>& blob_roots,
+  long bucket_size) {
+  bucket_begin_.push_back(0);
+  bucket_offset_.push_back(0);
+  for (long b = 0; b < blob_sizes.size(); b++) {
+    const long num_buckets = bucket_begin_.size() - 1;
+    if (num_buckets
+        && (blob_roots[b] == blob_roots[b - 1])
+        && (bucket_offset_[num_buckets] - bucket_offset_[num_buckets - 1]
+            + blob_sizes[b] <= bucket_size)) {
+      bucket_begin_.back() = b + 1;
+      bucket_offset_.back() += blob_sizes[b];
+    } else {
+      bucket_begin_.push_back(b + 1);
+      bucket_offset_.push_back(bucket_offset_.back() + blob_sizes[b]);
+    }
+    blob_bucket_.push_back(bucket_begin_.size() - 2);
+  }
+
+  const long num_buckets = bucket_begin_.size() - 1;
+  bucket_ready_time_.resize(num_buckets);
+  bucket_latency_.resize(num_buckets, 0.0);
+  bucket_timing_count_ = 0;
+  buckets_ready_ = 0;
+  buckets_finished_ = 0;
+}
+
+template <typename Dtype>
+void CommunicatorDiff<Dtype>::CreateSegment(long size) {
+  size = std::max(size, long(sizeof(Dtype)));
+  pinned_memory_ = false;
+#ifndef CPU_ONLY
+  if (Caffe::mode() == Caffe::GPU) {
+    void* ptr;
+    CUDA_CHECK(cudaMallocHost(&ptr, size));
+    SUCCESS_OR_DIE(gaspi_segment_use(segment_id_, ptr,
+                                     size,
+                                     GASPI_GROUP_ALL,
+                                     GASPI_BLOCK, 0));
+    pinned_memory_ = true;
+  }
+  else
+#endif
+  {
+    SUCCESS_OR_DIE(gaspi_segment_create(segment_id_,
+                                        size,
+                                        GASPI_GROUP_ALL,
+                                        GASPI_BLOCK,
+                                        GASPI_MEM_UNINITIALIZED));
+  }
+  gaspi_pointer_t ptr;
+  SUCCESS_OR_DIE(gaspi_segment_ptr(segment_id_, &ptr));
+  diff_ = (Dtype*) ptr;
 }
 
 template <typename Dtype>
 CommunicatorDiff<Dtype>::CommunicatorDiff(
-  const long buffer_size,
+  const std::vector<Blob<Dtype>*>& blobs,
+  const std::vector<gaspi_rank_t>& roots,
+  const GPIParameter& param,
   const gaspi_notification_id_t notification_id_base,
   const gaspi_segment_id_t segment_id,
   const gaspi_queue_id_t queue,
   const gaspi_rank_t rank,
   const gaspi_rank_t num_ranks) :
+  num_partitions_(DiffTopology(param, num_ranks, 0).NumPartitions()),
+  wire_format_(param.diff_wire_format()),
+  element_size_((wire_format_ == GPIParameter_WireFormat_NATIVE)
+                ? sizeof(Dtype) : sizeof(uint16_t)),
+  bytes_sent_(0),
+  bytes_received_(0),
+  topk_ratio_(param.diff_topk_ratio()),
+  topk_min_count_(param.diff_topk_min_count()),
+  // with SSP the senders run up to ssp_staleness iterations ahead of rank 0
+  link_iterations_((param.update_mode() == GPIParameter_UpdateMode_SSP)
+                   ? param.ssp_staleness() + 1 : 1),
+  residual_(blobs.size()),
   segment_id_(segment_id),
+  queue_(queue),
   rank_(rank),
-  num_ranks_(num_ranks) {
-  const int bf = GetDiffTreeBranchingFactor();
-  std::vector<gaspi_rank_t> ranks_read = GetDiffTreeReadRanks(rank_, bf);
-  std::vector<gaspi_rank_t> ranks_write = GetDiffTreeWriteRanks(rank_, bf);
+  num_ranks_(num_ranks),
+  blobs_(blobs),
+  num_calculated_blobs_(0) {
+  std::vector<long> blob_sizes;
+  for (long b = 0; b < blobs.size(); b++) {
+    blob_sizes.push_back(blobs[b]->count());
+  }
+  CHECK(!Sparse() || !Compressed())
+    << "diff_topk_ratio requires diff_wire_format NATIVE";
+  CHECK_LE(topk_ratio_, 1) << "diff_topk_ratio must be within [0, 1]";
+  if (Sparse()) {
+    for (long b = 0; b < blobs.size(); b++) {
+      if (blobs[b]->count() >= topk_min_count_) {
+        residual_[b].resize(blobs[b]->count(), Dtype(0));
+      }
+    }
+  }
+  std::vector<gaspi_rank_t> blob_roots(roots);
+  if (blob_roots.empty()) blob_roots.resize(blobs.size(), 0);
+  CHECK_EQ(blob_roots.size(), blobs.size()) << "One diff root per blob";
+  BuildBuckets(blob_sizes, blob_roots, param.diff_bucket_size());
+  const std::vector<long> rank_nodes =
+    (param.diff_topology() == GPIParameter_DiffTopology_HIERARCHICAL)
+    ? DiffTopology::GetRankNodes(param, rank, num_ranks) : std::vector<long>();
+  // one topology per root
+  std::vector<gaspi_rank_t> topology_roots;
+  for (long b = 0; b < bucket_latency_.size(); b++) {
+    const gaspi_rank_t root = blob_roots[bucket_begin_[b]];
+    const long t = std::find(topology_roots.begin(), topology_roots.end(),
+                             root) - topology_roots.begin();
+    if (t == topology_roots.size()) {
+      topology_roots.push_back(root);
+      topologies_.push_back(DiffTopology(param, num_ranks, root, rank_nodes));
+    }
+    bucket_topology_.push_back(t);
+  }
+  if (topologies_.size()) {
+    slice_reads_.resize(topologies_.size(),
+      std::vector<std::vector<std::pair<long, long> > >(
+        topologies_[0].NumSlices()));
+  }
 
-  const long diff_segment_size
-    = std::max(buffer_size * (ranks_read.size() + ranks_write.size()), 1ul);
-  SUCCESS_OR_DIE(gaspi_segment_create(segment_id_,
-                                      diff_segment_size * sizeof(Dtype),
-                                      GASPI_GROUP_ALL,
-                                      GASPI_BLOCK,
-                                      GASPI_MEM_UNINITIALIZED));
+  gaspi_config_t config;
+  SUCCESS_OR_DIE(gaspi_config_get(&config));
+  queue_depth_ = config.queue_depth;
 
-  long buffer_index = 0;
+  std::vector<gaspi_rank_t> ranks_read = GetReadRanks(rank_);
+  std::vector<gaspi_rank_t> ranks_write = GetWriteRanks(rank_);
 
-  for (int i = 0; i < ranks_write.size(); i++) {
-    const int rank_remote = ranks_write[i];
+  long diff_segment_size = bucket_offset_.back() * sizeof(Dtype);
+  for (int i = 0; i < ranks_read.size(); i++) {
+    diff_segment_size += GetLinkSize(ranks_read[i], rank_) * element_size_;
+  }
+  if (Staged()) {
+    for (int i = 0; i < ranks_write.size(); i++) {
+      diff_segment_size += GetLinkSize(rank_, ranks_write[i]) * element_size_;
+    }
+  }
+  CreateSegment(diff_segment_size);
 
-    std::vector<gaspi_rank_t> ranks_read_remote = GetDiffTreeReadRanks(rank_remote, bf);
-    std::vector<gaspi_rank_t> ranks_write_remote = GetDiffTreeWriteRanks(rank_remote, bf);
-    const long buffer_index_remote = ranks_write_remote.size()
-        + std::find(ranks_read_remote.begin(), ranks_read_remote.end(), rank_)
-        - ranks_read_remote.begin();
+  // the diffs of the blobs lie at the start of the segment in blob order
+  Dtype* ptr = diff_;
+  for (long b = 0; b < blobs.size(); b++) {
+    Blob<Dtype>& blob = *blobs[b];
+    caffe_copy(blob.count(), blob.cpu_diff(), ptr);
+    blob.set_cpu_diff(ptr);
+    ptr += blob.count();
+  }
+
+  for (int i = 0; i < ranks_write.size(); i++) {
+    const gaspi_rank_t rank_remote = ranks_write[i];
+    long buffer_index, buffer_offset;
+    GetLinkLocation(rank_, rank_remote, true, &buffer_index, &buffer_offset);
+    long buffer_index_remote, buffer_offset_remote;
+    GetLinkLocation(rank_remote, rank_, false,
+                    &buffer_index_remote, &buffer_offset_remote);
 
     com_buffers_diff_write_.push_back(RingBufferWrite<Dtype>(
-      buffer_size, segment_id_, notification_id_base + buffer_index,
-      buffer_index * buffer_size * sizeof(Dtype),
-      rank_remote, segment_id_, notification_id_base + buffer_index_remote,
-      buffer_index_remote * buffer_size * sizeof(Dtype), queue));
-    com_buffers_diff_write_status_.push_back(0);
-    buffer_index++;
+      GetLinkSize(rank_, rank_remote), segment_id_,
+      notification_id_base + 2 * buffer_index, buffer_offset,
+      rank_remote, segment_id_, notification_id_base + 2 * buffer_index_remote,
+      buffer_offset_remote, queue, wire_format_));
+    write_ranks_.push_back(rank_remote);
+    write_direct_notification_.push_back(
+      notification_id_base + 2 * buffer_index_remote + 1);
+
+    const std::vector<std::vector<long> > slices
+      = GetLinkSlices(rank_, rank_remote);
+    std::vector<std::vector<DiffTopology::ReadMode> > modes(slices.size());
+    for (long t = 0; t < slices.size(); t++) {
+      for (long j = 0; j < slices[t].size(); j++) {
+        modes[t].push_back(
+          topologies_[t].GetReadMode(rank_remote, rank_, slices[t][j]));
+      }
+    }
+    write_slices_.push_back(slices);
+    write_modes_.push_back(modes);
+    com_buffers_diff_write_status_.push_back(LinkStart(slices));
   }
 
   for (int i = 0; i < ranks_read.size(); i++) {
-    const int rank_remote = ranks_read[i];
+    const gaspi_rank_t rank_remote = ranks_read[i];
+    long buffer_index, buffer_offset;
+    GetLinkLocation(rank_, rank_remote, false, &buffer_index, &buffer_offset);
+    long buffer_index_remote, buffer_offset_remote;
+    GetLinkLocation(rank_remote, rank_, true,
+                    &buffer_index_remote, &buffer_offset_remote);
 
-    std::vector<gaspi_rank_t> ranks_write_remote = GetDiffTreeWriteRanks(rank_remote, bf);
-    long buffer_index_remote = 0;
-    for (int j = 0; (j < ranks_write_remote.size()) && (ranks_write_remote[j] != rank_); j++) {
-      buffer_index_remote++;
-    }
     com_buffers_diff_read_.push_back(RingBufferRead<Dtype>(
-      buffer_size, segment_id_, notification_id_base + buffer_index,
-      buffer_index * buffer_size * sizeof(Dtype),
-      ranks_read[i], segment_id_, notification_id_base + buffer_index_remote,
-      buffer_index_remote * buffer_size * sizeof(Dtype), queue));
-    com_buffers_diff_read_status_.push_back(0);
-    buffer_index ++;
+      GetLinkSize(rank_remote, rank_), segment_id_,
+      notification_id_base + 2 * buffer_index, buffer_offset,
+      rank_remote, segment_id_, notification_id_base + 2 * buffer_index_remote,
+      buffer_offset_remote, queue, wire_format_));
+    read_direct_notification_.push_back(
+      notification_id_base + 2 * buffer_index + 1);
+    read_direct_sequence_.push_back(0);
+
+    const std::vector<std::vector<long> > slices
+      = GetLinkSlices(rank_remote, rank_);
+    std::vector<std::vector<DiffTopology::ReadMode> > modes(slices.size());
+    for (long t = 0; t < slices.size(); t++) {
+      for (long j = 0; j < slices[t].size(); j++) {
+        modes[t].push_back(
+          topologies_[t].GetReadMode(rank_, rank_remote, slices[t][j]));
+        slice_reads_[t][slices[t][j]].push_back(
+          std::make_pair(long(com_buffers_diff_read_.size() - 1), j));
+      }
+    }
+    read_slices_.push_back(slices);
+    read_modes_.push_back(modes);
+    com_buffers_diff_read_status_.push_back(LinkStart(slices));
   }
 }
 
 template <typename Dtype>
 CommunicatorDiff<Dtype>::~CommunicatorDiff() {
   SUCCESS_OR_DIE(gaspi_segment_delete(segment_id_));
+#ifndef CPU_ONLY
+  if (pinned_memory_) CUDA_CHECK(cudaFreeHost(diff_));
+#endif
 }
 
+// Only the slices the receiver adds pass through its ring buffer, unless the
+// wire format needs a conversion or the diffs are sparse. Sparse messages
+// have a header. In elements.
 template <typename Dtype>
-int CommunicatorDiff<Dtype>::GetDiffTreeBranchingFactor() const {
-  return 2;
+long CommunicatorDiff<Dtype>::GetLinkSize(gaspi_rank_t rank_from,
+                                          gaspi_rank_t rank_to) const {
+  const std::pair<gaspi_rank_t, gaspi_rank_t> link(rank_from, rank_to);
+  std::map<std::pair<gaspi_rank_t, gaspi_rank_t>, long>::const_iterator it
+    = link_size_.find(link);
+  if (it != link_size_.end()) return it->second;
+
+  const std::vector<std::vector<long> > slices
+    = GetLinkSlices(rank_from, rank_to);
+  std::vector<std::vector<bool> > buffered(slices.size());
+  for (long t = 0; t < slices.size(); t++) {
+    for (long i = 0; i < slices[t].size(); i++) {
+      buffered[t].push_back(Staged()
+        || (topologies_[t].GetReadMode(rank_to, rank_from, slices[t][i])
+            == DiffTopology::ADD));
+    }
+  }
+  long size = 0;//can store all slices of the link
+  for (long b = 0; b < bucket_topology_.size(); b++) {
+    const long t = bucket_topology_[b];
+    const long count = bucket_offset_[b + 1] - bucket_offset_[b];
+    if (Sparse()) size += slices[t].size();
+    for (long i = 0; i < slices[t].size(); i++) {
+      if (!buffered[t][i]) continue;
+      const long partition = topologies_[t].SlicePartition(slices[t][i]);
+      size += DiffTopology::PartitionBegin(count, partition + 1,
+                                           num_partitions_)
+        - DiffTopology::PartitionBegin(count, partition, num_partitions_);
+    }
+  }
+  size = 1 + link_iterations_ * size;
+  link_size_[link] = size;
+  return size;
 }
 
+// slices transferred from rank_from to rank_to by every topology
 template <typename Dtype>
-std::vector<gaspi_rank_t> CommunicatorDiff<Dtype>::GetDiffTreeWriteRanks(
-  gaspi_rank_t rank, int branching_factor) const {
-  std::vector<gaspi_rank_t>  r;
+std::vector<std::vector<long> > CommunicatorDiff<Dtype>::GetLinkSlices(
+  gaspi_rank_t rank_from, gaspi_rank_t rank_to) const {
+  std::vector<std::vector<long> > r;
+  for (long t = 0; t < topologies_.size(); t++) {
+    r.push_back(topologies_[t].GetLinkSlices(rank_from, rank_to));
+  }
+  return r;
+}
 
-  if (rank > 0) {
-    long power = 1; // = branching_factor ** 0
-    while((power * branching_factor) <= long(rank)) {
-      power *= branching_factor;
-    }
-    r.push_back(long(rank) % power);
+template <typename Dtype>
+std::vector<gaspi_rank_t> CommunicatorDiff<Dtype>::GetReadRanks(
+  gaspi_rank_t rank) const {
+  std::vector<gaspi_rank_t> r;
+  for (long t = 0; t < topologies_.size(); t++) {
+    const std::vector<gaspi_rank_t> ranks = topologies_[t].GetReadRanks(rank);
+    r.insert(r.end(), ranks.begin(), ranks.end());
   }
+  std::sort(r.begin(), r.end());
+  r.erase(std::unique(r.begin(), r.end()), r.end());
   return r;
 }
 
 template <typename Dtype>
-std::vector<gaspi_rank_t> CommunicatorDiff<Dtype>::GetDiffTreeReadRanks(
-  gaspi_rank_t rank, int branching_factor) const {
+std::vector<gaspi_rank_t> CommunicatorDiff<Dtype>::GetWriteRanks(
+  gaspi_rank_t rank) const {
   std::vector<gaspi_rank_t> r;
+  for (long t = 0; t < topologies_.size(); t++) {
+    const std::vector<gaspi_rank_t> ranks = topologies_[t].GetWriteRanks(rank);
+    r.insert(r.end(), ranks.begin(), ranks.end());
+  }
+  std::sort(r.begin(), r.end());
+  r.erase(std::unique(r.begin(), r.end()), r.end());
+  return r;
+}
 
-  long power = 1;
-  while (power < long(num_ranks_)) {
-    if (power > long(rank)) {
-      for(long i = 1; i < branching_factor; i++) {
-        long n = i * power + long(rank);
-        if (n < long(num_ranks_)) {
-          r.push_back(n);
-        }
-      }
+// The segment of every rank holds the diffs followed by the ring buffers of
+// its read links in ascending order of the remote rank and, with a 16 bit
+// wire format or sparse diffs, the ring buffers of its write links. The links are numbered
+// write links first, link i owns the notifications 2 * i for its ring buffer
+// and 2 * i + 1 for the direct writes. The offset is in bytes.
+template <typename Dtype>
+void CommunicatorDiff<Dtype>::GetLinkLocation(gaspi_rank_t rank,
+                                              gaspi_rank_t rank_remote,
+                                              bool write,
+                                              long* index,
+                                              long* offset) const {
+  const std::vector<gaspi_rank_t> ranks_write = GetWriteRanks(rank);
+  const std::vector<gaspi_rank_t> ranks_read = GetReadRanks(rank);
+
+  *offset = bucket_offset_.back() * sizeof(Dtype);
+  for (int i = 0; i < ranks_read.size(); i++) {
+    *index = ranks_write.size() + i;
+    if (!write && (ranks_read[i] == rank_remote)) return;
+    *offset += GetLinkSize(ranks_read[i], rank) * element_size_;
+  }
+  for (int i = 0; i < ranks_write.size(); i++) {
+    *index = i;
+    if (write && (ranks_write[i] == rank_remote)) return;
+    if (Staged()) {
+      *offset += GetLinkSize(rank, ranks_write[i]) * element_size_;
     }
-    power *= branching_factor;
   }
-  return r;
+  LOG(FATAL) << "Rank " << rank << " has no diff link with rank "
+             << rank_remote;
 }
 
 template class CommunicatorDiff<float>;
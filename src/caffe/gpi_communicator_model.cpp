@@ -1,4 +1,5 @@
 #include "caffe/gpi_communicator_model.hpp"
+#include "caffe/gpi_trace.hpp"
 #include <algorithm>
 //#include <GASPI_Ext.h>
 
@@ -24,7 +25,8 @@ TransferForwardProducer::TransferForwardProducer(
   status_we_have_(0),
   status_we_started_sending_(0),
   status_we_finished_sending_(0),
-  status_acknowledged_by_remote_(0){
+  status_acknowledged_by_remote_(0),
+  bytes_sent_(0) {
 
 }
 
@@ -34,20 +36,24 @@ void TransferForwardProducer::LiftLocalStatus(long status) {
   }
 }
 
+// Sends the newest version once the remote acknowledged the last one sent.
+// Versions are only skipped with update_mode SSP, in lockstep the newest
+// version is always the next one.
 unsigned long TransferForwardProducer::GetStartedSending() {
   if ((status_we_have_ > status_we_started_sending_)
-      && ((status_we_have_ <= (GetRemoteAcknowledgement() + 1)))) {
-    SUCCESS_OR_DIE(gaspi_write_notify(segment_id_,
-                                      buffer_offset_local_,
-                                      rank_,
-                                      segment_id_,
-                                      buffer_offset_remote_,
-                                      size_,
-                                      notification_id_remote_,
-                                      status_we_have_ + 1,//zero is not allowed as notification
-                                      queue_,
-                                      GASPI_BLOCK));
+      && (status_we_started_sending_ <= GetRemoteAcknowledgement())) {
+    SUCCESS_OR_DIE(GPITrace::WriteNotify(segment_id_,
+                                         buffer_offset_local_,
+                                         rank_,
+                                         segment_id_,
+                                         buffer_offset_remote_,
+                                         size_,
+                                         notification_id_remote_,
+                                         status_we_have_ + 1,//zero is not allowed as notification
+                                         queue_,
+                                         GASPI_BLOCK));
     status_we_started_sending_ = status_we_have_;
+    bytes_sent_ += size_;
   }
   return status_we_started_sending_;
 }
@@ -151,7 +157,8 @@ CommunicatorModel<Dtype>::CommunicatorModel(
   const gaspi_queue_id_t queue_transfer,
   const gaspi_queue_id_t queue_acknowledge,
   const gaspi_rank_t rank,
-  const gaspi_rank_t num_ranks)
+  const gaspi_rank_t num_ranks,
+  const gaspi_rank_t root)
 : blob_(blob),
   segment_id_(segment_id),
   notification_base_id_(notification_base_id),
@@ -159,9 +166,12 @@ CommunicatorModel<Dtype>::CommunicatorModel(
   queue_send_(queue_transfer),
   queue_acknowledge_(queue_acknowledge),
   acknowledgement_local_(0),
+  status_acknowledged_local_(0),
   status_(0),
   status_completed_(0),
-  acknowledgement_total_(0) {
+  acknowledgement_total_(0),
+  bytes_received_(0),
+  bytes_sent_(0) {
 
   const long segment_size =  blob->count() * sizeof(Dtype);
   {
@@ -170,21 +180,24 @@ CommunicatorModel<Dtype>::CommunicatorModel(
     buffer_offset_ = ((char*)blob->cpu_data()) - ((char*)ptr);
   }
 
+  // the tree is built on the ranks relative to root, which sends the model
   const int bf = GetDataTreeBranchingFactor(num_ranks);
-  std::vector<gaspi_rank_t> ranks_read = GetDataTreeReadRanks(rank, bf);
-  std::vector<gaspi_rank_t> ranks_write = GetDataTreeWriteRanks(rank, num_ranks, bf);
+  const gaspi_rank_t rank_tree = (long(rank) - root + num_ranks) % num_ranks;
+  std::vector<gaspi_rank_t> ranks_read = GetDataTreeReadRanks(rank_tree, bf);
+  std::vector<gaspi_rank_t> ranks_write = GetDataTreeWriteRanks(rank_tree, num_ranks, bf);
 
   long buffer_index = 0;
 
   for (int i = 0; i < ranks_write.size(); i++) {
-    const int rank_remote = ranks_write[i];
+    const int rank_remote = (long(ranks_write[i]) + root) % num_ranks;
 
     std::vector<gaspi_rank_t> ranks_read_remote
-      = GetDataTreeReadRanks(rank_remote, bf);
+      = GetDataTreeReadRanks(ranks_write[i], bf);
     std::vector<gaspi_rank_t> ranks_write_remote
-      = GetDataTreeWriteRanks(rank_remote, num_ranks, bf);
+      = GetDataTreeWriteRanks(ranks_write[i], num_ranks, bf);
     const long buffer_index_remote = ranks_write_remote.size()
-        + std::find(ranks_read_remote.begin(), ranks_read_remote.end(), rank)
+        + std::find(ranks_read_remote.begin(), ranks_read_remote.end(),
+                    rank_tree)
         - ranks_read_remote.begin();
     CHECK(buffer_index < notification_id_num_)
       << "Not engough notification IDs";
@@ -199,12 +212,13 @@ CommunicatorModel<Dtype>::CommunicatorModel(
   }
 
   for (int i = 0; i < ranks_read.size(); i++) {
-    const int rank_remote = ranks_read[i];
+    const int rank_remote = (long(ranks_read[i]) + root) % num_ranks;
 
     std::vector<gaspi_rank_t> ranks_write_remote
-      = GetDataTreeWriteRanks(rank_remote, num_ranks, bf);
+      = GetDataTreeWriteRanks(ranks_read[i], num_ranks, bf);
     const long buffer_index_remote =
-        std::find(ranks_write_remote.begin(), ranks_write_remote.end(), rank)
+        std::find(ranks_write_remote.begin(), ranks_write_remote.end(),
+                  rank_tree)
         - ranks_write_remote.begin();
     CHECK(buffer_index < notification_id_num_)
       << "Not engough notification IDs";
@@ -228,13 +242,19 @@ void CommunicatorModel<Dtype>::operator()(void) {
 template <typename Dtype>
 void CommunicatorModel<Dtype>::UpdateStatus() {
   for (int i = 0; i < consumer_.size(); i++) {
-    status_ = consumer_[i].GetStatus();
+    const unsigned long status = consumer_[i].GetStatus();
+    // skipped versions were overwritten by the newer one
+    if (status > status_) {
+      bytes_received_.fetch_add(blob_->count() * sizeof(Dtype),
+                                boost::memory_order_relaxed);
+    }
+    status_ = status;
   }
 }
 
 template <typename Dtype>
 void CommunicatorModel<Dtype>::UpdateAcknowledgementTotal() {
-  unsigned long acknowledgement = acknowledgement_local_;
+  unsigned long acknowledgement = status_acknowledged_local_;
   for (int i = 0; i < producer_.size(); i++) {
     acknowledgement =
       std::min(acknowledgement, producer_[i].GetAcknowledgement());
@@ -252,18 +272,27 @@ void CommunicatorModel<Dtype>::UpdateAcknowledgementTotal() {
 template <typename Dtype>
 void CommunicatorModel<Dtype>::UpdateStatusCompleted() {
   unsigned long completed = status_;
+  unsigned long long bytes = 0;
   for (int i = 0; i < producer_.size(); i++) {
     producer_[i].LiftLocalStatus(status_);
     completed =
       std::min(completed, producer_[i].GetStartedSending());
+    bytes += producer_[i].BytesSent();
   }
   status_completed_ = completed;
+  bytes_sent_.store(bytes, boost::memory_order_relaxed);
 }
 
 template <typename Dtype>
 void CommunicatorModel<Dtype>::Acknowledge(void) {
   blob_->mutable_cpu_data();
   acknowledgement_local_++;
+  status_acknowledged_local_ = status_;
+}
+
+template <typename Dtype>
+void CommunicatorModel<Dtype>::AcknowledgeReceived(void) {
+  status_acknowledged_local_ = status_;
 }
 
 template <typename Dtype>
@@ -283,6 +312,27 @@ bool CommunicatorModel<Dtype>::Complete() const {
   return (status_completed_ == (acknowledgement_local_ + 1));
 }
 
+template <typename Dtype>
+unsigned long CommunicatorModel<Dtype>::Staleness() const {
+  const unsigned long expected = acknowledgement_local_ + 1;
+  return (status_completed_ < expected) ? expected - status_completed_ : 0;
+}
+
+template <typename Dtype>
+void CommunicatorModel<Dtype>::WaitForLocalCompletion(void) {
+  SUCCESS_OR_DIE(gaspi_wait(queue_send_, GASPI_BLOCK));
+}
+
+template <typename Dtype>
+unsigned long long CommunicatorModel<Dtype>::BytesSent(void) const {
+  return bytes_sent_.load(boost::memory_order_relaxed);
+}
+
+template <typename Dtype>
+unsigned long long CommunicatorModel<Dtype>::BytesReceived(void) const {
+  return bytes_received_.load(boost::memory_order_relaxed);
+}
+
 template <typename Dtype>
 std::vector<gaspi_rank_t> CommunicatorModel<Dtype>::GetDataTreeWriteRanks(
   gaspi_rank_t rank, gaspi_rank_t num_ranks, int branching_factor) {
@@ -334,6 +384,7 @@ void CommunicatorModel<Dtype>::status(std::ostream& s) const {
     << " queue_send_=" << long(queue_send_)
     << " queue_acknowledge_=" << long(queue_acknowledge_)
     << " acknowledgement_local_=" << acknowledgement_local_
+    << " status_acknowledged_local_=" << status_acknowledged_local_
     << " status_=" << status_
     << " status_completed_=" << status_completed_
     << " acknowledgement_total_=" << acknowledgement_total_
@@ -0,0 +1,157 @@
+#include "caffe/gpi_communicator_scalar.hpp"
+#include "caffe/gpi_trace.hpp"
+
+#include <algorithm>
+
+#include "glog/logging.h"
+
+namespace caffe {
+
+// The slots of a buffer: 0 receives the values of the folded rank, 1 to
+// log2(num_ranks) the partial sums of the partners, the last slot the sums
+// for a folded rank.
+template <typename Dtype>
+CommunicatorScalar<Dtype>::CommunicatorScalar(
+  const long max_count,
+  const gaspi_segment_id_t segment_id,
+  const gaspi_queue_id_t queue,
+  const gaspi_rank_t rank,
+  const gaspi_rank_t num_ranks)
+: max_count_(std::max(max_count, 1l)),
+  segment_id_(segment_id),
+  queue_(queue),
+  operation_(0),
+  buffer_index_(0),
+  running_(false) {
+  long num_ranks_pow2 = 1;
+  long num_bits = 0;
+  while (2 * num_ranks_pow2 <= num_ranks) {
+    num_ranks_pow2 *= 2;
+    num_bits++;
+  }
+  num_slots_ = num_bits + 2;
+  const long r = rank;
+
+  if (r >= num_ranks_pow2) {
+    Operation send = {SEND, gaspi_rank_t(r - num_ranks_pow2), 0};
+    Operation receive = {RECEIVE_COPY, gaspi_rank_t(r - num_ranks_pow2),
+                         num_slots_ - 1};
+    operations_.push_back(send);
+    operations_.push_back(receive);
+  } else {
+    const bool folded = (r + num_ranks_pow2 < num_ranks);
+    if (folded) {
+      Operation receive = {RECEIVE_ADD, gaspi_rank_t(r + num_ranks_pow2), 0};
+      operations_.push_back(receive);
+    }
+    for (long b = 0; b < num_bits; b++) {
+      Operation send = {SEND, gaspi_rank_t(r ^ (1l << b)), b + 1};
+      Operation receive = {RECEIVE_ADD, gaspi_rank_t(r ^ (1l << b)), b + 1};
+      operations_.push_back(send);
+      operations_.push_back(receive);
+    }
+    if (folded) {
+      Operation send = {SEND, gaspi_rank_t(r + num_ranks_pow2),
+                        num_slots_ - 1};
+      operations_.push_back(send);
+    }
+  }
+
+  // two receive buffers and one send buffer of num_slots_ slots each
+  const long size = 3 * num_slots_ * max_count_ * sizeof(Dtype);
+  SUCCESS_OR_DIE(gaspi_segment_create(segment_id_, size, GASPI_GROUP_ALL,
+                                      GASPI_BLOCK, GASPI_MEM_INITIALIZED));
+  gaspi_pointer_t ptr;
+  SUCCESS_OR_DIE(gaspi_segment_ptr(segment_id_, &ptr));
+  buffer_ = (Dtype*) ptr;
+}
+
+template <typename Dtype>
+CommunicatorScalar<Dtype>::~CommunicatorScalar() {
+  SUCCESS_OR_DIE(gaspi_wait(queue_, GASPI_BLOCK));
+  SUCCESS_OR_DIE(gaspi_segment_delete(segment_id_));
+}
+
+template <typename Dtype>
+long CommunicatorScalar<Dtype>::MaxCount(void) const {
+  return max_count_;
+}
+
+template <typename Dtype>
+gaspi_offset_t CommunicatorScalar<Dtype>::ReceiveOffset(long buffer,
+                                                        long slot) const {
+  return (buffer * num_slots_ + slot) * max_count_ * sizeof(Dtype);
+}
+
+template <typename Dtype>
+gaspi_offset_t CommunicatorScalar<Dtype>::SendOffset(long slot) const {
+  return ReceiveOffset(2, slot);
+}
+
+template <typename Dtype>
+gaspi_notification_id_t CommunicatorScalar<Dtype>::NotificationID(
+  long buffer, long slot) const {
+  return buffer * num_slots_ + slot;
+}
+
+template <typename Dtype>
+void CommunicatorScalar<Dtype>::Start(const std::vector<Dtype>& values) {
+  CHECK(!running_) << "The last reduction did not finish";
+  CHECK_LE(values.size(), max_count_) << "Too many values to reduce";
+  sums_ = values;
+  operation_ = 0;
+  running_ = true;
+  Progress();
+}
+
+template <typename Dtype>
+bool CommunicatorScalar<Dtype>::Progress(void) {
+  if (!running_) return true;
+  const long count = sums_.size();
+  for (; operation_ < operations_.size(); operation_++) {
+    const Operation& op = operations_[operation_];
+    if (op.type == SEND) {
+      Dtype* send = buffer_ + SendOffset(op.slot) / sizeof(Dtype);
+      std::copy(sums_.begin(), sums_.end(), send);
+      SUCCESS_OR_DIE(GPITrace::WriteNotify(segment_id_,
+                                           SendOffset(op.slot),
+                                           op.remote,
+                                           segment_id_,
+                                           ReceiveOffset(buffer_index_, op.slot),
+                                           std::max(count, 1l) * sizeof(Dtype),
+                                           NotificationID(buffer_index_, op.slot),
+                                           1,
+                                           queue_,
+                                           GASPI_BLOCK));
+      continue;
+    }
+    gaspi_notification_t value;
+    SUCCESS_OR_DIE(gaspi_notify_reset(segment_id_,
+                                      NotificationID(buffer_index_, op.slot),
+                                      &value));
+    if (!value) return false;
+    const Dtype* received =
+      buffer_ + ReceiveOffset(buffer_index_, op.slot) / sizeof(Dtype);
+    for (long i = 0; i < count; i++) {
+      sums_[i] = (op.type == RECEIVE_ADD) ? sums_[i] + received[i]
+                                          : received[i];
+    }
+  }
+  return true;
+}
+
+template <typename Dtype>
+void CommunicatorScalar<Dtype>::Finish(std::vector<Dtype>* sums) {
+  CHECK(running_) << "No reduction started";
+  while (!Progress()) {}
+  // the send slots are reused by the next reduction
+  SUCCESS_OR_DIE(gaspi_wait(queue_, GASPI_BLOCK));
+  buffer_index_ ^= 1;
+  running_ = false;
+  *sums = sums_;
+}
+
+template class CommunicatorScalar<float>;
+template class CommunicatorScalar<double>;
+
+}
@@ -0,0 +1,554 @@
+#include "caffe/gpi_diff_topology.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "glog/logging.h"
+
+namespace caffe {
+
+DiffTopology::DiffTopology(const GPIParameter& param,
+                           const gaspi_rank_t num_ranks,
+                           const gaspi_rank_t root,
+                           const std::vector<long>& rank_nodes)
+  : type_(param.diff_topology()),
+    allreduce_(param.update_mode() == GPIParameter_UpdateMode_ALLREDUCE),
+    branching_factor_(param.diff_tree_branching_factor()),
+    num_ranks_(num_ranks),
+    root_(root) {
+  CHECK_LT(root_, num_ranks_) << "Diff root " << root_ << " is no rank";
+  if (param.update_mode() == GPIParameter_UpdateMode_SSP) {
+    // every rank sends to rank 0 directly, a slow rank does not delay the
+    // diffs of others
+    type_ = GPIParameter_DiffTopology_BINOMIAL_TREE;
+    branching_factor_ = std::max(num_ranks_, 2l);
+  }
+  CHECK_GE(branching_factor_, 2) << "diff_tree_branching_factor must be >= 2";
+  num_ranks_pow2_ = 1;
+  num_bits_ = 0;
+  while (2 * num_ranks_pow2_ <= num_ranks_) {
+    num_ranks_pow2_ *= 2;
+    num_bits_++;
+  }
+  num_levels_ = BinomialLevels(num_ranks_);
+  num_node_levels_ = 0;
+  num_local_levels_ = 0;
+  if (type_ == GPIParameter_DiffTopology_HIERARCHICAL) BuildNodes(rank_nodes);
+}
+
+// Ranks on the same node are grouped in the order of their relative rank, so
+// root leads its node and the node of root comes first.
+void DiffTopology::BuildNodes(const std::vector<long>& rank_nodes) {
+  CHECK(rank_nodes.empty() || (rank_nodes.size() == num_ranks_))
+    << "One node per rank";
+  std::map<long, long> node_index;
+  long node_size_max = 0;
+  for (long r = 0; r < num_ranks_; r++) {
+    const long node = rank_nodes.size() ? rank_nodes[Real(r)] : Real(r);
+    if (!node_index.count(node)) {
+      node_index[node] = nodes_.size();
+      nodes_.push_back(std::vector<gaspi_rank_t>());
+    }
+    std::vector<gaspi_rank_t>& members = nodes_[node_index[node]];
+    rank_node_.push_back(node_index[node]);
+    rank_local_.push_back(members.size());
+    members.push_back(r);
+    node_size_max = std::max(node_size_max, long(members.size()));
+  }
+  num_node_levels_ = BinomialLevels(nodes_.size());
+  num_local_levels_ = BinomialLevels(node_size_max);
+}
+
+long DiffTopology::NumPartitions(void) const {
+  switch (type_) {
+  case GPIParameter_DiffTopology_RING:
+    return num_ranks_;
+  case GPIParameter_DiffTopology_RECURSIVE_HALVING_DOUBLING:
+    return num_ranks_pow2_;
+  default:
+    return 1;
+  }
+}
+
+long DiffTopology::NumPhases(void) const {
+  if (!allreduce_) {
+    return ((type_ == GPIParameter_DiffTopology_BINOMIAL_TREE)
+            || (type_ == GPIParameter_DiffTopology_HIERARCHICAL)) ? 1 : 2;
+  }
+  switch (type_) {
+  case GPIParameter_DiffTopology_RING:
+    return 2;
+  case GPIParameter_DiffTopology_RECURSIVE_HALVING_DOUBLING:
+    return num_bits_ + 2;
+  case GPIParameter_DiffTopology_HIERARCHICAL:
+    return 1 + (num_node_levels_ + num_local_levels_) * (branching_factor_ - 1);
+  default:
+    // one phase per child index and tree level
+    return 1 + num_levels_ * (branching_factor_ - 1);
+  }
+}
+
+long DiffTopology::NumSlices(void) const {
+  return NumPhases() * NumPartitions();
+}
+
+long DiffTopology::SlicePartition(long slice) const {
+  return slice % NumPartitions();
+}
+
+long DiffTopology::SlicePhase(long slice) const {
+  return slice / NumPartitions();
+}
+
+bool DiffTopology::Allreduce(void) const {
+  return allreduce_;
+}
+
+long DiffTopology::PartitionBegin(long count, long partition,
+                                  long num_partitions) {
+  return (count * partition) / num_partitions;
+}
+
+std::vector<gaspi_rank_t> DiffTopology::BalanceRanks(
+  const std::vector<long>& sizes, long num_ranks) {
+  std::vector<std::pair<long, long> > order;// (-size, item)
+  for (long i = 0; i < sizes.size(); i++) {
+    order.push_back(std::make_pair(-sizes[i], i));
+  }
+  std::sort(order.begin(), order.end());
+  std::vector<long> load(num_ranks, 0);
+  std::vector<gaspi_rank_t> r(sizes.size(), 0);
+  for (long i = 0; i < order.size(); i++) {
+    const long rank = std::min_element(load.begin(), load.end())
+      - load.begin();
+    r[order[i].second] = rank;
+    load[rank] -= order[i].first;
+  }
+  return r;
+}
+
+namespace {
+
+// FNV-1a
+unsigned long HashHostname(const std::string& name) {
+  unsigned long h = 14695981039346656037ul;
+  for (long i = 0; i < name.size(); i++) {
+    h ^= (unsigned char) name[i];
+    h *= 1099511628211ul;
+  }
+  return h;
+}
+
+}
+
+std::vector<long> DiffTopology::GetRankNodes(const GPIParameter& param,
+                                             gaspi_rank_t rank,
+                                             gaspi_rank_t num_ranks) {
+  std::vector<unsigned long> hosts(num_ranks, 0);
+  if (param.diff_machinefile().size()) {
+    // one line per rank as for gaspi_run
+    std::ifstream file(param.diff_machinefile().c_str());
+    CHECK(file.good()) << "Cannot open diff_machinefile "
+                       << param.diff_machinefile();
+    long r = 0;
+    std::string line;
+    while (std::getline(file, line)) {
+      std::istringstream words(line);
+      std::string host;
+      if (!(words >> host)) continue;
+      CHECK_LT(r, num_ranks) << param.diff_machinefile()
+                             << " lists more hosts than ranks";
+      hosts[r++] = HashHostname(host);
+    }
+    CHECK_EQ(r, num_ranks) << param.diff_machinefile()
+                           << " lists fewer hosts than ranks";
+  } else {
+    char name[256];
+    CHECK_EQ(gethostname(name, sizeof(name)), 0) << "gethostname failed";
+    name[sizeof(name) - 1] = 0;
+    std::vector<unsigned long> local(num_ranks, 0);
+    local[rank] = HashHostname(name);
+    gaspi_number_t elem_max;
+    SUCCESS_OR_DIE(gaspi_allreduce_elem_max(&elem_max));
+    for (long begin = 0; begin < num_ranks; begin += elem_max) {
+      const long n = std::min(long(elem_max), long(num_ranks) - begin);
+      SUCCESS_OR_DIE(gaspi_allreduce(&local[begin], &hosts[begin], n,
+                                     GASPI_OP_MAX, GASPI_TYPE_ULONG,
+                                     GASPI_GROUP_ALL, GASPI_BLOCK));
+    }
+  }
+  std::map<unsigned long, long> first_rank;
+  std::vector<long> nodes(num_ranks);
+  for (long r = 0; r < num_ranks; r++) {
+    nodes[r] = first_rank.insert(std::make_pair(hosts[r], r)).first->second;
+  }
+  return nodes;
+}
+
+gaspi_rank_t DiffTopology::Virtual(gaspi_rank_t rank) const {
+  return (long(rank) - root_ + num_ranks_) % num_ranks_;
+}
+
+gaspi_rank_t DiffTopology::Real(gaspi_rank_t rank) const {
+  return (long(rank) + root_) % num_ranks_;
+}
+
+std::vector<DiffTopology::Read> DiffTopology::GetReads(
+  gaspi_rank_t rank, long slice) const {
+  std::vector<Read> r;
+  const long partition = SlicePartition(slice);
+  const long phase = SlicePhase(slice);
+  if (phase == 0) {
+    GetTreeReads(Virtual(rank), partition, r);
+  } else {
+    gaspi_rank_t remote;
+    if (GetDistributeRead(Virtual(rank), partition, phase, &remote)) {
+      Read read = {remote, COPY};
+      r.push_back(read);
+    }
+  }
+  for (int i = 0; i < r.size(); i++) r[i].rank = Real(r[i].rank);
+  return r;
+}
+
+bool DiffTopology::GetWrite(gaspi_rank_t rank, long slice,
+                            gaspi_rank_t* remote) const {
+  const long partition = SlicePartition(slice);
+  const long phase = SlicePhase(slice);
+  const bool write = (phase == 0)
+    ? GetTreeWrite(Virtual(rank), partition, remote)
+    : GetDistributeWrite(Virtual(rank), partition, phase, remote);
+  if (write) *remote = Real(*remote);
+  return write;
+}
+
+// Phases > 0 hand the reduced partition from its root to rank 0 or, in
+// allreduce mode, to every rank.
+bool DiffTopology::GetDistributeRead(gaspi_rank_t rank, long partition,
+                                     long phase, gaspi_rank_t* remote) const {
+  const long r = rank;
+  if (!allreduce_) {
+    if ((r != 0) || (partition == 0)) return false;
+    *remote = partition;
+    return true;
+  }
+  switch (type_) {
+  case GPIParameter_DiffTopology_RING: {
+    // allgather around the ring, starting at the root of the partition
+    if (r == partition) return false;
+    *remote = (r - 1 + num_ranks_) % num_ranks_;
+    return true;
+  }
+  case GPIParameter_DiffTopology_RECURSIVE_HALVING_DOUBLING: {
+    if (phase <= num_bits_) {
+      // recursive doubling, lowest bit first
+      const long b = phase - 1;
+      if ((r >= num_ranks_pow2_) || ((r >> b) != ((partition >> b) ^ 1l))) {
+        return false;
+      }
+      *remote = r ^ (1l << b);
+      return true;
+    }
+    // hand the result back to the folded ranks
+    if (r < num_ranks_pow2_) return false;
+    *remote = r - num_ranks_pow2_;
+    return true;
+  }
+  case GPIParameter_DiffTopology_HIERARCHICAL: {
+    // first among the node leaders, then within every node
+    const long node = rank_node_[r];
+    const long local = rank_local_[r];
+    const long node_phases = num_node_levels_ * (branching_factor_ - 1);
+    long index;
+    if (phase <= node_phases) {
+      if ((local > 0) || !BinomialBroadcastRead(node, phase, &index)) {
+        return false;
+      }
+      *remote = nodes_[index][0];
+      return true;
+    }
+    if (!BinomialBroadcastRead(local, phase - node_phases, &index)) {
+      return false;
+    }
+    *remote = nodes_[node][index];
+    return true;
+  }
+  default: {
+    long index;
+    if (!BinomialBroadcastRead(r, phase, &index)) return false;
+    *remote = index;
+    return true;
+  }
+  }
+}
+
+bool DiffTopology::GetDistributeWrite(gaspi_rank_t rank, long partition,
+                                      long phase, gaspi_rank_t* remote) const {
+  const long r = rank;
+  if (!allreduce_) {
+    if ((r == 0) || (r != partition)) return false;
+    *remote = 0;
+    return true;
+  }
+  switch (type_) {
+  case GPIParameter_DiffTopology_RING: {
+    if (r == (partition - 1 + num_ranks_) % num_ranks_) return false;
+    *remote = (r + 1) % num_ranks_;
+    return true;
+  }
+  case GPIParameter_DiffTopology_RECURSIVE_HALVING_DOUBLING: {
+    if (phase <= num_bits_) {
+      const long b = phase - 1;
+      if ((r >= num_ranks_pow2_) || ((r >> b) != (partition >> b))) {
+        return false;
+      }
+      *remote = r ^ (1l << b);
+      return true;
+    }
+    if (r + num_ranks_pow2_ >= num_ranks_) return false;
+    *remote = r + num_ranks_pow2_;
+    return true;
+  }
+  case GPIParameter_DiffTopology_HIERARCHICAL: {
+    const long node = rank_node_[r];
+    const long local = rank_local_[r];
+    const long node_phases = num_node_levels_ * (branching_factor_ - 1);
+    long index;
+    if (phase <= node_phases) {
+      if ((local > 0)
+          || !BinomialBroadcastWrite(node, phase, nodes_.size(), &index)) {
+        return false;
+      }
+      *remote = nodes_[index][0];
+      return true;
+    }
+    if (!BinomialBroadcastWrite(local, phase - node_phases,
+                                nodes_[node].size(), &index)) {
+      return false;
+    }
+    *remote = nodes_[node][index];
+    return true;
+  }
+  default: {
+    long index;
+    if (!BinomialBroadcastWrite(r, phase, num_ranks_, &index)) return false;
+    *remote = index;
+    return true;
+  }
+  }
+}
+
+void DiffTopology::GetTreeReads(gaspi_rank_t rank, long partition,
+                                std::vector<Read>& reads) const {
+  switch (type_) {
+  case GPIParameter_DiffTopology_RING: {
+    // the slice starts at partition + 1 and ends at partition
+    const long pos = (long(rank) - partition - 1 + 2 * num_ranks_) % num_ranks_;
+    if (pos > 0) {
+      Read read = {gaspi_rank_t((long(rank) - 1 + num_ranks_) % num_ranks_),
+                   ADD};
+      reads.push_back(read);
+    }
+    break;
+  }
+  case GPIParameter_DiffTopology_RECURSIVE_HALVING_DOUBLING: {
+    if (long(rank) >= num_ranks_pow2_) break;
+    // ranks beyond the largest power of two fold their data in first
+    if (long(rank) + num_ranks_pow2_ < num_ranks_) {
+      Read read = {gaspi_rank_t(long(rank) + num_ranks_pow2_), ADD};
+      reads.push_back(read);
+    }
+    for (long b = num_bits_ - 1; b >= 0; b--) {
+      if ((long(rank) >> b) == (partition >> b)) {
+        Read read = {gaspi_rank_t(long(rank) ^ (1l << b)), ADD};
+        reads.push_back(read);
+      }
+    }
+    break;
+  }
+  case GPIParameter_DiffTopology_HIERARCHICAL: {
+    // the ranks of the node, and of the child nodes for the node leader
+    const long node = rank_node_[rank];
+    const long local = rank_local_[rank];
+    std::vector<long> children = BinomialChildren(local, nodes_[node].size());
+    for (int i = 0; i < children.size(); i++) {
+      Read read = {nodes_[node][children[i]], ADD};
+      reads.push_back(read);
+    }
+    if (local > 0) break;
+    children = BinomialChildren(node, nodes_.size());
+    for (int i = 0; i < children.size(); i++) {
+      Read read = {nodes_[children[i]][0], ADD};
+      reads.push_back(read);
+    }
+    break;
+  }
+  default: {
+    std::vector<long> children = BinomialChildren(rank, num_ranks_);
+    for (int i = 0; i < children.size(); i++) {
+      Read read = {gaspi_rank_t(children[i]), ADD};
+      reads.push_back(read);
+    }
+  }
+  }
+}
+
+bool DiffTopology::GetTreeWrite(gaspi_rank_t rank, long partition,
+                                gaspi_rank_t* remote) const {
+  switch (type_) {
+  case GPIParameter_DiffTopology_RING: {
+    const long pos = (long(rank) - partition - 1 + 2 * num_ranks_) % num_ranks_;
+    if (pos < num_ranks_ - 1) {
+      *remote = (long(rank) + 1) % num_ranks_;
+      return true;
+    }
+    return false;
+  }
+  case GPIParameter_DiffTopology_RECURSIVE_HALVING_DOUBLING: {
+    if (long(rank) >= num_ranks_pow2_) {
+      *remote = long(rank) - num_ranks_pow2_;
+      return true;
+    }
+    // send to the partner of the highest bit we differ from the slice root
+    for (long b = num_bits_ - 1; b >= 0; b--) {
+      if (((long(rank) ^ partition) >> b) & 1l) {
+        *remote = long(rank) ^ (1l << b);
+        return true;
+      }
+    }
+    return false;
+  }
+  case GPIParameter_DiffTopology_HIERARCHICAL: {
+    const long node = rank_node_[rank];
+    long parent;
+    if (BinomialParent(rank_local_[rank], &parent)) {
+      *remote = nodes_[node][parent];
+      return true;
+    }
+    if (BinomialParent(node, &parent)) {
+      *remote = nodes_[parent][0];
+      return true;
+    }
+    return false;
+  }
+  default: {
+    long parent;
+    if (!BinomialParent(rank, &parent)) return false;
+    *remote = parent;
+    return true;
+  }
+  }
+}
+
+std::vector<gaspi_rank_t> DiffTopology::GetReadRanks(gaspi_rank_t rank) const {
+  std::vector<gaspi_rank_t> r;
+  for (long s = 0; s < NumSlices(); s++) {
+    std::vector<Read> reads = GetReads(rank, s);
+    for (int i = 0; i < reads.size(); i++) {
+      r.push_back(reads[i].rank);
+    }
+  }
+  std::sort(r.begin(), r.end());
+  r.erase(std::unique(r.begin(), r.end()), r.end());
+  return r;
+}
+
+std::vector<gaspi_rank_t> DiffTopology::GetWriteRanks(gaspi_rank_t rank) const {
+  std::vector<gaspi_rank_t> r;
+  for (long s = 0; s < NumSlices(); s++) {
+    gaspi_rank_t remote;
+    if (GetWrite(rank, s, &remote)) r.push_back(remote);
+  }
+  std::sort(r.begin(), r.end());
+  r.erase(std::unique(r.begin(), r.end()), r.end());
+  return r;
+}
+
+std::vector<long> DiffTopology::GetLinkSlices(gaspi_rank_t rank_from,
+                                              gaspi_rank_t rank_to) const {
+  std::vector<long> r;
+  for (long s = 0; s < NumSlices(); s++) {
+    gaspi_rank_t remote;
+    if (GetWrite(rank_from, s, &remote) && (remote == rank_to)) r.push_back(s);
+  }
+  return r;
+}
+
+DiffTopology::ReadMode DiffTopology::GetReadMode(gaspi_rank_t rank,
+                                                 gaspi_rank_t rank_remote,
+                                                 long slice) const {
+  std::vector<Read> reads = GetReads(rank, slice);
+  for (int i = 0; i < reads.size(); i++) {
+    if (reads[i].rank == rank_remote) return reads[i].mode;
+  }
+  LOG(FATAL) << "Rank " << rank << " does not read slice " << slice
+             << " from rank " << rank_remote;
+  return ADD;
+}
+
+long DiffTopology::BinomialLevels(long size) const {
+  long levels = 0;
+  for (long power = 1; power < size; power *= branching_factor_) levels++;
+  return levels;
+}
+
+bool DiffTopology::BinomialParent(long index, long* parent) const {
+  if (index == 0) return false;
+  long power = 1; // = branching_factor ** 0
+  while ((power * branching_factor_) <= index) {
+    power *= branching_factor_;
+  }
+  *parent = index % power;
+  return true;
+}
+
+std::vector<long> DiffTopology::BinomialChildren(long index,
+                                                 long size) const {
+  std::vector<long> r;
+
+  long power = 1;
+  while (power < size) {
+    if (power > index) {
+      for (long i = 1; i < branching_factor_; i++) {
+        long n = i * power + index;
+        if (n < size) {
+          r.push_back(n);
+        }
+      }
+    }
+    power *= branching_factor_;
+  }
+  return r;
+}
+
+bool DiffTopology::BinomialBroadcastRead(long index, long phase,
+                                         long* remote) const {
+  const long level = (phase - 1) / (branching_factor_ - 1);
+  const long child = (phase - 1) % (branching_factor_ - 1) + 1;
+  if (index == 0) return false;
+  long power = 1;
+  while ((power * branching_factor_) <= index) power *= branching_factor_;
+  long level_index = 0;
+  for (long p = 1; p < power; p *= branching_factor_) level_index++;
+  if ((level_index != level) || ((index / power) != child)) return false;
+  *remote = index % power;
+  return true;
+}
+
+bool DiffTopology::BinomialBroadcastWrite(long index, long phase, long size,
+                                          long* remote) const {
+  const long level = (phase - 1) / (branching_factor_ - 1);
+  const long child = (phase - 1) % (branching_factor_ - 1) + 1;
+  long power = 1;
+  for (long i = 0; i < level; i++) power *= branching_factor_;
+  if ((index >= power) || (index + child * power >= size)) return false;
+  *remote = index + child * power;
+  return true;
+}
+
+}
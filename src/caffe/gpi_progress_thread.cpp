@@ -0,0 +1,225 @@
+#include <boost/thread.hpp>
+
+#include "caffe/gpi_progress_thread.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+CommunicationProgressThread<Dtype>::CommunicationProgressThread(
+  const std::vector<shared_ptr<CommunicatorDiff<Dtype> > >& diff,
+  const std::vector<shared_ptr<CommunicatorModel<Dtype> > >& data,
+  const bool communicate_data)
+: diff_(diff),
+  data_(data),
+  communicate_data_(communicate_data),
+  // a blob and its model update per parameter blob, plus some slack for the
+  // resets and log requests
+  events_(2 * data.size() + 16),
+  num_calculated_blobs_(0),
+  read_finished_local_(0),
+  write_finished_local_(0),
+  events_posted_(0),
+  events_processed_(0),
+  read_finished_(0),
+  write_finished_(0),
+  data_finished_(true),
+  model_staleness_(new boost::atomic<unsigned long>[data.size()]) {
+  for (int i = 0; i < data_.size(); i++) model_staleness_[i] = 0;
+}
+
+template <typename Dtype>
+CommunicationProgressThread<Dtype>::~CommunicationProgressThread() {
+  this->StopInternalThread();
+}
+
+template <typename Dtype>
+void CommunicationProgressThread<Dtype>::ResetCommunicationStatus(void) {
+  Event event = {RESET, NULL, 0, false};
+  Post(event);
+  // the published counters refer to the last iteration until the reset is
+  // processed
+  WaitForEvents();
+}
+
+template <typename Dtype>
+void CommunicationProgressThread<Dtype>::AddCalculatedBlob(Blob<Dtype>* blob,
+                                                           bool acknowledge) {
+  Event event = {BLOB_CALCULATED, blob, 0, acknowledge};
+  Post(event);
+}
+
+template <typename Dtype>
+void CommunicationProgressThread<Dtype>::UpdatedModelOnMaster(long index) {
+  Event event = {MODEL_UPDATED, NULL, index, false};
+  Post(event);
+}
+
+template <typename Dtype>
+void CommunicationProgressThread<Dtype>::AcknowledgeReceivedData(void) {
+  Event event = {RECEIVED_ACKNOWLEDGED, NULL, 0, false};
+  Post(event);
+  WaitForEvents();
+}
+
+template <typename Dtype>
+void CommunicationProgressThread<Dtype>::LogBucketTimings(void) {
+  Event event = {LOG_TIMINGS, NULL, 0, false};
+  Post(event);
+}
+
+template <typename Dtype>
+void CommunicationProgressThread<Dtype>::WaitForDiffLocalCompletion(void) {
+  Event event = {DIFF_LOCAL_COMPLETION, NULL, 0, false};
+  Post(event);
+  WaitForEvents();
+}
+
+template <typename Dtype>
+void CommunicationProgressThread<Dtype>::WaitForDataLocalCompletion(
+  long index) {
+  Event event = {DATA_LOCAL_COMPLETION, NULL, index, false};
+  Post(event);
+  WaitForEvents();
+}
+
+template <typename Dtype>
+long CommunicationProgressThread<Dtype>::DiffReadFinished(void) const {
+  return read_finished_.load(boost::memory_order_acquire);
+}
+
+template <typename Dtype>
+long CommunicationProgressThread<Dtype>::DiffWriteFinished(void) const {
+  return write_finished_.load(boost::memory_order_acquire);
+}
+
+template <typename Dtype>
+bool CommunicationProgressThread<Dtype>::DataFinished(void) const {
+  // data_finished_ is published before events_processed_
+  if (events_processed_.load(boost::memory_order_acquire) != events_posted_) {
+    return false;
+  }
+  return data_finished_.load(boost::memory_order_acquire);
+}
+
+template <typename Dtype>
+bool CommunicationProgressThread<Dtype>::DataStaleness(
+  long index, unsigned long* staleness) const {
+  if (events_processed_.load(boost::memory_order_acquire) != events_posted_) {
+    return false;
+  }
+  *staleness = model_staleness_[index].load(boost::memory_order_acquire);
+  return true;
+}
+
+template <typename Dtype>
+void CommunicationProgressThread<Dtype>::Post(const Event& event) {
+  while (!events_.push(event)) {
+    boost::this_thread::yield();
+  }
+  events_posted_++;
+}
+
+template <typename Dtype>
+void CommunicationProgressThread<Dtype>::WaitForEvents(void) const {
+  while (events_processed_.load(boost::memory_order_acquire)
+         != events_posted_) {
+    boost::this_thread::yield();
+  }
+}
+
+template <typename Dtype>
+void CommunicationProgressThread<Dtype>::Process(const Event& event) {
+  switch (event.type) {
+  case RESET:
+    for (int i = 0; i < diff_.size(); i++) diff_[i]->ResetCommunicationStatus();
+    num_calculated_blobs_ = 0;
+    read_finished_local_ = 0;
+    write_finished_local_ = 0;
+    break;
+  case BLOB_CALCULATED:
+    for (int i = 0; i < diff_.size(); i++) {
+      diff_[i]->AddCalculatedBlob(event.blob);
+    }
+    if (event.acknowledge) data_[num_calculated_blobs_]->Acknowledge();
+    num_calculated_blobs_++;
+    break;
+  case MODEL_UPDATED:
+    data_[event.index]->UpdatedModelOnMaster();
+    break;
+  case RECEIVED_ACKNOWLEDGED:
+    for (int i = 0; i < data_.size(); i++) data_[i]->AcknowledgeReceived();
+    break;
+  case LOG_TIMINGS:
+    for (int i = 0; i < diff_.size(); i++) diff_[i]->LogBucketTimings();
+    break;
+  case DIFF_LOCAL_COMPLETION:
+    for (int i = 0; i < diff_.size(); i++) diff_[i]->WaitForLocalCompletion();
+    break;
+  case DATA_LOCAL_COMPLETION:
+    data_[event.index]->WaitForLocalCompletion();
+    break;
+  }
+}
+
+// The reads and writes of the blobs finish in the order the blobs were
+// calculated, the compute thread only needs to know how many have.
+template <typename Dtype>
+void CommunicationProgressThread<Dtype>::Publish(void) {
+  for (; read_finished_local_ < num_calculated_blobs_;
+       read_finished_local_++) {
+    int running = 0;
+    for (int i = 0; i < diff_.size(); i++) {
+      running |=
+        !diff_[i]->CommunicateLayerDiffReadFinished(read_finished_local_);
+    }
+    if (running) break;
+  }
+  for (; write_finished_local_ < num_calculated_blobs_;
+       write_finished_local_++) {
+    int running = 0;
+    for (int i = 0; i < diff_.size(); i++) {
+      running |=
+        !diff_[i]->CommunicateLayerDiffWriteFinished(write_finished_local_);
+    }
+    if (running) break;
+  }
+  int running = 0;
+  for (int i = 0; i < data_.size(); i++) {
+    model_staleness_[i].store(data_[i]->Staleness(),
+                              boost::memory_order_release);
+    running |= !data_[i]->Complete();
+  }
+
+  read_finished_.store(read_finished_local_, boost::memory_order_release);
+  write_finished_.store(write_finished_local_, boost::memory_order_release);
+  data_finished_.store(!running, boost::memory_order_release);
+}
+
+template <typename Dtype>
+void CommunicationProgressThread<Dtype>::InternalThreadEntry() {
+  unsigned long processed = 0;
+  while (!must_stop()) {
+    Event event;
+    while (events_.pop(event)) {
+      Process(event);
+      processed++;
+    }
+    for (int i = 0; i < diff_.size(); i++) (*diff_[i])();
+    if (communicate_data_) {
+      for (int i = 0; i < data_.size(); i++) (*data_[i])();
+    }
+    Publish();
+    events_processed_.store(processed, boost::memory_order_release);
+    // nothing to send before the next blob is calculated
+    if ((read_finished_local_ == num_calculated_blobs_)
+        && (write_finished_local_ == num_calculated_blobs_)
+        && data_finished_.load(boost::memory_order_relaxed)) {
+      boost::this_thread::yield();
+    }
+  }
+}
+
+template class CommunicationProgressThread<float>;
+template class CommunicationProgressThread<double>;
+
+}
@@ -0,0 +1,100 @@
+#include <boost/thread.hpp>
+
+#include "caffe/gpi_resources.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#include "glog/logging.h"
+
+namespace caffe {
+
+namespace {
+
+boost::mutex resources_mutex;
+// the owner of every segment id, empty if the id is free
+std::vector<std::string> segment_owners;
+// the number of holders of every queue
+std::vector<long> queue_holders;
+
+void InitResources() {
+  if (segment_owners.empty()) {
+    gaspi_number_t segment_max;
+    SUCCESS_OR_DIE(gaspi_segment_max(&segment_max));
+    segment_owners.resize(segment_max);
+  }
+  if (queue_holders.empty()) {
+    gaspi_number_t queue_num;
+    SUCCESS_OR_DIE(gaspi_queue_num(&queue_num));
+    queue_holders.resize(queue_num, 0);
+  }
+}
+
+void LogAssignment(const std::string& owner, const char* resource, long id) {
+  gaspi_rank_t rank;
+  SUCCESS_OR_DIE(gaspi_proc_rank(&rank));
+  if (rank == 0) {
+    LOG(INFO) << owner << " uses GPI-2 " << resource << " " << id;
+  }
+}
+
+}
+
+gaspi_segment_id_t GPIResources::AcquireSegment(const std::string& owner) {
+  boost::mutex::scoped_lock lock(resources_mutex);
+  InitResources();
+  const long id = std::find(segment_owners.begin(), segment_owners.end(),
+                            std::string()) - segment_owners.begin();
+  if (id == segment_owners.size()) {
+    LOG(ERROR) << "Not enough GASPI segments for " << owner << "!";
+    for (long i = 0; i < segment_owners.size(); i++) {
+      LOG(ERROR) << "segment " << i << ": " << segment_owners[i];
+    }
+    exit(EXIT_FAILURE);
+  }
+  segment_owners[id] = owner.empty() ? std::string("unnamed") : owner;
+  LogAssignment(segment_owners[id], "segment", id);
+  return id;
+}
+
+void GPIResources::ReleaseSegment(const gaspi_segment_id_t id) {
+  boost::mutex::scoped_lock lock(resources_mutex);
+  CHECK_LT(id, segment_owners.size());
+  CHECK(!segment_owners[id].empty()) << "GPI-2 segment " << long(id)
+                                     << " is not in use";
+  segment_owners[id].clear();
+}
+
+gaspi_queue_id_t GPIResources::AcquireQueue(const std::string& owner) {
+  boost::mutex::scoped_lock lock(resources_mutex);
+  InitResources();
+  const long id = std::min_element(queue_holders.begin(), queue_holders.end())
+                  - queue_holders.begin();
+  if (queue_holders[id]) {
+    LOG(WARNING) << owner << " shares GPI-2 queue " << id;
+  }
+  queue_holders[id]++;
+  LogAssignment(owner, "queue", id);
+  return id;
+}
+
+gaspi_queue_id_t GPIResources::AcquireQueue(const std::string& owner,
+                                            const gaspi_queue_id_t id) {
+  boost::mutex::scoped_lock lock(resources_mutex);
+  InitResources();
+  CHECK_LT(id, queue_holders.size()) << "GPI-2 provides "
+                                     << queue_holders.size() << " queues";
+  queue_holders[id]++;
+  LogAssignment(owner, "queue", id);
+  return id;
+}
+
+void GPIResources::ReleaseQueue(const gaspi_queue_id_t id) {
+  boost::mutex::scoped_lock lock(resources_mutex);
+  CHECK_LT(id, queue_holders.size());
+  CHECK_GT(queue_holders[id], 0) << "GPI-2 queue " << long(id)
+                                 << " is not in use";
+  queue_holders[id]--;
+}
+
+}
@@ -1,4 +1,6 @@
 #include "caffe/gpi_ring_buffer.hpp"
+#include "caffe/gpi_trace.hpp"
+#include "caffe/util/half_conversion.hpp"
 #include "caffe/util/math_functions.hpp"
 
 #include <limits>
@@ -6,6 +8,29 @@
 
 namespace caffe {
 
+// Sparse messages start with the number of (index, value) pairs that follow,
+// or kDenseMessage if len dense values follow. Counts and indices are stored
+// as the bits of an int32_t in one element.
+namespace {
+
+const int32_t kDenseMessage = -1;
+
+template <typename Dtype>
+inline Dtype IndexElement(const int32_t index) {
+  Dtype e = 0;
+  memcpy(&e, &index, sizeof(index));
+  return e;
+}
+
+template <typename Dtype>
+inline int32_t ElementIndex(const Dtype e) {
+  int32_t index;
+  memcpy(&index, &e, sizeof(index));
+  return index;
+}
+
+}
+
 template <typename Dtype>
 RingBufferWrite<Dtype>::RingBufferWrite(const unsigned long buffer_size,
                                         const gaspi_segment_id_t segment_id_local,
@@ -15,8 +40,12 @@ RingBufferWrite<Dtype>::RingBufferWrite(const unsigned long buffer_size,
                                         const gaspi_segment_id_t segment_id_remote,
                                         const gaspi_notification_id_t notification_id_remote,
                                         const gaspi_offset_t offset_remote,
-                                        const gaspi_queue_id_t queue)
+                                        const gaspi_queue_id_t queue,
+                                        const GPIParameter_WireFormat wire_format)
   : error_(0),
+    wire_format_(wire_format),
+    element_size_((wire_format == GPIParameter_WireFormat_NATIVE)
+                  ? sizeof(Dtype) : sizeof(uint16_t)),
     size_(buffer_size),
     rp_(0),
     wp_(0),
@@ -69,57 +98,57 @@ int RingBufferWrite<Dtype>::Write(const Dtype* p,
     //first chunk
     const long chunk = std::min(len, size_ - wp_);
     const long rest = len - chunk;
-    caffe_copy(chunk, p, ((Dtype*)buffer) + wp_);
+    Pack(p, wp_, chunk);
 
     if (rest) {
       SUCCESS_OR_DIE(gaspi_write(segment_id_local_,
-                                 buffer_offset_local_ +  wp_ * sizeof(Dtype),
+                                 buffer_offset_local_ +  wp_ * element_size_,
                                  remote_rank_,
                                  segment_id_remote_,
-                                 buffer_offset_remote_ + wp_ * sizeof(Dtype),
-                                 chunk * sizeof(Dtype),
+                                 buffer_offset_remote_ + wp_ * element_size_,
+                                 chunk * element_size_,
                                  queue_,
                                  GASPI_BLOCK));
       wp_ = 0;
       //second chunk
-      caffe_copy(rest, ((Dtype*)p) + chunk, ((Dtype*)buffer) + wp_);
-      SUCCESS_OR_DIE(gaspi_write_notify(segment_id_local_,
-                                        buffer_offset_local_ +  wp_ * sizeof(Dtype),
-                                        remote_rank_,
-                                        segment_id_remote_,
-                                        buffer_offset_remote_ + wp_ * sizeof(Dtype),
-                                        rest * sizeof(Dtype),
-                                        notification_id_remote_,
-                                        wp_ + rest + 1,//zero is not allowed as notification
-                                        queue_,
-                                        GASPI_BLOCK));
+      Pack(p + chunk, wp_, rest);
+      SUCCESS_OR_DIE(GPITrace::WriteNotify(segment_id_local_,
+                                           buffer_offset_local_ +  wp_ * element_size_,
+                                           remote_rank_,
+                                           segment_id_remote_,
+                                           buffer_offset_remote_ + wp_ * element_size_,
+                                           rest * element_size_,
+                                           notification_id_remote_,
+                                           wp_ + rest + 1,//zero is not allowed as notification
+                                           queue_,
+                                           GASPI_BLOCK));
       wp_ += rest;
     } else {
       const unsigned long wpnew = (wp_ + chunk) % size_;
-      SUCCESS_OR_DIE(gaspi_write_notify(segment_id_local_,
-                                        buffer_offset_local_ +  wp_ * sizeof(Dtype),
-                                        remote_rank_,
-                                        segment_id_remote_,
-                                        buffer_offset_remote_ + wp_ * sizeof(Dtype),
-                                        chunk * sizeof(Dtype),
-                                        notification_id_remote_,
-                                        wpnew + 1,//zero is not allowed as notification
-                                        queue_,
-                                        GASPI_BLOCK));
+      SUCCESS_OR_DIE(GPITrace::WriteNotify(segment_id_local_,
+                                           buffer_offset_local_ +  wp_ * element_size_,
+                                           remote_rank_,
+                                           segment_id_remote_,
+                                           buffer_offset_remote_ + wp_ * element_size_,
+                                           chunk * element_size_,
+                                           notification_id_remote_,
+                                           wpnew + 1,//zero is not allowed as notification
+                                           queue_,
+                                           GASPI_BLOCK));
       wp_ = wpnew;
     }
   } else {
-    caffe_copy(len, p, ((Dtype*)buffer) + wp_);
-    SUCCESS_OR_DIE(gaspi_write_notify(segment_id_local_,
-                                      buffer_offset_local_ +  wp_ * sizeof(Dtype),
-                                      remote_rank_,
-                                      segment_id_remote_,
-                                      buffer_offset_remote_ + wp_ * sizeof(Dtype),
-                                      len * sizeof(Dtype),
-                                      notification_id_remote_,
-                                      wp_ + len + 1,//zero is not allowed as notification
-                                      queue_,
-                                      GASPI_BLOCK));
+    Pack(p, wp_, len);
+    SUCCESS_OR_DIE(GPITrace::WriteNotify(segment_id_local_,
+                                         buffer_offset_local_ +  wp_ * element_size_,
+                                         remote_rank_,
+                                         segment_id_remote_,
+                                         buffer_offset_remote_ + wp_ * element_size_,
+                                         len * element_size_,
+                                         notification_id_remote_,
+                                         wp_ + len + 1,//zero is not allowed as notification
+                                         queue_,
+                                         GASPI_BLOCK));
     wp_ += len;
   }
 //  gaspi_printf("wp: %lu\n", wp_);
@@ -131,6 +160,94 @@ int RingBufferWrite<Dtype>::Write(const Dtype* p,
   return 0;
 }
 
+template <typename Dtype>
+int RingBufferWrite<Dtype>::WriteSparse(const Dtype* p,
+                                        const unsigned long len,
+                                        unsigned long* written) {
+  CHECK_EQ(wire_format_, GPIParameter_WireFormat_NATIVE);
+  unsigned long n = 0;
+  for (unsigned long i = 0; i < len; i++) n += (p[i] != Dtype(0));
+  // pairs take two elements, send dense if that is shorter
+  if (2 * n < len) {
+    message_.resize(1 + 2 * n);
+    message_[0] = IndexElement<Dtype>(n);
+    unsigned long j = 1;
+    for (unsigned long i = 0; i < len; i++) {
+      if (p[i] != Dtype(0)) {
+        message_[j++] = IndexElement<Dtype>(i);
+        message_[j++] = p[i];
+      }
+    }
+  } else {
+    message_.resize(1 + len);
+    message_[0] = IndexElement<Dtype>(kDenseMessage);
+    caffe_copy(len, p, &message_[1]);
+  }
+  if (Write(&message_[0], message_.size())) return -1;
+  if (written) *written = message_.size();
+  return 0;
+}
+
+template <typename Dtype>
+void RingBufferWrite<Dtype>::Pack(const Dtype* p, const unsigned long pos,
+                                  const unsigned long len) {
+  if (wire_format_ == GPIParameter_WireFormat_NATIVE) {
+    caffe_copy(len, p, ((Dtype*)buffer) + pos);
+  } else {
+    caffe_cpu_half_pack(len, p, ((uint16_t*)buffer) + pos,
+                        (wire_format_ == GPIParameter_WireFormat_BF16)
+                        ? HALF_BF16 : HALF_FP16);
+  }
+}
+
+template <typename Dtype>
+int RingBufferWrite<Dtype>::WriteFromSegment(
+  const gaspi_segment_id_t segment_id_local,
+  const gaspi_offset_t offset_local,
+  const unsigned long len) {
+  CHECK_EQ(wire_format_, GPIParameter_WireFormat_NATIVE);
+  if (len > GetFreeSpace()) return -1;
+  ClearQueue();
+
+  const unsigned long chunk = std::min(len, size_ - wp_);
+  const unsigned long rest = len - chunk;
+  if (rest) {
+    SUCCESS_OR_DIE(gaspi_write(segment_id_local,
+                               offset_local,
+                               remote_rank_,
+                               segment_id_remote_,
+                               buffer_offset_remote_ + wp_ * sizeof(Dtype),
+                               chunk * sizeof(Dtype),
+                               queue_,
+                               GASPI_BLOCK));
+    SUCCESS_OR_DIE(GPITrace::WriteNotify(segment_id_local,
+                                         offset_local + chunk * sizeof(Dtype),
+                                         remote_rank_,
+                                         segment_id_remote_,
+                                         buffer_offset_remote_,
+                                         rest * sizeof(Dtype),
+                                         notification_id_remote_,
+                                         rest + 1,//zero is not allowed as notification
+                                         queue_,
+                                         GASPI_BLOCK));
+    wp_ = rest;
+  } else {
+    const unsigned long wpnew = (wp_ + chunk) % size_;
+    SUCCESS_OR_DIE(GPITrace::WriteNotify(segment_id_local,
+                                         offset_local,
+                                         remote_rank_,
+                                         segment_id_remote_,
+                                         buffer_offset_remote_ + wp_ * sizeof(Dtype),
+                                         chunk * sizeof(Dtype),
+                                         notification_id_remote_,
+                                         wpnew + 1,//zero is not allowed as notification
+                                         queue_,
+                                         GASPI_BLOCK));
+    wp_ = wpnew;
+  }
+  return 0;
+}
+
 template <typename Dtype>
 void RingBufferWrite<Dtype>::ClearQueue(void) {
   gaspi_number_t entries;
@@ -152,8 +269,12 @@ RingBufferRead<Dtype>::RingBufferRead(const unsigned long buffer_size,
                                       const gaspi_segment_id_t segment_id_remote,
                                       const gaspi_notification_id_t notification_id_remote,
                                       const gaspi_offset_t offset_remote,
-                                      const gaspi_queue_id_t queue)
+                                      const gaspi_queue_id_t queue,
+                                      const GPIParameter_WireFormat wire_format)
   : error_(0),
+    wire_format_(wire_format),
+    element_size_((wire_format == GPIParameter_WireFormat_NATIVE)
+                  ? sizeof(Dtype) : sizeof(uint16_t)),
     size_(buffer_size),
     rp_(0),
     wp_(0),
@@ -200,22 +321,19 @@ template <typename Dtype>
 int RingBufferRead<Dtype>::Add(Dtype* p,
                                const unsigned long len) {
   if (len > GetNumData()) return -1;
+  GPITraceSpan trace("gpi", "ring_buffer_add", "elements", len);
   if (rp_ <= wp_) {
-    const Dtype* s = ((Dtype*) buffer) + rp_;
-    caffe_axpy<Dtype>(len, 1.0, s, p);
+    Unpack(rp_, len, p, true);
     rp_ += len;
   } else {
     const unsigned long chunk = std::min(len, size_ - rp_);
     const unsigned long rest = len - chunk;
-    const Dtype* s = ((Dtype*)buffer) + rp_;
-    caffe_axpy<Dtype>(chunk, 1.0, s, p);
+    Unpack(rp_, chunk, p, true);
     rp_ += chunk;
     rp_ = rp_ % size_;
 
     if (rest > 0) {
-      const Dtype* s = ((Dtype*)buffer) + rp_;
-      Dtype* const d = p + chunk;
-      caffe_axpy<Dtype>(rest, 1.0, s, d);
+      Unpack(rp_, rest, p + chunk, true);
       rp_ += rest;
     }
   }
@@ -237,18 +355,18 @@ int RingBufferRead<Dtype>::Read(Dtype* p,
                                 const unsigned long len) {
   if (len > GetNumData()) return -1;
   if (rp_ <= wp_) {
-    caffe_copy(len, ((Dtype*)buffer) + rp_, p);
+    Unpack(rp_, len, p, false);
     rp_ += len;
   } else {
     const unsigned long chunk = std::min(len, size_ - rp_);
     const unsigned long rest = len - chunk;
 
-    caffe_copy(chunk, ((Dtype*)buffer) + rp_, p);
+    Unpack(rp_, chunk, p, false);
     rp_ += chunk;
     rp_ = rp_ % size_;
 
     if (rest > 0) {
-      caffe_copy(rest, ((Dtype*)buffer) + rp_, ((Dtype*)p) + chunk);
+      Unpack(rp_, rest, p + chunk, false);
       rp_ += rest;
     }
   }
@@ -265,6 +383,68 @@ int RingBufferRead<Dtype>::Read(Dtype* p,
   return 0;
 }
 
+template <typename Dtype>
+int RingBufferRead<Dtype>::ReadSparse(Dtype* p,
+                                      const unsigned long len,
+                                      bool add,
+                                      unsigned long* read) {
+  CHECK_EQ(wire_format_, GPIParameter_WireFormat_NATIVE);
+  const unsigned long available = GetNumData();
+  if (!available) return -1;
+  const Dtype* b = (const Dtype*)buffer;
+  const int32_t n = ElementIndex(b[rp_]);
+  const unsigned long message_size = 1 + ((n == kDenseMessage) ? len : 2 * n);
+  if (message_size > available) return -1;
+  GPITraceSpan trace("gpi", "ring_buffer_read_sparse", "elements",
+                     message_size);
+  if (read) *read = message_size;
+  rp_ = (rp_ + 1) % size_;
+
+  if (n == kDenseMessage) {
+    const unsigned long chunk = std::min(len, size_ - rp_);
+    Unpack(rp_, chunk, p, add);
+    rp_ = (rp_ + chunk) % size_;
+    if (len > chunk) {
+      Unpack(rp_, len - chunk, p + chunk, add);
+      rp_ += len - chunk;
+    }
+  } else {
+    if (!add) caffe_set(len, Dtype(0), p);
+    for (int32_t i = 0; i < n; i++) {
+      p[ElementIndex(b[rp_])] += b[(rp_ + 1) % size_];
+      rp_ = (rp_ + 2) % size_;
+    }
+  }
+
+  ClearQueue();
+  SUCCESS_OR_DIE(gaspi_notify(segment_id_remote_, remote_rank_, notification_id_remote_,
+                              rp_ + 1, queue_, GASPI_BLOCK));
+  return 0;
+}
+
+template <typename Dtype>
+void RingBufferRead<Dtype>::Unpack(const unsigned long pos,
+                                   const unsigned long len,
+                                   Dtype* p, bool add) {
+  if (wire_format_ == GPIParameter_WireFormat_NATIVE) {
+    const Dtype* s = ((Dtype*)buffer) + pos;
+    if (add) {
+      caffe_axpy<Dtype>(len, 1.0, s, p);
+    } else {
+      caffe_copy(len, s, p);
+    }
+  } else {
+    const uint16_t* s = ((uint16_t*)buffer) + pos;
+    const HalfFormat format = (wire_format_ == GPIParameter_WireFormat_BF16)
+      ? HALF_BF16 : HALF_FP16;
+    if (add) {
+      caffe_cpu_half_unpack_add(len, s, p, format);
+    } else {
+      caffe_cpu_half_unpack(len, s, p, format);
+    }
+  }
+}
+
 template <typename Dtype>
 void RingBufferRead<Dtype>::ClearQueue(void) {
   gaspi_number_t entries;
@@ -0,0 +1,343 @@
+#include <boost/thread.hpp>
+
+#include "caffe/gpi_resources.hpp"
+#include "caffe/gpi_trace.hpp"
+
+#include <time.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <vector>
+
+#include "glog/logging.h"
+
+namespace caffe {
+
+namespace {
+
+const long kChunkEvents = 4096;
+
+struct Event {
+  const char* category;
+  const char* name;
+  double begin;
+  double end;
+  const char* arg_name[2];
+  long arg[2];
+};
+
+// the owner thread appends events and chunks, publishing them through size
+// and next, Stop() reads them concurrently
+struct Chunk {
+  Chunk() : size(0), next(NULL) {}
+  Event events[kChunkEvents];
+  boost::atomic<long> size;
+  boost::atomic<Chunk*> next;
+};
+
+struct ThreadBuffer {
+  explicit ThreadBuffer(const int id)
+    : thread(id), head(new Chunk), tail(head), count(0), dropped(0) {}
+  const int thread;
+  Chunk* const head;
+  Chunk* tail;
+  long count;
+  boost::atomic<long> dropped;
+};
+
+boost::mutex trace_mutex;
+// the buffers outlive their threads, they are read by Stop()
+std::vector<ThreadBuffer*> buffers;
+std::set<std::string> names;
+void KeepBuffer(ThreadBuffer*) {}
+boost::thread_specific_ptr<ThreadBuffer> thread_buffer(KeepBuffer);
+bool trace_started = false;
+std::string trace_file;
+long trace_max_events = 0;
+double trace_origin = 0;
+
+double ClockMicroSeconds() {
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e6 + t.tv_nsec * 1e-3;
+}
+
+ThreadBuffer* GetThreadBuffer() {
+  ThreadBuffer* buffer = thread_buffer.get();
+  if (!buffer) {
+    boost::mutex::scoped_lock lock(trace_mutex);
+    buffer = new ThreadBuffer(buffers.size());
+    buffers.push_back(buffer);
+    thread_buffer.reset(buffer);
+  }
+  return buffer;
+}
+
+void WriteString(std::ostream& s, const char* string) {
+  s << '"';
+  for (const char* c = string; *c; c++) {
+    if ((*c == '"') || (*c == '\\')) s << '\\';
+    s << *c;
+  }
+  s << '"';
+}
+
+void WriteEvent(std::ostream& s, const Event& e, const long rank,
+                const int thread) {
+  s << "{\"ph\":\"X\",\"cat\":";
+  WriteString(s, e.category);
+  s << ",\"name\":";
+  WriteString(s, e.name);
+  s << ",\"pid\":" << rank << ",\"tid\":" << thread
+    << ",\"ts\":" << e.begin << ",\"dur\":" << e.end - e.begin;
+  if (e.arg_name[0]) {
+    s << ",\"args\":{";
+    WriteString(s, e.arg_name[0]);
+    s << ":" << e.arg[0];
+    if (e.arg_name[1]) {
+      s << ",";
+      WriteString(s, e.arg_name[1]);
+      s << ":" << e.arg[1];
+    }
+    s << "}";
+  }
+  s << "}";
+}
+
+// waits for the queue if a request more would not fit
+void WaitForQueueSpace(const gaspi_queue_id_t queue) {
+  gaspi_number_t entries;
+  gaspi_number_t queue_size_max;
+  SUCCESS_OR_DIE(gaspi_queue_size(queue, &entries));
+  SUCCESS_OR_DIE(gaspi_queue_size_max(&queue_size_max));
+  if (entries + 1 >= queue_size_max) {
+    SUCCESS_OR_DIE(gaspi_wait(queue, GASPI_BLOCK));
+  }
+}
+
+}
+
+boost::atomic<bool> GPITrace::enabled_(false);
+
+void GPITrace::Start(const std::string& file, const long max_events) {
+  CHECK(!trace_started) << "The process is traced once only";
+  trace_started = true;
+  trace_file = file;
+  trace_max_events = max_events;
+  SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+  trace_origin = ClockMicroSeconds();
+  enabled_.store(true);
+}
+
+void GPITrace::Stop(void) {
+  CHECK(enabled()) << "The trace was not started";
+  enabled_.store(false);
+  gaspi_rank_t rank;
+  gaspi_rank_t num_ranks;
+  SUCCESS_OR_DIE(gaspi_proc_rank(&rank));
+  SUCCESS_OR_DIE(gaspi_proc_num(&num_ranks));
+
+  std::vector<ThreadBuffer*> threads;
+  {
+    boost::mutex::scoped_lock lock(trace_mutex);
+    threads = buffers;
+  }
+  // the events of this rank, every line ends with a comma
+  long events = 0;
+  long dropped = 0;
+  std::ostringstream s;
+  s.precision(3);
+  s.setf(std::ios::fixed);
+  s << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" << rank
+    << ",\"args\":{\"name\":\"rank " << rank << "\"}},\n";
+  s << "{\"ph\":\"M\",\"name\":\"process_sort_index\",\"pid\":" << rank
+    << ",\"args\":{\"sort_index\":" << rank << "}},\n";
+  for (long i = 0; i < threads.size(); i++) {
+    for (Chunk* c = threads[i]->head; c; c = c->next.load()) {
+      const long size = c->size.load();
+      for (long j = 0; j < size; j++) {
+        WriteEvent(s, c->events[j], rank, threads[i]->thread);
+        s << ",\n";
+      }
+      events += size;
+    }
+    dropped += threads[i]->dropped.load();
+  }
+  const std::string fragment = s.str();
+  LOG_IF(WARNING, dropped) << "Rank " << rank << " dropped " << dropped
+    << " trace events, raise trace_max_events";
+
+  // rank 0 collects the sizes of the fragments of all ranks
+  gaspi_number_t notification_num;
+  SUCCESS_OR_DIE(gaspi_notification_num(&notification_num));
+  CHECK_LE(num_ranks, notification_num);
+  const gaspi_queue_id_t queue = GPIResources::AcquireQueue("trace");
+  const gaspi_segment_id_t segment_sizes =
+    GPIResources::AcquireSegment("trace sizes");
+  SUCCESS_OR_DIE(gaspi_segment_create(segment_sizes,
+                                      num_ranks * sizeof(long),
+                                      GASPI_GROUP_ALL, GASPI_BLOCK,
+                                      GASPI_MEM_UNINITIALIZED));
+  gaspi_pointer_t p;
+  SUCCESS_OR_DIE(gaspi_segment_ptr(segment_sizes, &p));
+  long* const sizes = static_cast<long*>(p);
+  sizes[rank] = fragment.size();
+  if (rank != 0) {
+    SUCCESS_OR_DIE(gaspi_write_notify(segment_sizes, rank * sizeof(long), 0,
+                                      segment_sizes, rank * sizeof(long),
+                                      sizeof(long), rank, 1, queue,
+                                      GASPI_BLOCK));
+    SUCCESS_OR_DIE(gaspi_wait(queue, GASPI_BLOCK));
+  } else {
+    for (long n = 1; n < num_ranks; n++) {
+      gaspi_notification_id_t id;
+      gaspi_notification_t value;
+      SUCCESS_OR_DIE(gaspi_notify_waitsome(segment_sizes, 1, num_ranks - 1,
+                                           &id, GASPI_BLOCK));
+      SUCCESS_OR_DIE(gaspi_notify_reset(segment_sizes, id, &value));
+    }
+  }
+  std::vector<long> offsets(num_ranks + 1, 0);
+  if (rank == 0) {
+    for (long r = 0; r < num_ranks; r++) {
+      offsets[r + 1] = offsets[r] + sizes[r];
+    }
+  }
+  SUCCESS_OR_DIE(gaspi_segment_delete(segment_sizes));
+  GPIResources::ReleaseSegment(segment_sizes);
+
+  // and reads the fragments into its segment one after the other
+  const gaspi_segment_id_t segment_events =
+    GPIResources::AcquireSegment("trace events");
+  SUCCESS_OR_DIE(gaspi_segment_create(segment_events,
+                                      (rank == 0) ? offsets[num_ranks]
+                                                  : fragment.size(),
+                                      GASPI_GROUP_ALL, GASPI_BLOCK,
+                                      GASPI_MEM_UNINITIALIZED));
+  SUCCESS_OR_DIE(gaspi_segment_ptr(segment_events, &p));
+  char* const data = static_cast<char*>(p);
+  memcpy(data, fragment.data(), fragment.size());
+  SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+  if (rank == 0) {
+    gaspi_size_t transfer_size_max;
+    SUCCESS_OR_DIE(gaspi_transfer_size_max(&transfer_size_max));
+    for (long r = 1; r < num_ranks; r++) {
+      const long bytes = offsets[r + 1] - offsets[r];
+      for (long done = 0; done < bytes; ) {
+        const long size = std::min(bytes - done,
+                                   static_cast<long>(transfer_size_max));
+        WaitForQueueSpace(queue);
+        SUCCESS_OR_DIE(gaspi_read(segment_events, offsets[r] + done, r,
+                                  segment_events, done, size, queue,
+                                  GASPI_BLOCK));
+        done += size;
+      }
+    }
+    SUCCESS_OR_DIE(gaspi_wait(queue, GASPI_BLOCK));
+
+    std::ofstream out(trace_file.c_str());
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    // without the comma and newline after the last event
+    out.write(data, offsets[num_ranks] - 2);
+    out << "\n]}\n";
+    CHECK(out.good()) << "Failed to write " << trace_file;
+    LOG(INFO) << "Wrote the communication trace of " << num_ranks
+              << " ranks to " << trace_file << ", " << events
+              << " events on rank 0";
+  }
+  // the other ranks keep their fragments until rank 0 read them
+  SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+  SUCCESS_OR_DIE(gaspi_segment_delete(segment_events));
+  GPIResources::ReleaseSegment(segment_events);
+  GPIResources::ReleaseQueue(queue);
+}
+
+double GPITrace::Now(void) {
+  return ClockMicroSeconds() - trace_origin;
+}
+
+const char* GPITrace::Intern(const std::string& name) {
+  boost::mutex::scoped_lock lock(trace_mutex);
+  return names.insert(name).first->c_str();
+}
+
+void GPITrace::Record(const char* category, const char* name,
+                      const double begin, const double end,
+                      const char* arg_name, const long arg,
+                      const char* arg_name2, const long arg2) {
+  if (!enabled()) return;
+  ThreadBuffer* buffer = GetThreadBuffer();
+  if (buffer->count >= trace_max_events) {
+    buffer->dropped.fetch_add(1, boost::memory_order_relaxed);
+    return;
+  }
+  Chunk* chunk = buffer->tail;
+  long size = chunk->size.load(boost::memory_order_relaxed);
+  if (size == kChunkEvents) {
+    chunk = new Chunk;
+    buffer->tail->next.store(chunk, boost::memory_order_release);
+    buffer->tail = chunk;
+    size = 0;
+  }
+  Event& e = chunk->events[size];
+  e.category = category;
+  e.name = name;
+  e.begin = begin;
+  e.end = end;
+  e.arg_name[0] = arg_name;
+  e.arg[0] = arg;
+  e.arg_name[1] = arg_name2;
+  e.arg[1] = arg2;
+  chunk->size.store(size + 1, boost::memory_order_release);
+  buffer->count++;
+}
+
+gaspi_return_t GPITrace::WriteNotify(
+  const gaspi_segment_id_t segment_id_local,
+  const gaspi_offset_t offset_local,
+  const gaspi_rank_t rank,
+  const gaspi_segment_id_t segment_id_remote,
+  const gaspi_offset_t offset_remote,
+  const gaspi_size_t size,
+  const gaspi_notification_id_t notification_id,
+  const gaspi_notification_t notification_value,
+  const gaspi_queue_id_t queue,
+  const gaspi_timeout_t timeout) {
+  if (!enabled()) {
+    return gaspi_write_notify(segment_id_local, offset_local, rank,
+                              segment_id_remote, offset_remote, size,
+                              notification_id, notification_value, queue,
+                              timeout);
+  }
+  const double begin = Now();
+  const gaspi_return_t ret =
+    gaspi_write_notify(segment_id_local, offset_local, rank,
+                       segment_id_remote, offset_remote, size,
+                       notification_id, notification_value, queue, timeout);
+  Record("gpi", "write_notify", begin, Now(), "rank", rank, "bytes", size);
+  return ret;
+}
+
+gaspi_return_t GPITrace::NotifyWaitsome(
+  const gaspi_segment_id_t segment_id,
+  const gaspi_notification_id_t notification_begin,
+  const gaspi_number_t num,
+  gaspi_notification_id_t* first_id,
+  const gaspi_timeout_t timeout) {
+  if (!enabled()) {
+    return gaspi_notify_waitsome(segment_id, notification_begin, num,
+                                 first_id, timeout);
+  }
+  const double begin = Now();
+  const gaspi_return_t ret = gaspi_notify_waitsome(segment_id,
+                                                   notification_begin, num,
+                                                   first_id, timeout);
+  Record("gpi", "notify_waitsome", begin, Now(), "segment", segment_id,
+         "notification", notification_begin);
+  return ret;
+}
+
+}
@@ -1,7 +1,10 @@
+#include <boost/bind.hpp>
+
 #include <vector>
 
 #include "caffe/layers/absval_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -18,7 +21,15 @@ void AbsValLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   const int count = top[0]->count();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  caffe_abs(count, bottom[0]->cpu_data(), top_data);
+  caffe_parallel_for(count, kElementwiseGrain,
+      boost::bind(&AbsValLayer<Dtype>::ForwardRange_cpu, this,
+                  bottom[0]->cpu_data(), top_data, _1, _2));
+}
+
+template <typename Dtype>
+void AbsValLayer<Dtype>::ForwardRange_cpu(const Dtype* bottom_data,
+    Dtype* top_data, int begin, int end) {
+  caffe_abs(end - begin, bottom_data + begin, top_data + begin);
 }
 
 template <typename Dtype>
@@ -29,11 +40,20 @@ void AbsValLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   if (propagate_down[0]) {
     const Dtype* bottom_data = bottom[0]->cpu_data();
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-    caffe_cpu_sign(count, bottom_data, bottom_diff);
-    caffe_mul(count, bottom_diff, top_diff, bottom_diff);
+    caffe_parallel_for(count, kElementwiseGrain,
+        boost::bind(&AbsValLayer<Dtype>::BackwardRange_cpu, this,
+                    bottom_data, top_diff, bottom_diff, _1, _2));
   }
 }
 
+template <typename Dtype>
+void AbsValLayer<Dtype>::BackwardRange_cpu(const Dtype* bottom_data,
+    const Dtype* top_diff, Dtype* bottom_diff, int begin, int end) {
+  const int count = end - begin;
+  caffe_cpu_sign(count, bottom_data + begin, bottom_diff + begin);
+  caffe_mul(count, bottom_diff + begin, top_diff + begin, bottom_diff + begin);
+}
+
 #ifdef CPU_ONLY
 STUB_GPU(AbsValLayer);
 #endif
@@ -5,6 +5,7 @@
 #include "caffe/layers/base_conv_layer.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -14,6 +15,7 @@ void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // Configure the kernel size, padding, stride, and inputs.
   ConvolutionParameter conv_param = this->layer_param_.convolution_param();
   force_nd_im2col_ = conv_param.force_nd_im2col();
+  col_tile_size_ = conv_param.col_tile_size();
   channel_axis_ = bottom[0]->CanonicalAxisIndex(conv_param.axis());
   const int first_spatial_axis = channel_axis_ + 1;
   const int num_axes = bottom[0]->num_axes();
@@ -114,6 +116,7 @@ void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
         kernel_shape_data[i] == 1 && stride_data[i] == 1 && pad_data[i] == 0;
     if (!is_1x1_) { break; }
   }
+  batched_1x1_cols_ = conv_param.batched_1x1_cols();
   // Configure output channels and groups.
   channels_ = bottom[0]->shape(channel_axis_);
   num_output_ = this->layer_param_.convolution_param().num_output();
@@ -238,10 +241,23 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       col_buffer_shape_.push_back(output_shape_[i]);
     }
   }
-  col_buffer_.Reshape(col_buffer_shape_);
+  // The tiled im2col of the CPU helpers needs a col buffer of a tile only.
+  col_tile_ = 0;
+  if (col_tile_size_ > 0 && !is_1x1_ && !force_nd_im2col_ &&
+      num_spatial_axes_ == 2 && Caffe::mode() == Caffe::CPU) {
+    col_tile_ = std::min(col_tile_size_, conv_out_spatial_dim_);
+    vector<int> col_tile_shape(1, kernel_dim_ * group_);
+    col_tile_shape.push_back(col_tile_);
+    col_buffer_.Reshape(col_tile_shape);
+  } else {
+    col_buffer_.Reshape(col_buffer_shape_);
+  }
   bottom_dim_ = bottom[0]->count(channel_axis_);
   top_dim_ = top[0]->count(channel_axis_);
   num_kernels_im2col_ = conv_in_channels_ * conv_out_spatial_dim_;
+  pack_images_ = is_1x1_ ?
+      std::min(batched_1x1_cols_ / conv_out_spatial_dim_, num_) : 0;
+  batched_1x1_ = pack_images_ > 1;
   num_kernels_col2im_ = reverse_dimensions() ? top_dim_ : bottom_dim_;
   // Set up the all ones "bias multiplier" for adding biases by BLAS
   out_spatial_dim_ = top[0]->count(first_spatial_axis);
@@ -253,20 +269,65 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::prepare_cpu_parts() {
+  cpu_parts_ = std::max(std::min(caffe_cpu_threads(), num_), 1);
+  part_col_buffers_.resize(cpu_parts_);
+  if (batched_1x1_) {
+    // the inputs and outputs of pack_images_ images per part
+    const int pack_count = pack_images_ *
+        (conv_in_channels_ + conv_out_channels_) * conv_out_spatial_dim_;
+    part_buffers_.resize(cpu_parts_ * pack_count);
+    for (int part = 0; part < cpu_parts_; ++part) {
+      part_col_buffers_[part] = &part_buffers_[part * pack_count];
+    }
+  } else if (is_1x1_) {
+    // 1x1 convolutions multiply the input directly
+    part_col_buffers_.assign(cpu_parts_, static_cast<Dtype*>(NULL));
+  } else {
+    const int col_count = col_buffer_.count();
+    part_buffers_.resize((cpu_parts_ - 1) * col_count);
+    part_col_buffers_[0] = col_buffer_.mutable_cpu_data();
+    for (int part = 1; part < cpu_parts_; ++part) {
+      part_col_buffers_[part] = &part_buffers_[(part - 1) * col_count];
+    }
+  }
+}
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
-    const Dtype* weights, Dtype* output, bool skip_im2col) {
-  const Dtype* col_buff = input;
+    const Dtype* weights, Dtype* output, bool skip_im2col, Dtype* col_buff) {
+  if (!is_1x1_ && !col_buff) {
+    col_buff = col_buffer_.mutable_cpu_data();
+  }
+  if (col_tile_ > 0) {
+    // output[:, tile] = weights * im2col(input)[:, tile], tile by tile
+    for (int col_begin = 0; col_begin < conv_out_spatial_dim_;
+         col_begin += col_tile_) {
+      const int cols = std::min(col_tile_, conv_out_spatial_dim_ - col_begin);
+      conv_im2col_tile_cpu(input, col_begin, col_begin + cols, col_buff);
+      for (int g = 0; g < group_; ++g) {
+        caffe_cpu_gemm_ld<Dtype>(CblasNoTrans, CblasNoTrans,
+            conv_out_channels_ / group_, cols, kernel_dim_,
+            (Dtype)1., weights + weight_offset_ * g, kernel_dim_,
+            col_buff + kernel_dim_ * cols * g, cols,
+            (Dtype)0., output + output_offset_ * g + col_begin,
+            conv_out_spatial_dim_);
+      }
+    }
+    return;
+  }
+  const Dtype* col_data = input;
   if (!is_1x1_) {
     if (!skip_im2col) {
-      conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
+      conv_im2col_cpu(input, col_buff);
     }
-    col_buff = col_buffer_.cpu_data();
+    col_data = col_buff;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
         group_, conv_out_spatial_dim_, kernel_dim_,
-        (Dtype)1., weights + weight_offset_ * g, col_buff + col_offset_ * g,
+        (Dtype)1., weights + weight_offset_ * g, col_data + col_offset_ * g,
         (Dtype)0., output + output_offset_ * g);
   }
 }
@@ -281,10 +342,28 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
-    const Dtype* weights, Dtype* input) {
-  Dtype* col_buff = col_buffer_.mutable_cpu_data();
+    const Dtype* weights, Dtype* input, Dtype* col_buff) {
   if (is_1x1_) {
     col_buff = input;
+  } else if (!col_buff) {
+    col_buff = col_buffer_.mutable_cpu_data();
+  }
+  if (col_tile_ > 0) {
+    // col2im(weights^T * output) summed up tile by tile
+    caffe_set(num_kernels_col2im_, Dtype(0), input);
+    for (int col_begin = 0; col_begin < conv_out_spatial_dim_;
+         col_begin += col_tile_) {
+      const int cols = std::min(col_tile_, conv_out_spatial_dim_ - col_begin);
+      for (int g = 0; g < group_; ++g) {
+        caffe_cpu_gemm_ld<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_, cols,
+            conv_out_channels_ / group_,
+            (Dtype)1., weights + weight_offset_ * g, kernel_dim_,
+            output + output_offset_ * g + col_begin, conv_out_spatial_dim_,
+            (Dtype)0., col_buff + kernel_dim_ * cols * g, cols);
+      }
+      conv_col2im_tile_add_cpu(col_buff, col_begin, col_begin + cols, input);
+    }
+    return;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_,
@@ -299,16 +378,35 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::weight_cpu_gemm(const Dtype* input,
-    const Dtype* output, Dtype* weights) {
-  const Dtype* col_buff = input;
+    const Dtype* output, Dtype* weights, Dtype* col_buff) {
+  if (!is_1x1_ && !col_buff) {
+    col_buff = col_buffer_.mutable_cpu_data();
+  }
+  if (col_tile_ > 0) {
+    // weights += output[:, tile] * im2col(input)[:, tile]^T, tile by tile
+    for (int col_begin = 0; col_begin < conv_out_spatial_dim_;
+         col_begin += col_tile_) {
+      const int cols = std::min(col_tile_, conv_out_spatial_dim_ - col_begin);
+      conv_im2col_tile_cpu(input, col_begin, col_begin + cols, col_buff);
+      for (int g = 0; g < group_; ++g) {
+        caffe_cpu_gemm_ld<Dtype>(CblasNoTrans, CblasTrans,
+            conv_out_channels_ / group_, kernel_dim_, cols,
+            (Dtype)1., output + output_offset_ * g + col_begin,
+            conv_out_spatial_dim_, col_buff + kernel_dim_ * cols * g, cols,
+            (Dtype)1., weights + weight_offset_ * g, kernel_dim_);
+      }
+    }
+    return;
+  }
+  const Dtype* col_data = input;
   if (!is_1x1_) {
-    conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
-    col_buff = col_buffer_.cpu_data();
+    conv_im2col_cpu(input, col_buff);
+    col_data = col_buff;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
         kernel_dim_, conv_out_spatial_dim_,
-        (Dtype)1., output + output_offset_ * g, col_buff + col_offset_ * g,
+        (Dtype)1., output + output_offset_ * g, col_data + col_offset_ * g,
         (Dtype)1., weights + weight_offset_ * g);
   }
 }
@@ -320,6 +418,121 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_bias(Dtype* bias,
       input, bias_multiplier_.cpu_data(), 1., bias);
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::pack_images_cpu(const Dtype* data,
+    int images, int channels, Dtype* pack) {
+  for (int n = 0; n < images; ++n) {
+    for (int c = 0; c < channels; ++c) {
+      caffe_copy(conv_out_spatial_dim_,
+          data + (n * channels + c) * conv_out_spatial_dim_,
+          pack + (c * images + n) * conv_out_spatial_dim_);
+    }
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::unpack_images_cpu(const Dtype* pack,
+    int images, int channels, Dtype* data) {
+  for (int n = 0; n < images; ++n) {
+    for (int c = 0; c < channels; ++c) {
+      caffe_copy(conv_out_spatial_dim_,
+          pack + (c * images + n) * conv_out_spatial_dim_,
+          data + (n * channels + c) * conv_out_spatial_dim_);
+    }
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_1x1(const Dtype* input,
+    const Dtype* weights, Dtype* output, int images, Dtype* pack_buff) {
+  const int input_dim = conv_in_channels_ * conv_out_spatial_dim_;
+  const int output_dim = conv_out_channels_ * conv_out_spatial_dim_;
+  for (int n = 0; n < images; n += pack_images_) {
+    forward_cpu_pack(input + n * input_dim, weights, output + n * output_dim,
+        std::min(pack_images_, images - n), pack_buff);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::backward_cpu_1x1(const Dtype* output_diff,
+    const Dtype* input, const Dtype* weights, Dtype* weights_diff,
+    Dtype* input_diff, int images, Dtype* pack_buff) {
+  const int input_dim = conv_in_channels_ * conv_out_spatial_dim_;
+  const int output_dim = conv_out_channels_ * conv_out_spatial_dim_;
+  for (int n = 0; n < images; n += pack_images_) {
+    backward_cpu_pack(output_diff + n * output_dim, input + n * input_dim,
+        weights, weights_diff, input_diff ? input_diff + n * input_dim : NULL,
+        std::min(pack_images_, images - n), pack_buff);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_pack(const Dtype* input,
+    const Dtype* weights, Dtype* output, int images, Dtype* pack_buff) {
+  const int cols = images * conv_out_spatial_dim_;
+  Dtype* input_pack = pack_buff;
+  Dtype* output_pack = pack_buff + conv_in_channels_ * cols;
+  const Dtype* input_data = input;
+  Dtype* output_data = output;
+  // A single image is its own pack.
+  if (images > 1) {
+    pack_images_cpu(input, images, conv_in_channels_, input_pack);
+    input_data = input_pack;
+    output_data = output_pack;
+  }
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
+        group_, cols, kernel_dim_,
+        (Dtype)1., weights + weight_offset_ * g,
+        input_data + col_offset_ * images * g,
+        (Dtype)0., output_data + output_offset_ * images * g);
+  }
+  if (images > 1) {
+    unpack_images_cpu(output_pack, images, conv_out_channels_, output);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::backward_cpu_pack(const Dtype* output_diff,
+    const Dtype* input, const Dtype* weights, Dtype* weights_diff,
+    Dtype* input_diff, int images, Dtype* pack_buff) {
+  const int cols = images * conv_out_spatial_dim_;
+  Dtype* input_pack = pack_buff;
+  Dtype* output_pack = pack_buff + conv_in_channels_ * cols;
+  const Dtype* output_data = output_diff;
+  if (images > 1) {
+    pack_images_cpu(output_diff, images, conv_out_channels_, output_pack);
+    output_data = output_pack;
+  }
+  if (weights_diff) {
+    const Dtype* input_data = input;
+    if (images > 1) {
+      pack_images_cpu(input, images, conv_in_channels_, input_pack);
+      input_data = input_pack;
+    }
+    for (int g = 0; g < group_; ++g) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans,
+          conv_out_channels_ / group_, kernel_dim_, cols,
+          (Dtype)1., output_data + output_offset_ * images * g,
+          input_data + col_offset_ * images * g,
+          (Dtype)1., weights_diff + weight_offset_ * g);
+    }
+  }
+  if (input_diff) {
+    Dtype* input_diff_data = (images > 1) ? input_pack : input_diff;
+    for (int g = 0; g < group_; ++g) {
+      caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_, cols,
+          conv_out_channels_ / group_,
+          (Dtype)1., weights + weight_offset_ * g,
+          output_data + output_offset_ * images * g,
+          (Dtype)0., input_diff_data + col_offset_ * images * g);
+    }
+    if (images > 1) {
+      unpack_images_cpu(input_pack, images, conv_in_channels_, input_diff);
+    }
+  }
+}
+
 #ifndef CPU_ONLY
 
 template <typename Dtype>
@@ -1,3 +1,4 @@
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <vector>
 
@@ -8,6 +9,7 @@
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/math_functions.hpp"
 
 namespace caffe {
 
@@ -49,6 +51,18 @@ void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   BaseDataLayer<Dtype>::LayerSetUp(bottom, top);
 
+  transform_pool_.reset(new ThreadPool(this->transform_param_.num_threads()));
+  transformers_.resize(transform_pool_->num_threads());
+  transformed_datas_.resize(transform_pool_->num_threads());
+  transformers_[0] = this->data_transformer_;
+  for (int i = 0; i < transform_pool_->num_threads(); ++i) {
+    if (i) {
+      transformers_[i].reset(
+          new DataTransformer<Dtype>(this->transform_param_, this->phase_));
+    }
+    transformed_datas_[i].reset(new Blob<Dtype>());
+  }
+
   // Before starting the prefetch thread, we make cpu_data and gpu_data
   // calls so that the prefetch thread does not accidentally make simultaneous
   // cudaMalloc calls when the main thread is running. In some GPUs this
@@ -109,6 +123,47 @@ void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
 #endif
 }
 
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::TransformItems(Batch<Dtype>* batch,
+    int batch_size) {
+  // drawn in item order for any number of threads, one thread included
+  if (this->data_transformer_->NeedsRand()) {
+    item_seeds_.resize(batch_size);
+    for (int item_id = 0; item_id < batch_size; ++item_id) {
+      item_seeds_[item_id] = caffe_rng_rand();
+    }
+  }
+  if (transform_pool_->num_threads() == 1) {
+    for (int item_id = 0; item_id < batch_size; ++item_id) {
+      TransformItem(batch, item_id, 0);
+    }
+    return;
+  }
+  for (int i = 0; i < transformed_datas_.size(); ++i) {
+    transformed_datas_[i]->ReshapeLike(transformed_data_);
+  }
+  // moves the batch to the CPU here, not concurrently in the threads
+  batch->data_.mutable_cpu_data();
+  if (this->output_labels_) {
+    batch->label_.mutable_cpu_data();
+  }
+  transform_pool_->Run(batch_size, boost::bind(
+      &BasePrefetchingDataLayer<Dtype>::TransformItem, this, batch, _1, _2));
+}
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::TransformItem(Batch<Dtype>* batch,
+    int item_id, int thread) {
+  DataTransformer<Dtype>* transformer = transformers_[thread].get();
+  if (transformer->NeedsRand()) {
+    transformer->InitRand(item_seeds_[item_id]);
+  }
+  // the calling thread uses transformed_data_, shaped by load_batch
+  transform_item(batch, item_id, thread, transformer,
+                 (transform_pool_->num_threads() == 1) ?
+                 &transformed_data_ : transformed_datas_[thread].get());
+}
+
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
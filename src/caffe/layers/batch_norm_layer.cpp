@@ -1,8 +1,11 @@
+#include <boost/bind.hpp>
+
 #include <algorithm>
 #include <vector>
 
 #include "caffe/layers/batch_norm_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -90,10 +93,7 @@ void BatchNormLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   Dtype* top_data = top[0]->mutable_cpu_data();
   int num = bottom[0]->shape(0);
   int spatial_dim = bottom[0]->count()/(bottom[0]->shape(0)*channels_);
-
-  if (bottom[0] != top[0]) {
-    caffe_copy(bottom[0]->count(), bottom_data, top_data);
-  }
+  const Dtype scale = 1. / (num * spatial_dim);
 
   if (use_global_stats_) {
     // use the stored mean/variance estimates.
@@ -105,31 +105,24 @@ void BatchNormLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
         this->blobs_[1]->cpu_data(), variance_.mutable_cpu_data());
   } else {
     // compute mean
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, channels_ * num, spatial_dim,
-        1. / (num * spatial_dim), bottom_data,
-        spatial_sum_multiplier_.cpu_data(), 0.,
-        num_by_chans_.mutable_cpu_data());
+    caffe_parallel_for(channels_ * num, 1,
+        boost::bind(&BatchNormLayer<Dtype>::SumPlanes_cpu, this,
+                    bottom_data, static_cast<const Dtype*>(NULL), scale,
+                    num_by_chans_.mutable_cpu_data(), _1, _2));
     caffe_cpu_gemv<Dtype>(CblasTrans, num, channels_, 1.,
         num_by_chans_.cpu_data(), batch_sum_multiplier_.cpu_data(), 0.,
         mean_.mutable_cpu_data());
   }
 
-  // subtract mean
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, channels_, 1, 1,
-      batch_sum_multiplier_.cpu_data(), mean_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels_ * num,
-      spatial_dim, 1, -1, num_by_chans_.cpu_data(),
-      spatial_sum_multiplier_.cpu_data(), 1., top_data);
+  // subtract mean, and sum up (X-EX)^2 per plane for the variance
+  caffe_parallel_for(channels_ * num, 1,
+      boost::bind(&BatchNormLayer<Dtype>::CenterPlanes_cpu, this,
+                  bottom_data, mean_.cpu_data(), scale,
+                  use_global_stats_ ? NULL : num_by_chans_.mutable_cpu_data(),
+                  top_data, _1, _2));
 
   if (!use_global_stats_) {
     // compute variance using var(X) = E((X-EX)^2)
-    caffe_powx(top[0]->count(), top_data, Dtype(2),
-        temp_.mutable_cpu_data());  // (X-EX)^2
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, channels_ * num, spatial_dim,
-        1. / (num * spatial_dim), temp_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), 0.,
-        num_by_chans_.mutable_cpu_data());
     caffe_cpu_gemv<Dtype>(CblasTrans, num, channels_, 1.,
         num_by_chans_.cpu_data(), batch_sum_multiplier_.cpu_data(), 0.,
         variance_.mutable_cpu_data());  // E((X_EX)^2)
@@ -151,39 +144,90 @@ void BatchNormLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   caffe_powx(variance_.count(), variance_.cpu_data(), Dtype(0.5),
              variance_.mutable_cpu_data());
 
-  // replicate variance to input size
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, channels_, 1, 1,
-      batch_sum_multiplier_.cpu_data(), variance_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels_ * num,
-      spatial_dim, 1, 1., num_by_chans_.cpu_data(),
-      spatial_sum_multiplier_.cpu_data(), 0., temp_.mutable_cpu_data());
-  caffe_div(temp_.count(), top_data, temp_.cpu_data(), top_data);
+  // divide by the standard deviation
   // TODO(cdoersch): The caching is only needed because later in-place layers
   //                 might clobber the data.  Can we skip this if they won't?
-  caffe_copy(x_norm_.count(), top_data,
-      x_norm_.mutable_cpu_data());
+  caffe_parallel_for(channels_ * num, 1,
+      boost::bind(&BatchNormLayer<Dtype>::NormalizePlanes_cpu, this,
+                  variance_.cpu_data(), top_data,
+                  x_norm_.mutable_cpu_data(), _1, _2));
+}
+
+template <typename Dtype>
+void BatchNormLayer<Dtype>::SumPlanes_cpu(const Dtype* a, const Dtype* b,
+    Dtype scale, Dtype* sums, int begin, int end) {
+  const int spatial_dim = x_norm_.count() / (x_norm_.shape(0) * channels_);
+  for (int plane = begin; plane < end; ++plane) {
+    const Dtype* x = a + plane * spatial_dim;
+    Dtype sum = 0;
+    if (b) {
+      const Dtype* y = b + plane * spatial_dim;
+      for (int i = 0; i < spatial_dim; ++i) {
+        sum += x[i] * y[i];
+      }
+    } else {
+      for (int i = 0; i < spatial_dim; ++i) {
+        sum += x[i];
+      }
+    }
+    sums[plane] = scale * sum;
+  }
+}
+
+template <typename Dtype>
+void BatchNormLayer<Dtype>::CenterPlanes_cpu(const Dtype* bottom_data,
+    const Dtype* mean, Dtype scale, Dtype* sums, Dtype* top_data,
+    int begin, int end) {
+  const int spatial_dim = x_norm_.count() / (x_norm_.shape(0) * channels_);
+  for (int plane = begin; plane < end; ++plane) {
+    const Dtype m = mean[plane % channels_];
+    const Dtype* x = bottom_data + plane * spatial_dim;
+    Dtype* y = top_data + plane * spatial_dim;
+    Dtype sum = 0;
+    for (int i = 0; i < spatial_dim; ++i) {
+      y[i] = x[i] - m;
+      sum += y[i] * y[i];
+    }
+    if (sums) sums[plane] = scale * sum;
+  }
+}
+
+template <typename Dtype>
+void BatchNormLayer<Dtype>::NormalizePlanes_cpu(const Dtype* std,
+    Dtype* top_data, Dtype* x_norm_data, int begin, int end) {
+  const int spatial_dim = x_norm_.count() / (x_norm_.shape(0) * channels_);
+  for (int plane = begin; plane < end; ++plane) {
+    const Dtype s = std[plane % channels_];
+    Dtype* y = top_data + plane * spatial_dim;
+    Dtype* x_norm = x_norm_data + plane * spatial_dim;
+    for (int i = 0; i < spatial_dim; ++i) {
+      y[i] /= s;
+      x_norm[i] = y[i];
+    }
+  }
 }
 
 template <typename Dtype>
 void BatchNormLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down,
     const vector<Blob<Dtype>*>& bottom) {
-  const Dtype* top_diff;
-  if (bottom[0] != top[0]) {
-    top_diff = top[0]->cpu_diff();
-  } else {
-    caffe_copy(x_norm_.count(), top[0]->cpu_diff(), x_norm_.mutable_cpu_diff());
-    top_diff = x_norm_.cpu_diff();
-  }
+  // In-place computation is fine, every element of the top diff is read
+  // before the same element of the bottom diff is written.
+  const Dtype* top_diff = top[0]->cpu_diff();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  if (use_global_stats_) {
-    caffe_div(temp_.count(), top_diff, temp_.cpu_data(), bottom_diff);
-    return;
-  }
   const Dtype* top_data = x_norm_.cpu_data();
   int num = bottom[0]->shape()[0];
   int spatial_dim = bottom[0]->count()/(bottom[0]->shape(0)*channels_);
+  // variance_ still contains sqrt(var(X)+eps), computed during the forward
+  // pass.
+  if (use_global_stats_) {
+    caffe_parallel_for(channels_ * num, 1,
+        boost::bind(&BatchNormLayer<Dtype>::BackwardPlanes_cpu, this,
+                    top_data, top_diff, static_cast<const Dtype*>(NULL),
+                    static_cast<const Dtype*>(NULL), variance_.cpu_data(),
+                    bottom_diff, _1, _2));
+    return;
+  }
   // if Y = (X-mean(X))/(sqrt(var(X)+eps)), then
   //
   // dE(Y)/dX =
@@ -195,50 +239,55 @@ void BatchNormLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   // along all dimensions except the channels dimension.  In the above
   // equation, the operations allow for expansion (i.e. broadcast) along all
   // dimensions except the channels dimension where required.
+  const Dtype scale = 1. / (num * spatial_dim);
 
-  // sum(dE/dY \cdot Y)
-  caffe_mul(temp_.count(), top_data, top_diff, bottom_diff);
-  caffe_cpu_gemv<Dtype>(CblasNoTrans, channels_ * num, spatial_dim, 1.,
-      bottom_diff, spatial_sum_multiplier_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
+  // mean(dE/dY \cdot Y) in mean_.data
+  caffe_parallel_for(channels_ * num, 1,
+      boost::bind(&BatchNormLayer<Dtype>::SumPlanes_cpu, this,
+                  top_diff, top_data, scale,
+                  num_by_chans_.mutable_cpu_data(), _1, _2));
   caffe_cpu_gemv<Dtype>(CblasTrans, num, channels_, 1.,
       num_by_chans_.cpu_data(), batch_sum_multiplier_.cpu_data(), 0.,
       mean_.mutable_cpu_data());
-
-  // reshape (broadcast) the above
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, channels_, 1, 1,
-      batch_sum_multiplier_.cpu_data(), mean_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels_ * num,
-      spatial_dim, 1, 1., num_by_chans_.cpu_data(),
-      spatial_sum_multiplier_.cpu_data(), 0., bottom_diff);
-
-  // sum(dE/dY \cdot Y) \cdot Y
-  caffe_mul(temp_.count(), top_data, bottom_diff, bottom_diff);
-
-  // sum(dE/dY)-sum(dE/dY \cdot Y) \cdot Y
-  caffe_cpu_gemv<Dtype>(CblasNoTrans, channels_ * num, spatial_dim, 1.,
-      top_diff, spatial_sum_multiplier_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
+  // mean(dE/dY), we hack a little bit by using mean_.diff to store it
+  caffe_parallel_for(channels_ * num, 1,
+      boost::bind(&BatchNormLayer<Dtype>::SumPlanes_cpu, this,
+                  top_diff, static_cast<const Dtype*>(NULL), scale,
+                  num_by_chans_.mutable_cpu_data(), _1, _2));
   caffe_cpu_gemv<Dtype>(CblasTrans, num, channels_, 1.,
       num_by_chans_.cpu_data(), batch_sum_multiplier_.cpu_data(), 0.,
-      mean_.mutable_cpu_data());
-  // reshape (broadcast) the above to make
-  // sum(dE/dY)-sum(dE/dY \cdot Y) \cdot Y
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, channels_, 1, 1,
-      batch_sum_multiplier_.cpu_data(), mean_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num * channels_,
-      spatial_dim, 1, 1., num_by_chans_.cpu_data(),
-      spatial_sum_multiplier_.cpu_data(), 1., bottom_diff);
-
-  // dE/dY - mean(dE/dY)-mean(dE/dY \cdot Y) \cdot Y
-  caffe_cpu_axpby(temp_.count(), Dtype(1), top_diff,
-      Dtype(-1. / (num * spatial_dim)), bottom_diff);
-
-  // note: temp_ still contains sqrt(var(X)+eps), computed during the forward
-  // pass.
-  caffe_div(temp_.count(), bottom_diff, temp_.cpu_data(), bottom_diff);
+      mean_.mutable_cpu_diff());
+
+  caffe_parallel_for(channels_ * num, 1,
+      boost::bind(&BatchNormLayer<Dtype>::BackwardPlanes_cpu, this,
+                  top_data, top_diff, mean_.cpu_diff(), mean_.cpu_data(),
+                  variance_.cpu_data(), bottom_diff, _1, _2));
+}
+
+template <typename Dtype>
+void BatchNormLayer<Dtype>::BackwardPlanes_cpu(const Dtype* top_data,
+    const Dtype* top_diff, const Dtype* mean_diff, const Dtype* mean_diff_y,
+    const Dtype* std, Dtype* bottom_diff, int begin, int end) {
+  const int spatial_dim = x_norm_.count() / (x_norm_.shape(0) * channels_);
+  for (int plane = begin; plane < end; ++plane) {
+    const int c = plane % channels_;
+    const int offset = plane * spatial_dim;
+    const Dtype* y = top_data + offset;
+    const Dtype* dy = top_diff + offset;
+    Dtype* dx = bottom_diff + offset;
+    const Dtype s = std[c];
+    if (mean_diff) {
+      const Dtype m = mean_diff[c];
+      const Dtype m_y = mean_diff_y[c];
+      for (int i = 0; i < spatial_dim; ++i) {
+        dx[i] = (dy[i] - m - m_y * y[i]) / s;
+      }
+    } else {
+      for (int i = 0; i < spatial_dim; ++i) {
+        dx[i] = dy[i] / s;
+      }
+    }
+  }
 }
 
 
@@ -1,7 +1,10 @@
+#include <boost/bind.hpp>
+
 #include <algorithm>
 #include <vector>
 
 #include "caffe/layers/bnll_layer.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -13,7 +16,15 @@ void BNLLLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const int count = bottom[0]->count();
-  for (int i = 0; i < count; ++i) {
+  caffe_parallel_for(count, kElementwiseGrain,
+      boost::bind(&BNLLLayer<Dtype>::ForwardRange_cpu, this,
+                  bottom_data, top_data, _1, _2));
+}
+
+template <typename Dtype>
+void BNLLLayer<Dtype>::ForwardRange_cpu(const Dtype* bottom_data,
+    Dtype* top_data, int begin, int end) {
+  for (int i = begin; i < end; ++i) {
     top_data[i] = bottom_data[i] > 0 ?
         bottom_data[i] + log(1. + exp(-bottom_data[i])) :
         log(1. + exp(bottom_data[i]));
@@ -29,11 +40,19 @@ void BNLLLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const Dtype* top_diff = top[0]->cpu_diff();
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const int count = bottom[0]->count();
-    Dtype expval;
-    for (int i = 0; i < count; ++i) {
-      expval = exp(std::min(bottom_data[i], Dtype(kBNLL_THRESHOLD)));
-      bottom_diff[i] = top_diff[i] * expval / (expval + 1.);
-    }
+    caffe_parallel_for(count, kElementwiseGrain,
+        boost::bind(&BNLLLayer<Dtype>::BackwardRange_cpu, this,
+                    bottom_data, top_diff, bottom_diff, _1, _2));
+  }
+}
+
+template <typename Dtype>
+void BNLLLayer<Dtype>::BackwardRange_cpu(const Dtype* bottom_data,
+    const Dtype* top_diff, Dtype* bottom_diff, int begin, int end) {
+  Dtype expval;
+  for (int i = begin; i < end; ++i) {
+    expval = exp(std::min(bottom_data[i], Dtype(kBNLL_THRESHOLD)));
+    bottom_diff[i] = top_diff[i] * expval / (expval + 1.);
   }
 }
 
@@ -1,6 +1,9 @@
+#include <boost/bind.hpp>
+
 #include <vector>
 
 #include "caffe/layers/conv_layer.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -25,14 +28,36 @@ template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const Dtype* weight = this->blobs_[0]->cpu_data();
+  const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  this->prepare_cpu_parts();
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = top[i]->mutable_cpu_data();
-    for (int n = 0; n < this->num_; ++n) {
-      this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
-          top_data + n * this->top_dim_);
+    caffe_parallel_for(this->cpu_parts_, 1, boost::bind(
+        &ConvolutionLayer<Dtype>::ForwardParts_cpu, this, bottom_data, weight,
+        bias, top_data, _1, _2));
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::ForwardParts_cpu(const Dtype* bottom_data,
+    const Dtype* weight, const Dtype* bias, Dtype* top_data, int part_begin,
+    int part_end) {
+  for (int part = part_begin; part < part_end; ++part) {
+    Dtype* col_buff = this->part_col_buffers_[part];
+    const int image_begin = this->first_image(part);
+    const int image_end = this->first_image(part + 1);
+    if (this->batched_1x1_) {
+      this->forward_cpu_1x1(bottom_data + image_begin * this->bottom_dim_,
+          weight, top_data + image_begin * this->top_dim_,
+          image_end - image_begin, col_buff);
+    }
+    for (int n = image_begin; n < image_end; ++n) {
+      if (!this->batched_1x1_) {
+        this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
+            top_data + n * this->top_dim_, false, col_buff);
+      }
       if (this->bias_term_) {
-        const Dtype* bias = this->blobs_[1]->cpu_data();
         this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
       }
     }
@@ -44,6 +69,14 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
   const Dtype* weight = this->blobs_[0]->cpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+  const int weight_count = this->blobs_[0]->count();
+  this->prepare_cpu_parts();
+  weight_diff_parts_.resize((this->cpu_parts_ - 1) * weight_count);
+  part_weight_diffs_.resize(this->cpu_parts_);
+  part_weight_diffs_[0] = weight_diff;
+  for (int part = 1; part < this->cpu_parts_; ++part) {
+    part_weight_diffs_[part] = &weight_diff_parts_[(part - 1) * weight_count];
+  }
   for (int i = 0; i < top.size(); ++i) {
     const Dtype* top_diff = top[i]->cpu_diff();
     const Dtype* bottom_data = bottom[i]->cpu_data();
@@ -56,22 +89,55 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       }
     }
     if (this->param_propagate_down_[0] || propagate_down[i]) {
-      for (int n = 0; n < this->num_; ++n) {
-        // gradient w.r.t. weight. Note that we will accumulate diffs.
-        if (this->param_propagate_down_[0]) {
-          this->weight_cpu_gemm(bottom_data + n * this->bottom_dim_,
-              top_diff + n * this->top_dim_, weight_diff);
-        }
-        // gradient w.r.t. bottom data, if necessary.
-        if (propagate_down[i]) {
-          this->backward_cpu_gemm(top_diff + n * this->top_dim_, weight,
-              bottom_diff + n * this->bottom_dim_);
+      caffe_parallel_for(this->cpu_parts_, 1, boost::bind(
+          &ConvolutionLayer<Dtype>::BackwardParts_cpu, this, top_diff,
+          bottom_data, weight, propagate_down[i] ? bottom_diff : NULL,
+          _1, _2));
+      if (this->param_propagate_down_[0]) {
+        for (int part = 1; part < this->cpu_parts_; ++part) {
+          caffe_axpy(weight_count, Dtype(1), part_weight_diffs_[part],
+              weight_diff);
         }
       }
     }
   }
 }
 
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::BackwardParts_cpu(const Dtype* top_diff,
+    const Dtype* bottom_data, const Dtype* weight, Dtype* bottom_diff,
+    int part_begin, int part_end) {
+  for (int part = part_begin; part < part_end; ++part) {
+    Dtype* col_buff = this->part_col_buffers_[part];
+    Dtype* weight_diff = part_weight_diffs_[part];
+    if (part > 0 && this->param_propagate_down_[0]) {
+      caffe_set(this->blobs_[0]->count(), Dtype(0), weight_diff);
+    }
+    const int image_begin = this->first_image(part);
+    const int image_end = this->first_image(part + 1);
+    if (this->batched_1x1_) {
+      this->backward_cpu_1x1(top_diff + image_begin * this->top_dim_,
+          bottom_data + image_begin * this->bottom_dim_, weight,
+          this->param_propagate_down_[0] ? weight_diff : NULL,
+          bottom_diff ? bottom_diff + image_begin * this->bottom_dim_ : NULL,
+          image_end - image_begin, col_buff);
+      continue;
+    }
+    for (int n = image_begin; n < image_end; ++n) {
+      // gradient w.r.t. weight. Note that we will accumulate diffs.
+      if (this->param_propagate_down_[0]) {
+        this->weight_cpu_gemm(bottom_data + n * this->bottom_dim_,
+            top_diff + n * this->top_dim_, weight_diff, col_buff);
+      }
+      // gradient w.r.t. bottom data, if necessary.
+      if (bottom_diff) {
+        this->backward_cpu_gemm(top_diff + n * this->top_dim_, weight,
+            bottom_diff + n * this->bottom_dim_, col_buff);
+      }
+    }
+  }
+}
+
 #ifdef CPU_ONLY
 STUB_GPU(ConvolutionLayer);
 #endif
@@ -89,40 +89,34 @@ void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   CHECK(this->transformed_data_.count());
   const int batch_size = this->layer_param_.data_param().batch_size();
 
-  Datum datum;
+  item_values_.resize(batch_size);
   for (int item_id = 0; item_id < batch_size; ++item_id) {
     timer.Start();
     while (Skip()) {
       Next();
     }
-    datum.ParseFromString(cursor_->value());
-    read_time += timer.MicroSeconds();
+    item_values_[item_id] = cursor_->value();
 
     if (item_id == 0) {
       // Reshape according to the first datum of each batch
       // on single input batches allows for inputs of varying dimension.
       // Use data_transformer to infer the expected blob shape from datum.
+      Datum datum;
+      datum.ParseFromString(item_values_[item_id]);
       vector<int> top_shape = this->data_transformer_->InferBlobShape(datum);
       this->transformed_data_.Reshape(top_shape);
       // Reshape batch according to the batch_size.
       top_shape[0] = batch_size;
       batch->data_.Reshape(top_shape);
     }
-
-    // Apply data transformations (mirror, scale, crop...)
-    timer.Start();
-    int offset = batch->data_.offset(item_id);
-    Dtype* top_data = batch->data_.mutable_cpu_data();
-    this->transformed_data_.set_cpu_data(top_data + offset);
-    this->data_transformer_->Transform(datum, &(this->transformed_data_));
-    // Copy label.
-    if (this->output_labels_) {
-      Dtype* top_label = batch->label_.mutable_cpu_data();
-      top_label[item_id] = datum.label();
-    }
-    trans_time += timer.MicroSeconds();
+    read_time += timer.MicroSeconds();
     Next();
   }
+
+  // Parse and apply data transformations (mirror, scale, crop...)
+  timer.Start();
+  this->TransformItems(batch, batch_size);
+  trans_time += timer.MicroSeconds();
   timer.Stop();
   batch_timer.Stop();
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
@@ -130,6 +124,23 @@ void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
 }
 
+template<typename Dtype>
+void DataLayer<Dtype>::transform_item(Batch<Dtype>* batch, int item_id,
+    int thread, DataTransformer<Dtype>* transformer,
+    Blob<Dtype>* transformed_data) {
+  Datum datum;
+  datum.ParseFromString(item_values_[item_id]);
+  int offset = batch->data_.offset(item_id);
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  transformed_data->set_cpu_data(top_data + offset);
+  transformer->Transform(datum, transformed_data);
+  // Copy label.
+  if (this->output_labels_) {
+    Dtype* top_label = batch->label_.mutable_cpu_data();
+    top_label[item_id] = datum.label();
+  }
+}
+
 INSTANTIATE_CLASS(DataLayer);
 REGISTER_LAYER_CLASS(Data);
 
@@ -1,9 +1,12 @@
 // TODO (sergeyk): effect should not be dependent on phase. wasted memcpy.
 
+#include <boost/bind.hpp>
+
 #include <vector>
 
 #include "caffe/layers/dropout_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -37,9 +40,9 @@ void DropoutLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   if (this->phase_ == TRAIN) {
     // Create random numbers
     caffe_rng_bernoulli(count, 1. - threshold_, mask);
-    for (int i = 0; i < count; ++i) {
-      top_data[i] = bottom_data[i] * mask[i] * scale_;
-    }
+    caffe_parallel_for(count, kElementwiseGrain,
+        boost::bind(&DropoutLayer<Dtype>::ScaleRange_cpu, this,
+                    bottom_data, mask, top_data, _1, _2));
   } else {
     caffe_copy(bottom[0]->count(), bottom_data, top_data);
   }
@@ -55,9 +58,9 @@ void DropoutLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     if (this->phase_ == TRAIN) {
       const unsigned int* mask = rand_vec_.cpu_data();
       const int count = bottom[0]->count();
-      for (int i = 0; i < count; ++i) {
-        bottom_diff[i] = top_diff[i] * mask[i] * scale_;
-      }
+      caffe_parallel_for(count, kElementwiseGrain,
+          boost::bind(&DropoutLayer<Dtype>::ScaleRange_cpu, this,
+                      top_diff, mask, bottom_diff, _1, _2));
     } else {
       caffe_copy(top[0]->count(), top_diff, bottom_diff);
     }
@@ -65,6 +68,14 @@ void DropoutLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
 }
 
 
+template <typename Dtype>
+void DropoutLayer<Dtype>::ScaleRange_cpu(const Dtype* x,
+    const unsigned int* mask, Dtype* y, int begin, int end) {
+  for (int i = begin; i < end; ++i) {
+    y[i] = x[i] * mask[i] * scale_;
+  }
+}
+
 #ifdef CPU_ONLY
 STUB_GPU(DropoutLayer);
 #endif
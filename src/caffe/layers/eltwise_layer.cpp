@@ -1,8 +1,11 @@
+#include <boost/bind.hpp>
+
 #include <cfloat>
 #include <vector>
 
 #include "caffe/layers/eltwise_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -45,32 +48,48 @@ template <typename Dtype>
 void EltwiseLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   int* mask = NULL;
-  const Dtype* bottom_data_a = NULL;
-  const Dtype* bottom_data_b = NULL;
   const int count = top[0]->count();
   Dtype* top_data = top[0]->mutable_cpu_data();
+  vector<const Dtype*> bottom_data(bottom.size());
+  for (int i = 0; i < bottom.size(); ++i) {
+    bottom_data[i] = bottom[i]->cpu_data();
+  }
+  if (op_ == EltwiseParameter_EltwiseOp_MAX) {
+    mask = max_idx_.mutable_cpu_data();
+  }
+  caffe_parallel_for(count, kElementwiseGrain,
+      boost::bind(&EltwiseLayer<Dtype>::ForwardRange_cpu, this,
+                  boost::cref(bottom_data), top_data, mask, _1, _2));
+}
+
+template <typename Dtype>
+void EltwiseLayer<Dtype>::ForwardRange_cpu(
+    const vector<const Dtype*>& bottom_data, Dtype* top_data, int* mask,
+    int begin, int end) {
+  const Dtype* bottom_data_a = NULL;
+  const Dtype* bottom_data_b = NULL;
+  const int count = end - begin;
+  top_data += begin;
   switch (op_) {
   case EltwiseParameter_EltwiseOp_PROD:
-    caffe_mul(count, bottom[0]->cpu_data(), bottom[1]->cpu_data(), top_data);
-    for (int i = 2; i < bottom.size(); ++i) {
-      caffe_mul(count, top_data, bottom[i]->cpu_data(), top_data);
+    caffe_mul(count, bottom_data[0] + begin, bottom_data[1] + begin,
+              top_data);
+    for (int i = 2; i < bottom_data.size(); ++i) {
+      caffe_mul(count, top_data, bottom_data[i] + begin, top_data);
     }
     break;
   case EltwiseParameter_EltwiseOp_SUM:
     caffe_set(count, Dtype(0), top_data);
     // TODO(shelhamer) does BLAS optimize to sum for coeff = 1?
-    for (int i = 0; i < bottom.size(); ++i) {
-      caffe_axpy(count, coeffs_[i], bottom[i]->cpu_data(), top_data);
+    for (int i = 0; i < bottom_data.size(); ++i) {
+      caffe_axpy(count, coeffs_[i], bottom_data[i] + begin, top_data);
     }
     break;
   case EltwiseParameter_EltwiseOp_MAX:
-    // Initialize
-    mask = max_idx_.mutable_cpu_data();
-    caffe_set(count, -1, mask);
-    caffe_set(count, Dtype(-FLT_MAX), top_data);
+    mask += begin;
     // bottom 0 & 1
-    bottom_data_a = bottom[0]->cpu_data();
-    bottom_data_b = bottom[1]->cpu_data();
+    bottom_data_a = bottom_data[0] + begin;
+    bottom_data_b = bottom_data[1] + begin;
     for (int idx = 0; idx < count; ++idx) {
       if (bottom_data_a[idx] > bottom_data_b[idx]) {
         top_data[idx] = bottom_data_a[idx];  // maxval
@@ -81,8 +100,8 @@ void EltwiseLayer<Dtype>::Forward_cpu(
       }
     }
     // bottom 2++
-    for (int blob_idx = 2; blob_idx < bottom.size(); ++blob_idx) {
-      bottom_data_b = bottom[blob_idx]->cpu_data();
+    for (int blob_idx = 2; blob_idx < bottom_data.size(); ++blob_idx) {
+      bottom_data_b = bottom_data[blob_idx] + begin;
       for (int idx = 0; idx < count; ++idx) {
         if (bottom_data_b[idx] > top_data[idx]) {
           top_data[idx] = bottom_data_b[idx];  // maxval
@@ -103,50 +122,71 @@ void EltwiseLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   const int count = top[0]->count();
   const Dtype* top_data = top[0]->cpu_data();
   const Dtype* top_diff = top[0]->cpu_diff();
+  vector<const Dtype*> bottom_data(bottom.size());
+  for (int i = 0; i < bottom.size(); ++i) {
+    bottom_data[i] = bottom[i]->cpu_data();
+  }
+  if (op_ == EltwiseParameter_EltwiseOp_MAX) {
+    mask = max_idx_.cpu_data();
+  }
   for (int i = 0; i < bottom.size(); ++i) {
     if (propagate_down[i]) {
-      const Dtype* bottom_data = bottom[i]->cpu_data();
       Dtype* bottom_diff = bottom[i]->mutable_cpu_diff();
-      switch (op_) {
-      case EltwiseParameter_EltwiseOp_PROD:
-        if (stable_prod_grad_) {
-          bool initialized = false;
-          for (int j = 0; j < bottom.size(); ++j) {
-            if (i == j) { continue; }
-            if (!initialized) {
-              caffe_copy(count, bottom[j]->cpu_data(), bottom_diff);
-              initialized = true;
-            } else {
-              caffe_mul(count, bottom[j]->cpu_data(), bottom_diff,
-                        bottom_diff);
-            }
-          }
-        } else {
-          caffe_div(count, top_data, bottom_data, bottom_diff);
-        }
-        caffe_mul(count, bottom_diff, top_diff, bottom_diff);
-        break;
-      case EltwiseParameter_EltwiseOp_SUM:
-        if (coeffs_[i] == Dtype(1)) {
-          caffe_copy(count, top_diff, bottom_diff);
+      caffe_parallel_for(count, kElementwiseGrain,
+          boost::bind(&EltwiseLayer<Dtype>::BackwardRange_cpu, this,
+                      boost::cref(bottom_data), top_data, top_diff, mask, i,
+                      bottom_diff, _1, _2));
+    }
+  }
+}
+
+template <typename Dtype>
+void EltwiseLayer<Dtype>::BackwardRange_cpu(
+    const vector<const Dtype*>& bottom_data, const Dtype* top_data,
+    const Dtype* top_diff, const int* mask, int i, Dtype* bottom_diff,
+    int begin, int end) {
+  const int count = end - begin;
+  top_data += begin;
+  top_diff += begin;
+  bottom_diff += begin;
+  switch (op_) {
+  case EltwiseParameter_EltwiseOp_PROD:
+    if (stable_prod_grad_) {
+      bool initialized = false;
+      for (int j = 0; j < bottom_data.size(); ++j) {
+        if (i == j) { continue; }
+        if (!initialized) {
+          caffe_copy(count, bottom_data[j] + begin, bottom_diff);
+          initialized = true;
         } else {
-          caffe_cpu_scale(count, coeffs_[i], top_diff, bottom_diff);
+          caffe_mul(count, bottom_data[j] + begin, bottom_diff,
+                    bottom_diff);
         }
-        break;
-      case EltwiseParameter_EltwiseOp_MAX:
-        mask = max_idx_.cpu_data();
-        for (int index = 0; index < count; ++index) {
-          Dtype gradient = 0;
-          if (mask[index] == i) {
-            gradient += top_diff[index];
-          }
-          bottom_diff[index] = gradient;
-        }
-        break;
-      default:
-        LOG(FATAL) << "Unknown elementwise operation.";
       }
+    } else {
+      caffe_div(count, top_data, bottom_data[i] + begin, bottom_diff);
+    }
+    caffe_mul(count, bottom_diff, top_diff, bottom_diff);
+    break;
+  case EltwiseParameter_EltwiseOp_SUM:
+    if (coeffs_[i] == Dtype(1)) {
+      caffe_copy(count, top_diff, bottom_diff);
+    } else {
+      caffe_cpu_scale(count, coeffs_[i], top_diff, bottom_diff);
+    }
+    break;
+  case EltwiseParameter_EltwiseOp_MAX:
+    mask += begin;
+    for (int index = 0; index < count; ++index) {
+      Dtype gradient = 0;
+      if (mask[index] == i) {
+        gradient += top_diff[index];
+      }
+      bottom_diff[index] = gradient;
     }
+    break;
+  default:
+    LOG(FATAL) << "Unknown elementwise operation.";
   }
 }
 
@@ -1,7 +1,10 @@
+#include <boost/bind.hpp>
+
 #include <algorithm>
 #include <vector>
 
 #include "caffe/layers/elu_layer.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -11,8 +14,16 @@ void ELULayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const int count = bottom[0]->count();
+  caffe_parallel_for(count, kElementwiseGrain,
+      boost::bind(&ELULayer<Dtype>::ForwardRange_cpu, this,
+                  bottom_data, top_data, _1, _2));
+}
+
+template <typename Dtype>
+void ELULayer<Dtype>::ForwardRange_cpu(const Dtype* bottom_data,
+    Dtype* top_data, int begin, int end) {
   Dtype alpha = this->layer_param_.elu_param().alpha();
-  for (int i = 0; i < count; ++i) {
+  for (int i = begin; i < end; ++i) {
     top_data[i] = std::max(bottom_data[i], Dtype(0))
         + alpha * (exp(std::min(bottom_data[i], Dtype(0))) - Dtype(1));
   }
@@ -28,11 +39,20 @@ void ELULayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const Dtype* top_diff = top[0]->cpu_diff();
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const int count = bottom[0]->count();
-    Dtype alpha = this->layer_param_.elu_param().alpha();
-    for (int i = 0; i < count; ++i) {
-      bottom_diff[i] = top_diff[i] * ((bottom_data[i] > 0)
-          + (alpha + top_data[i]) * (bottom_data[i] <= 0));
-    }
+    caffe_parallel_for(count, kElementwiseGrain,
+        boost::bind(&ELULayer<Dtype>::BackwardRange_cpu, this,
+                    bottom_data, top_data, top_diff, bottom_diff, _1, _2));
+  }
+}
+
+template <typename Dtype>
+void ELULayer<Dtype>::BackwardRange_cpu(const Dtype* bottom_data,
+    const Dtype* top_data, const Dtype* top_diff, Dtype* bottom_diff,
+    int begin, int end) {
+  Dtype alpha = this->layer_param_.elu_param().alpha();
+  for (int i = begin; i < end; ++i) {
+    bottom_diff[i] = top_diff[i] * ((bottom_data[i] > 0)
+        + (alpha + top_data[i]) * (bottom_data[i] <= 0));
   }
 }
 
@@ -1,7 +1,10 @@
+#include <boost/bind.hpp>
+
 #include <vector>
 
 #include "caffe/layers/exp_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -33,6 +36,17 @@ void ExpLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const int count = bottom[0]->count();
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
+  caffe_parallel_for(count, kElementwiseGrain,
+      boost::bind(&ExpLayer<Dtype>::ForwardRange_cpu, this,
+                  bottom_data, top_data, _1, _2));
+}
+
+template <typename Dtype>
+void ExpLayer<Dtype>::ForwardRange_cpu(const Dtype* bottom_data,
+    Dtype* top_data, int begin, int end) {
+  const int count = end - begin;
+  bottom_data += begin;
+  top_data += begin;
   if (inner_scale_ == Dtype(1)) {
     caffe_exp(count, bottom_data, top_data);
   } else {
@@ -52,6 +66,18 @@ void ExpLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   const Dtype* top_data = top[0]->cpu_data();
   const Dtype* top_diff = top[0]->cpu_diff();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  caffe_parallel_for(count, kElementwiseGrain,
+      boost::bind(&ExpLayer<Dtype>::BackwardRange_cpu, this,
+                  top_data, top_diff, bottom_diff, _1, _2));
+}
+
+template <typename Dtype>
+void ExpLayer<Dtype>::BackwardRange_cpu(const Dtype* top_data,
+    const Dtype* top_diff, Dtype* bottom_diff, int begin, int end) {
+  const int count = end - begin;
+  top_data += begin;
+  top_diff += begin;
+  bottom_diff += begin;
   caffe_mul(count, top_data, top_diff, bottom_diff);
   if (inner_scale_ != Dtype(1)) {
     caffe_scal(count, inner_scale_, bottom_diff);
@@ -1,7 +1,10 @@
+#include <boost/bind.hpp>
+
 #include <vector>
 
 #include "caffe/layers/log_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -36,6 +39,17 @@ void LogLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const int count = bottom[0]->count();
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
+  caffe_parallel_for(count, kElementwiseGrain,
+      boost::bind(&LogLayer<Dtype>::ForwardRange_cpu, this,
+                  bottom_data, top_data, _1, _2));
+}
+
+template <typename Dtype>
+void LogLayer<Dtype>::ForwardRange_cpu(const Dtype* bottom_data,
+    Dtype* top_data, int begin, int end) {
+  const int count = end - begin;
+  bottom_data += begin;
+  top_data += begin;
   if (input_scale_ == Dtype(1) && input_shift_ == Dtype(0)) {
     caffe_log(count, bottom_data, top_data);
   } else {
@@ -61,6 +75,18 @@ void LogLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   const Dtype* bottom_data = bottom[0]->cpu_data();
   const Dtype* top_diff = top[0]->cpu_diff();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  caffe_parallel_for(count, kElementwiseGrain,
+      boost::bind(&LogLayer<Dtype>::BackwardRange_cpu, this,
+                  bottom_data, top_diff, bottom_diff, _1, _2));
+}
+
+template <typename Dtype>
+void LogLayer<Dtype>::BackwardRange_cpu(const Dtype* bottom_data,
+    const Dtype* top_diff, Dtype* bottom_diff, int begin, int end) {
+  const int count = end - begin;
+  bottom_data += begin;
+  top_diff += begin;
+  bottom_diff += begin;
   caffe_copy(count, bottom_data, bottom_diff);
   if (input_scale_ != Dtype(1)) {
     caffe_scal(count, input_scale_, bottom_diff);
@@ -1,7 +1,10 @@
+#include <boost/bind.hpp>
+
 #include <vector>
 
 #include "caffe/layers/lrn_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -110,45 +113,56 @@ void LRNLayer<Dtype>::CrossChannelForward_cpu(
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   Dtype* scale_data = scale_.mutable_cpu_data();
+  // go through the images
+  caffe_parallel_for(num_, 1,
+      boost::bind(&LRNLayer<Dtype>::CrossChannelForwardImages_cpu, this,
+                  bottom_data, scale_data, top_data, _1, _2));
+}
+
+template <typename Dtype>
+void LRNLayer<Dtype>::CrossChannelForwardImages_cpu(const Dtype* bottom_data,
+    Dtype* scale_data, Dtype* top_data, int begin, int end) {
+  const int spatial_dim = height_ * width_;
+  const int count = (end - begin) * channels_ * spatial_dim;
   // start with the constant value
-  for (int i = 0; i < scale_.count(); ++i) {
-    scale_data[i] = k_;
-  }
-  Blob<Dtype> padded_square(1, channels_ + size_ - 1, height_, width_);
-  Dtype* padded_square_data = padded_square.mutable_cpu_data();
-  caffe_set(padded_square.count(), Dtype(0), padded_square_data);
+  caffe_set(count, k_, scale_data + scale_.offset(begin));
+  // padded square of one image, of the calling thread
+  vector<Dtype> padded_square((channels_ + size_ - 1) * spatial_dim,
+                              Dtype(0));
+  Dtype* padded_square_data = &padded_square[0];
   Dtype alpha_over_size = alpha_ / size_;
-  // go through the images
-  for (int n = 0; n < num_; ++n) {
+  for (int n = begin; n < end; ++n) {
     // compute the padded square
-    caffe_sqr(channels_ * height_ * width_,
-        bottom_data + bottom[0]->offset(n),
-        padded_square_data + padded_square.offset(0, pre_pad_));
+    caffe_sqr(channels_ * spatial_dim,
+        bottom_data + scale_.offset(n),
+        padded_square_data + pre_pad_ * spatial_dim);
     // Create the first channel scale
     for (int c = 0; c < size_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c),
+      caffe_axpy<Dtype>(spatial_dim, alpha_over_size,
+          padded_square_data + c * spatial_dim,
           scale_data + scale_.offset(n, 0));
     }
     for (int c = 1; c < channels_; ++c) {
       // copy previous scale
-      caffe_copy<Dtype>(height_ * width_,
+      caffe_copy<Dtype>(spatial_dim,
           scale_data + scale_.offset(n, c - 1),
           scale_data + scale_.offset(n, c));
       // add head
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c + size_ - 1),
+      caffe_axpy<Dtype>(spatial_dim, alpha_over_size,
+          padded_square_data + (c + size_ - 1) * spatial_dim,
           scale_data + scale_.offset(n, c));
       // subtract tail
-      caffe_axpy<Dtype>(height_ * width_, -alpha_over_size,
-          padded_square_data + padded_square.offset(0, c - 1),
+      caffe_axpy<Dtype>(spatial_dim, -alpha_over_size,
+          padded_square_data + (c - 1) * spatial_dim,
           scale_data + scale_.offset(n, c));
     }
   }
 
   // In the end, compute output
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, top_data);
-  caffe_mul<Dtype>(scale_.count(), top_data, bottom_data, top_data);
+  caffe_powx<Dtype>(count, scale_data + scale_.offset(begin), -beta_,
+      top_data + scale_.offset(begin));
+  caffe_mul<Dtype>(count, top_data + scale_.offset(begin),
+      bottom_data + scale_.offset(begin), top_data + scale_.offset(begin));
 }
 
 template <typename Dtype>
@@ -185,48 +199,62 @@ void LRNLayer<Dtype>::CrossChannelBackward_cpu(
   const Dtype* bottom_data = bottom[0]->cpu_data();
   const Dtype* scale_data = scale_.cpu_data();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  Blob<Dtype> padded_ratio(1, channels_ + size_ - 1, height_, width_);
-  Blob<Dtype> accum_ratio(1, 1, height_, width_);
-  Dtype* padded_ratio_data = padded_ratio.mutable_cpu_data();
-  Dtype* accum_ratio_data = accum_ratio.mutable_cpu_data();
-  // We hack a little bit by using the diff() to store an additional result
-  Dtype* accum_ratio_times_bottom = accum_ratio.mutable_cpu_diff();
-  caffe_set(padded_ratio.count(), Dtype(0), padded_ratio_data);
+  // go through individual data
+  caffe_parallel_for(num_, 1,
+      boost::bind(&LRNLayer<Dtype>::CrossChannelBackwardImages_cpu, this,
+                  top_data, top_diff, bottom_data, scale_data, bottom_diff,
+                  _1, _2));
+}
+
+template <typename Dtype>
+void LRNLayer<Dtype>::CrossChannelBackwardImages_cpu(const Dtype* top_data,
+    const Dtype* top_diff, const Dtype* bottom_data, const Dtype* scale_data,
+    Dtype* bottom_diff, int begin, int end) {
+  const int spatial_dim = height_ * width_;
+  const int count = (end - begin) * channels_ * spatial_dim;
+  // padded ratio and accumulated ratio of one image, of the calling thread
+  vector<Dtype> padded_ratio((channels_ + size_ - 1) * spatial_dim,
+                             Dtype(0));
+  vector<Dtype> accum_ratio(spatial_dim);
+  vector<Dtype> accum_ratio_times_bottom(spatial_dim);
+  Dtype* padded_ratio_data = &padded_ratio[0];
+  Dtype* accum_ratio_data = &accum_ratio[0];
   Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
 
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, bottom_diff);
-  caffe_mul<Dtype>(scale_.count(), top_diff, bottom_diff, bottom_diff);
+  caffe_powx<Dtype>(count, scale_data + scale_.offset(begin), -beta_,
+      bottom_diff + scale_.offset(begin));
+  caffe_mul<Dtype>(count, top_diff + scale_.offset(begin),
+      bottom_diff + scale_.offset(begin), bottom_diff + scale_.offset(begin));
 
-  // go through individual data
   int inverse_pre_pad = size_ - (size_ + 1) / 2;
-  for (int n = 0; n < num_; ++n) {
+  for (int n = begin; n < end; ++n) {
     int block_offset = scale_.offset(n);
     // first, compute diff_i * y_i / s_i
-    caffe_mul<Dtype>(channels_ * height_ * width_,
+    caffe_mul<Dtype>(channels_ * spatial_dim,
         top_diff + block_offset, top_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    caffe_div<Dtype>(channels_ * height_ * width_,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad),
+        padded_ratio_data + inverse_pre_pad * spatial_dim);
+    caffe_div<Dtype>(channels_ * spatial_dim,
+        padded_ratio_data + inverse_pre_pad * spatial_dim,
         scale_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
+        padded_ratio_data + inverse_pre_pad * spatial_dim);
     // Now, compute the accumulated ratios and the bottom diff
-    caffe_set(accum_ratio.count(), Dtype(0), accum_ratio_data);
+    caffe_set(spatial_dim, Dtype(0), accum_ratio_data);
     for (int c = 0; c < size_ - 1; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
+      caffe_axpy<Dtype>(spatial_dim, 1.,
+          padded_ratio_data + c * spatial_dim, accum_ratio_data);
     }
     for (int c = 0; c < channels_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c + size_ - 1),
+      caffe_axpy<Dtype>(spatial_dim, 1.,
+          padded_ratio_data + (c + size_ - 1) * spatial_dim,
           accum_ratio_data);
       // compute bottom diff
-      caffe_mul<Dtype>(height_ * width_,
-          bottom_data + top[0]->offset(n, c),
-          accum_ratio_data, accum_ratio_times_bottom);
-      caffe_axpy<Dtype>(height_ * width_, -cache_ratio_value,
-          accum_ratio_times_bottom, bottom_diff + top[0]->offset(n, c));
-      caffe_axpy<Dtype>(height_ * width_, -1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
+      caffe_mul<Dtype>(spatial_dim,
+          bottom_data + scale_.offset(n, c),
+          accum_ratio_data, &accum_ratio_times_bottom[0]);
+      caffe_axpy<Dtype>(spatial_dim, -cache_ratio_value,
+          &accum_ratio_times_bottom[0], bottom_diff + scale_.offset(n, c));
+      caffe_axpy<Dtype>(spatial_dim, -1.,
+          padded_ratio_data + c * spatial_dim, accum_ratio_data);
     }
   }
 }
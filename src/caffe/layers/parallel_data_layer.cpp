@@ -1,7 +1,9 @@
 #ifdef USE_OPENCV
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 
+#include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
 #include <iostream>  // NOLINT(readability/streams)
 #include <string>
@@ -57,25 +59,49 @@ void ParallelDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom
   if (currentRank==0)
     LOG(INFO) << "Opening data file " << source<<std::endl;
 
-  //open binary  
-  std::ifstream inFile;
-  inFile.open(source.c_str(),  std::ios::binary);
-  
-  //get bin file size
-  inFile.seekg(0,inFile.end);
-  long binFileSize = inFile.tellg();
-  inFile.seekg(0,inFile.beg);
-  inFile.close();
+  //map binary once, load_batch reads from the mapping
+  source_file_.reset(new MappedFile(source,
+      this->layer_param_.parallel_data_param().shuffle() ?
+      MappedFile::RANDOM : MappedFile::SEQUENTIAL));
+  long binFileSize = source_file_->size();
+  const long targetSize =
+      (headerSize+new_height*new_width*numChannels)*Labels_.size();
 
   if (currentRank==0)
   {
     LOG(INFO) << " binary size = "<< binFileSize << " target size: "<<
-        (headerSize+new_height*new_width*numChannels)*Labels_.size();
+        targetSize;
   }
+  CHECK_GE(binFileSize, targetSize) << "Binary file " << source
+      << " is smaller than the label file requires";
+  rawData_.resize(std::max<int>(this->transform_param_.num_threads(), 1),
+      std::vector<uint8_t>(new_height*new_width*numChannels));
 
   //offset for each rank
+  samplesPerRank_ = std::max<long>(Labels_.size()/numRanks, 1);
   label_id_ = (Labels_.size()/numRanks)*currentRank;
   data_id_=0;  
+  sampleCount_ = 0;
+
+  //the ranks start in different places of the same order, together they
+  //see every sample once per epoch of samplesPerRank_ samples
+  if (this->layer_param_.parallel_data_param().shuffle())
+  {
+    if (currentRank==0)
+      LOG(INFO) << "Shuffling data";
+    order_.resize(Labels_.size());
+  }
+  shuffleEpoch_ = -1;
+
+  if (this->layer_param_.parallel_data_param().rand_skip())
+  {
+    unsigned int skip = caffe_rng_rand() %
+        this->layer_param_.parallel_data_param().rand_skip();
+    LOG(INFO) << "Rank " << currentRank << ": skipping first " << skip
+        << " data points.";
+    CHECK_GT(Labels_.size(), skip) << "Not enough points to skip";
+    label_id_ = (label_id_ + skip) % Labels_.size();
+  }
 
   vector<int> top_shape(4);
   top_shape[0]=1;
@@ -118,8 +144,6 @@ void ParallelDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   const int new_height = parallel_data_param.new_height();
   const int new_width = parallel_data_param.new_width();
   const bool is_color = parallel_data_param.is_color();
-  string root_folder = parallel_data_param.root_folder();
-  const string& source = this->layer_param_.parallel_data_param().source();
   int headerSize = this->layer_param_.parallel_data_param().headersize();
 
   int numChannels = 1;
@@ -128,12 +152,6 @@ void ParallelDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
 
   int imageSize=new_height*new_width*numChannels;
 
-  //open binary  
-  std::ifstream inFile;
-  inFile.open(source.c_str(),  std::ios::binary);
-  long currentOffset = (headerSize+imageSize) * label_id_*sizeof(uint8_t); 
-  inFile.seekg(currentOffset );
-
   vector<int> top_shape(4);
   top_shape[0]=1;
   top_shape[1]=numChannels;
@@ -145,86 +163,108 @@ void ParallelDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   top_shape[0] = batch_size;
   batch->data_.Reshape(top_shape);
 
-  Dtype* prefetch_data = batch->data_.mutable_cpu_data();
   Dtype* prefetch_label = batch->label_.mutable_cpu_data();
 
-  //pre allocate image mem
-  rawData_= new uint8_t[imageSize * sizeof(uint8_t)];
-  uint8_t tmp;
+  const long sampleSize = headerSize+imageSize;
+  const uint8_t* sourceData = source_file_->data();
+  const bool shuffle = parallel_data_param.shuffle();
 
   // get batch
-  for (long item_id = 0; item_id < batch_size; ++item_id , label_id_++) 
+  itemData_.resize(batch_size);
+  for (long item_id = 0; item_id < batch_size; ++item_id , label_id_++, sampleCount_++) 
   {
     if (label_id_ >= Labels_.size())
     {
         label_id_=0;
-        inFile.seekg(0,inFile.beg);
     }
-
-    // get a blob
-    int offset = batch->data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(prefetch_data + offset);
- 
-    for (long e=0;e<headerSize;++e)
+    if (shuffle && sampleCount_ / samplesPerRank_ != shuffleEpoch_)
     {
-        //read header   
-        inFile.read(reinterpret_cast<char*>(&tmp),sizeof(uint8_t));
+        shuffleEpoch_ = sampleCount_ / samplesPerRank_;
+        ShuffleImages();
     }
-    if (numChannels==1)
-    {   
-      for (long e=0;e<imageSize;++e)
-      {
-        inFile.read(reinterpret_cast<char*>(&tmp),sizeof(uint8_t));
-        rawData_[e]=(Dtype)tmp;
-      }
-      cv::Mat cv_img(new_height, new_width, CV_8UC1, rawData_);
-      this->data_transformer_->Transform(cv_img, &(this->transformed_data_));
-    }
-    else //open cvs hav BGR color order!
-    {
-        uint8_t r,g,b;
-        for (long e=0;e<imageSize;++e)
-        {
-                inFile.read(reinterpret_cast<char*>(&r),sizeof(uint8_t));
-                inFile.read(reinterpret_cast<char*>(&g),sizeof(uint8_t));
-                inFile.read(reinterpret_cast<char*>(&b),sizeof(uint8_t));
-
-                rawData_[e]=(Dtype)b;
-                e++;
-                rawData_[e]=(Dtype)g;
-                e++;
-                rawData_[e]=(Dtype)r;
-        }
-        cv::Mat cv_img(new_height, new_width, CV_8UC3, rawData_);
-        this->data_transformer_->Transform(cv_img, &(this->transformed_data_));
-
-	/*
-        if(currentRank==0&&Labels_[label_id_]==0)
-        {
-                std::stringstream tmpName;
-                tmpName <<"/u/k/keuper/tmp/tmp_"<<currentRank<<"_"<<label_id_<<"_"<<Labels_[label_id_]<<".png";
-                cv::imwrite( tmpName.str(), cv_img);
-        }
-	*/
-        
-    }
- 
-    prefetch_label[item_id] = Labels_[label_id_];
+    const long sample = shuffle ? order_[label_id_] : label_id_;
+
+    //skip header
+    itemData_[item_id] = sourceData + sample*sampleSize + headerSize;
+    prefetch_label[item_id] = Labels_[sample];
 
  }
 
- delete[] rawData_;
- inFile.close(); 
-  
+ this->TransformItems(batch, batch_size);
+
+ //read the next batch ahead while the net works on this one
+ if (!shuffle)
+ {
+   source_file_->WillNeed(label_id_*sampleSize, batch_size*sampleSize);
+ }
+ else
+ {
+   //one request per run of consecutive samples
+   nextSamples_.resize(batch_size);
+   for (long i = 0, id = label_id_; i < batch_size; ++i, ++id)
+   {
+     if (id >= Labels_.size())
+       id = 0;
+     nextSamples_[i] = order_[id];
+   }
+   std::sort(nextSamples_.begin(), nextSamples_.end());
+   for (long i = 0; i < batch_size;)
+   {
+     long run = 1;
+     while (i+run < batch_size &&
+            nextSamples_[i+run] <= nextSamples_[i+run-1]+1)
+       ++run;
+     const long first = nextSamples_[i];
+     source_file_->WillNeed(first*sampleSize,
+                            (nextSamples_[i+run-1]-first+1)*sampleSize);
+     i += run;
+   }
+ }
+
  batch_timer.Stop();
- //if (currentRank==0)
- //       std::cout<<"BATCH time: "<<batch_timer.MilliSeconds() << " ms."<<std::endl; 
+ DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
   
 }
 
+template <typename Dtype>
+void ParallelDataLayer<Dtype>::transform_item(Batch<Dtype>* batch,
+    int item_id, int thread, DataTransformer<Dtype>* transformer,
+    Blob<Dtype>* transformed_data) {
+  const ParallelDataParameter& parallel_data_param =
+      this->layer_param_.parallel_data_param();
+  const int new_height = parallel_data_param.new_height();
+  const int new_width = parallel_data_param.new_width();
+
+  // get a blob
+  int offset = batch->data_.offset(item_id);
+  transformed_data->set_cpu_data(batch->data_.mutable_cpu_data() + offset);
+
+  uint8_t* imageData = const_cast<uint8_t*>(itemData_[item_id]);
+  if (!parallel_data_param.is_color())
+  {
+    cv::Mat cv_img(new_height, new_width, CV_8UC1, imageData);
+    transformer->Transform(cv_img, transformed_data);
+  }
+  else //open cvs hav BGR color order!
+  {
+    cv::Mat rgb_img(new_height, new_width, CV_8UC3, imageData);
+    cv::Mat cv_img(new_height, new_width, CV_8UC3, &rawData_[thread][0]);
+    cv::cvtColor(rgb_img, cv_img, cv::COLOR_RGB2BGR);
+    transformer->Transform(cv_img, transformed_data);
+  }
+}
+
 template <typename Dtype>
 void ParallelDataLayer<Dtype>::ShuffleImages() {
-//empty dummy to meet enheritance conditions
+  //all ranks draw the same order, it only depends on the seed and the epoch
+  const unsigned int prefetch_rng_seed =
+      this->layer_param_.parallel_data_param().shuffle_seed() + shuffleEpoch_;
+  prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
+  caffe::rng_t* prefetch_rng =
+      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+  for (long i = 0; i < order_.size(); ++i)
+    order_[i] = i;
+  shuffle(order_.begin(), order_.end(), prefetch_rng);
 }
 
 
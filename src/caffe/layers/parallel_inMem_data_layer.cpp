@@ -1,19 +1,32 @@
 #ifdef USE_OPENCV
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/bind.hpp>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
 #include <fstream>  // NOLINT(readability/streams)
 #include <iostream>  // NOLINT(readability/streams)
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "caffe/gpi_resources.hpp"
+#include "caffe/gpi_trace.hpp"
 #include "caffe/layers/parallel_inMem_data_layer.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/format.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/util/GPIhelper.h"
 
 
@@ -22,6 +35,17 @@ namespace caffe {
 template <typename Dtype>
 ParallelInMemDataLayer<Dtype>::~ParallelInMemDataLayer<Dtype>() {
   this->StopInternalThread();
+  if (segmentCreated_)
+  {
+    //the reads of this rank are done, the other ranks may still read
+    SUCCESS_OR_DIE( gaspi_wait(qID_, GASPI_BLOCK));
+    SUCCESS_OR_DIE( gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+    SUCCESS_OR_DIE( gaspi_segment_delete(segment_id_));
+    if (mappedBytes_)
+      munmap(segment_0_P_, mappedBytes_);
+    GPIResources::ReleaseSegment(segment_id_);
+    GPIResources::ReleaseQueue(qID_);
+  }
 }
 
 template <typename Dtype>
@@ -40,7 +64,7 @@ void ParallelInMemDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& b
   string labelFileName = this->layer_param_.parallel_inmem_data_param().label();
   int headerSize = this->layer_param_.parallel_inmem_data_param().headersize();
   const int batch_size = this->layer_param_.parallel_inmem_data_param().batch_size();
-  bool is_test = this->layer_param_.parallel_inmem_data_param().test();
+  const string encodeType = this->layer_param_.parallel_inmem_data_param().encode_type();
 
   int numChannels = 1;
   if (is_color)
@@ -61,14 +85,10 @@ void ParallelInMemDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& b
   if (currentRank==0)
     LOG(INFO) << "Opening data file " << source<<std::endl;
 
-  //open binary  
-  std::ifstream inFile;
-  inFile.open(source.c_str(),  std::ios::binary);
-  
-  //get bin file size
-  inFile.seekg(0,inFile.end);
-  long binFileSize = inFile.tellg();
-  inFile.seekg(0,inFile.beg);
+  //get bin file size, the file is only read without a valid cache
+  struct stat sourceStat;
+  CHECK_EQ(stat(source.c_str(), &sourceStat), 0) << "Could not open " << source;
+  long binFileSize = sourceStat.st_size;
 
   if (currentRank==0)
   {
@@ -83,7 +103,7 @@ void ParallelInMemDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& b
   samplesPerRank_ = batchesPerRank_ * batch_size;
   rankOffset_ = samplesPerRank_ * (imageSize+headerSize);
   maxLabel_ = batchesPerRank_ * numRanks * batch_size;
-  label_id_ = currentRank*samplesPerRank_;
+  const long firstSample = currentRank*samplesPerRank_;
 
   if (currentRank==0)
   {
@@ -92,71 +112,188 @@ void ParallelInMemDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& b
         << ", # samples per Rank : "<< samplesPerRank_;
   }
 
-  //gaspi setup
-  if (is_test) //use different segments for train and val data, seg 0 for solver com
-	segment_id_ = 2;
+  //gaspi setup, one segment and one queue per layer, the reads complete by
+  //notification
+  const string owner = "ParallelInMemData layer " + this->layer_param_.name();
+  segment_id_ = GPIResources::AcquireSegment(owner);
+  if (this->layer_param_.parallel_inmem_data_param().has_queue())
+    qID_ = GPIResources::AcquireQueue(owner,
+        this->layer_param_.parallel_inmem_data_param().queue());
   else
-	segment_id_ = 1;
-
-  qID_ = currentRank%7; //use 8 queues 
-  
-  //allocate global mem: n storage batches + input buffer  
-  SUCCESS_OR_DIE(
-        gaspi_segment_create( segment_id_, (batchesPerRank_+1)*batchMemSize_*sizeof(uint8_t), GASPI_GROUP_ALL,
-            GASPI_BLOCK, GASPI_MEM_INITIALIZED)
-  );
-
-  //get pointer to global mem    
-  SUCCESS_OR_DIE(
-      gaspi_segment_ptr (segment_id_, &segment_0_P_)
-  );
+    qID_ = GPIResources::AcquireQueue(owner);
+
+  currentRank_ = currentRank;
+  prefetchDepth_ = this->layer_param_.parallel_inmem_data_param().remote_prefetch();
+  loadCount_ = 0;
+  readCount_ = 0;
+  //one notification per read, at most one read per image
+  gaspi_number_t notificationNum;
+  SUCCESS_OR_DIE( gaspi_notification_num(&notificationNum));
+  CHECK_LE((prefetchDepth_+1)*batch_size, notificationNum);
+  itemOffsets_.assign(prefetchDepth_+1, std::vector<long>(batch_size));
+  itemSizes_.assign(prefetchDepth_+1, std::vector<long>(batch_size));
+  itemLabels_.assign(prefetchDepth_+1, std::vector<int>(batch_size));
+  slotReads_.assign(prefetchDepth_+1, 0);
+
+  if (this->layer_param_.parallel_inmem_data_param().shuffle())
+  {
+    if (currentRank==0)
+      LOG(INFO) << "Shuffling data";
+    order_.resize(maxLabel_);
+  }
+  shuffleEpoch_ = -1;
 
-  //get local pointer to segment
-  rawData_ = (uint8_t*) segment_0_P_;
+  if (this->layer_param_.parallel_inmem_data_param().rand_skip())
+  {
+    unsigned int skip = caffe_rng_rand() %
+        this->layer_param_.parallel_inmem_data_param().rand_skip();
+    CHECK_GT(maxLabel_, skip) << "Not enough points to skip";
+    LOG(INFO) << "Rank " << currentRank << ": skipping first "
+        << skip / batch_size << " batches.";
+    loadCount_ = skip / batch_size;
+    readCount_ = loadCount_;
+  }
 
-  //open binary  
-  long currentOffset = (headerSize+imageSize) * label_id_*sizeof(uint8_t);
-  inFile.seekg(currentOffset );
- 
-  //read from file
-  long pos=0;
-  for (long i = 0; i < samplesPerRank_; ++i)
+  //encoded images are packed behind the index of the images of this rank
+  encoded_ = !encodeType.empty();
+  const long indexBytes = encoded_ ? (samplesPerRank_+1)*sizeof(long) : 0;
+  long dataBytes = batchesPerRank_*batchMemSize_;
+  long maxBytes = imageSize;
+  const string cacheFile = this->layer_param_.parallel_inmem_data_param().cache().empty()
+      ? string() : this->layer_param_.parallel_inmem_data_param().cache() + ".rank"
+      + format_int(currentRank);
+  ShardCacheHeader header = {};
+  strncpy(header.magic, "CGPISHR2", sizeof(header.magic));
+  header.sourceSize = binFileSize;
+  header.sourceTime = sourceStat.st_mtime;
+  header.firstSample = firstSample;
+  header.samples = samplesPerRank_;
+  header.headerSize = headerSize;
+  header.imageSize = imageSize;
+  header.numRanks = numRanks;
+  strncpy(header.encodeType, encodeType.c_str(), sizeof(header.encodeType)-1);
+
+  CPUTimer load_timer;
+  load_timer.Start();
+  int fd = -1;
+  if (!cacheFile.empty())
+    fd = OpenCache(cacheFile, &header);
+  const long pageSize = sysconf(_SC_PAGESIZE);
+  std::vector<std::vector<uint8_t> > chunkData;
+  std::vector<long> imageSizes;
+  shared_ptr<MappedFile> sourceFile;
+  if (fd >= 0)
   {
-    if (i%10000==0)
-    	std::cerr<<"Rank "<<currentRank<<": read "<<i<<" samples from file\n";
-    uint8_t tmp;	
-    for (long e=0;e<headerSize;++e)
-    {
-        //read header   
-        inFile.read(reinterpret_cast<char*>(&tmp),sizeof(uint8_t));
-    }
-    if (numChannels==1)
+    dataBytes = header.dataBytes - indexBytes;
+    maxBytes = header.maxImageBytes;
+  }
+  else
+  {
+    sourceFile.reset(new MappedFile(source));
+    CHECK_GE((long) sourceFile->size(), (firstSample+samplesPerRank_)*(headerSize+imageSize))
+        << "Binary file " << source << " is smaller than the label file requires";
+    if (encoded_) //encode on all threads before the size of the segment is known
     {
-      for (long e=0;e<imageSize;++e,++pos)
+      ThreadPool pool(this->transform_param_.num_threads());
+      chunkData.resize((samplesPerRank_+LoadChunkSamples()-1) / LoadChunkSamples());
+      imageSizes.resize(samplesPerRank_);
+      pool.Run(chunkData.size(), boost::bind(
+          &ParallelInMemDataLayer<Dtype>::EncodeChunk, this, sourceFile.get(),
+          firstSample, &chunkData, &imageSizes, _1, _2));
+      dataBytes = 0;
+      maxBytes = 0;
+      for (long i = 0; i < samplesPerRank_; ++i)
       {
-        inFile.read(reinterpret_cast<char*>(&tmp),sizeof(uint8_t));
-        rawData_[pos]=tmp;
+        dataBytes += imageSizes[i];
+        maxBytes = std::max(maxBytes, imageSizes[i]);
       }
     }
-    else //open cvs hav BGR color order!
+  }
+
+  //the staging slots hold batch_size of the largest images of all ranks
+  imageBytes_ = maxBytes;
+  if (encoded_)
+  {
+    SUCCESS_OR_DIE( gaspi_allreduce(&maxBytes, &imageBytes_, 1, GASPI_OP_MAX,
+        GASPI_TYPE_LONG, GASPI_GROUP_ALL, GASPI_BLOCK));
+    LOG(INFO) << "Rank " << currentRank << ": " << samplesPerRank_*imageSize
+        << " bytes encoded to " << dataBytes << " bytes";
+  }
+  header.dataBytes = indexBytes + dataBytes;
+  header.maxImageBytes = maxBytes;
+  //page aligned, a cache is mapped in front of the index of all ranks and
+  //the staging slots, which the other ranks write and read
+  indexOffset_ = (header.dataBytes + pageSize-1) / pageSize * pageSize;
+  stagingOffset_ = indexOffset_ + (encoded_ ? numRanks*indexBytes : 0);
+  const long segmentSize = stagingOffset_+(prefetchDepth_+1)*batch_size*imageBytes_*sizeof(uint8_t);
+
+  if (fd >= 0)
+  {
+    //register the cache with GPI-2 as it is
+    segment_0_P_ = MapCache(fd, header.dataBytes, segmentSize);
+    mappedBytes_ = segmentSize;
+    SUCCESS_OR_DIE(
+          gaspi_segment_use( segment_id_, segment_0_P_, segmentSize, GASPI_GROUP_ALL,
+              GASPI_BLOCK, 0)
+    );
+  }
+  else
+  {
+    //allocate global mem: n storage batches + index + staging slots for remote batches
+    SUCCESS_OR_DIE(
+          gaspi_segment_create( segment_id_, segmentSize, GASPI_GROUP_ALL,
+              GASPI_BLOCK, GASPI_MEM_INITIALIZED)
+    );
+
+    //get pointer to global mem    
+    SUCCESS_OR_DIE(
+        gaspi_segment_ptr (segment_id_, &segment_0_P_)
+    );
+  }
+
+  segmentCreated_ = true;
+
+  //get local pointer to segment
+  rawData_ = (uint8_t*) segment_0_P_;
+  imageIndex_ = (long*) (rawData_ + indexOffset_);
+
+  if (fd < 0 && encoded_)
+  {
+    long* index = (long*) rawData_;
+    index[0] = indexBytes;
+    for (long i = 0; i < samplesPerRank_; ++i)
+      index[i+1] = index[i] + imageSizes[i];
+    for (long c = 0; c < chunkData.size(); ++c)
     {
-        uint8_t r,g,b;
-        for (long e=0;e<imageSize;++e,++pos)
-        {
-                inFile.read(reinterpret_cast<char*>(&r),sizeof(uint8_t));
-                inFile.read(reinterpret_cast<char*>(&g),sizeof(uint8_t));
-                inFile.read(reinterpret_cast<char*>(&b),sizeof(uint8_t));
-
-                rawData_[pos]=(Dtype)b;
-                pos++;e++;
-                rawData_[pos]=(Dtype)g;
-                pos++;e++;
-                rawData_[pos]=(Dtype)r;
-        }
+      std::copy(chunkData[c].begin(), chunkData[c].end(),
+          rawData_ + index[c*LoadChunkSamples()]);
+      std::vector<uint8_t>().swap(chunkData[c]);
     }
   }
-
-  inFile.close();
+  else if (fd < 0)
+  {
+    //large reads of the mapped file on all threads straight into the segment
+    ThreadPool pool(this->transform_param_.num_threads());
+    pool.Run((samplesPerRank_+LoadChunkSamples()-1) / LoadChunkSamples(),
+        boost::bind(&ParallelInMemDataLayer<Dtype>::LoadChunk, this,
+        sourceFile.get(), firstSample, _1, _2));
+  }
+  if (fd < 0 && !cacheFile.empty())
+    WriteCache(cacheFile, header);
+  if (fd >= 0)
+    close(fd);
+  if (encoded_)
+    std::copy((long*) rawData_, (long*) rawData_ + samplesPerRank_+1,
+        imageIndex_ + currentRank*(samplesPerRank_+1));
+  load_timer.Stop();
+  LOG(INFO) << "Rank " << currentRank << ": loaded " << header.dataBytes
+      << " bytes " << ((fd >= 0) ? "from cache " : "") << "in "
+      << load_timer.Seconds() << " s";
+
+  if (encoded_)
+    ExchangeIndex();
+  //the other ranks read from the segment from their first batch on
+  SUCCESS_OR_DIE( gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
 
   vector<int> top_shape(4);
   top_shape[0]=1;
@@ -179,12 +316,6 @@ void ParallelInMemDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& b
     this->prefetch_[i]->label_.Reshape(label_shape);
   }
 
-/*
-  label_id_ = (currentRank+1)*samplesPerRank_;
-  if (label_id_>=maxLabel_)
-        label_id_=0;
-*/
-
 }
 
 // This function is called on prefetch thread
@@ -223,89 +354,357 @@ void ParallelInMemDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   top_shape[0] = batch_size;
   batch->data_.Reshape(top_shape);
 
-  Dtype* prefetch_data = batch->data_.mutable_cpu_data();
   Dtype* prefetch_label = batch->label_.mutable_cpu_data();
 
-  //compute rank of target batch
-  long batchId = label_id_ / batch_size;
-  gaspi_rank_t sRank = batchId / batchesPerRank_;
-  long sbatchId = batchId - sRank*batchesPerRank_;
-  long lbatchId = batchId - currentRank*batchesPerRank_;
-  long sOffset = sbatchId*batch_size*imageSize*sizeof(uint8_t);
-
-  //std::cout<<"BATCH "<<currentRank<<" "<<label_id_<<" "<<batchId<<" "<<sRank<<" "<<sbatchId<<" "<<std::endl;
-
-  //get local pointer to segment
-  rawData_ = (uint8_t*) segment_0_P_;
-  if (sRank == currentRank) //data is local
+  //start reading this and the next prefetchDepth_ batches
+  for (; readCount_ <= loadCount_+prefetchDepth_; ++readCount_)
   {
-	rawData_+= lbatchId*batch_size*imageSize*sizeof(uint8_t);
+	ReadBatch(readCount_);
   }
-  else //get data first
+
+  //wait for the remote images
+  currentSlot_ = loadCount_ % (prefetchDepth_+1);
+  for (long read = 0; read < slotReads_[currentSlot_]; ++read)
   {
+	gaspi_notification_id_t id;
+	gaspi_notification_t value;
 	SUCCESS_OR_DIE(
-		gaspi_read(segment_id_, samplesPerRank_*imageSize*sizeof(uint8_t), sRank, segment_id_, sOffset,
-			batch_size*imageSize*sizeof(uint8_t),qID_, GASPI_BLOCK)
+		GPITrace::NotifyWaitsome(segment_id_, currentSlot_*batch_size + read, 1,
+		    &id, GASPI_BLOCK)
+	);
+	SUCCESS_OR_DIE(
+		gaspi_notify_reset(segment_id_, id, &value)
 	);
-	SUCCESS_OR_LOG(
-        	gaspi_wait(qID_, GASPI_BLOCK)
-   	);
-
-	rawData_+=samplesPerRank_*imageSize*sizeof(uint8_t);
-	
   }
 
-
   // get batch
   for (long item_id = 0; item_id < batch_size; ++item_id) 
   {
-    // get a blob
-    int offset = batch->data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(prefetch_data + offset);
- 
+    prefetch_label[item_id] = itemLabels_[currentSlot_][item_id];
+  }
+
+ this->TransformItems(batch, batch_size);
+ //the staging slot is free for the read of batch loadCount_+prefetchDepth_+1
+ loadCount_++;
+
+ batch_timer.Stop();
+ DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
+  
+}
+
+template <typename Dtype>
+void ParallelInMemDataLayer<Dtype>::ReadBatch(long load) {
+  const int batch_size = this->layer_param_.parallel_inmem_data_param().batch_size();
+  const long slot = load % (prefetchDepth_+1);
+
+  //the batches follow each other in the global order, starting with the
+  //first batch of this rank
+  const long numBatches = maxLabel_ / batch_size;
+  const long position = ((currentRank_*batchesPerRank_ + load) % numBatches)
+      * batch_size;
+  const bool shuffle = this->layer_param_.parallel_inmem_data_param().shuffle();
+  if (shuffle && load / batchesPerRank_ != shuffleEpoch_)
+  {
+    shuffleEpoch_ = load / batchesPerRank_;
+    ShuffleImages();
+  }
+
+  //the images ordered by their owner and their place there
+  std::vector<std::pair<long, int> > samples(batch_size);
+  for (int item_id = 0; item_id < batch_size; ++item_id)
+  {
+    const long sample = shuffle ? order_[position+item_id] : position+item_id;
+    samples[item_id] = std::make_pair(sample, item_id);
+    itemLabels_[slot][item_id] = Labels_[sample];
+  }
+  std::sort(samples.begin(), samples.end());
+
+  //local images are used in place, remote ones are staged in this order
+  std::vector<long>& offsets = itemOffsets_[slot];
+  std::vector<long>& sizes = itemSizes_[slot];
+  const long slotOffset = stagingOffset_ + slot*batch_size*imageBytes_;
+  long staged = 0; //bytes
+  long reads = 0;
+  for (int i = 0; i < batch_size; )
+  {
+    const long sample = samples[i].first;
+    const gaspi_rank_t sRank = sample / samplesPerRank_;
+    const long local = sample - sRank*samplesPerRank_;
+    const long sOffset = ImageOffset(sRank, local);
+    if (sRank == currentRank_)
+    {
+      offsets[samples[i].second] = sOffset;
+      sizes[samples[i].second] = ImageOffset(sRank, local+1) - sOffset;
+      ++i;
+      continue;
+    }
+
+    //coalesce the images stored one after the other on sRank
+    long run = 0;
+    for (; i+run < batch_size && samples[i+run].first == sample+run
+        && (sample+run) / samplesPerRank_ == sRank; ++run)
+    {
+      const long begin = ImageOffset(sRank, local+run);
+      offsets[samples[i+run].second] = slotOffset + staged + begin - sOffset;
+      sizes[samples[i+run].second] = ImageOffset(sRank, local+run+1) - begin;
+    }
+    const long runBytes = ImageOffset(sRank, local+run) - sOffset;
+
+    //the completed reads stay in the queue until gaspi_wait
+    gaspi_number_t entries;
+    gaspi_number_t queueSizeMax;
+    SUCCESS_OR_DIE( gaspi_queue_size(qID_, &entries));
+    SUCCESS_OR_DIE( gaspi_queue_size_max(&queueSizeMax));
+    if (entries+1 >= queueSizeMax)
+    {
+      SUCCESS_OR_DIE( gaspi_wait(qID_, GASPI_BLOCK));
+    }
+    SUCCESS_OR_DIE(
+        gaspi_read_notify(segment_id_, slotOffset + staged,
+            sRank, segment_id_, sOffset, runBytes,
+            slot*batch_size + reads, qID_, GASPI_BLOCK)
+    );
+    staged += runBytes;
+    i += run;
+    ++reads;
+  }
+  slotReads_[slot] = reads;
+}
+
+template <typename Dtype>
+void ParallelInMemDataLayer<Dtype>::transform_item(Batch<Dtype>* batch,
+    int item_id, int thread, DataTransformer<Dtype>* transformer,
+    Blob<Dtype>* transformed_data) {
+  const ParallelInMemDataParameter& parallel_inmem_data_param =
+      this->layer_param_.parallel_inmem_data_param();
+  const int new_height = parallel_inmem_data_param.new_height();
+  const int new_width = parallel_inmem_data_param.new_width();
+  const int numChannels = parallel_inmem_data_param.is_color() ? 3 : 1;
+
+  // get a blob
+  int offset = batch->data_.offset(item_id);
+  transformed_data->set_cpu_data(batch->data_.mutable_cpu_data() + offset);
+
+  //the segment holds the images in BGR order
+  uint8_t* imageData = rawData_ + itemOffsets_[currentSlot_][item_id];
+  if (encoded_)
+  {
+    cv::Mat encoded(1, itemSizes_[currentSlot_][item_id], CV_8UC1, imageData);
+    cv::Mat cv_img = cv::imdecode(encoded, (numChannels==1) ?
+        CV_LOAD_IMAGE_GRAYSCALE : CV_LOAD_IMAGE_COLOR);
+    CHECK(cv_img.data) << "Could not decode image " << item_id;
+    transformer->Transform(cv_img, transformed_data);
+  }
+  else
+  {
+    cv::Mat cv_img(new_height, new_width, (numChannels==1) ? CV_8UC1 : CV_8UC3,
+        imageData);
+    transformer->Transform(cv_img, transformed_data);
+  }
+}
+
+template <typename Dtype>
+long ParallelInMemDataLayer<Dtype>::ImageOffset(gaspi_rank_t rank,
+    long local) const {
+  if (encoded_)
+    return imageIndex_[rank*(samplesPerRank_+1) + local];
+  return local*imageBytes_;
+}
+
+template <typename Dtype>
+void ParallelInMemDataLayer<Dtype>::ExchangeIndex() {
+  gaspi_rank_t numRanks=0;
+  SUCCESS_OR_DIE( gaspi_proc_num(&numRanks));
+  gaspi_number_t notificationNum;
+  SUCCESS_OR_DIE( gaspi_notification_num(&notificationNum));
+  CHECK_LE(numRanks, notificationNum);
+
+  //every rank writes its part of the index to all others
+  const long indexOffset = indexOffset_
+      + currentRank_*(samplesPerRank_+1)*sizeof(long);
+  for (gaspi_rank_t rank = 0; rank < numRanks; ++rank)
+  {
+    if (rank == currentRank_)
+      continue;
+    gaspi_number_t entries;
+    gaspi_number_t queueSizeMax;
+    SUCCESS_OR_DIE( gaspi_queue_size(qID_, &entries));
+    SUCCESS_OR_DIE( gaspi_queue_size_max(&queueSizeMax));
+    if (entries+1 >= queueSizeMax)
+    {
+      SUCCESS_OR_DIE( gaspi_wait(qID_, GASPI_BLOCK));
+    }
+    SUCCESS_OR_DIE(
+        GPITrace::WriteNotify(segment_id_, indexOffset, rank, segment_id_,
+            indexOffset, (samplesPerRank_+1)*sizeof(long), currentRank_, 1,
+            qID_, GASPI_BLOCK)
+    );
+  }
+  SUCCESS_OR_DIE( gaspi_wait(qID_, GASPI_BLOCK));
+  for (long n = 1; n < numRanks; ++n)
+  {
+    gaspi_notification_id_t id;
+    gaspi_notification_t value;
+    SUCCESS_OR_DIE(
+        GPITrace::NotifyWaitsome(segment_id_, 0, numRanks, &id, GASPI_BLOCK)
+    );
+    SUCCESS_OR_DIE(
+        gaspi_notify_reset(segment_id_, id, &value)
+    );
+  }
+}
+
+template <typename Dtype>
+long ParallelInMemDataLayer<Dtype>::LoadChunkSamples() const {
+  //about 64 MB per read
+  const ParallelInMemDataParameter& parallel_inmem_data_param =
+      this->layer_param_.parallel_inmem_data_param();
+  const long sampleSize = parallel_inmem_data_param.headersize()
+      + parallel_inmem_data_param.new_height()*parallel_inmem_data_param.new_width()
+      * (parallel_inmem_data_param.is_color() ? 3 : 1);
+  return std::max(1l, (64l << 20) / sampleSize);
+}
+
+template <typename Dtype>
+void ParallelInMemDataLayer<Dtype>::LoadChunk(const MappedFile* source,
+    long firstSample, int chunk, int thread) {
+  const ParallelInMemDataParameter& parallel_inmem_data_param =
+      this->layer_param_.parallel_inmem_data_param();
+  const long headerSize = parallel_inmem_data_param.headersize();
+  const int new_height = parallel_inmem_data_param.new_height();
+  const int new_width = parallel_inmem_data_param.new_width();
+  const int numChannels = parallel_inmem_data_param.is_color() ? 3 : 1;
+  const long imageSize = new_height*new_width*numChannels;
+  const long sampleSize = headerSize+imageSize;
+  const long begin = chunk*LoadChunkSamples();
+  const long end = std::min(begin+LoadChunkSamples(), samplesPerRank_);
+
+  source->WillNeed((firstSample+begin)*sampleSize, (end-begin)*sampleSize);
+  for (long i = begin; i < end; ++i)
+  {
+    const uint8_t* in = source->data() + (firstSample+i)*sampleSize + headerSize;
+    uint8_t* out = rawData_ + i*imageSize;
     if (numChannels==1)
-    {   
-      cv::Mat cv_img(new_height, new_width, CV_8UC1, rawData_);
-      this->data_transformer_->Transform(cv_img, &(this->transformed_data_));
+    {
+      std::copy(in, in+imageSize, out);
     }
     else //open cvs hav BGR color order!
     {
-        cv::Mat cv_img(new_height, new_width, CV_8UC3, rawData_);
-
-	/*
-        if(Labels_[label_id_]==10)
-        {
-                std::stringstream tmpName;
-                tmpName <<"/home/keuper/tmp/tmp_"<<currentRank<<"_"<<sRank<<"_"<<label_id_<<"_"<<Labels_[label_id_]<<".png";
-                cv::imwrite( tmpName.str(), cv_img);
-        }
-	*/
-
-	this->data_transformer_->Transform(cv_img, &(this->transformed_data_));
-        
+      const cv::Mat in_img(new_height, new_width, CV_8UC3,
+          const_cast<uint8_t*>(in));
+      cv::Mat out_img(new_height, new_width, CV_8UC3, out);
+      cv::cvtColor(in_img, out_img, cv::COLOR_RGB2BGR);
     }
-    
-    rawData_+=imageSize*sizeof(uint8_t);
-	 
-    prefetch_label[item_id] = Labels_[label_id_];
+  }
+}
 
-    label_id_++;	
-    if (label_id_ >= maxLabel_)
+template <typename Dtype>
+void ParallelInMemDataLayer<Dtype>::EncodeChunk(const MappedFile* source,
+    long firstSample, std::vector<std::vector<uint8_t> >* data,
+    std::vector<long>* sizes, int chunk, int thread) {
+  const ParallelInMemDataParameter& parallel_inmem_data_param =
+      this->layer_param_.parallel_inmem_data_param();
+  const int new_height = parallel_inmem_data_param.new_height();
+  const int new_width = parallel_inmem_data_param.new_width();
+  const long headerSize = parallel_inmem_data_param.headersize();
+  const int numChannels = parallel_inmem_data_param.is_color() ? 3 : 1;
+  const long imageSize = new_height*new_width*numChannels;
+  const long sampleSize = headerSize+imageSize;
+  const string& encodeType = parallel_inmem_data_param.encode_type();
+  const long begin = chunk*LoadChunkSamples();
+  const long end = std::min(begin+LoadChunkSamples(), samplesPerRank_);
+
+  source->WillNeed((firstSample+begin)*sampleSize, (end-begin)*sampleSize);
+  std::vector<uint8_t> bgr(imageSize);
+  std::vector<uchar> buf;
+  for (long i = begin; i < end; ++i)
+  {
+    uint8_t* in = const_cast<uint8_t*>(source->data())
+        + (firstSample+i)*sampleSize + headerSize;
+    cv::Mat cv_img(new_height, new_width, (numChannels==1) ? CV_8UC1 : CV_8UC3, in);
+    if (numChannels==3) //open cvs hav BGR color order!
     {
-	label_id_=0;
-    } 
+      cv::Mat bgr_img(new_height, new_width, CV_8UC3, &bgr[0]);
+      cv::cvtColor(cv_img, bgr_img, cv::COLOR_RGB2BGR);
+      cv_img = bgr_img;
+    }
+    CHECK(cv::imencode("."+encodeType, cv_img, buf))
+        << "Could not encode sample " << firstSample+i << " as " << encodeType;
+    (*data)[chunk].insert((*data)[chunk].end(), buf.begin(), buf.end());
+    (*sizes)[i] = buf.size();
+  }
+}
 
- }
+template <typename Dtype>
+int ParallelInMemDataLayer<Dtype>::OpenCache(const string& filename,
+    ShardCacheHeader* header) {
+  const int fd = open(filename.c_str(), O_RDWR);
+  if (fd < 0)
+    return -1;
+  ShardCacheHeader cached;
+  struct stat cacheStat;
+  if (pread(fd, &cached, sizeof(cached), 0) != sizeof(cached)
+      || fstat(fd, &cacheStat) != 0
+      || memcmp(&cached, header, offsetof(ShardCacheHeader, dataBytes)) != 0
+      || cacheStat.st_size < sysconf(_SC_PAGESIZE) + cached.dataBytes)
+  {
+    LOG(INFO) << "Shard cache " << filename << " does not match, reading the source";
+    close(fd);
+    return -1;
+  }
+  header->dataBytes = cached.dataBytes;
+  header->maxImageBytes = cached.maxImageBytes;
+  return fd;
+}
 
- batch_timer.Stop();
- if (currentRank==0)
-        std::cout<<"BATCH time: "<<batch_timer.MilliSeconds() << " ms."<<std::endl; 
-  
+template <typename Dtype>
+void* ParallelInMemDataLayer<Dtype>::MapCache(int fd, long dataBytes,
+    long segmentSize) {
+  //anonymous memory for the index of all ranks and the staging slots, the
+  //cache is mapped over its front and only read by the other ranks
+  void* memory = mmap(NULL, segmentSize, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  CHECK(memory != MAP_FAILED) << "Could not map " << segmentSize << " bytes";
+  if (dataBytes > 0)
+  {
+    //shared, the pages of the page cache are registered without copy
+    CHECK(mmap(memory, dataBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+        fd, sysconf(_SC_PAGESIZE)) != MAP_FAILED) << "Could not map the shard cache";
+  }
+  return memory;
+}
+
+template <typename Dtype>
+void ParallelInMemDataLayer<Dtype>::WriteCache(const string& filename,
+    const ShardCacheHeader& header) {
+  //the header fills the first page, the segment content follows
+  const string tmpName = filename + ".tmp";
+  std::vector<char> page(sysconf(_SC_PAGESIZE), 0);
+  memcpy(&page[0], &header, sizeof(header));
+  std::ofstream out(tmpName.c_str(), std::ios::binary);
+  out.write(&page[0], page.size());
+  out.write(reinterpret_cast<const char*>(rawData_), header.dataBytes);
+  out.close();
+  if (!out || rename(tmpName.c_str(), filename.c_str()) != 0)
+  {
+    LOG(WARNING) << "Could not write the shard cache " << filename;
+    unlink(tmpName.c_str());
+    return;
+  }
+  LOG(INFO) << "Wrote the shard cache " << filename;
 }
 
 template <typename Dtype>
 void ParallelInMemDataLayer<Dtype>::ShuffleImages() {
-//empty dummy to meet enheritance conditions
+  //all ranks draw the same order, it only depends on the seed and the epoch
+  const unsigned int prefetch_rng_seed =
+      this->layer_param_.parallel_inmem_data_param().shuffle_seed() + shuffleEpoch_;
+  prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
+  caffe::rng_t* prefetch_rng =
+      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+  for (long i = 0; i < order_.size(); ++i)
+    order_[i] = i;
+  shuffle(order_.begin(), order_.end(), prefetch_rng);
 }
 
 
@@ -1,9 +1,12 @@
+#include <boost/bind.hpp>
+
 #include <algorithm>
 #include <cfloat>
 #include <vector>
 
 #include "caffe/layers/pooling_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 //#include <GASPI_Ext.h>
 
@@ -131,7 +134,7 @@ void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  const int top_count = top[0]->count();
+  const int num_planes = bottom[0]->num() * channels_;
   // We'll output the mask to top[1] if it's of size >1.
   const bool use_top_mask = top.size() > 1;
   int* mask = NULL;  // suppress warnings about uninitalized variables
@@ -140,91 +143,119 @@ void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   // loop to save time, although this results in more code.
   switch (this->layer_param_.pooling_param().pool()) {
   case PoolingParameter_PoolMethod_MAX:
-    // Initialize
     if (use_top_mask) {
       top_mask = top[1]->mutable_cpu_data();
-      caffe_set(top_count, Dtype(-1), top_mask);
     } else {
       mask = max_idx_.mutable_cpu_data();
-      caffe_set(top_count, -1, mask);
     }
-    caffe_set(top_count, Dtype(-FLT_MAX), top_data);
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_);
-            int wend = min(wstart + kernel_w_, width_);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            const int pool_index = ph * pooled_width_ + pw;
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                const int index = h * width_ + w;
-                if (bottom_data[index] > top_data[pool_index]) {
-                  top_data[pool_index] = bottom_data[index];
-                  if (use_top_mask) {
-                    top_mask[pool_index] = static_cast<Dtype>(index);
-                  } else {
-                    mask[pool_index] = index;
-                  }
-                }
+    caffe_parallel_for(num_planes, 1,
+        boost::bind(&PoolingLayer<Dtype>::MaxForwardPlanes_cpu, this,
+                    bottom_data, top_data, mask, top_mask, _1, _2));
+    break;
+  case PoolingParameter_PoolMethod_AVE:
+    caffe_parallel_for(num_planes, 1,
+        boost::bind(&PoolingLayer<Dtype>::AveForwardPlanes_cpu, this,
+                    bottom_data, top_data, _1, _2));
+    break;
+  case PoolingParameter_PoolMethod_STOCHASTIC:
+    NOT_IMPLEMENTED;
+    break;
+  default:
+    LOG(FATAL) << "Unknown pooling method.";
+  }
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::MaxForwardPlanes_cpu(const Dtype* bottom_data,
+      Dtype* top_data, int* mask, Dtype* top_mask, int begin, int end) {
+  const int bottom_offset = height_ * width_;
+  const int top_offset = pooled_height_ * pooled_width_;
+  const bool use_top_mask = top_mask != NULL;
+  bottom_data += begin * bottom_offset;
+  top_data += begin * top_offset;
+  if (use_top_mask) {
+    top_mask += begin * top_offset;
+  } else {
+    mask += begin * top_offset;
+  }
+  // Initialize
+  const int top_count = (end - begin) * top_offset;
+  if (use_top_mask) {
+    caffe_set(top_count, Dtype(-1), top_mask);
+  } else {
+    caffe_set(top_count, -1, mask);
+  }
+  caffe_set(top_count, Dtype(-FLT_MAX), top_data);
+  // The main loop
+  for (int plane = begin; plane < end; ++plane) {
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        int hstart = ph * stride_h_ - pad_h_;
+        int wstart = pw * stride_w_ - pad_w_;
+        int hend = min(hstart + kernel_h_, height_);
+        int wend = min(wstart + kernel_w_, width_);
+        hstart = max(hstart, 0);
+        wstart = max(wstart, 0);
+        const int pool_index = ph * pooled_width_ + pw;
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            const int index = h * width_ + w;
+            if (bottom_data[index] > top_data[pool_index]) {
+              top_data[pool_index] = bottom_data[index];
+              if (use_top_mask) {
+                top_mask[pool_index] = static_cast<Dtype>(index);
+              } else {
+                mask[pool_index] = index;
               }
             }
           }
         }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
-        } else {
-          mask += top[0]->offset(0, 1);
-        }
       }
     }
-    break;
-  case PoolingParameter_PoolMethod_AVE:
-    for (int i = 0; i < top_count; ++i) {
-      top_data[i] = 0;
+    // compute offset
+    bottom_data += bottom_offset;
+    top_data += top_offset;
+    if (use_top_mask) {
+      top_mask += top_offset;
+    } else {
+      mask += top_offset;
     }
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                top_data[ph * pooled_width_ + pw] +=
-                    bottom_data[h * width_ + w];
-              }
-            }
-            top_data[ph * pooled_width_ + pw] /= pool_size;
+  }
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::AveForwardPlanes_cpu(const Dtype* bottom_data,
+      Dtype* top_data, int begin, int end) {
+  const int bottom_offset = height_ * width_;
+  const int top_offset = pooled_height_ * pooled_width_;
+  bottom_data += begin * bottom_offset;
+  top_data += begin * top_offset;
+  caffe_set((end - begin) * top_offset, Dtype(0), top_data);
+  // The main loop
+  for (int plane = begin; plane < end; ++plane) {
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        int hstart = ph * stride_h_ - pad_h_;
+        int wstart = pw * stride_w_ - pad_w_;
+        int hend = min(hstart + kernel_h_, height_ + pad_h_);
+        int wend = min(wstart + kernel_w_, width_ + pad_w_);
+        int pool_size = (hend - hstart) * (wend - wstart);
+        hstart = max(hstart, 0);
+        wstart = max(wstart, 0);
+        hend = min(hend, height_);
+        wend = min(wend, width_);
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            top_data[ph * pooled_width_ + pw] +=
+                bottom_data[h * width_ + w];
           }
         }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
+        top_data[ph * pooled_width_ + pw] /= pool_size;
       }
     }
-    break;
-  case PoolingParameter_PoolMethod_STOCHASTIC:
-    NOT_IMPLEMENTED;
-    break;
-  default:
-    LOG(FATAL) << "Unknown pooling method.";
+    // compute offset
+    bottom_data += bottom_offset;
+    top_data += top_offset;
   }
 }
 
@@ -236,71 +267,28 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   }
   const Dtype* top_diff = top[0]->cpu_diff();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  // Different pooling methods. We explicitly do the switch outside the for
-  // loop to save time, although this results in more codes.
-  caffe_set(bottom[0]->count(), Dtype(0), bottom_diff);
+  const int num_planes = top[0]->num() * channels_;
   // We'll output the mask to top[1] if it's of size >1.
   const bool use_top_mask = top.size() > 1;
   const int* mask = NULL;  // suppress warnings about uninitialized variables
   const Dtype* top_mask = NULL;
+  // Different pooling methods. We explicitly do the switch outside the for
+  // loop to save time, although this results in more codes.
   switch (this->layer_param_.pooling_param().pool()) {
   case PoolingParameter_PoolMethod_MAX:
-    // The main loop
     if (use_top_mask) {
       top_mask = top[1]->cpu_data();
     } else {
       mask = max_idx_.cpu_data();
     }
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            const int index = ph * pooled_width_ + pw;
-            const int bottom_index =
-                use_top_mask ? top_mask[index] : mask[index];
-//todo bottom_index can be less then 0, should be debugged further
-            bottom_diff[bottom_index] += top_diff[index];
-            //if (bottom_index<0) gaspi_printf("NoNo %d\n", bottom_index);
-          }
-        }
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
-        } else {
-          mask += top[0]->offset(0, 1);
-        }
-      }
-    }
+    caffe_parallel_for(num_planes, 1,
+        boost::bind(&PoolingLayer<Dtype>::MaxBackwardPlanes_cpu, this,
+                    top_diff, mask, top_mask, bottom_diff, _1, _2));
     break;
   case PoolingParameter_PoolMethod_AVE:
-    // The main loop
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                bottom_diff[h * width_ + w] +=
-                  top_diff[ph * pooled_width_ + pw] / pool_size;
-              }
-            }
-          }
-        }
-        // offset
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
-      }
-    }
+    caffe_parallel_for(num_planes, 1,
+        boost::bind(&PoolingLayer<Dtype>::AveBackwardPlanes_cpu, this,
+                    top_diff, bottom_diff, _1, _2));
     break;
   case PoolingParameter_PoolMethod_STOCHASTIC:
     NOT_IMPLEMENTED;
@@ -310,6 +298,78 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   }
 }
 
+template <typename Dtype>
+void PoolingLayer<Dtype>::MaxBackwardPlanes_cpu(const Dtype* top_diff,
+      const int* mask, const Dtype* top_mask, Dtype* bottom_diff,
+      int begin, int end) {
+  const int bottom_offset = height_ * width_;
+  const int top_offset = pooled_height_ * pooled_width_;
+  const bool use_top_mask = top_mask != NULL;
+  top_diff += begin * top_offset;
+  bottom_diff += begin * bottom_offset;
+  if (use_top_mask) {
+    top_mask += begin * top_offset;
+  } else {
+    mask += begin * top_offset;
+  }
+  caffe_set((end - begin) * bottom_offset, Dtype(0), bottom_diff);
+  // The main loop
+  for (int plane = begin; plane < end; ++plane) {
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        const int index = ph * pooled_width_ + pw;
+        const int bottom_index =
+            use_top_mask ? top_mask[index] : mask[index];
+//todo bottom_index can be less then 0, should be debugged further
+        bottom_diff[bottom_index] += top_diff[index];
+        //if (bottom_index<0) gaspi_printf("NoNo %d\n", bottom_index);
+      }
+    }
+    bottom_diff += bottom_offset;
+    top_diff += top_offset;
+    if (use_top_mask) {
+      top_mask += top_offset;
+    } else {
+      mask += top_offset;
+    }
+  }
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::AveBackwardPlanes_cpu(const Dtype* top_diff,
+      Dtype* bottom_diff, int begin, int end) {
+  const int bottom_offset = height_ * width_;
+  const int top_offset = pooled_height_ * pooled_width_;
+  top_diff += begin * top_offset;
+  bottom_diff += begin * bottom_offset;
+  caffe_set((end - begin) * bottom_offset, Dtype(0), bottom_diff);
+  // The main loop
+  for (int plane = begin; plane < end; ++plane) {
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        int hstart = ph * stride_h_ - pad_h_;
+        int wstart = pw * stride_w_ - pad_w_;
+        int hend = min(hstart + kernel_h_, height_ + pad_h_);
+        int wend = min(wstart + kernel_w_, width_ + pad_w_);
+        int pool_size = (hend - hstart) * (wend - wstart);
+        hstart = max(hstart, 0);
+        wstart = max(wstart, 0);
+        hend = min(hend, height_);
+        wend = min(wend, width_);
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            bottom_diff[h * width_ + w] +=
+              top_diff[ph * pooled_width_ + pw] / pool_size;
+          }
+        }
+      }
+    }
+    // offset
+    bottom_diff += bottom_offset;
+    top_diff += top_offset;
+  }
+}
+
 
 #ifdef CPU_ONLY
 STUB_GPU(PoolingLayer);
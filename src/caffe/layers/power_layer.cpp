@@ -1,7 +1,10 @@
+#include <boost/bind.hpp>
+
 #include <vector>
 
 #include "caffe/layers/power_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -28,6 +31,17 @@ void PowerLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     return;
   }
   const Dtype* bottom_data = bottom[0]->cpu_data();
+  caffe_parallel_for(count, kElementwiseGrain,
+      boost::bind(&PowerLayer<Dtype>::ForwardRange_cpu, this,
+                  bottom_data, top_data, _1, _2));
+}
+
+template <typename Dtype>
+void PowerLayer<Dtype>::ForwardRange_cpu(const Dtype* bottom_data,
+    Dtype* top_data, int begin, int end) {
+  const int count = end - begin;
+  bottom_data += begin;
+  top_data += begin;
   caffe_copy(count, bottom_data, top_data);
   if (scale_ != Dtype(1)) {
     caffe_scal(count, scale_, top_data);
@@ -48,47 +62,60 @@ void PowerLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const int count = bottom[0]->count();
     const Dtype* top_diff = top[0]->cpu_diff();
-    if (diff_scale_ == Dtype(0) || power_ == Dtype(1)) {
-      caffe_set(count, diff_scale_, bottom_diff);
+    const Dtype* bottom_data = bottom[0]->cpu_data();
+    const Dtype* top_data = top[0]->cpu_data();
+    caffe_parallel_for(count, kElementwiseGrain,
+        boost::bind(&PowerLayer<Dtype>::BackwardRange_cpu, this,
+                    bottom_data, top_data, top_diff, bottom_diff, _1, _2));
+  }
+}
+
+template <typename Dtype>
+void PowerLayer<Dtype>::BackwardRange_cpu(const Dtype* bottom_data,
+    const Dtype* top_data, const Dtype* top_diff, Dtype* bottom_diff,
+    int begin, int end) {
+  const int count = end - begin;
+  bottom_data += begin;
+  top_data += begin;
+  top_diff += begin;
+  bottom_diff += begin;
+  if (diff_scale_ == Dtype(0) || power_ == Dtype(1)) {
+    caffe_set(count, diff_scale_, bottom_diff);
+  } else {
+    // Compute dy/dx = scale * power * (shift + scale * x)^(power - 1)
+    //               = diff_scale * y / (shift + scale * x)
+    if (power_ == Dtype(2)) {
+      // Special case for y = (shift + scale * x)^2
+      //     -> dy/dx = 2 * scale * (shift + scale * x)
+      //              = diff_scale * shift + diff_scale * scale * x
+      caffe_cpu_axpby(count, diff_scale_ * scale_, bottom_data,
+          Dtype(0), bottom_diff);
+      if (shift_ != Dtype(0)) {
+        caffe_add_scalar(count, diff_scale_ * shift_, bottom_diff);
+      }
+    } else if (shift_ == Dtype(0)) {
+      // Special case for y = (scale * x)^power
+      //     -> dy/dx = scale * power * (scale * x)^(power - 1)
+      //              = scale * power * (scale * x)^power * (scale * x)^(-1)
+      //              = power * y / x
+      caffe_div(count, top_data, bottom_data, bottom_diff);
+      caffe_scal(count, power_, bottom_diff);
     } else {
-      const Dtype* bottom_data = bottom[0]->cpu_data();
-      // Compute dy/dx = scale * power * (shift + scale * x)^(power - 1)
-      //               = diff_scale * y / (shift + scale * x)
-      if (power_ == Dtype(2)) {
-        // Special case for y = (shift + scale * x)^2
-        //     -> dy/dx = 2 * scale * (shift + scale * x)
-        //              = diff_scale * shift + diff_scale * scale * x
-        caffe_cpu_axpby(count, diff_scale_ * scale_, bottom_data,
-            Dtype(0), bottom_diff);
-        if (shift_ != Dtype(0)) {
-          caffe_add_scalar(count, diff_scale_ * shift_, bottom_diff);
-        }
-      } else if (shift_ == Dtype(0)) {
-        // Special case for y = (scale * x)^power
-        //     -> dy/dx = scale * power * (scale * x)^(power - 1)
-        //              = scale * power * (scale * x)^power * (scale * x)^(-1)
-        //              = power * y / x
-        const Dtype* top_data = top[0]->cpu_data();
-        caffe_div(count, top_data, bottom_data, bottom_diff);
-        caffe_scal(count, power_, bottom_diff);
-      } else {
-        caffe_copy(count, bottom_data, bottom_diff);
-        if (scale_ != Dtype(1)) {
-          caffe_scal(count, scale_, bottom_diff);
-        }
-        if (shift_ != Dtype(0)) {
-          caffe_add_scalar(count, shift_, bottom_diff);
-        }
-        const Dtype* top_data = top[0]->cpu_data();
-        caffe_div<Dtype>(count, top_data, bottom_diff, bottom_diff);
-        if (diff_scale_ != Dtype(1)) {
-          caffe_scal(count, diff_scale_, bottom_diff);
-        }
+      caffe_copy(count, bottom_data, bottom_diff);
+      if (scale_ != Dtype(1)) {
+        caffe_scal(count, scale_, bottom_diff);
+      }
+      if (shift_ != Dtype(0)) {
+        caffe_add_scalar(count, shift_, bottom_diff);
+      }
+      caffe_div<Dtype>(count, top_data, bottom_diff, bottom_diff);
+      if (diff_scale_ != Dtype(1)) {
+        caffe_scal(count, diff_scale_, bottom_diff);
       }
     }
-    if (diff_scale_ != Dtype(0)) {
-      caffe_mul(count, top_diff, bottom_diff, bottom_diff);
-    }
+  }
+  if (diff_scale_ != Dtype(0)) {
+    caffe_mul(count, top_diff, bottom_diff, bottom_diff);
   }
 }
 
@@ -1,3 +1,5 @@
+#include <boost/bind.hpp>
+
 #include <algorithm>
 #include <vector>
 
@@ -5,6 +7,7 @@
 
 #include "caffe/layers/neuron_layer.hpp"
 #include "caffe/layers/prelu_layer.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -78,10 +81,19 @@ void PReLULayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     caffe_copy(count, bottom_data, bottom_memory_.mutable_cpu_data());
   }
 
+  caffe_parallel_for(count, kElementwiseGrain,
+      boost::bind(&PReLULayer<Dtype>::ForwardRange_cpu, this, bottom_data,
+                  slope_data, top_data, channels, dim, _1, _2));
+}
+
+template <typename Dtype>
+void PReLULayer<Dtype>::ForwardRange_cpu(const Dtype* bottom_data,
+    const Dtype* slope_data, Dtype* top_data, int channels, int dim,
+    int begin, int end) {
   // if channel_shared, channel index in the following computation becomes
   // always zero.
   const int div_factor = channel_shared_ ? channels : 1;
-  for (int i = 0; i < count; ++i) {
+  for (int i = begin; i < end; ++i) {
     int c = (i / dim) % channels / div_factor;
     top_data[i] = std::max(bottom_data[i], Dtype(0))
         + slope_data[c] * std::min(bottom_data[i], Dtype(0));
@@ -122,11 +134,22 @@ void PReLULayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   // Propagate to bottom
   if (propagate_down[0]) {
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-    for (int i = 0; i < count; ++i) {
-      int c = (i / dim) % channels / div_factor;
-      bottom_diff[i] = top_diff[i] * ((bottom_data[i] > 0)
-          + slope_data[c] * (bottom_data[i] <= 0));
-    }
+    caffe_parallel_for(count, kElementwiseGrain,
+        boost::bind(&PReLULayer<Dtype>::BackwardRange_cpu, this,
+                    bottom_data, slope_data, top_diff, bottom_diff,
+                    channels, dim, _1, _2));
+  }
+}
+
+template <typename Dtype>
+void PReLULayer<Dtype>::BackwardRange_cpu(const Dtype* bottom_data,
+    const Dtype* slope_data, const Dtype* top_diff, Dtype* bottom_diff,
+    int channels, int dim, int begin, int end) {
+  const int div_factor = channel_shared_ ? channels : 1;
+  for (int i = begin; i < end; ++i) {
+    int c = (i / dim) % channels / div_factor;
+    bottom_diff[i] = top_diff[i] * ((bottom_data[i] > 0)
+        + slope_data[c] * (bottom_data[i] <= 0));
   }
 }
 
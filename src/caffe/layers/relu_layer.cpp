@@ -1,7 +1,10 @@
+#include <boost/bind.hpp>
+
 #include <algorithm>
 #include <vector>
 
 #include "caffe/layers/relu_layer.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -11,8 +14,16 @@ void ReLULayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const int count = bottom[0]->count();
+  caffe_parallel_for(count, kElementwiseGrain,
+      boost::bind(&ReLULayer<Dtype>::ForwardRange_cpu, this,
+                  bottom_data, top_data, _1, _2));
+}
+
+template <typename Dtype>
+void ReLULayer<Dtype>::ForwardRange_cpu(const Dtype* bottom_data,
+    Dtype* top_data, int begin, int end) {
   Dtype negative_slope = this->layer_param_.relu_param().negative_slope();
-  for (int i = 0; i < count; ++i) {
+  for (int i = begin; i < end; ++i) {
     top_data[i] = std::max(bottom_data[i], Dtype(0))
         + negative_slope * std::min(bottom_data[i], Dtype(0));
   }
@@ -27,11 +38,19 @@ void ReLULayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const Dtype* top_diff = top[0]->cpu_diff();
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const int count = bottom[0]->count();
-    Dtype negative_slope = this->layer_param_.relu_param().negative_slope();
-    for (int i = 0; i < count; ++i) {
-      bottom_diff[i] = top_diff[i] * ((bottom_data[i] > 0)
-          + negative_slope * (bottom_data[i] <= 0));
-    }
+    caffe_parallel_for(count, kElementwiseGrain,
+        boost::bind(&ReLULayer<Dtype>::BackwardRange_cpu, this,
+                    top_diff, bottom_data, bottom_diff, _1, _2));
+  }
+}
+
+template <typename Dtype>
+void ReLULayer<Dtype>::BackwardRange_cpu(const Dtype* top_diff,
+    const Dtype* bottom_data, Dtype* bottom_diff, int begin, int end) {
+  Dtype negative_slope = this->layer_param_.relu_param().negative_slope();
+  for (int i = begin; i < end; ++i) {
+    bottom_diff[i] = top_diff[i] * ((bottom_data[i] > 0)
+        + negative_slope * (bottom_data[i] <= 0));
   }
 }
 
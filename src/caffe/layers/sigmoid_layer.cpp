@@ -1,7 +1,10 @@
+#include <boost/bind.hpp>
+
 #include <cmath>
 #include <vector>
 
 #include "caffe/layers/sigmoid_layer.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -16,7 +19,15 @@ void SigmoidLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const int count = bottom[0]->count();
-  for (int i = 0; i < count; ++i) {
+  caffe_parallel_for(count, kElementwiseGrain,
+      boost::bind(&SigmoidLayer<Dtype>::ForwardRange_cpu, this,
+                  bottom_data, top_data, _1, _2));
+}
+
+template <typename Dtype>
+void SigmoidLayer<Dtype>::ForwardRange_cpu(const Dtype* bottom_data,
+    Dtype* top_data, int begin, int end) {
+  for (int i = begin; i < end; ++i) {
     top_data[i] = sigmoid(bottom_data[i]);
   }
 }
@@ -30,10 +41,18 @@ void SigmoidLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const Dtype* top_diff = top[0]->cpu_diff();
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const int count = bottom[0]->count();
-    for (int i = 0; i < count; ++i) {
-      const Dtype sigmoid_x = top_data[i];
-      bottom_diff[i] = top_diff[i] * sigmoid_x * (1. - sigmoid_x);
-    }
+    caffe_parallel_for(count, kElementwiseGrain,
+        boost::bind(&SigmoidLayer<Dtype>::BackwardRange_cpu, this,
+                    top_data, top_diff, bottom_diff, _1, _2));
+  }
+}
+
+template <typename Dtype>
+void SigmoidLayer<Dtype>::BackwardRange_cpu(const Dtype* top_data,
+    const Dtype* top_diff, Dtype* bottom_diff, int begin, int end) {
+  for (int i = begin; i < end; ++i) {
+    const Dtype sigmoid_x = top_data[i];
+    bottom_diff[i] = top_diff[i] * sigmoid_x * (1. - sigmoid_x);
   }
 }
 
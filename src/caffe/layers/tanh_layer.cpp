@@ -1,9 +1,12 @@
 // TanH neuron activation function layer.
 // Adapted from ReLU layer code written by Yangqing Jia
 
+#include <boost/bind.hpp>
+
 #include <vector>
 
 #include "caffe/layers/tanh_layer.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -13,7 +16,15 @@ void TanHLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const int count = bottom[0]->count();
-  for (int i = 0; i < count; ++i) {
+  caffe_parallel_for(count, kElementwiseGrain,
+      boost::bind(&TanHLayer<Dtype>::ForwardRange_cpu, this,
+                  bottom_data, top_data, _1, _2));
+}
+
+template <typename Dtype>
+void TanHLayer<Dtype>::ForwardRange_cpu(const Dtype* bottom_data,
+    Dtype* top_data, int begin, int end) {
+  for (int i = begin; i < end; ++i) {
     top_data[i] = tanh(bottom_data[i]);
   }
 }
@@ -27,11 +38,19 @@ void TanHLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const Dtype* top_diff = top[0]->cpu_diff();
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const int count = bottom[0]->count();
-    Dtype tanhx;
-    for (int i = 0; i < count; ++i) {
-      tanhx = top_data[i];
-      bottom_diff[i] = top_diff[i] * (1 - tanhx * tanhx);
-    }
+    caffe_parallel_for(count, kElementwiseGrain,
+        boost::bind(&TanHLayer<Dtype>::BackwardRange_cpu, this,
+                    top_data, top_diff, bottom_diff, _1, _2));
+  }
+}
+
+template <typename Dtype>
+void TanHLayer<Dtype>::BackwardRange_cpu(const Dtype* top_data,
+    const Dtype* top_diff, Dtype* bottom_diff, int begin, int end) {
+  Dtype tanhx;
+  for (int i = begin; i < end; ++i) {
+    tanhx = top_data[i];
+    bottom_diff[i] = top_diff[i] * (1 - tanhx * tanhx);
   }
 }
 
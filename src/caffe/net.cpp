@@ -6,10 +6,13 @@
 #include <vector>
 //#include <GASPI_Ext.h>
 
+#include <boost/thread.hpp>
+
 #include "hdf5.h"
 
 #include "caffe/solver.hpp"
 #include "caffe/common.hpp"
+#include "caffe/gpi_resources.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/net.hpp"
 #include "caffe/parallel.hpp"
@@ -46,6 +49,11 @@ Net<Dtype>::Net(const string& param_file, Phase phase,
 template <typename Dtype>
 Net<Dtype>::~Net() {
   if (gpi_communication_) {
+    // the diff and loss communicators delete their segments
+    progress_thread_.reset();
+    if (gpi_tracing_) GPITrace::Stop();
+    com_buffers_diff_.clear();
+    com_scalars_.reset();
 #ifndef CPU_ONLY
     if (Caffe::mode() == Caffe::GPU) {
       gaspi_pointer_t ptr;
@@ -54,8 +62,13 @@ Net<Dtype>::~Net() {
     }
 #endif
     SUCCESS_OR_DIE(gaspi_segment_delete(segment_id_data_));
-    SUCCESS_OR_DIE(gaspi_segment_delete(segment_id_diff_));
-    SUCCESS_OR_DIE(gaspi_segment_delete(segment_id_loss_));
+    GPIResources::ReleaseSegment(segment_id_data_);
+    GPIResources::ReleaseSegment(segment_id_diff_);
+    GPIResources::ReleaseSegment(segment_id_loss_);
+    GPIResources::ReleaseQueue(queue_diff_);
+    GPIResources::ReleaseQueue(queue_data_write_);
+    GPIResources::ReleaseQueue(queue_data_acknowledge_);
+    GPIResources::ReleaseQueue(queue_loss_);
   }
 }
 
@@ -268,6 +281,7 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   }
   for (size_t layer_id = 0; layer_id < layer_names_.size(); ++layer_id) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
+    trace_layer_names_.push_back(GPITrace::Intern(layer_names_[layer_id]));
   }
   ShareWeights();
   debug_info_ = param.debug_info();
@@ -275,6 +289,10 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
 
   //GPI communication
   gpi_communication_ = (phase_ == TRAIN) ? true : false;
+  gpi_param_ = in_param.gpi_param();
+  gpi_reduce_outputs_ = false;
+  gpi_profiling_ = false;
+  gpi_tracing_ = false;
   if (gpi_communication_) {
     SUCCESS_OR_DIE(gaspi_proc_num(&num_ranks_));
     SUCCESS_OR_DIE(gaspi_proc_rank(&rank_));
@@ -284,20 +302,39 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
       const long s = learnable_params_[i]->count();
       learnable_params_size_aggregated_.push_back(learnable_params_size_aggregated_.back() + s);
     }
-    loss_buffer_index_ = 0;
-    CheckAvailableSegments(segment_id_loss_);
-    const long loss_segment_size = 2 * num_ranks_;
-    SUCCESS_OR_DIE(gaspi_segment_create(segment_id_loss_,
-                                        loss_segment_size * sizeof(Dtype),
-                                        GASPI_GROUP_ALL,
-                                        GASPI_BLOCK,
-                                        GASPI_MEM_UNINITIALIZED));
+    staleness_sum_ = 0;
+    staleness_max_ = 0;
+    staleness_count_ = 0;
+    queue_diff_ = GPIResources::AcquireQueue("Net " + name_ + " diffs");
+    queue_data_write_ =
+      GPIResources::AcquireQueue("Net " + name_ + " model writes");
+    queue_data_acknowledge_ =
+      GPIResources::AcquireQueue("Net " + name_ + " model acknowledges");
+    queue_loss_ = GPIResources::AcquireQueue("Net " + name_ + " loss");
+    segment_id_loss_ = GPIResources::AcquireSegment("Net " + name_ + " loss");
+    // the loss and the output blobs
+    long num_scalars = 1;
+    for (int i = 0; i < net_output_blobs_.size(); i++) {
+      num_scalars += net_output_blobs_[i]->count();
+    }
+    com_scalars_.reset(new CommunicatorScalar<Dtype>(
+      num_scalars, segment_id_loss_, queue_loss_, rank_, num_ranks_));
+    AssignLayerUpdateRanks();
     BuildLayerDataCommunication();
     BuildLayerDiffCommunication();
+    if (!gpi_param_.trace_file().empty()) {
+      GPITrace::Start(gpi_param_.trace_file(), gpi_param_.trace_max_events());
+      gpi_tracing_ = true;
+    }
     //broadcast model
     MarkDataAsUpdatedOnMasterNode();
     CommunicateDataBlocking();
     ResetCommunicationStatus();
+    if (gpi_param_.progress_thread()) {
+      progress_thread_.reset(new CommunicationProgressThread<Dtype>(
+        com_buffers_diff_, com_buffers_data_, !GPIAllreduce()));
+      progress_thread_->StartInternalThread();
+    }
   }
 }
 
@@ -586,7 +623,16 @@ Dtype Net<Dtype>::ForwardFromToLocal(int start, int end) {
     for (int c = 0; c < before_forward_.size(); ++c) {
       before_forward_[c]->run(i);
     }
-    Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
+    ProfileLap(NULL);
+    // the weight broadcast of the last iteration may still be running
+    WaitForLayerData(i);
+    if (gpi_profiling_) ProfileLap(&gpi_profile_.data_wait[i]);
+    Dtype layer_loss;
+    {
+      GPITraceSpan trace("forward", trace_layer_names_[i]);
+      layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
+    }
+    if (gpi_profiling_) ProfileLap(&gpi_profile_.forward[i]);
     loss += layer_loss;
     if (debug_info_) { ForwardDebugInfo(i); }
     for (int c = 0; c < after_forward_.size(); ++c) {
@@ -653,16 +699,24 @@ void Net<Dtype>::BackwardFromToAndAggregateDiffs(int start, int end) {
   CHECK_LT(start, layers_.size());
 
   ResetCommunicationStatus();
+  ProfileLap(NULL);
   for (int i = start; i >= end; --i) {
     if (layer_need_backward_[i]) {
-      layers_[i]->Backward(
-          top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
+      {
+        GPITraceSpan trace("backward", trace_layer_names_[i]);
+        layers_[i]->Backward(
+            top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
+      }
+      if (gpi_profiling_) ProfileLap(&gpi_profile_.backward[i]);
       if (debug_info_) { BackwardDebugInfo(i); }
       AppendLayerToCalculatedBlobs(i);
       CommunicateLayerDiff();
+      CommunicateLossProgress();
+      if (gpi_profiling_) ProfileLap(&gpi_profile_.overlap);
     }
   }
   CommunicateLayerDiffBlocking();
+  if (gpi_profiling_) ProfileLap(&gpi_profile_.diff_blocking);
   ScaleLayerDiff(1./Dtype(num_ranks_));
 }
 
@@ -673,19 +727,27 @@ void Net<Dtype>::BackwardFromToAndAggregateDiffsAndUpdate(
   CHECK_LT(start, layers_.size());
 
   ResetCommunicationStatus();
+  ProfileLap(NULL);
   for (int i = start; i >= end; --i) {
     if (layer_need_backward_[i]) {
-      layers_[i]->Backward(
-          top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
+      {
+        GPITraceSpan trace("backward", trace_layer_names_[i]);
+        layers_[i]->Backward(
+            top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
+      }
+      if (gpi_profiling_) ProfileLap(&gpi_profile_.backward[i]);
       if (debug_info_) { BackwardDebugInfo(i); }
       AppendLayerToCalculatedBlobs(i);
       CommunicateLayerDiff();
       UpdateLayersWithSolver(solver);
       CommunicateLayerData();
+      CommunicateLossProgress();
+      if (gpi_profiling_) ProfileLap(&gpi_profile_.overlap);
     }
   }
 
-  CommunicateLayerDiffAndDataBlocking(solver);
+  CommunicateLayerDiffAndUpdateBlocking(solver);
+  if (gpi_profiling_) ProfileLap(&gpi_profile_.diff_blocking);
 }
 
 template <typename Dtype>
@@ -1027,67 +1089,77 @@ void Net<Dtype>::ToHDF5(const string& filename, bool write_diff) const {
   H5Fclose(file_hid);
 }
 
+// Rank 0 updates all layers unless update_mode is SHARDED. The layers are
+// assigned as a whole, so a layer's parameters become ready together.
 template <typename Dtype>
-void Net<Dtype>::CheckAvailableSegments(gaspi_segment_id_t id) {
-  gaspi_number_t segment_num;
-  SUCCESS_OR_DIE(gaspi_segment_num(&segment_num));
-  gaspi_number_t segment_max;
-  SUCCESS_OR_DIE(gaspi_segment_max(&segment_max));
-  if ((segment_num >= segment_max) || (id >= segment_max)) {
-    LOG(ERROR) << "Not enough GASPI segments!" << std::endl;
-    exit(EXIT_FAILURE);
-  }
-}
+void Net<Dtype>::AssignLayerUpdateRanks() {
+  layer_update_rank_.assign(layers_.size(), 0);
+  learnable_param_update_rank_.assign(learnable_params_.size(), 0);
+  if (!GPISharded()) return;
 
-template <typename Dtype>
-void Net<Dtype>::BuildLayerDiffCommunication() {
-  CheckAvailableSegments(notification_id_diff_);
-  const long buffer_size = //can store full model
-    learnable_params_size_aggregated_.back() + 1;
-  com_buffers_diff_.push_back(shared_ptr<CommunicatorDiff<Dtype> > (
-    new CommunicatorDiff<Dtype>(buffer_size, notification_id_diff_,
-                                segment_id_diff_, queue_diff_, rank_,
-                                num_ranks_)));
-}
-
-template <typename Dtype>
-int Net<Dtype>::GetDiffTreeBranchingFactor() const {
-  return 2;
+  vector<int> layer_ids;
+  vector<long> sizes;
+  for (int i = layers_.size() - 1; i >= 0; --i) {
+    if (layer_need_backward_[i]) {
+      vector<shared_ptr<Blob<Dtype> > >& blobs = layers_[i].get()->blobs();
+      long size = 0;
+      for (int j = 0; j < blobs.size(); j++) size += blobs[j]->count();
+      layer_ids.push_back(i);
+      sizes.push_back(size);
+    }
+  }
+  const vector<gaspi_rank_t> ranks =
+    DiffTopology::BalanceRanks(sizes, num_ranks_);
+  for (int k = 0; k < layer_ids.size(); k++) {
+    layer_update_rank_[layer_ids[k]] = ranks[k];
+    vector<shared_ptr<Blob<Dtype> > >& blobs =
+      layers_[layer_ids[k]].get()->blobs();
+    for (int j = 0; j < blobs.size(); j++) {
+      const int param_id = std::find(learnable_params_.begin(),
+                                     learnable_params_.end(), blobs[j].get())
+                           - learnable_params_.begin();
+      if (param_id < learnable_params_.size()) {
+        learnable_param_update_rank_[param_id] = ranks[k];
+      }
+    }
+  }
 }
 
 template <typename Dtype>
-std::vector<gaspi_rank_t> Net<Dtype>::GetDiffTreeWriteRanks(
-  gaspi_rank_t rank, int branching_factor) const {
-  std::vector<gaspi_rank_t>  r;
-
-  if (rank > 0) {
-    long power = 1; // = branching_factor ** 0
-    while((power * branching_factor) <= long(rank)) {
-      power *= branching_factor;
+std::vector<gaspi_rank_t> Net<Dtype>::CalculatedBlobUpdateRanks() {
+  std::vector<gaspi_rank_t> ranks;
+  for (int i = layers_.size() - 1; i >= 0; --i) {
+    if (layer_need_backward_[i]) {
+      ranks.insert(ranks.end(), layers_[i]->blobs().size(),
+                   layer_update_rank_[i]);
     }
-    r.push_back(long(rank) % power);
   }
-  return r;
+  return ranks;
 }
 
 template <typename Dtype>
-std::vector<gaspi_rank_t>  Net<Dtype>::GetDiffTreeReadRanks(
-  gaspi_rank_t rank, int branching_factor) const {
-  std::vector<gaspi_rank_t> r;
+bool Net<Dtype>::GPIUpdatesParam(int param_id) const {
+  return !gpi_communication_ || GPIAllreduce()
+    || (learnable_param_update_rank_[param_id] == rank_);
+}
 
-  long power = 1;
-  while (power < long(num_ranks_)) {
-    if (power > long(rank)) {
-      for(long i = 1; i < branching_factor; i++) {
-        long n = i * power + long(rank);
-        if (n < long(num_ranks_)) {
-          r.push_back(n);
-        }
+template <typename Dtype>
+void Net<Dtype>::BuildLayerDiffCommunication() {
+  segment_id_diff_ = GPIResources::AcquireSegment("Net " + name_ + " diffs");
+  std::vector<Blob<Dtype>*> diff_blobs;
+  for (int i = layers_.size() - 1; i >= 0; --i) {
+    if (layer_need_backward_[i]) {
+      vector<shared_ptr<Blob<Dtype> > >& blobs = layers_[i].get()->blobs();
+      for (int j = 0; j < blobs.size(); j++) {
+        diff_blobs.push_back(blobs[j].get());
       }
     }
-    power *= branching_factor;
   }
-  return r;
+  com_buffers_diff_.push_back(shared_ptr<CommunicatorDiff<Dtype> > (
+    new CommunicatorDiff<Dtype>(diff_blobs, CalculatedBlobUpdateRanks(),
+                                gpi_param_, notification_id_diff_,
+                                segment_id_diff_, queue_diff_, rank_,
+                                num_ranks_)));
 }
 
 template <typename Dtype>
@@ -1106,7 +1178,7 @@ void Net<Dtype>::BuildLayerDataCommunication() {
     }
   }
 
-  CheckAvailableSegments(segment_id_data_);
+  segment_id_data_ = GPIResources::AcquireSegment("Net " + name_ + " model");
 #ifndef CPU_ONLY
   if (Caffe::mode() == Caffe::GPU) {
     void* ptr;
@@ -1135,6 +1207,7 @@ void Net<Dtype>::BuildLayerDataCommunication() {
 
   int iblob = 0;
 
+  layer_com_buffers_data_.resize(layers_.size());
   for (int i = layers_.size() - 1; i >= 0; --i) {
     if (layer_need_backward_[i]) {
       vector<shared_ptr<Blob<Dtype> > >& blobs = layers_[i].get()->blobs();
@@ -1154,12 +1227,13 @@ void Net<Dtype>::BuildLayerDataCommunication() {
         const long notification_num_local
           = ((iblob + 1) * notification_num_total + num_blobs - 1) / num_blobs
             - notification_base_id;
+        layer_com_buffers_data_[i].push_back(iblob);
         iblob++;
         com_buffers_data_.push_back(shared_ptr<CommunicatorModel<Dtype> > (
           new CommunicatorModel<Dtype>(
             &blob, segment_id_data_, notification_base_id, notification_num_local,
-            queue_data_write, queue_data_acknowledge_, rank_,
-            num_ranks_)));
+            queue_data_write_, queue_data_acknowledge_, rank_,
+            num_ranks_, layer_update_rank_[i])));
       }
     }
   }
@@ -1184,8 +1258,12 @@ void Net<Dtype>::BuildLayerDataCommunication() {
 
 template <typename Dtype>
 void Net<Dtype>::ResetCommunicationStatus(void) {
-  for (int i = 0; i < com_buffers_diff_.size(); i++)
-    com_buffers_diff_[i]->ResetCommunicationStatus();
+  if (progress_thread_) {
+    progress_thread_->ResetCommunicationStatus();
+  } else {
+    for (int i = 0; i < com_buffers_diff_.size(); i++)
+      com_buffers_diff_[i]->ResetCommunicationStatus();
+  }
   calculated_blobs_.resize(0);
   update_status_ = 0;
 }
@@ -1198,11 +1276,17 @@ void Net<Dtype>::AppendLayerToCalculatedBlobs(int index) {
   for (int i = 0; i < blobs.size(); i++) {
     Blob<Dtype>* blob = blobs[i].get();
     calculated_blobs_.push_back(blob);
+    if (progress_thread_) {
+      progress_thread_->AddCalculatedBlob(blob, !GPIAllreduce());
+      continue;
+    }
     for (int k = 0; k < com_buffers_diff_.size(); k++) {
       com_buffers_diff_[k]->AddCalculatedBlob(blob);
     }
   }
 
+  // with allreduce the weights are not broadcast, nothing to acknowledge
+  if (GPIAllreduce() || progress_thread_) return;
   for (; j < calculated_blobs_.size(); j++) {
     com_buffers_data_[j]->Acknowledge();
   }
@@ -1211,7 +1295,7 @@ void Net<Dtype>::AppendLayerToCalculatedBlobs(int index) {
 
 template <typename Dtype>
 void Net<Dtype>::CommunicateLayerDiff() {
-  if (!gpi_communication_) return;
+  if (!gpi_communication_ || progress_thread_) return;
 
   for (int i = 0; i < com_buffers_diff_.size(); i++) {
     (*com_buffers_diff_[i])();
@@ -1220,13 +1304,40 @@ void Net<Dtype>::CommunicateLayerDiff() {
 
 template <typename Dtype>
 void Net<Dtype>::CommunicateLayerDiffBlocking() {
+  GPITraceSpan trace("wait", "diffs");
   while(!CommunicateLayerDiffFinished()) {
     CommunicateLayerDiff();
+    YieldToProgressThread();
   }
+  WaitForDiffLocalCompletion();
+}
+
+template <typename Dtype>
+void Net<Dtype>::WaitForDiffLocalCompletion() {
+  if (progress_thread_) {
+    progress_thread_->WaitForDiffLocalCompletion();
+    return;
+  }
+  for (int i = 0; i < com_buffers_diff_.size(); i++) {
+    com_buffers_diff_[i]->WaitForLocalCompletion();
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::WaitForDataLocalCompletion(int index) {
+  if (progress_thread_) {
+    progress_thread_->WaitForDataLocalCompletion(index);
+    return;
+  }
+  com_buffers_data_[index]->WaitForLocalCompletion();
 }
 
 template <typename Dtype>
 bool Net<Dtype>::CommunicateLayerDiffFinished() {
+  if (progress_thread_) {
+    return (progress_thread_->DiffReadFinished() == calculated_blobs_.size())
+      && (progress_thread_->DiffWriteFinished() == calculated_blobs_.size());
+  }
   int running = 0;
   for (long i = 0; i < com_buffers_diff_.size(); i++) {
     running |= !com_buffers_diff_[i]->CommunicateLayerDiffFinished();
@@ -1236,6 +1347,7 @@ bool Net<Dtype>::CommunicateLayerDiffFinished() {
 
 template <typename Dtype>
 bool Net<Dtype>::CommunicateLayerDiffReadFinished(int index) {
+  if (progress_thread_) return index < progress_thread_->DiffReadFinished();
   int running = 0;
   for (long i = 0; i < com_buffers_diff_.size(); i++) {
     running |= !com_buffers_diff_[i]->CommunicateLayerDiffReadFinished(index);
@@ -1243,6 +1355,16 @@ bool Net<Dtype>::CommunicateLayerDiffReadFinished(int index) {
   return !running;
 }
 
+template <typename Dtype>
+bool Net<Dtype>::CommunicateLayerDiffWriteFinished(int index) {
+  if (progress_thread_) return index < progress_thread_->DiffWriteFinished();
+  int running = 0;
+  for (long i = 0; i < com_buffers_diff_.size(); i++) {
+    running |= !com_buffers_diff_[i]->CommunicateLayerDiffWriteFinished(index);
+  }
+  return !running;
+}
+
 template <typename Dtype>
 void Net<Dtype>::ScaleLayerDiff(Dtype s) {
   for (long i = 0; i < calculated_blobs_.size(); i++) {
@@ -1254,13 +1376,62 @@ template <typename Dtype>
 void Net<Dtype>::CommunicateDataBlocking(void) {
   if (!gpi_communication_) return;
 
+  ProfileLap(NULL);
+  GPITraceSpan trace("wait", "all weights");
   while (!CommunicateLayerDataFinished()) {
-    CommunicateLayerData();
+    if (GPISSP()) AcknowledgeReceivedLayerData();
+    ProgressLayerData();
+  }
+  if (gpi_profiling_) ProfileLap(&gpi_profile_.data_blocking);
+}
+
+// With SSP the weights may be up to ssp_staleness versions old.
+template <typename Dtype>
+void Net<Dtype>::WaitForLayerData(int layer_id) {
+  if (!gpi_communication_ || GPIAllreduce()) return;
+
+  const unsigned long staleness_max =
+    GPISSP() ? gpi_param_.ssp_staleness() : 0;
+  unsigned long staleness;
+  GPITraceSpan trace("wait", "weights", "layer", layer_id);
+  while (!LayerDataStaleness(layer_id, &staleness)
+         || (staleness > staleness_max)) {
+    ProgressLayerData();
+  }
+  if (layer_com_buffers_data_[layer_id].size()) {
+    staleness_sum_ += staleness;
+    staleness_max_ = std::max(staleness_max_, staleness);
+    staleness_count_++;
+  }
+}
+
+// Drives the communicators itself, the initial broadcast of the model also
+// runs with update_mode ALLREDUCE.
+template <typename Dtype>
+void Net<Dtype>::ProgressLayerData(void) {
+  if (progress_thread_) {
+    YieldToProgressThread();
+    return;
+  }
+  for (long i = 0; i < com_buffers_data_.size(); i++) {
+    (*com_buffers_data_[i])();
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::AcknowledgeReceivedLayerData(void) {
+  if (progress_thread_) {
+    progress_thread_->AcknowledgeReceivedData();
+    return;
+  }
+  for (long i = 0; i < com_buffers_data_.size(); i++) {
+    com_buffers_data_[i]->AcknowledgeReceived();
   }
 }
 
 template <typename Dtype>
 bool Net<Dtype>::CommunicateLayerDataFinished(void) {
+  if (progress_thread_) return progress_thread_->DataFinished();
   int running = 0;
   for (long i = 0; i < com_buffers_data_.size(); i++) {
     running |= !com_buffers_data_[i]->Complete();
@@ -1268,19 +1439,73 @@ bool Net<Dtype>::CommunicateLayerDataFinished(void) {
   return !running;
 }
 
+template <typename Dtype>
+bool Net<Dtype>::LayerDataStaleness(int layer_id,
+                                    unsigned long* staleness) {
+  const vector<int>& buffers = layer_com_buffers_data_[layer_id];
+  *staleness = 0;
+  for (long i = 0; i < buffers.size(); i++) {
+    unsigned long s;
+    if (progress_thread_) {
+      if (!progress_thread_->DataStaleness(buffers[i], &s)) return false;
+    } else {
+      s = com_buffers_data_[buffers[i]]->Staleness();
+    }
+    *staleness = std::max(*staleness, s);
+  }
+  return true;
+}
+
+template <typename Dtype>
+void Net<Dtype>::LogWeightStaleness(void) {
+  if (!GPISSP() || (rank_ == 0) || !staleness_count_) return;
+  LOG(INFO) << "Rank " << rank_ << " weight staleness: mean "
+            << staleness_sum_ / staleness_count_ << ", max "
+            << staleness_max_ << " versions over " << staleness_count_
+            << " layers";
+  staleness_sum_ = 0;
+  staleness_max_ = 0;
+  staleness_count_ = 0;
+}
+
 template <typename Dtype>
 void Net<Dtype>::MarkDataAsUpdatedOnMasterNode(void) {
   for (int i = 0; i < com_buffers_data_.size(); i++) {
-    CommunicatorModel<Dtype>& buffer = *com_buffers_data_[i];
-    if (!buffer.HaveUpdateSource()) {
-      buffer.UpdatedModelOnMaster();
+    if (!com_buffers_data_[i]->HaveUpdateSource()) {
+      UpdatedModelOnMaster(i);
     }
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::UpdatedModelOnMaster(int index) {
+  if (progress_thread_) {
+    progress_thread_->UpdatedModelOnMaster(index);
+  } else {
+    com_buffers_data_[index]->UpdatedModelOnMaster();
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::YieldToProgressThread(void) {
+  if (progress_thread_) boost::this_thread::yield();
+}
+
+template <typename Dtype>
+void Net<Dtype>::LogDiffBucketTimings(void) {
+  if (!gpi_communication_ || (rank_ != 0)) return;
+  if (progress_thread_) {
+    progress_thread_->LogBucketTimings();
+    return;
+  }
+  for (int i = 0; i < com_buffers_diff_.size(); i++) {
+    com_buffers_diff_[i]->LogBucketTimings();
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::CommunicateLayerData() {
-  if (!gpi_communication_) return;
+  if (!gpi_communication_ || GPIAllreduce() || progress_thread_) return;
 
   for (long i = 0; i < com_buffers_data_.size(); i++) {
     (*com_buffers_data_[i])();
@@ -1288,37 +1513,80 @@ void Net<Dtype>::CommunicateLayerData() {
 }
 
 template <typename Dtype>
-void Net<Dtype>::CommunicateLayerDiffAndDataBlocking(Solver<Dtype>* solver) {
-  while(!CommunicateLayerDiffAndDataFinished()) {
+void Net<Dtype>::CommunicateLayerDiffAndUpdateBlocking(
+  Solver<Dtype>* solver) {
+  GPITraceSpan trace("wait", "diffs");
+  while(!CommunicateLayerDiffAndUpdateFinished()) {
     CommunicateLayerDiff();
     UpdateLayersWithSolver(solver);
     CommunicateLayerData();
+    YieldToProgressThread();
   }
+  WaitForDiffLocalCompletion();
 }
 
+// The weight broadcast is not awaited, the next forward pass waits for the
+// parameters of every layer before it runs the layer.
 template <typename Dtype>
-bool Net<Dtype>::CommunicateLayerDiffAndDataFinished(void) {
+bool Net<Dtype>::CommunicateLayerDiffAndUpdateFinished(void) {
   int running = !CommunicateLayerDiffFinished();
-  running |= !CommunicateLayerDataFinished();
+  running |= (update_status_ < calculated_blobs_.size());
 
   return !running;
 }
 
 template <typename Dtype>
 void Net<Dtype>::UpdateLayersWithSolver(Solver<Dtype>* solver) {
+  // the diffs are sent in place, they must not change before the sends
+  // completed
+  bool waited = false;
+  if (GPIAllreduce()) {
+    while ((update_status_ < calculated_blobs_.size())
+           && CommunicateLayerDiffReadFinished(update_status_)
+           && CommunicateLayerDiffWriteFinished(update_status_)) {
+      if (!waited) {
+        WaitForDiffLocalCompletion();
+        waited = true;
+      }
+      const int param_id =
+        FindLearnableParamsID(calculated_blobs_[update_status_]);
+      learnable_params_[param_id]->scale_diff(1.0 / num_ranks_);
+      ApplyUpdateLayer(solver, param_id);
+      update_status_++;
+    }
+    return;
+  }
 
-  while (CommunicateLayerDiffReadFinished(update_status_)
-         && (update_status_ < calculated_blobs_.size())
-         && !com_buffers_data_[update_status_]->HaveUpdateSource()) {
+  while (update_status_ < calculated_blobs_.size()) {
+    // the weights are updated by another rank
+    if (com_buffers_data_[update_status_]->HaveUpdateSource()) {
+      update_status_++;
+      continue;
+    }
+    if (!CommunicateLayerDiffReadFinished(update_status_)) break;
+    if (!waited) {
+      WaitForDiffLocalCompletion();
+      // with SSP the ranks may still receive an older version of the model
+      if (GPISSP()) WaitForDataLocalCompletion(update_status_);
+      waited = true;
+    }
     const int param_id =
       FindLearnableParamsID(calculated_blobs_[update_status_]);
     learnable_params_[param_id]->scale_diff(1.0 / num_ranks_);
-    solver->ApplyUpdateLayer(param_id);
-    com_buffers_data_[update_status_]->UpdatedModelOnMaster();
+    ApplyUpdateLayer(solver, param_id);
+    UpdatedModelOnMaster(update_status_);
     update_status_++;
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::ApplyUpdateLayer(Solver<Dtype>* solver, int param_id) {
+  GPITraceSpan trace("update",
+                     trace_layer_names_[param_layer_indices_[param_id].first],
+                     "param", param_id);
+  solver->ApplyUpdateLayer(param_id);
+}
+
 template <typename Dtype>
 int Net<Dtype>::FindLearnableParamsID(Blob<Dtype>* blob) {
   const int param_id = std::find(learnable_params().begin(),
@@ -1333,65 +1601,87 @@ int Net<Dtype>::FindLearnableParamsID(Blob<Dtype>* blob) {
 
 template <typename Dtype>
 void Net<Dtype>::CommunicateLossSend(Dtype loss) {
-  if (!gpi_communication_) return;
+  // with SSP the ranks are not in lockstep, every rank reports the loss and
+  // outputs of its own batch
+  if (!gpi_communication_ || GPISSP()) return;
+
+  std::vector<Dtype> values(1, loss);
+  if (gpi_reduce_outputs_) {
+    for (int i = 0; i < net_output_blobs_.size(); i++) {
+      const Dtype* data = net_output_blobs_[i]->cpu_data();
+      values.insert(values.end(), data, data + net_output_blobs_[i]->count());
+    }
+  }
+  com_scalars_->Start(values);
+}
+
+// lets the reduction advance during the backward pass
+template <typename Dtype>
+void Net<Dtype>::CommunicateLossProgress(void) {
+  if (!gpi_communication_ || GPISSP()) return;
 
-  gaspi_pointer_t p;
-  SUCCESS_OR_DIE(gaspi_segment_ptr(segment_id_loss_, &p));
-  Dtype* const buffer((Dtype*)p);
+  com_scalars_->Progress();
+}
 
-  const long slot = 2 * rank_ + loss_buffer_index_;
-  buffer[slot] = loss;
-  SUCCESS_OR_DIE(gaspi_notify(segment_id_loss_,
-                              rank_,
-                              notification_id_loss_ + slot,
-                              1,
-                              queue_loss_,
-                              GASPI_BLOCK));
+template <typename Dtype>
+void Net<Dtype>::CommunicateLossCollect(Dtype& loss) {
+  if (!gpi_communication_ || GPISSP()) return;
 
-  for (long remote_rank = 0; remote_rank < num_ranks_; remote_rank++) {
-    if (remote_rank == rank_) continue;
-    SUCCESS_OR_DIE(gaspi_write_notify(segment_id_loss_,
-                                      slot * sizeof(Dtype),
-                                      remote_rank,
-                                      segment_id_loss_,
-                                      slot * sizeof(Dtype),
-                                      sizeof(Dtype),
-                                      notification_id_loss_ + slot,
-                                      1,
-                                      queue_loss_,
-                                      GASPI_BLOCK));
+  std::vector<Dtype> sums;
+  ProfileLap(NULL);
+  {
+    GPITraceSpan trace("wait", "loss");
+    com_scalars_->Finish(&sums);
+  }
+  if (gpi_profiling_) ProfileLap(&gpi_profile_.loss_blocking);
+  // the mean over the ranks, like the loss of a single rank
+  loss = sums[0] / num_ranks_;
+  if (sums.size() == 1) return;
+  long offset = 1;
+  for (int i = 0; i < net_output_blobs_.size(); i++) {
+    const int count = net_output_blobs_[i]->count();
+    caffe_cpu_scale(count, Dtype(1) / num_ranks_, &sums[offset],
+                    net_output_blobs_[i]->mutable_cpu_data());
+    offset += count;
   }
 }
 
 template <typename Dtype>
-void Net<Dtype>::CommunicateLossCollect(Dtype& loss) {
-  if (!gpi_communication_) return;
+void Net<Dtype>::set_gpi_profile(const bool value) {
+  gpi_profiling_ = value;
+  gpi_profile_.forward.assign(layers_.size(), 0.0);
+  gpi_profile_.data_wait.assign(layers_.size(), 0.0);
+  gpi_profile_.backward.assign(layers_.size(), 0.0);
+  gpi_profile_.overlap = 0.0;
+  gpi_profile_.diff_blocking = 0.0;
+  gpi_profile_.data_blocking = 0.0;
+  gpi_profile_.loss_blocking = 0.0;
+}
+
+template <typename Dtype>
+void Net<Dtype>::GPIBytes(unsigned long long* diff_sent,
+                          unsigned long long* diff_received,
+                          unsigned long long* data_sent,
+                          unsigned long long* data_received) const {
+  *diff_sent = *diff_received = *data_sent = *data_received = 0;
+  for (int i = 0; i < com_buffers_diff_.size(); i++) {
+    *diff_sent += com_buffers_diff_[i]->BytesSent();
+    *diff_received += com_buffers_diff_[i]->BytesReceived();
+  }
+  for (int i = 0; i < com_buffers_data_.size(); i++) {
+    *data_sent += com_buffers_data_[i]->BytesSent();
+    *data_received += com_buffers_data_[i]->BytesReceived();
+  }
+}
 
-  gaspi_pointer_t p;
-  SUCCESS_OR_DIE(gaspi_segment_ptr(segment_id_loss_, &p));
-  Dtype* const buffer((Dtype*)p);
-
-  loss = 0;
-  for (long remote_rank = 0; remote_rank < num_ranks_; remote_rank++) {
-    const long slot = 2 * remote_rank + loss_buffer_index_;
-    while (1) {
-      gaspi_notification_id_t id;
-      gaspi_notification_t v;
-      SUCCESS_OR_DIE(gaspi_notify_waitsome(segment_id_loss_,
-                                           notification_id_loss_ + slot,
-                                           1,
-                                           &id,
-                                           GASPI_BLOCK));
-      SUCCESS_OR_DIE(gaspi_notify_reset(segment_id_loss_,
-                                        notification_id_loss_ + slot,
-                                        &v));
-      if (v > 0) break;
-    }
-    loss += buffer[slot];
-  }
-
-  loss_buffer_index_ ^= gaspi_notification_id_t(1);
-  SUCCESS_OR_DIE(gaspi_wait(queue_loss_, GASPI_BLOCK));
+template <typename Dtype>
+void Net<Dtype>::ProfileLap(double* time) {
+  if (!gpi_profiling_) return;
+#ifndef CPU_ONLY
+  if (Caffe::mode() == Caffe::GPU) CUDA_CHECK(cudaDeviceSynchronize());
+#endif
+  if (time) *time += profile_timer_.MicroSeconds();
+  profile_timer_.Start();
 }
 
 template <>
@@ -98,6 +98,9 @@ void Solver<Dtype>::InitTrainNet() {
   net_state.MergeFrom(net_param.state());
   net_state.MergeFrom(param_.train_state());
   net_param.mutable_state()->CopyFrom(net_state);
+  if (param_.has_gpi_param()) {
+    net_param.mutable_gpi_param()->CopyFrom(param_.gpi_param());
+  }
   net_.reset(new Net<Dtype>(net_param));
 }
 
@@ -186,6 +189,8 @@ void Solver<Dtype>::Step(int iters) {
   losses_.clear();
   smoothed_loss_ = 0;
   iteration_timer_.Start();
+  CHECK(SupportApplyUpdateLayer() || !net_->GPISharded())
+    << "update_mode SHARDED requires layer-wise updates";
 
   while (iter_ < stop_iter) {
     // zero-init the params
@@ -206,6 +211,7 @@ void Solver<Dtype>::Step(int iters) {
     }
     const bool display = param_.display() && iter_ % param_.display() == 0;
     net_->set_debug_info(display && param_.debug_info());
+    net_->set_gpi_reduce_outputs(display);
     // accumulate the loss and gradient
     Dtype loss = 0;
     for (int i = 0; i < param_.iter_size() - 1; ++i) {
@@ -231,6 +237,10 @@ void Solver<Dtype>::Step(int iters) {
           << param_.display() << " iters), loss = " << smoothed_loss_;
       iteration_timer_.Start();
       iterations_last_ = iter_;
+      if (param_.gpi_param().diff_bucket_report()) {
+        net_->LogDiffBucketTimings();
+      }
+      net_->LogWeightStaleness();
       const vector<Blob<Dtype>*>& result = net_->output_blobs();
       int score_index = 0;
       for (int j = 0; j < result.size(); ++j) {
@@ -256,9 +266,13 @@ void Solver<Dtype>::Step(int iters) {
       for (int i = 0; i < callbacks_.size(); ++i) {
         callbacks_[i]->on_gradients_ready();
       }
-      if (net_->AmIGPIMaster()) ApplyUpdate();
-      net_->MarkDataAsUpdatedOnMasterNode();
-      net_->CommunicateDataBlocking();
+      if (net_->GPIAllreduce()) {
+        ApplyUpdate();
+      } else {
+        if (net_->AmIGPIMaster()) ApplyUpdate();
+        // the broadcast overlaps the next forward pass
+        net_->MarkDataAsUpdatedOnMasterNode();
+      }
     }
 
     // Increment the internal iter_ counter -- its value should always indicate
@@ -300,6 +314,8 @@ void Solver<Dtype>::Solve(const char* resume_file) {
   // should be given, and we will just provide dummy vecs.
   int start_iter = iter_;
   Step(param_.max_iter() - iter_);
+  // finish the weight broadcast of the last iteration
+  net_->CommunicateDataBlocking();
   // If we haven't already, save a snapshot after optimization, unless
   // overridden by setting snapshot_after_train := false
   if (param_.snapshot_after_train()
@@ -345,6 +361,8 @@ bool Solver<Dtype>::SupportApplyUpdateLayer() {
 
 template <typename Dtype>
 void Solver<Dtype>::TestAll() {
+  // the test nets share the weights of the training net
+  net_->CommunicateDataBlocking();
   for (int test_net_id = 0;
        test_net_id < test_nets_.size() && !requested_early_exit_;
        ++test_net_id) {
@@ -429,16 +447,25 @@ void Solver<Dtype>::Test(const int test_net_id) {
 
 template <typename Dtype>
 void Solver<Dtype>::Snapshot() {
-  if (!net_->AmIGPIMaster()) return;
+  if (net_->GPISharded()) {
+    // rank 0 writes the model once the weights updated by the other ranks
+    // arrived, every rank writes its part of the solver state
+    net_->CommunicateDataBlocking();
+  } else if (!net_->AmIGPIMaster()) {
+    return;
+  }
 
   CHECK(Caffe::root_solver());
+  const bool write_model = net_->AmIGPIMaster();
   string model_filename;
   switch (param_.snapshot_format()) {
   case caffe::SolverParameter_SnapshotFormat_BINARYPROTO:
-    model_filename = SnapshotToBinaryProto();
+    model_filename = write_model ? SnapshotToBinaryProto()
+                                 : SnapshotFilename(".caffemodel");
     break;
   case caffe::SolverParameter_SnapshotFormat_HDF5:
-    model_filename = SnapshotToHDF5();
+    model_filename = write_model ? SnapshotToHDF5()
+                                 : SnapshotFilename(".caffemodel.h5");
     break;
   default:
     LOG(FATAL) << "Unsupported snapshot format.";
@@ -471,6 +498,12 @@ string Solver<Dtype>::SnapshotFilename(const string extension) {
     + extension;
 }
 
+template <typename Dtype>
+string Solver<Dtype>::SolverStateFilename(const string& filename) {
+  if (!net_->GPISharded() || net_->AmIGPIMaster()) return filename;
+  return filename + ".rank" + caffe::format_int(net_->GPIRank());
+}
+
 template <typename Dtype>
 string Solver<Dtype>::SnapshotToBinaryProto() {
   string model_filename = SnapshotFilename(".caffemodel");
@@ -494,9 +527,9 @@ void Solver<Dtype>::Restore(const char* state_file) {
   string state_filename(state_file);
   if (state_filename.size() >= 3 &&
       state_filename.compare(state_filename.size() - 3, 3, ".h5") == 0) {
-    RestoreSolverStateFromHDF5(state_filename);
+    RestoreSolverStateFromHDF5(SolverStateFilename(state_filename));
   } else {
-    RestoreSolverStateFromBinaryProto(state_filename);
+    RestoreSolverStateFromBinaryProto(SolverStateFilename(state_filename));
   }
 }
 
@@ -10,7 +10,8 @@ void AdaDeltaSolver<Dtype>::AdaDeltaPreSolve() {
   // SGDSolver::PreSolve
   const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
   for (int i = 0; i < net_params.size(); ++i) {
-        const vector<int>& shape = net_params[i]->shape();
+        const vector<int> shape = this->net_->GPIUpdatesParam(i)
+          ? net_params[i]->shape() : vector<int>(1, 0);
         this->history_.push_back(
                 shared_ptr<Blob<Dtype> >(new Blob<Dtype>(shape)));
   }
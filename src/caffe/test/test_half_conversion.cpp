@@ -0,0 +1,260 @@
+#include <stdint.h>
+#include <string.h>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/half_conversion.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class HalfConversionTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    Caffe::set_random_seed(1701);
+  }
+
+  std::vector<Dtype> RoundTrip(const std::vector<Dtype>& x,
+                               const HalfFormat format) {
+    std::vector<uint16_t> h(x.size());
+    std::vector<Dtype> y(x.size());
+    caffe_cpu_half_pack<Dtype>(x.size(), &x[0], &h[0], format);
+    caffe_cpu_half_unpack<Dtype>(x.size(), &h[0], &y[0], format);
+    return y;
+  }
+
+  // Squared error of the least squares problem |Xw - t|^2 / 2 after SGD
+  // over num_workers shards. With a format the gradients of all shards but
+  // the first pass the wire as 16 bit and the summed gradient is rounded
+  // again, as CommunicatorDiff does when distributing the reduced diffs.
+  Dtype TrainLeastSquares(const HalfFormat* format, std::vector<Dtype>* w) {
+    const int num_workers = 4;
+    const int rows = 64;
+    const int dim = 16;
+    const int iterations = 200;
+    const Dtype lr = 0.5;
+    const int total = num_workers * rows;
+    std::vector<Dtype> x(total * dim);
+    std::vector<Dtype> w_true(dim);
+    std::vector<Dtype> t(total);
+    Caffe::set_random_seed(1701);
+    caffe_rng_gaussian<Dtype>(x.size(), 0, 1, &x[0]);
+    caffe_rng_gaussian<Dtype>(dim, 0, 1, &w_true[0]);
+    caffe_rng_gaussian<Dtype>(total, 0, 0.01, &t[0]);
+    caffe_cpu_gemv<Dtype>(CblasNoTrans, total, dim, 1, &x[0], &w_true[0], 1,
+                          &t[0]);
+
+    w->assign(dim, 0);
+    std::vector<Dtype> residual(rows);
+    std::vector<Dtype> grad(dim);
+    std::vector<Dtype> sum(dim);
+    std::vector<uint16_t> wire(dim);
+    for (int it = 0; it < iterations; ++it) {
+      for (int k = 0; k < num_workers; ++k) {
+        const Dtype* xk = &x[k * rows * dim];
+        caffe_copy<Dtype>(rows, &t[k * rows], &residual[0]);
+        caffe_cpu_gemv<Dtype>(CblasNoTrans, rows, dim, 1, xk, &(*w)[0], -1,
+                              &residual[0]);
+        caffe_cpu_gemv<Dtype>(CblasTrans, rows, dim, Dtype(1) / total, xk,
+                              &residual[0], 0, &grad[0]);
+        if (k == 0) {
+          caffe_copy<Dtype>(dim, &grad[0], &sum[0]);
+        } else if (format) {
+          caffe_cpu_half_pack<Dtype>(dim, &grad[0], &wire[0], *format);
+          caffe_cpu_half_unpack_add<Dtype>(dim, &wire[0], &sum[0], *format);
+        } else {
+          caffe_axpy<Dtype>(dim, 1, &grad[0], &sum[0]);
+        }
+      }
+      if (format) caffe_cpu_half_round<Dtype>(dim, &sum[0], *format);
+      caffe_axpy<Dtype>(dim, -lr, &sum[0], &(*w)[0]);
+    }
+
+    residual.resize(total);
+    caffe_copy<Dtype>(total, &t[0], &residual[0]);
+    caffe_cpu_gemv<Dtype>(CblasNoTrans, total, dim, 1, &x[0], &(*w)[0], -1,
+                          &residual[0]);
+    return caffe_cpu_dot<Dtype>(total, &residual[0], &residual[0]) / 2;
+  }
+};
+
+TYPED_TEST_CASE(HalfConversionTest, TestDtypes);
+
+TYPED_TEST(HalfConversionTest, TestRoundTripExact) {
+  std::vector<TypeParam> fp16;
+  std::vector<TypeParam> bf16;
+  for (int i = -2048; i <= 2048; ++i) fp16.push_back(i);
+  for (int i = -256; i <= 256; ++i) bf16.push_back(TypeParam(i) / 1024);
+  fp16.push_back(65504);
+  fp16.push_back(std::ldexp(TypeParam(1), -24));
+  bf16.push_back(std::ldexp(TypeParam(1), 127));
+  bf16.push_back(std::ldexp(TypeParam(1), -133));
+  const std::vector<TypeParam> fp16_out = this->RoundTrip(fp16, HALF_FP16);
+  const std::vector<TypeParam> bf16_out = this->RoundTrip(bf16, HALF_BF16);
+  for (int i = 0; i < fp16.size(); ++i) {
+    EXPECT_EQ(fp16[i], fp16_out[i]);
+  }
+  for (int i = 0; i < bf16.size(); ++i) {
+    EXPECT_EQ(bf16[i], bf16_out[i]);
+  }
+}
+
+TYPED_TEST(HalfConversionTest, TestRoundTripError) {
+  const int n = 10000;
+  std::vector<TypeParam> x(n);
+  caffe_rng_gaussian<TypeParam>(n, 0, 1, &x[0]);
+  for (int i = 0; i < n; ++i) x[i] *= std::pow(TypeParam(10), i % 7 - 3);
+  const std::vector<TypeParam> fp16 = this->RoundTrip(x, HALF_FP16);
+  const std::vector<TypeParam> bf16 = this->RoundTrip(x, HALF_BF16);
+  for (int i = 0; i < n; ++i) {
+    const TypeParam a = std::fabs(x[i]);
+    // fp16 rounds to 2^-24 below its normal range
+    EXPECT_LE(std::fabs(fp16[i] - x[i]),
+              std::max(a * std::ldexp(TypeParam(1), -11),
+                       std::ldexp(TypeParam(1), -25)));
+    EXPECT_LE(std::fabs(bf16[i] - x[i]), a * std::ldexp(TypeParam(1), -8));
+  }
+}
+
+TYPED_TEST(HalfConversionTest, TestSpecialValues) {
+  const TypeParam inf = std::numeric_limits<TypeParam>::infinity();
+  std::vector<TypeParam> x;
+  x.push_back(0);
+  x.push_back(-TypeParam(0));
+  x.push_back(inf);
+  x.push_back(-inf);
+  x.push_back(std::numeric_limits<TypeParam>::quiet_NaN());
+  x.push_back(1e6);
+  x.push_back(-65520);
+  x.push_back(65519);
+  const std::vector<TypeParam> fp16 = this->RoundTrip(x, HALF_FP16);
+  const std::vector<TypeParam> bf16 = this->RoundTrip(x, HALF_BF16);
+  EXPECT_EQ(0, fp16[0]);
+  EXPECT_FALSE(std::signbit(fp16[0]));
+  EXPECT_TRUE(std::signbit(fp16[1]));
+  EXPECT_TRUE(std::signbit(bf16[1]));
+  EXPECT_EQ(inf, fp16[2]);
+  EXPECT_EQ(-inf, fp16[3]);
+  EXPECT_EQ(inf, bf16[2]);
+  EXPECT_EQ(-inf, bf16[3]);
+  EXPECT_TRUE(std::isnan(fp16[4]));
+  EXPECT_TRUE(std::isnan(bf16[4]));
+  // fp16 overflows, bf16 keeps the float range
+  EXPECT_EQ(inf, fp16[5]);
+  EXPECT_EQ(-inf, fp16[6]);
+  EXPECT_EQ(65504, fp16[7]);
+  EXPECT_NEAR(1e6, bf16[5], 1e6 / 256);
+}
+
+TYPED_TEST(HalfConversionTest, TestUnpackAdd) {
+  const int n = 1000;
+  std::vector<TypeParam> x(n);
+  std::vector<TypeParam> y(n);
+  caffe_rng_gaussian<TypeParam>(n, 0, 1, &x[0]);
+  caffe_rng_gaussian<TypeParam>(n, 0, 1, &y[0]);
+  for (int f = 0; f < 2; ++f) {
+    const HalfFormat format = f ? HALF_BF16 : HALF_FP16;
+    std::vector<uint16_t> h(n);
+    std::vector<TypeParam> sum(y);
+    caffe_cpu_half_pack<TypeParam>(n, &x[0], &h[0], format);
+    caffe_cpu_half_unpack_add<TypeParam>(n, &h[0], &sum[0], format);
+    for (int i = 0; i < n; ++i) {
+      EXPECT_EQ(y[i] + TypeParam(caffe_half_to_float(h[i], format)), sum[i]);
+    }
+  }
+}
+
+TYPED_TEST(HalfConversionTest, TestRound) {
+  const int n = 3000;
+  std::vector<TypeParam> x(n);
+  caffe_rng_gaussian<TypeParam>(n, 0, 1, &x[0]);
+  for (int f = 0; f < 2; ++f) {
+    const HalfFormat format = f ? HALF_BF16 : HALF_FP16;
+    const std::vector<TypeParam> expected = this->RoundTrip(x, format);
+    std::vector<TypeParam> y(x);
+    caffe_cpu_half_round<TypeParam>(n, &y[0], format);
+    for (int i = 0; i < n; ++i) {
+      EXPECT_EQ(expected[i], y[i]);
+    }
+    // rounding again does not change the values
+    caffe_cpu_half_round<TypeParam>(n, &y[0], format);
+    for (int i = 0; i < n; ++i) {
+      EXPECT_EQ(expected[i], y[i]);
+    }
+  }
+}
+
+TYPED_TEST(HalfConversionTest, TestConvergenceDrift) {
+  std::vector<TypeParam> w;
+  const TypeParam loss = this->TrainLeastSquares(NULL, &w);
+  for (int f = 0; f < 2; ++f) {
+    const HalfFormat format = f ? HALF_BF16 : HALF_FP16;
+    std::vector<TypeParam> w_half;
+    const TypeParam loss_half = this->TrainLeastSquares(&format, &w_half);
+    TypeParam drift = 0;
+    TypeParam norm = 0;
+    for (int i = 0; i < w.size(); ++i) {
+      drift += (w_half[i] - w[i]) * (w_half[i] - w[i]);
+      norm += w[i] * w[i];
+    }
+    EXPECT_LT(std::sqrt(drift / norm), f ? 1e-4 : 1e-5);
+    EXPECT_LT(loss_half, loss * 1.001);
+  }
+}
+
+// The vectorized conversions must match the scalar ones bit for bit.
+class HalfConversionVectorTest : public ::testing::Test {};
+
+TEST_F(HalfConversionVectorTest, TestPackMatchesScalar) {
+  std::vector<float> x;
+  // sweep all exponents with varying mantissas, including ties
+  for (uint32_t e = 0; e < 256; ++e) {
+    for (uint32_t m = 0; m < 64; ++m) {
+      const uint32_t mantissa = (m * 0x1fffff + (m & 3) * 0x1000) & 0x7fffff;
+      for (uint32_t s = 0; s < 2; ++s) {
+        const uint32_t u = (s << 31) | (e << 23) | mantissa;
+        float f;
+        memcpy(&f, &u, sizeof(f));
+        x.push_back(f);
+      }
+    }
+  }
+  x.push_back(65519.f);
+  x.push_back(65520.f);
+  x.push_back(std::ldexp(1.f, -25));
+  x.push_back(std::ldexp(3.f, -26));
+  std::vector<uint16_t> h(x.size());
+  for (int f = 0; f < 2; ++f) {
+    const HalfFormat format = f ? HALF_BF16 : HALF_FP16;
+    // odd lengths exercise the scalar tails
+    for (int n = x.size() - 3; n <= x.size(); ++n) {
+      caffe_cpu_half_pack<float>(n, &x[0], &h[0], format);
+      for (int i = 0; i < n; ++i) {
+        EXPECT_EQ(caffe_float_to_half(x[i], format), h[i]) << x[i];
+      }
+    }
+  }
+}
+
+TEST_F(HalfConversionVectorTest, TestUnpackMatchesScalar) {
+  std::vector<uint16_t> h(65536 + 5);
+  for (int i = 0; i < h.size(); ++i) h[i] = uint16_t(i);
+  std::vector<float> y(h.size());
+  for (int f = 0; f < 2; ++f) {
+    const HalfFormat format = f ? HALF_BF16 : HALF_FP16;
+    caffe_cpu_half_unpack<float>(h.size(), &h[0], &y[0], format);
+    for (int i = 0; i < h.size(); ++i) {
+      const float expected = caffe_half_to_float(h[i], format);
+      EXPECT_EQ(0, memcmp(&expected, &y[i], sizeof(float))) << h[i];
+    }
+  }
+}
+
+}  // namespace caffe
@@ -97,6 +97,46 @@ TYPED_TEST(ImageDataLayerTest, TestRead) {
   }
 }
 
+TYPED_TEST(ImageDataLayerTest, TestThreads) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  ImageDataParameter* image_data_param = param.mutable_image_data_param();
+  image_data_param->set_batch_size(5);
+  image_data_param->set_source(this->filename_.c_str());
+  image_data_param->set_shuffle(false);
+  TransformationParameter* transform_param = param.mutable_transform_param();
+  transform_param->set_crop_size(64);
+  transform_param->set_mirror(true);
+  param.set_phase(TRAIN);
+  // Random crops and mirrors must not depend on the number of threads.
+  vector<vector<Dtype> > batches;
+  const int num_threads[] = {1, 2, 4};
+  for (int t = 0; t < 3; ++t) {
+    Caffe::set_random_seed(this->seed_);
+    transform_param->set_num_threads(num_threads[t]);
+    ImageDataLayer<Dtype> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    EXPECT_EQ(this->blob_top_data_->num(), 5);
+    EXPECT_EQ(this->blob_top_data_->height(), 64);
+    EXPECT_EQ(this->blob_top_data_->width(), 64);
+    for (int iter = 0; iter < 2; ++iter) {
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(i, this->blob_top_label_->cpu_data()[i]);
+      }
+      const Dtype* data = this->blob_top_data_->cpu_data();
+      if (t == 0) {
+        batches.push_back(
+            vector<Dtype>(data, data + this->blob_top_data_->count()));
+      } else {
+        for (int i = 0; i < this->blob_top_data_->count(); ++i) {
+          EXPECT_EQ(batches[iter][i], data[i]);
+        }
+      }
+    }
+  }
+}
+
 TYPED_TEST(ImageDataLayerTest, TestResize) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter param;
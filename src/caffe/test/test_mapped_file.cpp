@@ -0,0 +1,75 @@
+#include <stdint.h>
+
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/mapped_file.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class MappedFileTest : public ::testing::Test {
+ protected:
+  void WriteFile(const std::vector<uint8_t>& content, string* filename) {
+    MakeTempFilename(filename);
+    std::ofstream file(filename->c_str(), std::ios::binary);
+    if (content.size()) {
+      file.write(reinterpret_cast<const char*>(&content[0]), content.size());
+    }
+  }
+};
+
+TEST_F(MappedFileTest, TestContent) {
+  std::vector<uint8_t> content(3 * 4096 + 17);
+  for (int i = 0; i < content.size(); ++i) {
+    content[i] = (i * 7 + 3) % 251;
+  }
+  string filename;
+  WriteFile(content, &filename);
+  MappedFile file(filename);
+  ASSERT_EQ(content.size(), file.size());
+  for (int i = 0; i < content.size(); ++i) {
+    EXPECT_EQ(content[i], file.data()[i]);
+  }
+}
+
+TEST_F(MappedFileTest, TestWillNeed) {
+  std::vector<uint8_t> content(2 * 4096 + 5, 42);
+  string filename;
+  WriteFile(content, &filename);
+  MappedFile file(filename);
+  // unaligned ranges and ranges beyond the end of the file are fine
+  file.WillNeed(13, 4096);
+  file.WillNeed(4096 + 3, 100000);
+  file.WillNeed(content.size(), 10);
+  EXPECT_EQ(42, file.data()[content.size() - 1]);
+}
+
+TEST_F(MappedFileTest, TestRandom) {
+  std::vector<uint8_t> content(3 * 4096, 7);
+  content[4096 + 1] = 8;
+  string filename;
+  WriteFile(content, &filename);
+  MappedFile file(filename, MappedFile::RANDOM);
+  file.WillNeed(4096, 2);
+  EXPECT_EQ(content.size(), file.size());
+  EXPECT_EQ(8, file.data()[4096 + 1]);
+  EXPECT_EQ(7, file.data()[2 * 4096]);
+}
+
+TEST_F(MappedFileTest, TestEmpty) {
+  string filename;
+  WriteFile(std::vector<uint8_t>(), &filename);
+  MappedFile file(filename);
+  EXPECT_EQ(0, file.size());
+  EXPECT_TRUE(file.data() == NULL);
+  file.WillNeed(0, 10);
+}
+
+}  // namespace caffe
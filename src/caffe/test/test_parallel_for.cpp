@@ -0,0 +1,343 @@
+#include <boost/bind.hpp>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layer_factory.hpp"
+#include "caffe/util/parallel_for.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ParallelForTest : public ::testing::Test {
+ public:
+  virtual void TearDown() {
+    caffe_set_cpu_threads(1);
+  }
+
+  void Count(int begin, int end) {
+    ranges_[begin]++;
+    for (int i = begin; i < end; ++i) {
+      calls_[i]++;
+    }
+  }
+
+  void CountNested(int begin, int end) {
+    // runs on the calling thread of the inner loop
+    caffe_parallel_for(end - begin, 1,
+        boost::bind(&ParallelForTest::CountOffset, this, begin, _1, _2));
+  }
+
+  void CountOffset(int offset, int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      calls_[offset + i]++;
+    }
+  }
+
+ protected:
+  vector<int> calls_;
+  vector<int> ranges_;
+};
+
+TEST_F(ParallelForTest, TestAllItemsOnce) {
+  const int n = 1000;
+  for (int num_threads = 1; num_threads <= 4; ++num_threads) {
+    caffe_set_cpu_threads(num_threads);
+    EXPECT_EQ(num_threads, caffe_cpu_threads());
+    calls_.assign(n, 0);
+    ranges_.assign(n, 0);
+    caffe_parallel_for(n, 1, boost::bind(&ParallelForTest::Count, this,
+                                         _1, _2));
+    int num_ranges = 0;
+    for (int i = 0; i < n; ++i) {
+      EXPECT_EQ(1, calls_[i]);
+      num_ranges += ranges_[i];
+    }
+    EXPECT_EQ(num_threads, num_ranges);
+  }
+}
+
+TEST_F(ParallelForTest, TestGrain) {
+  caffe_set_cpu_threads(4);
+  calls_.assign(100, 0);
+  ranges_.assign(100, 0);
+  caffe_parallel_for(100, 40, boost::bind(&ParallelForTest::Count, this,
+                                          _1, _2));
+  // 100 items of a grain of 40 make 3 ranges
+  int num_ranges = 0;
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(1, calls_[i]);
+    num_ranges += ranges_[i];
+  }
+  EXPECT_EQ(3, num_ranges);
+}
+
+TEST_F(ParallelForTest, TestNested) {
+  caffe_set_cpu_threads(4);
+  calls_.assign(1000, 0);
+  caffe_parallel_for(1000, 1, boost::bind(&ParallelForTest::CountNested,
+                                          this, _1, _2));
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(1, calls_[i]);
+  }
+}
+
+template <typename TypeParam>
+class ParallelLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  ParallelLayerTest()
+      : blob_bottom_(new Blob<Dtype>(8, 5, 33, 31)),
+        blob_bottom_b_(new Blob<Dtype>(8, 5, 33, 31)) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_);
+    filler.Fill(blob_bottom_b_);
+  }
+  virtual ~ParallelLayerTest() {
+    caffe_set_cpu_threads(1);
+    delete blob_bottom_;
+    delete blob_bottom_b_;
+  }
+
+  // for layers that need a positive input
+  void FillPositive() {
+    FillerParameter filler_param;
+    filler_param.set_min(0.5);
+    filler_param.set_max(2);
+    UniformFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_);
+  }
+
+  // top data and bottom diffs of a forward and backward pass with num_threads
+  void Run(const LayerParameter& param, int num_threads,
+           vector<Dtype>* top_data, vector<Dtype>* bottom_diff) {
+    caffe_set_cpu_threads(num_threads);
+    // the same dropout mask for all numbers of threads
+    Caffe::set_random_seed(1701);
+    shared_ptr<Layer<Dtype> > layer =
+        LayerRegistry<Dtype>::CreateLayer(param);
+    Blob<Dtype> top;
+    vector<Blob<Dtype>*> bottom_vec(1, blob_bottom_);
+    if (param.type() == "Eltwise") {
+      bottom_vec.push_back(blob_bottom_b_);
+    }
+    vector<Blob<Dtype>*> top_vec(1, &top);
+    layer->SetUp(bottom_vec, top_vec);
+    layer->Forward(bottom_vec, top_vec);
+    top_data->assign(top.cpu_data(), top.cpu_data() + top.count());
+    bottom_diff->clear();
+    // Threshold has no backward pass
+    if (param.type() == "Threshold") {
+      return;
+    }
+    caffe_copy(top.count(), top.cpu_data(), top.mutable_cpu_diff());
+    layer->Backward(top_vec, vector<bool>(bottom_vec.size(), true),
+                    bottom_vec);
+    for (int i = 0; i < bottom_vec.size(); ++i) {
+      bottom_diff->insert(bottom_diff->end(), bottom_vec[i]->cpu_diff(),
+          bottom_vec[i]->cpu_diff() + bottom_vec[i]->count());
+    }
+    for (int i = 0; i < layer->blobs().size(); ++i) {
+      bottom_diff->insert(bottom_diff->end(), layer->blobs()[i]->cpu_diff(),
+          layer->blobs()[i]->cpu_diff() + layer->blobs()[i]->count());
+    }
+  }
+
+  void CheckThreads(const LayerParameter& param) {
+    vector<Dtype> top_data, bottom_diff;
+    Run(param, 1, &top_data, &bottom_diff);
+    for (int num_threads = 2; num_threads <= 5; ++num_threads) {
+      vector<Dtype> top_data_threads, bottom_diff_threads;
+      Run(param, num_threads, &top_data_threads, &bottom_diff_threads);
+      EXPECT_TRUE(top_data == top_data_threads) << num_threads << " threads";
+      EXPECT_TRUE(bottom_diff == bottom_diff_threads)
+          << num_threads << " threads";
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_bottom_b_;
+};
+
+TYPED_TEST_CASE(ParallelLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(ParallelLayerTest, TestMaxPooling) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  LayerParameter param;
+  param.set_type("Pooling");
+  param.mutable_pooling_param()->set_kernel_size(3);
+  param.mutable_pooling_param()->set_stride(2);
+  this->CheckThreads(param);
+}
+
+TYPED_TEST(ParallelLayerTest, TestAvePooling) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  LayerParameter param;
+  param.set_type("Pooling");
+  param.mutable_pooling_param()->set_kernel_size(3);
+  param.mutable_pooling_param()->set_pad(1);
+  param.mutable_pooling_param()->set_pool(PoolingParameter_PoolMethod_AVE);
+  this->CheckThreads(param);
+}
+
+TYPED_TEST(ParallelLayerTest, TestReLU) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  LayerParameter param;
+  param.set_type("ReLU");
+  param.mutable_relu_param()->set_negative_slope(0.1);
+  this->CheckThreads(param);
+}
+
+TYPED_TEST(ParallelLayerTest, TestLRN) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  LayerParameter param;
+  param.set_type("LRN");
+  this->CheckThreads(param);
+}
+
+TYPED_TEST(ParallelLayerTest, TestLRNWithinChannel) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  LayerParameter param;
+  param.set_type("LRN");
+  param.mutable_lrn_param()->set_norm_region(
+      LRNParameter_NormRegion_WITHIN_CHANNEL);
+  param.mutable_lrn_param()->set_local_size(3);
+  this->CheckThreads(param);
+}
+
+TYPED_TEST(ParallelLayerTest, TestSoftmax) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  LayerParameter param;
+  param.set_type("Softmax");
+  this->CheckThreads(param);
+}
+
+TYPED_TEST(ParallelLayerTest, TestBatchNorm) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  LayerParameter param;
+  param.set_type("BatchNorm");
+  this->CheckThreads(param);
+}
+
+TYPED_TEST(ParallelLayerTest, TestEltwiseSum) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  LayerParameter param;
+  param.set_type("Eltwise");
+  param.mutable_eltwise_param()->set_operation(EltwiseParameter_EltwiseOp_SUM);
+  param.mutable_eltwise_param()->add_coeff(1);
+  param.mutable_eltwise_param()->add_coeff(-0.5);
+  this->CheckThreads(param);
+}
+
+TYPED_TEST(ParallelLayerTest, TestEltwiseProd) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  LayerParameter param;
+  param.set_type("Eltwise");
+  param.mutable_eltwise_param()->set_operation(
+      EltwiseParameter_EltwiseOp_PROD);
+  this->CheckThreads(param);
+}
+
+TYPED_TEST(ParallelLayerTest, TestEltwiseMax) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  LayerParameter param;
+  param.set_type("Eltwise");
+  param.mutable_eltwise_param()->set_operation(EltwiseParameter_EltwiseOp_MAX);
+  this->CheckThreads(param);
+}
+
+TYPED_TEST(ParallelLayerTest, TestSigmoid) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  LayerParameter param;
+  param.set_type("Sigmoid");
+  this->CheckThreads(param);
+}
+
+TYPED_TEST(ParallelLayerTest, TestTanH) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  LayerParameter param;
+  param.set_type("TanH");
+  this->CheckThreads(param);
+}
+
+TYPED_TEST(ParallelLayerTest, TestBNLL) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  LayerParameter param;
+  param.set_type("BNLL");
+  this->CheckThreads(param);
+}
+
+TYPED_TEST(ParallelLayerTest, TestELU) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  LayerParameter param;
+  param.set_type("ELU");
+  param.mutable_elu_param()->set_alpha(0.5);
+  this->CheckThreads(param);
+}
+
+TYPED_TEST(ParallelLayerTest, TestThreshold) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  LayerParameter param;
+  param.set_type("Threshold");
+  param.mutable_threshold_param()->set_threshold(0.3);
+  this->CheckThreads(param);
+}
+
+TYPED_TEST(ParallelLayerTest, TestAbsVal) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  LayerParameter param;
+  param.set_type("AbsVal");
+  this->CheckThreads(param);
+}
+
+TYPED_TEST(ParallelLayerTest, TestExp) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  LayerParameter param;
+  param.set_type("Exp");
+  param.mutable_exp_param()->set_scale(0.5);
+  this->CheckThreads(param);
+}
+
+TYPED_TEST(ParallelLayerTest, TestLog) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  this->FillPositive();
+  LayerParameter param;
+  param.set_type("Log");
+  param.mutable_log_param()->set_base(2);
+  this->CheckThreads(param);
+}
+
+TYPED_TEST(ParallelLayerTest, TestPower) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  this->FillPositive();
+  LayerParameter param;
+  param.set_type("Power");
+  param.mutable_power_param()->set_power(0.37);
+  param.mutable_power_param()->set_scale(0.83);
+  param.mutable_power_param()->set_shift(-0.2);
+  this->CheckThreads(param);
+}
+
+TYPED_TEST(ParallelLayerTest, TestPReLU) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  LayerParameter param;
+  param.set_type("PReLU");
+  this->CheckThreads(param);
+}
+
+TYPED_TEST(ParallelLayerTest, TestDropout) {
+  if (Caffe::mode() != Caffe::CPU) return;
+  LayerParameter param;
+  param.set_type("Dropout");
+  this->CheckThreads(param);
+}
+
+}  // namespace caffe
@@ -0,0 +1,57 @@
+#include <boost/bind.hpp>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ThreadPoolTest : public ::testing::Test {
+ public:
+  void Count(int item, int thread) {
+    calls_[item]++;
+    threads_[item] = thread;
+  }
+
+ protected:
+  vector<int> calls_;
+  vector<int> threads_;
+};
+
+TEST_F(ThreadPoolTest, TestAllItemsOnce) {
+  const int num_items = 1000;
+  for (int num_threads = 1; num_threads <= 4; ++num_threads) {
+    ThreadPool pool(num_threads);
+    EXPECT_EQ(num_threads, pool.num_threads());
+    // the threads are reused by consecutive loops
+    for (int run = 0; run < 3; ++run) {
+      calls_.assign(num_items, 0);
+      threads_.assign(num_items, -1);
+      pool.Run(num_items, boost::bind(&ThreadPoolTest::Count, this, _1, _2));
+      for (int i = 0; i < num_items; ++i) {
+        EXPECT_EQ(1, calls_[i]);
+        EXPECT_GE(threads_[i], 0);
+        EXPECT_LT(threads_[i], num_threads);
+      }
+    }
+  }
+}
+
+TEST_F(ThreadPoolTest, TestFewItems) {
+  ThreadPool pool(4);
+  for (int num_items = 0; num_items < 4; ++num_items) {
+    calls_.assign(num_items, 0);
+    threads_.assign(num_items, -1);
+    pool.Run(num_items, boost::bind(&ThreadPoolTest::Count, this, _1, _2));
+    for (int i = 0; i < num_items; ++i) {
+      EXPECT_EQ(1, calls_[i]);
+    }
+  }
+}
+
+}  // namespace caffe
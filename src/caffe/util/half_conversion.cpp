@@ -0,0 +1,264 @@
+#include <string.h>
+
+#include <algorithm>
+
+#include "caffe/util/half_conversion.hpp"
+
+// The vector conversions are compiled for AVX2 and F16C via function target
+// attributes and chosen at runtime, the build does not need -march flags.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAFFE_HALF_X86
+#include <immintrin.h>
+#endif
+
+namespace caffe {
+
+namespace {
+
+inline uint32_t FloatBits(const float x) {
+  uint32_t u;
+  memcpy(&u, &x, sizeof(u));
+  return u;
+}
+
+inline float BitsFloat(const uint32_t u) {
+  float x;
+  memcpy(&x, &u, sizeof(x));
+  return x;
+}
+
+uint16_t FloatToFp16(const float f) {
+  uint32_t x = FloatBits(f);
+  const uint16_t sign = (x >> 16) & 0x8000;
+  x &= 0x7fffffff;
+  if (x >= 0x7f800000) {
+    if (x == 0x7f800000) return sign | 0x7c00;
+    return sign | 0x7e00 | ((x >> 13) & 0x3ff);  // quiet NaN
+  }
+  // 65520 is halfway between 65504 and 65536, rounds to even infinity
+  if (x >= 0x477ff000) return sign | 0x7c00;
+  const uint32_t exponent = x >> 23;
+  if (exponent < 113) {
+    // subnormal half, in units of 2^-24
+    if (exponent < 102) return sign;
+    const uint32_t m = (x & 0x7fffff) | 0x800000;
+    const uint32_t shift = 126 - exponent;
+    uint32_t h = m >> shift;
+    const uint32_t rest = m & ((1u << shift) - 1);
+    const uint32_t half = 1u << (shift - 1);
+    if ((rest > half) || ((rest == half) && (h & 1))) h++;
+    return sign | h;
+  }
+  uint32_t h = (x - 0x38000000) >> 13;  // rebias the exponent from 127 to 15
+  const uint32_t rest = x & 0x1fff;
+  if ((rest > 0x1000) || ((rest == 0x1000) && (h & 1))) h++;
+  return sign | h;
+}
+
+float Fp16ToFloat(const uint16_t h) {
+  const uint32_t sign = uint32_t(h & 0x8000) << 16;
+  uint32_t exponent = (h >> 10) & 0x1f;
+  uint32_t m = h & 0x3ff;
+  if (exponent == 0x1f) {
+    // NaNs become quiet NaNs
+    return BitsFloat(sign | 0x7f800000 | (m << 13) | (m ? 0x400000 : 0));
+  }
+  if (exponent) return BitsFloat(sign | ((exponent + 112) << 23) | (m << 13));
+  if (!m) return BitsFloat(sign);
+  // normalize the subnormal
+  exponent = 113;
+  while (!(m & 0x400)) {
+    m <<= 1;
+    exponent--;
+  }
+  return BitsFloat(sign | (exponent << 23) | ((m & 0x3ff) << 13));
+}
+
+uint16_t FloatToBf16(const float f) {
+  const uint32_t x = FloatBits(f);
+  if ((x & 0x7fffffff) > 0x7f800000) return (x >> 16) | 0x40;  // quiet NaN
+  return (x + 0x7fff + ((x >> 16) & 1)) >> 16;
+}
+
+float Bf16ToFloat(const uint16_t h) {
+  return BitsFloat(uint32_t(h) << 16);
+}
+
+#ifdef CAFFE_HALF_X86
+
+// every CPU with AVX2 also has F16C
+bool HasAvx2(void) {
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+}
+
+__attribute__((target("avx2,f16c")))
+void PackFp16Avx2(const int N, const float* x, uint16_t* y) {
+  int i = 0;
+  for (; i + 8 <= N; i += 8) {
+    const __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(x + i),
+                                      _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y + i), h);
+  }
+  for (; i < N; i++) y[i] = FloatToFp16(x[i]);
+}
+
+__attribute__((target("avx2,f16c")))
+void UnpackFp16Avx2(const int N, const uint16_t* x, float* y, bool add) {
+  int i = 0;
+  for (; i + 8 <= N; i += 8) {
+    __m256 f = _mm256_cvtph_ps(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i)));
+    if (add) f = _mm256_add_ps(f, _mm256_loadu_ps(y + i));
+    _mm256_storeu_ps(y + i, f);
+  }
+  for (; i < N; i++) y[i] = add ? y[i] + Fp16ToFloat(x[i]) : Fp16ToFloat(x[i]);
+}
+
+__attribute__((target("avx2")))
+inline __m256i RoundBf16Avx2(const __m256i x) {
+  const __m256i upper = _mm256_srli_epi32(x, 16);
+  const __m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(
+    x, _mm256_add_epi32(_mm256_set1_epi32(0x7fff),
+                        _mm256_and_si256(upper, _mm256_set1_epi32(1)))), 16);
+  const __m256i nan = _mm256_cmpgt_epi32(
+    _mm256_and_si256(x, _mm256_set1_epi32(0x7fffffff)),
+    _mm256_set1_epi32(0x7f800000));
+  const __m256i quiet = _mm256_or_si256(upper, _mm256_set1_epi32(0x40));
+  return _mm256_blendv_epi8(rounded, quiet, nan);
+}
+
+__attribute__((target("avx2")))
+void PackBf16Avx2(const int N, const float* x, uint16_t* y) {
+  int i = 0;
+  for (; i + 16 <= N; i += 16) {
+    const __m256i a = RoundBf16Avx2(
+      _mm256_castps_si256(_mm256_loadu_ps(x + i)));
+    const __m256i b = RoundBf16Avx2(
+      _mm256_castps_si256(_mm256_loadu_ps(x + i + 8)));
+    // packus works within 128 bit lanes, restore the element order
+    const __m256i h = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b),
+                                               0xd8);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(y + i), h);
+  }
+  for (; i < N; i++) y[i] = FloatToBf16(x[i]);
+}
+
+__attribute__((target("avx2")))
+void UnpackBf16Avx2(const int N, const uint16_t* x, float* y, bool add) {
+  int i = 0;
+  for (; i + 8 <= N; i += 8) {
+    __m256 f = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i))), 16));
+    if (add) f = _mm256_add_ps(f, _mm256_loadu_ps(y + i));
+    _mm256_storeu_ps(y + i, f);
+  }
+  for (; i < N; i++) y[i] = add ? y[i] + Bf16ToFloat(x[i]) : Bf16ToFloat(x[i]);
+}
+
+#endif  // CAFFE_HALF_X86
+
+template <typename Dtype>
+void UnpackScalar(const int N, const uint16_t* x, Dtype* y,
+                  const HalfFormat format, bool add) {
+  for (int i = 0; i < N; i++) {
+    const Dtype f = caffe_half_to_float(x[i], format);
+    y[i] = add ? y[i] + f : f;
+  }
+}
+
+}  // namespace
+
+uint16_t caffe_float_to_half(const float x, const HalfFormat format) {
+  return (format == HALF_BF16) ? FloatToBf16(x) : FloatToFp16(x);
+}
+
+float caffe_half_to_float(const uint16_t x, const HalfFormat format) {
+  return (format == HALF_BF16) ? Bf16ToFloat(x) : Fp16ToFloat(x);
+}
+
+template <>
+void caffe_cpu_half_pack<float>(const int N, const float* x, uint16_t* y,
+    const HalfFormat format) {
+#ifdef CAFFE_HALF_X86
+  if (HasAvx2()) {
+    if (format == HALF_BF16) {
+      PackBf16Avx2(N, x, y);
+    } else {
+      PackFp16Avx2(N, x, y);
+    }
+    return;
+  }
+#endif
+  for (int i = 0; i < N; i++) y[i] = caffe_float_to_half(x[i], format);
+}
+
+template <>
+void caffe_cpu_half_pack<double>(const int N, const double* x, uint16_t* y,
+    const HalfFormat format) {
+  for (int i = 0; i < N; i++) {
+    y[i] = caffe_float_to_half(static_cast<float>(x[i]), format);
+  }
+}
+
+template <>
+void caffe_cpu_half_unpack<float>(const int N, const uint16_t* x, float* y,
+    const HalfFormat format) {
+#ifdef CAFFE_HALF_X86
+  if (HasAvx2()) {
+    if (format == HALF_BF16) {
+      UnpackBf16Avx2(N, x, y, false);
+    } else {
+      UnpackFp16Avx2(N, x, y, false);
+    }
+    return;
+  }
+#endif
+  UnpackScalar(N, x, y, format, false);
+}
+
+template <>
+void caffe_cpu_half_unpack<double>(const int N, const uint16_t* x, double* y,
+    const HalfFormat format) {
+  UnpackScalar(N, x, y, format, false);
+}
+
+template <>
+void caffe_cpu_half_unpack_add<float>(const int N, const uint16_t* x,
+    float* y, const HalfFormat format) {
+#ifdef CAFFE_HALF_X86
+  if (HasAvx2()) {
+    if (format == HALF_BF16) {
+      UnpackBf16Avx2(N, x, y, true);
+    } else {
+      UnpackFp16Avx2(N, x, y, true);
+    }
+    return;
+  }
+#endif
+  UnpackScalar(N, x, y, format, true);
+}
+
+template <>
+void caffe_cpu_half_unpack_add<double>(const int N, const uint16_t* x,
+    double* y, const HalfFormat format) {
+  UnpackScalar(N, x, y, format, true);
+}
+
+template <typename Dtype>
+void caffe_cpu_half_round(const int N, Dtype* x, const HalfFormat format) {
+  const int block = 1024;
+  uint16_t h[block];
+  for (int i = 0; i < N; i += block) {
+    const int n = std::min(block, N - i);
+    caffe_cpu_half_pack(n, x + i, h, format);
+    caffe_cpu_half_unpack(n, h, x + i, format);
+  }
+}
+
+template void caffe_cpu_half_round<float>(const int N, float* x,
+    const HalfFormat format);
+template void caffe_cpu_half_round<double>(const int N, double* x,
+    const HalfFormat format);
+
+}  // namespace caffe
@@ -230,5 +230,98 @@ template void col2im_nd_cpu<double>(const double* data_col,
     const int* kernel_shape, const int* pad, const int* stride,
     const int* dilation, double* data_im);
 
+// im2col or col2im of the columns [col_begin, col_end) of the col matrix, the
+// tile of the col matrix is contiguous with col_end - col_begin columns.
+template <typename Dtype>
+inline void im2col_tile_core_cpu(const bool im2col, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w,
+    const int col_begin, const int col_end, Dtype* data_im, Dtype* data_col) {
+  const int output_w = (width + 2 * pad_w -
+    (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
+  const int channel_size = height * width;
+  for (int channel = channels; channel--; data_im += channel_size) {
+    for (int kernel_row = 0; kernel_row < kernel_h; kernel_row++) {
+      for (int kernel_col = 0; kernel_col < kernel_w; kernel_col++) {
+        int output_row = col_begin / output_w;
+        int output_col = col_begin % output_w;
+        for (int col = col_begin; col < col_end; col++, data_col++) {
+          const int input_row = -pad_h + kernel_row * dilation_h +
+              output_row * stride_h;
+          const int input_col = -pad_w + kernel_col * dilation_w +
+              output_col * stride_w;
+          if (is_a_ge_zero_and_a_lt_b(input_row, height) &&
+              is_a_ge_zero_and_a_lt_b(input_col, width)) {
+            if (im2col) {
+              *data_col = data_im[input_row * width + input_col];
+            } else {
+              data_im[input_row * width + input_col] += *data_col;
+            }
+          } else if (im2col) {
+            *data_col = 0;
+          }
+          if (++output_col == output_w) {
+            output_col = 0;
+            output_row++;
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void im2col_tile_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w,
+    const int col_begin, const int col_end, Dtype* data_col) {
+  im2col_tile_core_cpu(true, channels, height, width, kernel_h, kernel_w,
+      pad_h, pad_w, stride_h, stride_w, dilation_h, dilation_w,
+      col_begin, col_end, const_cast<Dtype*>(data_im), data_col);
+}
+
+// Explicit instantiation
+template void im2col_tile_cpu<float>(const float* data_im,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, const int col_begin, const int col_end,
+    float* data_col);
+template void im2col_tile_cpu<double>(const double* data_im,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, const int col_begin, const int col_end,
+    double* data_col);
+
+template <typename Dtype>
+void col2im_tile_add_cpu(const Dtype* data_col, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w,
+    const int col_begin, const int col_end, Dtype* data_im) {
+  im2col_tile_core_cpu(false, channels, height, width, kernel_h, kernel_w,
+      pad_h, pad_w, stride_h, stride_w, dilation_h, dilation_w,
+      col_begin, col_end, data_im, const_cast<Dtype*>(data_col));
+}
+
+// Explicit instantiation
+template void col2im_tile_add_cpu<float>(const float* data_col,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, const int col_begin, const int col_end,
+    float* data_im);
+template void col2im_tile_add_cpu<double>(const double* data_col,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, const int col_begin, const int col_end,
+    double* data_im);
 
 }  // namespace caffe
@@ -0,0 +1,49 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+
+#include "caffe/util/mapped_file.hpp"
+
+namespace caffe {
+
+MappedFile::MappedFile(const string& filename, Access access)
+    : data_(NULL), size_(0) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_NE(fd, -1) << "File not found: " << filename;
+  struct stat file_stat;
+  CHECK_EQ(fstat(fd, &file_stat), 0) << "Could not stat " << filename;
+  size_ = file_stat.st_size;
+  if (size_) {
+    void* ptr = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+    CHECK(ptr != MAP_FAILED) << "Could not map " << filename;
+    // a file read front to back enlarges the kernel read ahead, a randomly
+    // read file is only read ahead by WillNeed()
+    madvise(ptr, size_,
+            (access == SEQUENTIAL) ? MADV_SEQUENTIAL : MADV_RANDOM);
+    data_ = static_cast<const uint8_t*>(ptr);
+  }
+  // the mapping keeps the file open
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (data_) {
+    munmap(const_cast<uint8_t*>(data_), size_);
+  }
+}
+
+void MappedFile::WillNeed(size_t offset, size_t length) const {
+  if (offset >= size_) return;
+  length = std::min(length, size_ - offset);
+  // madvise needs a page aligned start
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  const size_t begin = offset - offset % page_size;
+  madvise(const_cast<uint8_t*>(data_) + begin, offset + length - begin,
+          MADV_WILLNEED);
+}
+
+}  // namespace caffe
@@ -0,0 +1,57 @@
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+
+#include <algorithm>
+
+#include "caffe/common.hpp"
+#include "caffe/util/parallel_for.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+namespace {
+
+int cpu_threads = 1;
+shared_ptr<ThreadPool> cpu_pool;
+// a loop runs on cpu_pool
+boost::atomic<bool> cpu_pool_busy(false);
+
+void RunRange(const int n, const int ranges,
+              const boost::function<void(int, int)>& task, const int range) {
+  const int begin = static_cast<long>(n) * range / ranges;
+  const int end = static_cast<long>(n) * (range + 1) / ranges;
+  task(begin, end);
+}
+
+}  // namespace
+
+void caffe_set_cpu_threads(int num_threads) {
+  CHECK(!cpu_pool_busy.load()) << "A parallel loop is running";
+  cpu_threads = std::max(num_threads, 1);
+  cpu_pool.reset();
+  if (cpu_threads > 1) {
+    cpu_pool.reset(new ThreadPool(cpu_threads));
+  }
+}
+
+int caffe_cpu_threads() {
+  return cpu_threads;
+}
+
+void caffe_parallel_for(int n, int grain,
+                        const boost::function<void(int, int)>& task) {
+  if (n <= 0) return;
+  grain = std::max(grain, 1);
+  const int ranges = std::min(cpu_threads, (n + grain - 1) / grain);
+  bool idle = false;
+  if (ranges <= 1 || !cpu_pool_busy.compare_exchange_strong(idle, true)) {
+    task(0, n);
+    return;
+  }
+  cpu_pool->Run(ranges, boost::bind(&RunRange, n, ranges, boost::cref(task),
+                                    _1));
+  cpu_pool_busy.store(false);
+}
+
+}  // namespace caffe
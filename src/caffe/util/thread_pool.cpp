@@ -0,0 +1,91 @@
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+ThreadPool::ThreadPool(int num_threads)
+    : num_threads_(std::max(num_threads, 1)),
+      generation_(0),
+      busy_(0),
+      stop_(false),
+      task_(NULL),
+      num_items_(0),
+      next_item_(0) {
+  for (int i = 1; i < num_threads_; ++i) {
+    try {
+      threads_.push_back(shared_ptr<boost::thread>(
+          new boost::thread(&ThreadPool::Work, this, i)));
+    } catch (std::exception& e) {
+      LOG(FATAL) << "Thread exception: " << e.what();
+    }
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stop_ = true;
+  }
+  start_.notify_all();
+  for (int i = 0; i < threads_.size(); ++i) {
+    threads_[i]->join();
+  }
+}
+
+void ThreadPool::Run(int num_items,
+                     const boost::function<void(int, int)>& task) {
+  if (num_items <= 0) return;
+  if (num_threads_ == 1 || num_items == 1) {
+    for (int i = 0; i < num_items; ++i) {
+      task(i, 0);
+    }
+    return;
+  }
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    task_ = &task;
+    num_items_ = num_items;
+    next_item_ = 0;
+    busy_ = num_threads_ - 1;
+    generation_++;
+  }
+  start_.notify_all();
+  RunItems(0);
+  // the threads use task, an interrupt must not unwind the caller's stack
+  boost::this_thread::disable_interruption no_interruption;
+  boost::mutex::scoped_lock lock(mutex_);
+  while (busy_) {
+    done_.wait(lock);
+  }
+}
+
+void ThreadPool::Work(int thread) {
+  long generation = 0;
+  while (true) {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (!stop_ && generation == generation_) {
+        start_.wait(lock);
+      }
+      if (stop_) return;
+      generation = generation_;
+    }
+    RunItems(thread);
+    boost::mutex::scoped_lock lock(mutex_);
+    if (--busy_ == 0) {
+      done_.notify_all();
+    }
+  }
+}
+
+void ThreadPool::RunItems(int thread) {
+  for (int i = next_item_++; i < num_items_; i = next_item_++) {
+    (*task_)(i, thread);
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,157 @@
+#include "caffe/blob.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layer_factory.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/parallel_for.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <vector>
+
+// Compares the CPU convolution engines on typical 3x3 and 1x1 convolutions:
+// one image at a time with the col matrix of a whole image, as many images
+// at a time as there are threads, both with the tiled im2col, and the 1x1
+// convolutions with gemms over several images. Prints per
+// convolution the milliseconds of one forward and backward pass and the
+// memory of the col or pack buffers. Start with e.g.
+//   runConvEngine [threads] [batch size] [col tile size] [1x1 cols]
+//                 [iterations]
+
+typedef float Dtype;
+
+struct Case {
+  const char* name;
+  int kernel;
+  int channels;
+  int num_output;
+  int size;
+};
+
+std::vector<Case> Cases() {
+  const Case cases[] = {
+    {"3x3 64->64 56x56", 3, 64, 64, 56},
+    {"3x3 128->128 28x28", 3, 128, 128, 28},
+    {"3x3 256->256 14x14", 3, 256, 256, 14},
+    {"1x1 256->64 56x56", 1, 256, 64, 56},
+    {"1x1 1024->256 14x14", 1, 1024, 256, 14},
+    {"1x1 2048->512 7x7", 1, 2048, 512, 7},
+    {"1x1 512->2048 7x7", 1, 512, 2048, 7},
+  };
+  return std::vector<Case>(cases, cases + sizeof(cases) / sizeof(cases[0]));
+}
+
+struct Engine {
+  int threads;
+  int col_tile_size;
+  int batched_1x1_cols;
+};
+
+// The col buffers the layer holds, one per image processed concurrently of
+// kernel * kernel * channels rows and a column per output position of a tile
+// or image. 1x1 convolutions multiply the input directly, or pack the input
+// and output of the images of a gemm if batched.
+double ColBufferMB(const Case& c, const int num_threads, const int batch_size,
+                   const int col_tile_size, const int batched_1x1_cols) {
+  const int parts = std::min(num_threads, batch_size);
+  if (c.kernel == 1) {
+    const int pack_images = batched_1x1_cols / (c.size * c.size);
+    if (pack_images <= 1) return 0;
+    return static_cast<double>(parts) * pack_images *
+      (c.channels + c.num_output) * c.size * c.size * sizeof(Dtype)
+      / (1024 * 1024);
+  }
+  const int positions = c.size * c.size;
+  const int cols = (col_tile_size > 0) ?
+    std::min(col_tile_size, positions) : positions;
+  return static_cast<double>(parts) * c.kernel * c.kernel * c.channels * cols
+    * sizeof(Dtype) / (1024 * 1024);
+}
+
+// milliseconds of one forward and backward pass
+double Run(const Case& c, const Engine& engine, const int batch_size,
+           const int iterations) {
+  caffe::caffe_set_cpu_threads(engine.threads);
+  caffe::Caffe::set_random_seed(1701);
+  caffe::LayerParameter param;
+  param.set_type("Convolution");
+  caffe::ConvolutionParameter* conv_param = param.mutable_convolution_param();
+  conv_param->add_kernel_size(c.kernel);
+  conv_param->add_pad(c.kernel / 2);
+  conv_param->set_num_output(c.num_output);
+  conv_param->set_col_tile_size(engine.col_tile_size);
+  conv_param->set_batched_1x1_cols(engine.batched_1x1_cols);
+  conv_param->mutable_weight_filler()->set_type("gaussian");
+  conv_param->mutable_bias_filler()->set_type("gaussian");
+
+  caffe::Blob<Dtype> bottom_blob(batch_size, c.channels, c.size, c.size);
+  caffe::FillerParameter filler_param;
+  caffe::GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&bottom_blob);
+  caffe::Blob<Dtype> top_blob;
+  std::vector<caffe::Blob<Dtype>*> bottom(1, &bottom_blob);
+  std::vector<caffe::Blob<Dtype>*> top(1, &top_blob);
+  caffe::shared_ptr<caffe::Layer<Dtype> > layer =
+    caffe::LayerRegistry<Dtype>::CreateLayer(param);
+  layer->SetUp(bottom, top);
+  filler.Fill(&top_blob);
+  caffe::caffe_copy(top_blob.count(), top_blob.cpu_data(),
+                    top_blob.mutable_cpu_diff());
+  const std::vector<bool> propagate_down(1, true);
+
+  // warm up
+  layer->Forward(bottom, top);
+  layer->Backward(top, propagate_down, bottom);
+  caffe::CPUTimer timer;
+  timer.Start();
+  for (int i = 0; i < iterations; i++) {
+    layer->Forward(bottom, top);
+    layer->Backward(top, propagate_down, bottom);
+  }
+  timer.Stop();
+  return timer.MilliSeconds() / iterations;
+}
+
+int main(int argc, char** argv) {
+  const int num_threads = (argc > 1) ? atoi(argv[1]) : 16;
+  const int batch_size = (argc > 2) ? atoi(argv[2]) : 32;
+  const int col_tile_size = (argc > 3) ? atoi(argv[3]) : 256;
+  const int batched_1x1_cols = (argc > 4) ? atoi(argv[4]) : 256;
+  const int iterations = (argc > 5) ? atoi(argv[5]) : 5;
+  caffe::Caffe::set_mode(caffe::Caffe::CPU);
+
+  std::cout << "Batch size " << batch_size << ", ms per forward and backward "
+            << "pass [MB of col buffers]" << std::endl;
+  const Engine engines[] = {
+    {1, 0, 0}, {1, col_tile_size, 0}, {1, 0, batched_1x1_cols},
+    {num_threads, 0, 0}, {num_threads, col_tile_size, 0},
+    {num_threads, 0, batched_1x1_cols}
+  };
+  const int num_engines = sizeof(engines) / sizeof(engines[0]);
+  std::cout << std::setw(22) << "threads, tile, 1x1 cols";
+  for (int j = 0; j < num_engines; j++) {
+    std::ostringstream name;
+    name << engines[j].threads << ", " << engines[j].col_tile_size << ", "
+         << engines[j].batched_1x1_cols;
+    std::cout << std::setw(16) << name.str();
+  }
+  std::cout << std::endl;
+
+  const std::vector<Case> cases = Cases();
+  for (int i = 0; i < cases.size(); i++) {
+    std::cout << std::setw(22) << cases[i].name << std::fixed;
+    for (int j = 0; j < num_engines; j++) {
+      const double ms = Run(cases[i], engines[j], batch_size, iterations);
+      std::cout << std::setw(8) << std::setprecision(1) << ms << " ["
+                << std::setw(5) << std::setprecision(1)
+                << ColBufferMB(cases[i], engines[j].threads, batch_size,
+                               engines[j].col_tile_size,
+                               engines[j].batched_1x1_cols)
+                << "]";
+    }
+    std::cout << std::endl;
+  }
+  return 0;
+}
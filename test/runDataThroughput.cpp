@@ -0,0 +1,98 @@
+#include "caffe/layers/image_data_layer.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/io.hpp"
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <vector>
+
+// Measures the images per second an ImageData layer delivers for increasing
+// transform_param.num_threads. The images are random JPEGs decoded,
+// randomly cropped and mirrored as in ImageNet training. Checks that the
+// batches do not depend on the number of threads. Start with e.g.
+//   runDataThroughput [images] [batches] [max threads] [image size]
+
+typedef float Dtype;
+
+struct Result {
+  double images_per_second;
+  std::vector<Dtype> first_batch;
+};
+
+Result Run(const std::string& list_file, const int batch_size,
+           const int batches, const int crop_size, const int num_threads) {
+  caffe::Caffe::set_random_seed(1701);
+  caffe::LayerParameter param;
+  param.set_phase(caffe::TRAIN);
+  caffe::ImageDataParameter* image_data_param =
+    param.mutable_image_data_param();
+  image_data_param->set_batch_size(batch_size);
+  image_data_param->set_source(list_file);
+  caffe::TransformationParameter* transform_param =
+    param.mutable_transform_param();
+  transform_param->set_crop_size(crop_size);
+  transform_param->set_mirror(true);
+  transform_param->set_num_threads(num_threads);
+
+  caffe::ImageDataLayer<Dtype> layer(param);
+  caffe::Blob<Dtype> data;
+  caffe::Blob<Dtype> label;
+  std::vector<caffe::Blob<Dtype>*> bottom;
+  std::vector<caffe::Blob<Dtype>*> top;
+  top.push_back(&data);
+  top.push_back(&label);
+  layer.SetUp(bottom, top);
+
+  Result result;
+  layer.Forward(bottom, top);
+  result.first_batch.assign(data.cpu_data(), data.cpu_data() + data.count());
+  caffe::CPUTimer timer;
+  timer.Start();
+  for (int i = 0; i < batches; i++) layer.Forward(bottom, top);
+  timer.Stop();
+  result.images_per_second = batches * batch_size / timer.Seconds();
+  return result;
+}
+
+int main(int argc, char** argv) {
+  const int num_images = (argc > 1) ? atoi(argv[1]) : 256;
+  const int batches = (argc > 2) ? atoi(argv[2]) : 20;
+  const int max_threads = (argc > 3) ? atoi(argv[3]) : 8;
+  const int image_size = (argc > 4) ? atoi(argv[4]) : 256;
+  const int crop_size = image_size * 7 / 8;
+  const int batch_size = 64;
+
+  std::string dir;
+  caffe::MakeTempDir(&dir);
+  const std::string list_file = dir + "/list.txt";
+  std::ofstream list(list_file.c_str());
+  cv::Mat image(image_size, image_size, CV_8UC3);
+  for (int i = 0; i < num_images; i++) {
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(256));
+    std::ostringstream name;
+    name << dir << "/" << i << ".jpg";
+    cv::imwrite(name.str(), image);
+    list << name.str() << " " << (i % 1000) << std::endl;
+  }
+  list.close();
+
+  std::cout << num_images << " JPEGs of " << image_size << "x" << image_size
+            << ", crop " << crop_size << ", batch size " << batch_size
+            << std::endl;
+  std::vector<Dtype> reference;
+  for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+    const Result r = Run(list_file, batch_size, batches, crop_size,
+                         num_threads);
+    // a single thread keeps the random numbers of the sequential loader
+    bool correct = true;
+    if (num_threads == 2) reference = r.first_batch;
+    if (num_threads > 2) correct = (r.first_batch == reference);
+    std::cout << num_threads << " threads: " << r.images_per_second
+              << " images/s" << (correct ? "" : "  WRONG RESULT")
+              << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,322 @@
+#include "caffe/gpi_communicator_diff.hpp"
+#include "caffe/gpi_communicator_model.hpp"
+#include "caffe/gpi_resources.hpp"
+#include "caffe/gpi_ring_buffer.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/GPIhelper.h"
+#include "caffe/util/math_functions.hpp"
+#include <algorithm>
+#include <iostream>
+#include <stdlib.h>
+#include <vector>
+
+// Measures the communication primitives of the distributed training on
+// messages of min bytes to max bytes, growing by a factor of 4, and on the
+// first 2, 4, 8, ... ranks and all ranks of the job, the other ranks idle:
+//   ring_buffer      every rank streams the message through a RingBufferWrite
+//                    to a RingBufferRead on the next rank of the ring
+//   diff_reduce      CommunicatorDiff sums a blob of the message size to
+//                    rank 0 along the default binomial tree
+//   diff_allreduce   CommunicatorDiff sums it to all ranks along a ring
+//   model_broadcast  CommunicatorModel sends a blob of the message size from
+//                    rank 0 to all ranks and waits for their acknowledgement
+// Rank 0 prints one CSV line per benchmark, rank count and message size. The
+// time is the mean per iteration of the slowest rank, i.e. the latency for
+// small messages, the bandwidth is the message size divided by it. Large
+// messages run fewer iterations, so every size moves at most about 1 GB per
+// rank. Errors counts the wrong elements received.
+// Start with e.g.
+//   gaspi_run -m machines runGPICollectives [min bytes] [max bytes] [iters]
+// using a machine file listing the local host several times.
+
+typedef float Dtype;
+
+// the segment and queues of a run, every run creates and deletes the segment
+struct Resources {
+  Resources()
+    : segment_id(caffe::GPIResources::AcquireSegment("runGPICollectives")),
+      queue_write(caffe::GPIResources::AcquireQueue("runGPICollectives")),
+      queue_acknowledge(
+        caffe::GPIResources::AcquireQueue("runGPICollectives")) {}
+  // after the segment was deleted and the queues waited for
+  ~Resources() {
+    caffe::GPIResources::ReleaseQueue(queue_acknowledge);
+    caffe::GPIResources::ReleaseQueue(queue_write);
+    caffe::GPIResources::ReleaseSegment(segment_id);
+  }
+  const gaspi_segment_id_t segment_id;
+  const gaspi_queue_id_t queue_write;
+  const gaspi_queue_id_t queue_acknowledge;
+};
+
+struct Result {
+  double us;
+  long errors;
+};
+
+// slowest rank and total errors of all ranks
+Result Summarize(double us, long errors) {
+  Result result;
+  SUCCESS_OR_DIE(gaspi_allreduce(&us, &result.us, 1, GASPI_OP_MAX,
+                                 GASPI_TYPE_DOUBLE, GASPI_GROUP_ALL,
+                                 GASPI_BLOCK));
+  SUCCESS_OR_DIE(gaspi_allreduce(&errors, &result.errors, 1, GASPI_OP_SUM,
+                                 GASPI_TYPE_LONG, GASPI_GROUP_ALL,
+                                 GASPI_BLOCK));
+  return result;
+}
+
+// idle ranks take part in the collective creation of the segment only
+Dtype* CreateSegment(const gaspi_segment_id_t segment_id, long size) {
+  size = std::max(size, long(sizeof(Dtype)));
+  SUCCESS_OR_DIE(gaspi_segment_create(segment_id, size, GASPI_GROUP_ALL,
+                                      GASPI_BLOCK, GASPI_MEM_UNINITIALIZED));
+  gaspi_pointer_t ptr;
+  SUCCESS_OR_DIE(gaspi_segment_ptr(segment_id, &ptr));
+  return (Dtype*) ptr;
+}
+
+Dtype Element(const long rank, const long iteration, const long i) {
+  // exact in float
+  return Dtype((rank * 31 + iteration * 7 + i) % 4096);
+}
+
+Result RunRingBuffer(const long count,
+                     const long iterations,
+                     const gaspi_rank_t rank,
+                     const gaspi_rank_t num_ranks) {
+  const bool active = rank < num_ranks;
+  const Resources resources;
+  const gaspi_segment_id_t segment_id = resources.segment_id;
+  const gaspi_queue_id_t queue_write = resources.queue_write;
+  const gaspi_queue_id_t queue_acknowledge = resources.queue_acknowledge;
+  // large messages are streamed through a smaller buffer
+  const long buffer_size = std::min(count, 1l << 22) + 1;
+  CreateSegment(segment_id, active ? 2 * buffer_size * sizeof(Dtype) : 0);
+  double time = 0.0;
+  long errors = 0;
+  if (active) {
+    const gaspi_rank_t next = (rank + 1) % num_ranks;
+    const gaspi_rank_t previous = (rank + num_ranks - 1) % num_ranks;
+    const gaspi_notification_id_t notification_write = 0;
+    const gaspi_notification_id_t notification_read = 1;
+    const gaspi_offset_t offset_read = buffer_size * sizeof(Dtype);
+    caffe::RingBufferWrite<Dtype> writer(
+      buffer_size, segment_id, notification_write, 0, next,
+      segment_id, notification_read, offset_read, queue_write);
+    caffe::RingBufferRead<Dtype> reader(
+      buffer_size, segment_id, notification_read, offset_read,
+      previous, segment_id, notification_write, 0, queue_acknowledge);
+    std::vector<Dtype> send(count);
+    std::vector<Dtype> receive(count);
+    SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+
+    for (long it = 0; it <= iterations; it++) {
+      for (long i = 0; i < count; i++) send[i] = Element(rank, it, i);
+      SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+
+      caffe::CPUTimer timer;
+      timer.Start();
+      long sent = 0;
+      long received = 0;
+      while ((sent < count) || (received < count)) {
+        const long chunk_write = std::min(count - sent,
+                                          long(writer.GetFreeSpace()));
+        if (chunk_write > 0) {
+          writer.Write(&send[sent], chunk_write);
+          sent += chunk_write;
+        }
+        const long chunk_read = std::min(count - received,
+                                         long(reader.GetNumData()));
+        if (chunk_read > 0) {
+          reader.Read(&receive[received], chunk_read);
+          received += chunk_read;
+        }
+      }
+      SUCCESS_OR_DIE(gaspi_wait(queue_write, GASPI_BLOCK));
+      SUCCESS_OR_DIE(gaspi_wait(queue_acknowledge, GASPI_BLOCK));
+      timer.Stop();
+      if (it > 0) time += timer.MicroSeconds();//first iteration is warm up
+
+      for (long i = 0; i < count; i++) {
+        errors += (receive[i] != Element(previous, it, i));
+      }
+    }
+  } else {
+    SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+    for (long it = 0; it <= iterations; it++) {
+      SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+    }
+  }
+  SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+  SUCCESS_OR_DIE(gaspi_segment_delete(segment_id));
+  return Summarize(time / iterations, errors);
+}
+
+Result RunDiff(const caffe::GPIParameter& param,
+               const long count,
+               const long iterations,
+               const gaspi_rank_t rank,
+               const gaspi_rank_t num_ranks) {
+  const bool active = rank < num_ranks;
+  const bool allreduce =
+    (param.update_mode() == caffe::GPIParameter_UpdateMode_ALLREDUCE);
+  const Resources resources;
+  const gaspi_segment_id_t segment_id = resources.segment_id;
+  const gaspi_queue_id_t queue_write = resources.queue_write;
+  double time = 0.0;
+  long errors = 0;
+  if (active) {
+    caffe::Blob<Dtype> blob(std::vector<int>(1, count));
+    std::vector<caffe::Blob<Dtype>*> blobs(1, &blob);
+    caffe::CommunicatorDiff<Dtype> com(blobs, std::vector<gaspi_rank_t>(),
+                                       param, 0, segment_id, queue_write,
+                                       rank, num_ranks);
+    SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+
+    const Dtype expected = Dtype(num_ranks * (num_ranks + 1) / 2);
+    for (long it = 0; it <= iterations; it++) {
+      caffe::caffe_set(count, Dtype(rank + 1), blob.mutable_cpu_diff());
+      SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+
+      caffe::CPUTimer timer;
+      timer.Start();
+      com.ResetCommunicationStatus();
+      com.AddCalculatedBlob(&blob);
+      while (!com.CommunicateLayerDiffFinished()) com();
+      com.WaitForLocalCompletion();
+      timer.Stop();
+      if (it > 0) time += timer.MicroSeconds();//first iteration is warm up
+
+      if ((rank == 0) || allreduce) {
+        const Dtype* d = blob.cpu_diff();
+        for (long i = 0; i < count; i++) errors += (d[i] != expected);
+      }
+    }
+    SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+  } else {
+    CreateSegment(segment_id, 0);
+    SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+    for (long it = 0; it <= iterations; it++) {
+      SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+    }
+    SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+    SUCCESS_OR_DIE(gaspi_segment_delete(segment_id));
+  }
+  return Summarize(time / iterations, errors);
+}
+
+Result RunModel(const long count,
+                const long iterations,
+                const gaspi_rank_t rank,
+                const gaspi_rank_t num_ranks) {
+  const bool active = rank < num_ranks;
+  const Resources resources;
+  const gaspi_segment_id_t segment_id = resources.segment_id;
+  const gaspi_queue_id_t queue_write = resources.queue_write;
+  const gaspi_queue_id_t queue_acknowledge = resources.queue_acknowledge;
+  Dtype* base = CreateSegment(segment_id, active ? count * sizeof(Dtype) : 0);
+  double time = 0.0;
+  long errors = 0;
+  if (active) {
+    gaspi_number_t notification_num;
+    SUCCESS_OR_DIE(gaspi_notification_num(&notification_num));
+    caffe::Blob<Dtype> blob(std::vector<int>(1, count));
+    blob.set_cpu_data(base);
+    caffe::CommunicatorModel<Dtype> model(&blob, segment_id, 0,
+                                          notification_num, queue_write,
+                                          queue_acknowledge, rank, num_ranks,
+                                          0);
+    SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+
+    for (long it = 0; it <= iterations; it++) {
+      if (it > 0) model.Acknowledge();
+      if (rank == 0) caffe::caffe_set(count, Dtype(it + 1), base);
+      SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+
+      caffe::CPUTimer timer;
+      timer.Start();
+      model.UpdatedModelOnMaster();
+      while (!model.Complete()) model();
+      model.WaitForLocalCompletion();
+      timer.Stop();
+      if (it > 0) time += timer.MicroSeconds();//first iteration is warm up
+
+      for (long i = 0; i < count; i++) errors += (base[i] != Dtype(it + 1));
+      // the next version may only be written after all ranks checked this one
+      SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+    }
+    SUCCESS_OR_DIE(gaspi_wait(queue_acknowledge, GASPI_BLOCK));
+  } else {
+    SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+    for (long it = 0; it <= iterations; it++) {
+      SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+      SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+    }
+  }
+  SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+  SUCCESS_OR_DIE(gaspi_segment_delete(segment_id));
+  return Summarize(time / iterations, errors);
+}
+
+void Print(const char* benchmark, const long ranks, const long bytes,
+           const long iterations, const Result& result) {
+  std::cout << benchmark << "," << ranks << "," << bytes << ","
+            << iterations << "," << result.us << ","
+            << bytes / result.us << "," << result.errors << std::endl;
+}
+
+int main(int argc, char** argv) {
+  SUCCESS_OR_DIE(gaspi_proc_init(GASPI_BLOCK));
+
+  gaspi_rank_t num_ranks;
+  gaspi_rank_t rank;
+  SUCCESS_OR_DIE(gaspi_proc_num(&num_ranks));
+  SUCCESS_OR_DIE(gaspi_proc_rank(&rank));
+
+  const long min_bytes = (argc > 1) ? atol(argv[1]) : 1l << 10;
+  const long max_bytes = (argc > 2) ? atol(argv[2]) : 1l << 30;
+  const long max_iterations = (argc > 3) ? atol(argv[3]) : 100;
+  const long volume = 1l << 30;
+
+  std::vector<long> rank_counts;
+  for (long n = 2; n < num_ranks; n *= 2) rank_counts.push_back(n);
+  if (num_ranks > 1) rank_counts.push_back(num_ranks);
+
+  caffe::GPIParameter param_reduce;
+  caffe::GPIParameter param_allreduce;
+  param_allreduce.set_diff_topology(caffe::GPIParameter_DiffTopology_RING);
+  param_allreduce.set_update_mode(caffe::GPIParameter_UpdateMode_ALLREDUCE);
+
+  if (rank == 0) {
+    if (rank_counts.empty()) {
+      std::cout << "At least two ranks are necessary for this test."
+                << std::endl;
+    } else {
+      std::cout << "benchmark,ranks,bytes,iterations,time_us,bandwidth_MBps,"
+                << "errors" << std::endl;
+    }
+  }
+  for (long r = 0; r < rank_counts.size(); r++) {
+    const gaspi_rank_t n = rank_counts[r];
+    for (long bytes = min_bytes; bytes <= max_bytes; bytes *= 4) {
+      const long count = std::max(1l, long(bytes / sizeof(Dtype)));
+      const long message = count * sizeof(Dtype);
+      const long iterations =
+        std::max(1l, std::min(max_iterations, volume / message));
+
+      Result result = RunRingBuffer(count, iterations, rank, n);
+      if (rank == 0) Print("ring_buffer", n, message, iterations, result);
+      result = RunDiff(param_reduce, count, iterations, rank, n);
+      if (rank == 0) Print("diff_reduce", n, message, iterations, result);
+      result = RunDiff(param_allreduce, count, iterations, rank, n);
+      if (rank == 0) Print("diff_allreduce", n, message, iterations, result);
+      result = RunModel(count, iterations, rank, n);
+      if (rank == 0) Print("model_broadcast", n, message, iterations, result);
+    }
+  }
+
+  SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+  SUCCESS_OR_DIE(gaspi_proc_term(GASPI_BLOCK));
+  return 0;
+}
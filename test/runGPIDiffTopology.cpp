@@ -0,0 +1,221 @@
+#include "caffe/gpi_communicator_diff.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/GPIhelper.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <vector>
+
+// Compares the diff reduction topologies and wire formats of
+// CommunicatorDiff, reducing to rank 0, as allreduce and reducing every blob
+// to its shard owner as with update_mode SHARDED. Reports the
+// bytes all ranks send per reduction and the largest relative error against
+// the exact sum. With a top-k ratio every rank sets only that share of the
+// diffs, so the sparsification is lossless. The hierarchical topology groups
+// the ranks by hostname unless a machine file is given.
+// Start with e.g.
+//   gaspi_run -m machines runGPIDiffTopology [floats] [iters] [bucket floats]
+//                                            [top-k ratio] [machines]
+// using 2 to 16 local ranks.
+
+typedef float Dtype;
+
+// mimics the parameter blobs of a convolutional net: big weights, small biases
+std::vector<long> GetBlobSizes(long model_size) {
+  std::vector<long> sizes;
+  long total = 0;
+  for (long i = 0; total < model_size; i++) {
+    const long weights = std::min(model_size - total,
+                                  std::max(1l, model_size / 16));
+    sizes.push_back(weights);
+    total += weights;
+    if (total < model_size) {
+      const long bias = std::min(model_size - total, 64l << (i % 4));
+      sizes.push_back(bias);
+      total += bias;
+    }
+  }
+  return sizes;
+}
+
+double RunTopology(const caffe::GPIParameter& param,
+                   const std::vector<long>& sizes,
+                   const long iterations,
+                   const gaspi_rank_t rank,
+                   const gaspi_rank_t num_ranks,
+                   double* bytes,
+                   double* error) {
+  const gaspi_segment_id_t segment_id = 0;
+  const gaspi_queue_id_t queue = 0;
+
+  std::vector<caffe::Blob<Dtype>*> blobs;
+  for (long i = 0; i < sizes.size(); i++) {
+    blobs.push_back(new caffe::Blob<Dtype>(std::vector<int>(1, sizes[i])));
+  }
+
+  const bool sharded =
+    (param.update_mode() == caffe::GPIParameter_UpdateMode_SHARDED);
+  const std::vector<gaspi_rank_t> roots = sharded
+    ? caffe::DiffTopology::BalanceRanks(sizes, num_ranks)
+    : std::vector<gaspi_rank_t>(sizes.size(), 0);
+  caffe::CommunicatorDiff<Dtype> com(blobs, roots, param, 0, segment_id,
+                                     queue, rank, num_ranks);
+  SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+
+  double time = 0.0;
+  unsigned long bytes_sent = 0;
+  double max_error = 0.0;
+  // rank r sets the diffs j with j % stride == r % stride
+  const long stride = (param.diff_topk_ratio() > 0)
+    ? long(std::ceil(1. / param.diff_topk_ratio())) : 1;
+  for (long it = 0; it <= iterations; it++) {
+    // not representable in 16 bit
+    for (long i = 0; i < blobs.size(); i++) {
+      Dtype* d = blobs[i]->mutable_cpu_diff();
+      for (long j = 0; j < blobs[i]->count(); j++) {
+        d[j] = ((j % stride) == (rank % stride)) ? Dtype(rank + 1) / 3 : 0;
+      }
+    }
+    const unsigned long long bytes_before = com.BytesSent();
+    SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+
+    caffe::CPUTimer timer;
+    timer.Start();
+    com.ResetCommunicationStatus();
+    for (long i = 0; i < blobs.size(); i++) {
+      com.AddCalculatedBlob(blobs[i]);
+      com();
+    }
+    while (!com.CommunicateLayerDiffFinished()) com();
+    com.WaitForLocalCompletion();
+    SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+    timer.Stop();
+    if (it > 0) {//first iteration is warm up
+      time += timer.MicroSeconds();
+      bytes_sent += com.BytesSent() - bytes_before;
+    }
+
+    const bool allreduce =
+      (param.update_mode() == caffe::GPIParameter_UpdateMode_ALLREDUCE);
+    for (long i = 0; i < blobs.size(); i++) {
+      if ((rank == roots[i]) || allreduce) {
+        const Dtype* d = blobs[i]->cpu_diff();
+        for (long j = 0; j < blobs[i]->count(); j++) {
+          double expected = 0.0;
+          for (long r = j % stride; r < num_ranks; r += stride) {
+            expected += double(r + 1) / 3;
+          }
+          // also catches NaNs
+          const double e = std::fabs(d[j] - expected) / std::max(expected, 1.);
+          if (!(e <= max_error)) max_error = std::isnan(e) ? HUGE_VAL : e;
+        }
+      }
+    }
+  }
+
+  unsigned long bytes_total;
+  SUCCESS_OR_DIE(gaspi_allreduce(&bytes_sent, &bytes_total, 1, GASPI_OP_SUM,
+                                 GASPI_TYPE_ULONG, GASPI_GROUP_ALL,
+                                 GASPI_BLOCK));
+  SUCCESS_OR_DIE(gaspi_allreduce(&max_error, error, 1, GASPI_OP_MAX,
+                                 GASPI_TYPE_DOUBLE, GASPI_GROUP_ALL,
+                                 GASPI_BLOCK));
+  *bytes = double(bytes_total) / iterations;
+
+  for (long i = 0; i < blobs.size(); i++) delete blobs[i];
+  return time / iterations;
+}
+
+int main(int argc, char** argv) {
+  SUCCESS_OR_DIE(gaspi_proc_init(GASPI_BLOCK));
+
+  gaspi_rank_t num_ranks;
+  gaspi_rank_t rank;
+  SUCCESS_OR_DIE(gaspi_proc_num(&num_ranks));
+  SUCCESS_OR_DIE(gaspi_proc_rank(&rank));
+
+  const long model_size = (argc > 1) ? atol(argv[1]) : 0x1000000;
+  const long iterations = (argc > 2) ? atol(argv[2]) : 10;
+  const long bucket_size = (argc > 3) ? atol(argv[3]) : 0;
+  const float topk_ratio = (argc > 4) ? atof(argv[4]) : 0;
+  const std::string machinefile = (argc > 5) ? argv[5] : "";
+  const std::vector<long> sizes = GetBlobSizes(model_size);
+
+  std::vector<caffe::GPIParameter> params;
+  std::vector<std::string> names;
+  const char* wire_names[] = {"", " fp16", " bf16"};
+  // sparse diffs are only sent in the native format
+  const int num_wire = (topk_ratio > 0) ? 1 : 3;
+  const caffe::GPIParameter_UpdateMode modes[] = {
+    caffe::GPIParameter_UpdateMode_MASTER,
+    caffe::GPIParameter_UpdateMode_ALLREDUCE,
+    caffe::GPIParameter_UpdateMode_SHARDED};
+  const char* mode_names[] = {"", " allreduce", " sharded"};
+  for (int mode = 0; mode < 3; mode++) for (int wire = 0; wire < num_wire; wire++) {
+    caffe::GPIParameter base;
+    base.set_update_mode(modes[mode]);
+    base.set_diff_bucket_size(bucket_size);
+    base.set_diff_wire_format(caffe::GPIParameter_WireFormat(wire));
+    base.set_diff_topk_ratio(topk_ratio);
+    base.set_diff_topk_min_count(0);
+    base.set_diff_machinefile(machinefile);
+    const std::string suffix = std::string(mode_names[mode])
+      + wire_names[wire];
+    for (int bf = 2; bf <= 4; bf++) {
+      caffe::GPIParameter param(base);
+      param.set_diff_topology(caffe::GPIParameter_DiffTopology_BINOMIAL_TREE);
+      param.set_diff_tree_branching_factor(bf);
+      params.push_back(param);
+      std::ostringstream name;
+      name << "binomial tree bf=" << bf << suffix;
+      names.push_back(name.str());
+    }
+    {
+      caffe::GPIParameter param(base);
+      param.set_diff_topology(caffe::GPIParameter_DiffTopology_RING);
+      params.push_back(param);
+      names.push_back("ring" + suffix);
+    }
+    {
+      caffe::GPIParameter param(base);
+      param.set_diff_topology(
+        caffe::GPIParameter_DiffTopology_RECURSIVE_HALVING_DOUBLING);
+      params.push_back(param);
+      names.push_back("recursive halving doubling" + suffix);
+    }
+    {
+      caffe::GPIParameter param(base);
+      param.set_diff_topology(caffe::GPIParameter_DiffTopology_HIERARCHICAL);
+      params.push_back(param);
+      names.push_back("hierarchical" + suffix);
+    }
+  }
+
+  if (rank == 0) {
+    std::cout << num_ranks << " ranks, " << sizes.size() << " blobs, "
+              << model_size << " floats, " << iterations << " iterations, "
+              << "bucket size " << bucket_size << ", top-k ratio "
+              << topk_ratio << std::endl;
+  }
+  for (int i = 0; i < params.size(); i++) {
+    double bytes, error;
+    const double us = RunTopology(params[i], sizes, iterations,
+                                  rank, num_ranks, &bytes, &error);
+    // 16 bit formats round every partial sum
+    const bool correct = error <=
+      ((params[i].diff_wire_format() == caffe::GPIParameter_WireFormat_NATIVE)
+       ? 1e-5 : 0.1);
+    if (rank == 0) {
+      std::cout << names[i] << ": " << us / 1000. << " ms/reduction, "
+                << (model_size * sizeof(Dtype)) / us << " MB/s, "
+                << bytes / 1e6 << " MB on the wire, max rel. error "
+                << error << (correct ? "" : "  WRONG RESULT") << std::endl;
+    }
+  }
+
+  SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+  SUCCESS_OR_DIE(gaspi_proc_term(GASPI_BLOCK));
+  return 0;
+}
@@ -0,0 +1,250 @@
+#include "caffe/gpi_communicator_diff.hpp"
+#include "caffe/gpi_communicator_model.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/GPIhelper.h"
+#include <algorithm>
+#include <iostream>
+#include <stdlib.h>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+// Compares the throughput of update_mode MASTER with SSP when ranks are
+// temporarily slow. Every rank runs a simulated forward and backward pass
+// of the given duration over the parameter blobs, in every iteration one
+// rank in eight on average is slowed down by the slow factor. Reports the
+// iterations per second and the staleness of the weights used in the
+// forward passes, and checks the reduced diffs and the weight versions.
+// Start with e.g.
+//   gaspi_run -m machines runGPIStaleness [floats] [iters] [staleness]
+//                                         [ms per iteration] [slow factor]
+
+typedef float Dtype;
+
+const gaspi_segment_id_t segment_id_diff = 0;
+const gaspi_segment_id_t segment_id_data = 2;
+const gaspi_queue_id_t queue_diff = 0;
+const gaspi_queue_id_t queue_data_write = 5;
+const gaspi_queue_id_t queue_data_acknowledge = 6;
+
+struct Result {
+  double iterations_per_second;
+  double staleness_mean;
+  unsigned long staleness_max;
+  bool correct;
+};
+
+// deterministic choice of the slow ranks, the same for every mode
+bool Slow(const gaspi_rank_t rank, const long iteration) {
+  unsigned long h = (rank + 1) * 2654435761ul + iteration * 40503ul;
+  h ^= h >> 13;
+  h *= 0x5bd1e995ul;
+  h ^= h >> 15;
+  return (h & 7) == 0;
+}
+
+struct Progress {
+  std::vector<caffe::CommunicatorModel<Dtype>*>* models;
+  caffe::CommunicatorDiff<Dtype>* com;
+  void operator()(void) {
+    (*com)();
+    for (long i = 0; i < models->size(); i++) (*(*models)[i])();
+  }
+};
+
+// busy waits for the simulated computation and drives the communication
+void Compute(const double us, Progress& progress) {
+  const boost::posix_time::ptime end =
+    boost::posix_time::microsec_clock::local_time()
+    + boost::posix_time::microseconds(long(us));
+  while (boost::posix_time::microsec_clock::local_time() < end) progress();
+}
+
+Result Run(const caffe::GPIParameter& param,
+           const long model_size,
+           const long num_blobs,
+           const long iterations,
+           const double iteration_us,
+           const double slow_factor,
+           const gaspi_rank_t rank,
+           const gaspi_rank_t num_ranks) {
+  std::vector<caffe::Blob<Dtype>*> blobs;
+  for (long i = 0; i < num_blobs; i++) {
+    const long size = (model_size * (i + 1)) / num_blobs
+      - (model_size * i) / num_blobs;
+    blobs.push_back(new caffe::Blob<Dtype>(std::vector<int>(1, size)));
+  }
+
+  // the weights live in the data segment, as in Net
+  SUCCESS_OR_DIE(gaspi_segment_create(segment_id_data,
+                                      model_size * sizeof(Dtype),
+                                      GASPI_GROUP_ALL, GASPI_BLOCK,
+                                      GASPI_MEM_UNINITIALIZED));
+  gaspi_pointer_t ptr;
+  SUCCESS_OR_DIE(gaspi_segment_ptr(segment_id_data, &ptr));
+  Dtype* base_ptr = (Dtype*) ptr;
+  gaspi_number_t notification_num_total;
+  SUCCESS_OR_DIE(gaspi_notification_num(&notification_num_total));
+  std::vector<caffe::CommunicatorModel<Dtype>*> models;
+  for (long i = 0; i < num_blobs; i++) {
+    blobs[i]->set_cpu_data(base_ptr);
+    base_ptr += blobs[i]->count();
+    caffe::caffe_set(blobs[i]->count(), Dtype(rank ? -1 : 0),
+                     blobs[i]->mutable_cpu_data());
+    const long notification_base_id
+      = (i * notification_num_total + num_blobs - 1) / num_blobs;
+    const long notification_num_local
+      = ((i + 1) * notification_num_total + num_blobs - 1) / num_blobs
+        - notification_base_id;
+    models.push_back(new caffe::CommunicatorModel<Dtype>(
+      blobs[i], segment_id_data, notification_base_id, notification_num_local,
+      queue_data_write, queue_data_acknowledge, rank, num_ranks, 0));
+  }
+  caffe::CommunicatorDiff<Dtype> com(blobs, std::vector<gaspi_rank_t>(),
+                                     param, 0, segment_id_diff, queue_diff,
+                                     rank, num_ranks);
+  SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+
+  Progress progress = {&models, &com};
+
+  // initial broadcast of the weights
+  for (long i = 0; i < num_blobs; i++) models[i]->UpdatedModelOnMaster();
+  for (long i = 0; i < num_blobs; i++) {
+    while (!models[i]->Complete()) progress();
+  }
+
+  const unsigned long staleness_allowed =
+    (param.update_mode() == caffe::GPIParameter_UpdateMode_SSP)
+    ? param.ssp_staleness() : 0;
+  double staleness_sum = 0;
+  unsigned long staleness_max = 0;
+  long errors = 0;
+  const double blob_us = iteration_us / 2 / num_blobs;
+
+  SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+  caffe::CPUTimer timer;
+  timer.Start();
+  for (long it = 0; it < iterations; it++) {
+    const double factor = Slow(rank, it) ? slow_factor : 1;
+    // forward, the last blob belongs to the first layer
+    for (long i = num_blobs - 1; i >= 0; i--) {
+      while (models[i]->Staleness() > staleness_allowed) progress();
+      const unsigned long staleness = models[i]->Staleness();
+      staleness_sum += staleness;
+      staleness_max = std::max(staleness_max, staleness);
+      // the weights hold the number of updates of the master
+      const Dtype version = blobs[i]->cpu_data()[0];
+      if ((version > it) || (version + staleness_allowed < it)) errors++;
+      Compute(blob_us * factor, progress);
+    }
+    // backward
+    com.ResetCommunicationStatus();
+    long updated = 0;
+    for (long i = 0; i < num_blobs; i++) {
+      Compute(blob_us * factor, progress);
+      caffe::caffe_set(blobs[i]->count(), Dtype(rank + 1),
+                       blobs[i]->mutable_cpu_diff());
+      models[i]->Acknowledge();
+      com.AddCalculatedBlob(blobs[i]);
+      progress();
+    }
+    while (!com.CommunicateLayerDiffFinished()
+           || ((rank == 0) && (updated < num_blobs))) {
+      progress();
+      for (; (rank == 0) && (updated < num_blobs)
+             && com.CommunicateLayerDiffReadFinished(updated); updated++) {
+        const Dtype* d = blobs[updated]->cpu_diff();
+        if (d[0] != Dtype(num_ranks * (num_ranks + 1) / 2)) errors++;
+        models[updated]->WaitForLocalCompletion();
+        caffe::caffe_set(blobs[updated]->count(), Dtype(it + 1),
+                         blobs[updated]->mutable_cpu_data());
+        models[updated]->UpdatedModelOnMaster();
+      }
+    }
+    com.WaitForLocalCompletion();
+  }
+  for (long i = 0; i < num_blobs; i++) {
+    while (!models[i]->Complete()) {
+      models[i]->AcknowledgeReceived();
+      progress();
+    }
+    if (blobs[i]->cpu_data()[0] != iterations) errors++;
+  }
+  timer.Stop();
+  SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+
+  double seconds = timer.Seconds();
+  double seconds_max, staleness_total;
+  unsigned long staleness_max_total;
+  long errors_total;
+  SUCCESS_OR_DIE(gaspi_allreduce(&seconds, &seconds_max, 1, GASPI_OP_MAX,
+                                 GASPI_TYPE_DOUBLE, GASPI_GROUP_ALL,
+                                 GASPI_BLOCK));
+  SUCCESS_OR_DIE(gaspi_allreduce(&staleness_sum, &staleness_total, 1,
+                                 GASPI_OP_SUM, GASPI_TYPE_DOUBLE,
+                                 GASPI_GROUP_ALL, GASPI_BLOCK));
+  SUCCESS_OR_DIE(gaspi_allreduce(&staleness_max, &staleness_max_total, 1,
+                                 GASPI_OP_MAX, GASPI_TYPE_ULONG,
+                                 GASPI_GROUP_ALL, GASPI_BLOCK));
+  SUCCESS_OR_DIE(gaspi_allreduce(&errors, &errors_total, 1, GASPI_OP_SUM,
+                                 GASPI_TYPE_LONG, GASPI_GROUP_ALL,
+                                 GASPI_BLOCK));
+
+  for (long i = 0; i < num_blobs; i++) delete models[i];
+  SUCCESS_OR_DIE(gaspi_segment_delete(segment_id_data));
+  for (long i = 0; i < num_blobs; i++) delete blobs[i];
+
+  Result result;
+  result.iterations_per_second = iterations / seconds_max;
+  result.staleness_mean = staleness_total / (num_ranks * iterations
+                                             * num_blobs);
+  result.staleness_max = staleness_max_total;
+  result.correct = !errors_total;
+  return result;
+}
+
+int main(int argc, char** argv) {
+  SUCCESS_OR_DIE(gaspi_proc_init(GASPI_BLOCK));
+
+  gaspi_rank_t num_ranks;
+  gaspi_rank_t rank;
+  SUCCESS_OR_DIE(gaspi_proc_num(&num_ranks));
+  SUCCESS_OR_DIE(gaspi_proc_rank(&rank));
+
+  const long model_size = (argc > 1) ? atol(argv[1]) : 0x100000;
+  const long iterations = (argc > 2) ? atol(argv[2]) : 50;
+  const long staleness = (argc > 3) ? atol(argv[3]) : 2;
+  const double iteration_ms = (argc > 4) ? atof(argv[4]) : 20;
+  const double slow_factor = (argc > 5) ? atof(argv[5]) : 4;
+  const long num_blobs = 8;
+
+  std::vector<caffe::GPIParameter> params(3);
+  params[0].set_update_mode(caffe::GPIParameter_UpdateMode_MASTER);
+  params[1].set_update_mode(caffe::GPIParameter_UpdateMode_SSP);
+  params[1].set_ssp_staleness(0);
+  params[2].set_update_mode(caffe::GPIParameter_UpdateMode_SSP);
+  params[2].set_ssp_staleness(staleness);
+  const char* names[] = {"master", "ssp staleness 0", "ssp staleness "};
+  if (rank == 0) {
+    std::cout << num_ranks << " ranks, " << model_size << " floats, "
+              << iterations << " iterations of " << iteration_ms
+              << " ms, slow factor " << slow_factor << std::endl;
+  }
+  for (int i = 0; i < params.size(); i++) {
+    const Result r = Run(params[i], model_size, num_blobs, iterations,
+                         iteration_ms * 1000, slow_factor, rank, num_ranks);
+    if (rank == 0) {
+      std::cout << names[i];
+      if (i == 2) std::cout << staleness;
+      std::cout << ": "
+                << r.iterations_per_second << " iterations/s, staleness mean "
+                << r.staleness_mean << " max " << r.staleness_max
+                << (r.correct ? "" : "  WRONG RESULT") << std::endl;
+    }
+  }
+
+  SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+  SUCCESS_OR_DIE(gaspi_proc_term(GASPI_BLOCK));
+  return 0;
+}
@@ -0,0 +1,151 @@
+#include "caffe/blob.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layer_factory.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/parallel_for.hpp"
+#include <iomanip>
+#include <iostream>
+#include <stdlib.h>
+#include <vector>
+
+// Measures how the CPU forward and backward passes of the layers scale with
+// the number of threads of caffe_parallel_for, from 1 thread up to max
+// threads doubling each step. Prints per layer the milliseconds of one
+// forward and backward pass and the speedup over one thread. Start with e.g.
+//   runLayerScaling [max threads] [batch size] [channels] [size] [iterations]
+
+typedef float Dtype;
+
+struct Case {
+  const char* name;
+  caffe::LayerParameter param;
+  int num_bottoms;
+};
+
+std::vector<Case> Cases() {
+  std::vector<Case> cases;
+  Case c;
+  c.num_bottoms = 1;
+
+  c.name = "Pooling MAX 3x3/2";
+  c.param = caffe::LayerParameter();
+  c.param.set_type("Pooling");
+  c.param.mutable_pooling_param()->set_kernel_size(3);
+  c.param.mutable_pooling_param()->set_stride(2);
+  cases.push_back(c);
+
+  c.name = "Pooling AVE 3x3/1";
+  c.param = caffe::LayerParameter();
+  c.param.set_type("Pooling");
+  c.param.mutable_pooling_param()->set_kernel_size(3);
+  c.param.mutable_pooling_param()->set_pad(1);
+  c.param.mutable_pooling_param()->set_pool(
+    caffe::PoolingParameter_PoolMethod_AVE);
+  cases.push_back(c);
+
+  c.name = "LRN across channels";
+  c.param = caffe::LayerParameter();
+  c.param.set_type("LRN");
+  c.param.mutable_lrn_param()->set_local_size(5);
+  cases.push_back(c);
+
+  c.name = "BatchNorm";
+  c.param = caffe::LayerParameter();
+  c.param.set_type("BatchNorm");
+  cases.push_back(c);
+
+  c.name = "Softmax";
+  c.param = caffe::LayerParameter();
+  c.param.set_type("Softmax");
+  cases.push_back(c);
+
+  const char* neurons[] = {"ReLU", "Sigmoid", "TanH", "ELU", "PReLU", "AbsVal"};
+  for (int i = 0; i < sizeof(neurons) / sizeof(neurons[0]); i++) {
+    c.name = neurons[i];
+    c.param = caffe::LayerParameter();
+    c.param.set_type(neurons[i]);
+    cases.push_back(c);
+  }
+
+  c.name = "Eltwise SUM";
+  c.param = caffe::LayerParameter();
+  c.param.set_type("Eltwise");
+  c.num_bottoms = 2;
+  cases.push_back(c);
+  return cases;
+}
+
+// milliseconds of one forward and backward pass
+double Run(const Case& c, const int num_threads, const int iterations,
+           const std::vector<int>& shape) {
+  caffe::caffe_set_cpu_threads(num_threads);
+  caffe::Caffe::set_random_seed(1701);
+  caffe::LayerParameter param = c.param;
+  param.set_phase(caffe::TRAIN);
+  std::vector<caffe::Blob<Dtype>*> bottom;
+  caffe::FillerParameter filler_param;
+  caffe::GaussianFiller<Dtype> filler(filler_param);
+  for (int i = 0; i < c.num_bottoms; i++) {
+    bottom.push_back(new caffe::Blob<Dtype>(shape));
+    filler.Fill(bottom.back());
+  }
+  caffe::Blob<Dtype> top_blob;
+  std::vector<caffe::Blob<Dtype>*> top(1, &top_blob);
+  caffe::shared_ptr<caffe::Layer<Dtype> > layer =
+    caffe::LayerRegistry<Dtype>::CreateLayer(param);
+  layer->SetUp(bottom, top);
+  filler.Fill(&top_blob);
+  caffe::caffe_copy(top_blob.count(), top_blob.cpu_data(),
+                    top_blob.mutable_cpu_diff());
+  const std::vector<bool> propagate_down(bottom.size(), true);
+
+  // warm up
+  layer->Forward(bottom, top);
+  layer->Backward(top, propagate_down, bottom);
+  caffe::CPUTimer timer;
+  timer.Start();
+  for (int i = 0; i < iterations; i++) {
+    layer->Forward(bottom, top);
+    layer->Backward(top, propagate_down, bottom);
+  }
+  timer.Stop();
+  for (int i = 0; i < bottom.size(); i++) delete bottom[i];
+  return timer.MilliSeconds() / iterations;
+}
+
+int main(int argc, char** argv) {
+  const int max_threads = (argc > 1) ? atoi(argv[1]) : 64;
+  const int batch_size = (argc > 2) ? atoi(argv[2]) : 32;
+  const int channels = (argc > 3) ? atoi(argv[3]) : 64;
+  const int size = (argc > 4) ? atoi(argv[4]) : 56;
+  const int iterations = (argc > 5) ? atoi(argv[5]) : 10;
+  caffe::Caffe::set_mode(caffe::Caffe::CPU);
+
+  std::vector<int> shape(4);
+  shape[0] = batch_size;
+  shape[1] = channels;
+  shape[2] = size;
+  shape[3] = size;
+  std::cout << "Input " << batch_size << "x" << channels << "x" << size
+            << "x" << size << ", ms per forward and backward pass "
+            << "(speedup over 1 thread)" << std::endl;
+  std::cout << std::setw(22) << "threads";
+  for (int t = 1; t <= max_threads; t *= 2) std::cout << std::setw(16) << t;
+  std::cout << std::endl;
+
+  const std::vector<Case> cases = Cases();
+  for (int i = 0; i < cases.size(); i++) {
+    std::cout << std::setw(22) << cases[i].name << std::fixed;
+    double single = 0;
+    for (int t = 1; t <= max_threads; t *= 2) {
+      const double ms = Run(cases[i], t, iterations, shape);
+      if (t == 1) single = ms;
+      std::cout << std::setw(9) << std::setprecision(2) << ms << " ("
+                << std::setw(4) << std::setprecision(1) << single / ms
+                << ")";
+    }
+    std::cout << std::endl;
+  }
+  return 0;
+}
@@ -6,6 +6,7 @@ namespace bp = boost::python;
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <cstring>
 #include <map>
 #include <string>
@@ -13,6 +14,7 @@ namespace bp = boost::python;
 
 #include "boost/algorithm/string.hpp"
 #include "caffe/caffe.hpp"
+#include "caffe/util/parallel_for.hpp"
 #include "caffe/util/signal_handler.h"
 #include "caffe/util/GPIhelper.h"
 
@@ -58,6 +60,9 @@ DEFINE_string(sigint_effect, "stop",
 DEFINE_string(sighup_effect, "snapshot",
              "Optional; action to take when a SIGHUP signal is received: "
              "snapshot, stop or none.");
+DEFINE_int32(cpu_threads, 1,
+    "Optional; the number of threads the CPU layers split their work over, "
+    "e.g. the cores per rank.");
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -358,8 +363,165 @@ int test() {
 RegisterBrewFunction(test);
 
 
+// Sums or maximizes values over all ranks, depending on op.
+static void AllreduceGPI(vector<double>* values, gaspi_operation_t op) {
+  gaspi_number_t elem_max;
+  SUCCESS_OR_DIE(gaspi_allreduce_elem_max(&elem_max));
+  vector<double> local(*values);
+  for (long begin = 0; begin < local.size(); begin += elem_max) {
+    const long n = std::min(long(elem_max), long(local.size()) - begin);
+    SUCCESS_OR_DIE(gaspi_allreduce(&local[begin], &(*values)[begin], n, op,
+                                   GASPI_TYPE_DOUBLE, GASPI_GROUP_ALL,
+                                   GASPI_BLOCK));
+  }
+}
+
+// Time the distributed training steps of a solver, run under gaspi_run.
+static int time_gpi() {
+  gaspi_rank_t rank;
+  gaspi_rank_t num_ranks;
+  SUCCESS_OR_DIE(gaspi_proc_rank(&rank));
+  SUCCESS_OR_DIE(gaspi_proc_num(&num_ranks));
+
+  caffe::SolverParameter solver_param;
+  caffe::ReadSolverParamsFromTextFileOrDie(FLAGS_solver, &solver_param);
+  solver_param.mutable_train_state()->set_level(FLAGS_level);
+  vector<string> stages = get_stages_from_flags();
+  for (int i = 0; i < stages.size(); i++) {
+    solver_param.mutable_train_state()->add_stage(stages[i]);
+  }
+  // only the training steps are timed
+  solver_param.set_test_interval(0);
+  solver_param.set_display(0);
+  solver_param.set_snapshot(0);
+  solver_param.set_snapshot_after_train(false);
+
+  vector<int> gpus;
+  get_gpus(&gpus, rank);
+  if (gpus.size() != 0) {
+    LOG(INFO) << "Rank " << rank << " uses GPU with device ID " << gpus[0];
+    solver_param.set_device_id(gpus[0]);
+    Caffe::SetDevice(gpus[0]);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    Caffe::set_mode(Caffe::CPU);
+  }
+  shared_ptr<Solver<float> >
+      solver(caffe::SolverRegistry<float>::CreateSolver(solver_param));
+  if (FLAGS_weights.size()) {
+    CopyLayers(solver.get(), FLAGS_weights);
+  }
+  Net<float>& net = *solver->net();
+
+  // A step for the memory allocations, so the timed ones are more stable.
+  solver->Step(1);
+  LOG_IF(INFO, rank == 0) << "*** Distributed benchmark begins ***";
+  LOG_IF(INFO, rank == 0) << "Timing " << FLAGS_iterations
+                          << " iterations on " << num_ranks << " ranks.";
+  unsigned long long bytes_begin[4];
+  net.GPIBytes(&bytes_begin[0], &bytes_begin[1], &bytes_begin[2],
+               &bytes_begin[3]);
+  net.set_gpi_profile(true);
+  caffe::CPUTimer iter_timer;
+  double iteration_time = 0.0;
+  for (int j = 0; j < FLAGS_iterations; ++j) {
+    iter_timer.Start();
+    solver->Step(1);
+    const double t = iter_timer.MicroSeconds();
+    iteration_time += t;
+    LOG_IF(INFO, rank == 0) << "Iteration: " << j + 1
+                            << " training step time: " << t / 1000 << " ms.";
+  }
+  unsigned long long bytes_end[4];
+  net.GPIBytes(&bytes_end[0], &bytes_end[1], &bytes_end[2], &bytes_end[3]);
+  const Net<float>::GPIProfile profile = net.gpi_profile();
+  net.set_gpi_profile(false);
+
+  // per layer forward, weight wait and backward, then the totals
+  const int num_layers = net.layers().size();
+  enum { OVERLAP, DIFF_BLOCKING, DATA_BLOCKING, LOSS_BLOCKING, ITERATION,
+         DIFF_SENT, DIFF_RECEIVED, DATA_SENT, DATA_RECEIVED, NUM_TOTALS };
+  vector<double> local(3 * num_layers + NUM_TOTALS);
+  double data_wait = 0.0;
+  for (int i = 0; i < num_layers; ++i) {
+    local[3 * i] = profile.forward[i];
+    local[3 * i + 1] = profile.data_wait[i];
+    local[3 * i + 2] = profile.backward[i];
+    data_wait += profile.data_wait[i];
+  }
+  double* totals = &local[3 * num_layers];
+  totals[OVERLAP] = profile.overlap;
+  totals[DIFF_BLOCKING] = profile.diff_blocking;
+  totals[DATA_BLOCKING] = profile.data_blocking + data_wait;
+  totals[LOSS_BLOCKING] = profile.loss_blocking;
+  totals[ITERATION] = iteration_time;
+  for (int k = 0; k < 4; ++k) {
+    totals[DIFF_SENT + k] = bytes_end[k] - bytes_begin[k];
+  }
+  for (int i = 0; i < local.size(); ++i) local[i] /= FLAGS_iterations;
+  vector<double> mean(local);
+  AllreduceGPI(&mean, GASPI_OP_SUM);
+  for (int i = 0; i < mean.size(); ++i) mean[i] /= num_ranks;
+  vector<double> max(local);
+  AllreduceGPI(&max, GASPI_OP_MAX);
+  if (rank == 0) {
+    LOG(INFO) << "Average time per layer and iteration in ms, mean / max "
+                 "over the ranks:";
+    LOG(INFO) << std::setfill(' ') << std::setw(10) << "layer"
+              << std::setw(20) << "forward" << std::setw(20) << "weights"
+              << std::setw(20) << "backward";
+    for (int i = 0; i < num_layers; ++i) {
+      ostringstream line;
+      line << std::setfill(' ') << std::setw(10)
+           << net.layers()[i]->layer_param().name();
+      for (int k = 0; k < 3; ++k) {
+        ostringstream cell;
+        cell << mean[3 * i + k] / 1000 << " / " << max[3 * i + k] / 1000;
+        line << std::setw(20) << cell.str();
+      }
+      LOG(INFO) << line.str();
+    }
+    const double* mean_totals = &mean[3 * num_layers];
+    const double* max_totals = &max[3 * num_layers];
+    const char* names[] = {"Overlapped communication and updates",
+                           "Blocked on diffs", "Blocked on weights",
+                           "Blocked on loss", "Training step"};
+    for (int k = OVERLAP; k <= ITERATION; ++k) {
+      LOG(INFO) << names[k] << ": " << mean_totals[k] / 1000 << " / "
+                << max_totals[k] / 1000 << " ms.";
+    }
+    LOG(INFO) << "Diff bytes per rank and iteration, sent: "
+              << mean_totals[DIFF_SENT] << " / " << max_totals[DIFF_SENT]
+              << ", received: " << mean_totals[DIFF_RECEIVED] << " / "
+              << max_totals[DIFF_RECEIVED];
+    LOG(INFO) << "Weight bytes per rank and iteration, sent: "
+              << mean_totals[DATA_SENT] << " / " << max_totals[DATA_SENT]
+              << ", received: " << mean_totals[DATA_RECEIVED] << " / "
+              << max_totals[DATA_RECEIVED];
+    // bytes per microsecond are MB/s
+    const double bytes = mean_totals[DIFF_SENT] + mean_totals[DIFF_RECEIVED]
+                         + mean_totals[DATA_SENT] + mean_totals[DATA_RECEIVED];
+    const double communication = mean_totals[OVERLAP]
+      + mean_totals[DIFF_BLOCKING] + mean_totals[DATA_BLOCKING]
+      + mean_totals[LOSS_BLOCKING];
+    LOG(INFO) << "Achieved bandwidth per rank: "
+              << bytes / std::max(mean_totals[ITERATION], 1.0)
+              << " MB/s over the step, "
+              << bytes / std::max(communication, 1.0)
+              << " MB/s over the communication.";
+    LOG(INFO) << "*** Distributed benchmark ends ***";
+  }
+
+  solver.reset();
+  SUCCESS_OR_DIE(gaspi_barrier(GASPI_GROUP_ALL, GASPI_BLOCK));
+  SUCCESS_OR_DIE(gaspi_proc_term(GASPI_BLOCK));
+  return 0;
+}
+
 // Time: benchmark the execution time of a model.
 int time() {
+  SUCCESS_OR_DIE(gaspi_proc_init(GASPI_BLOCK));
+  if (FLAGS_solver.size()) return time_gpi();
   CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to time.";
   caffe::Phase phase = get_phase_from_flags(caffe::TRAIN);
   vector<string> stages = get_stages_from_flags();
@@ -445,6 +607,7 @@ int time() {
     FLAGS_iterations << " ms.";
   LOG(INFO) << "Total Time: " << total_timer.MilliSeconds() << " ms.";
   LOG(INFO) << "*** Benchmark ends ***";
+  SUCCESS_OR_DIE(gaspi_proc_term(GASPI_BLOCK));
   return 0;
 }
 RegisterBrewFunction(time);
@@ -461,9 +624,11 @@ int main(int argc, char** argv) {
       "  train           train or finetune a model\n"
       "  test            score a model\n"
       "  device_query    show GPU diagnostic information\n"
-      "  time            benchmark model execution time");
+      "  time            benchmark model execution time, with -solver the\n"
+      "                  distributed training steps under gaspi_run");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
+  caffe::caffe_set_cpu_threads(FLAGS_cpu_threads);
   if (argc == 2) {
 #ifdef WITH_PYTHON_LAYER
     try {